@@ -0,0 +1,162 @@
+/* This file is part of KDE
+    Copyright 2020 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QDateTime>
+#include <konqcompletionindex.h>
+
+class CompletionIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testNormalized();
+    void testDuplicates();
+    void testRanking();
+    void testWords();
+    void testRemove();
+    void testManyMatches();
+};
+
+QTEST_MAIN(CompletionIndexTest)
+
+static QDateTime daysAgo(int days)
+{
+    return QDateTime::currentDateTime().addDays(-days);
+}
+
+void CompletionIndexTest::testNormalized()
+{
+    QCOMPARE(KonqCompletionIndex::normalized(QStringLiteral("http://www.KDE.org/")), QStringLiteral("kde.org"));
+    QCOMPARE(KonqCompletionIndex::normalized(QStringLiteral("https://kde.org/news")), QStringLiteral("kde.org/news"));
+    QCOMPARE(KonqCompletionIndex::normalized(QStringLiteral("ftp://ftp.kde.org")), QStringLiteral("ftp.kde.org"));
+    QCOMPARE(KonqCompletionIndex::normalized(QStringLiteral("file:///usr/share/")), QStringLiteral("/usr/share"));
+    QCOMPARE(KonqCompletionIndex::normalized(QStringLiteral("/")), QStringLiteral("/"));
+}
+
+void CompletionIndexTest::testDuplicates()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://www.kde.org/"), 1, daysAgo(1));
+    index.addItem(QStringLiteral("kde.org"), 11, daysAgo(1));
+    index.addItem(QStringLiteral("https://kde.org"), 1, daysAgo(2));
+    QCOMPARE(index.count(), 1);
+
+    // Shown as the variant which ranks best
+    QCOMPARE(index.matches(QStringLiteral("kd"), 10), QStringList() << QStringLiteral("kde.org"));
+    QCOMPARE(index.matches(QStringLiteral("http://www.kd"), 10), QStringList() << QStringLiteral("kde.org"));
+
+    // The scheme doesn't match everything with that scheme
+    index.addItem(QStringLiteral("http://hotmail.com/"), 1, daysAgo(1));
+    QCOMPARE(index.matches(QStringLiteral("h"), 10), QStringList() << QStringLiteral("http://hotmail.com/"));
+}
+
+void CompletionIndexTest::testRanking()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("http://a.example/often"), 10, daysAgo(120));
+    index.addItem(QStringLiteral("http://a.example/recent"), 2, daysAgo(1));
+    index.addItem(QStringLiteral("http://a.example/old"), 2, daysAgo(60));
+    index.addItem(QStringLiteral("http://a.example/bookmark"), 1, QDateTime());
+
+    // 10 visits 4 months ago weigh less than 2 visits yesterday, but more than 2 visits 2 months ago
+    const QStringList expected = QStringList() << QStringLiteral("http://a.example/recent")
+                                               << QStringLiteral("http://a.example/often")
+                                               << QStringLiteral("http://a.example/old")
+                                               << QStringLiteral("http://a.example/bookmark");
+    QCOMPARE(index.matches(QStringLiteral("a.ex"), 10), expected);
+    QCOMPARE(index.matches(QStringLiteral("a.ex"), 2), expected.mid(0, 2));
+
+    // Visiting again
+    index.addItem(QStringLiteral("http://a.example/old"), 1, daysAgo(0));
+    QCOMPARE(index.matches(QStringLiteral("a.ex"), 1), QStringList() << QStringLiteral("http://a.example/old"));
+}
+
+void CompletionIndexTest::testWords()
+{
+    KonqCompletionIndex index;
+    index.addItem(QStringLiteral("https://bugs.kde.org/show_bug.cgi?id=1"), 1, daysAgo(1));
+    index.addItem(QStringLiteral("https://kde.org/"), 1, daysAgo(2));
+    index.addItem(QStringLiteral("https://example.com/kdebugs"), 1, daysAgo(0));
+
+    // Prefix matches first, then word matches
+    QCOMPARE(index.matches(QStringLiteral("kde"), 10), QStringList() << QStringLiteral("https://kde.org/")
+                                                                     << QStringLiteral("https://example.com/kdebugs")
+                                                                     << QStringLiteral("https://bugs.kde.org/show_bug.cgi?id=1"));
+
+    QCOMPARE(index.substringMatches(QStringLiteral("kde bug"), 10), QStringList() << QStringLiteral("https://bugs.kde.org/show_bug.cgi?id=1"));
+    QCOMPARE(index.substringMatches(QStringLiteral("kdebu"), 10), QStringList() << QStringLiteral("https://example.com/kdebugs"));
+    QVERIFY(index.substringMatches(QStringLiteral("ugs"), 10).isEmpty());
+}
+
+void CompletionIndexTest::testRemove()
+{
+    KonqCompletionIndex index;
+    const QDateTime yesterday = daysAgo(1);
+    index.addItem(QStringLiteral("http://kde.org/"), 1, yesterday);
+    index.addItem(QStringLiteral("kde.org"), 11, yesterday);
+    index.addItem(QStringLiteral("http://kde.org/news"), 1, yesterday);
+
+    index.removeItem(QStringLiteral("kde.org"));
+    QCOMPARE(index.count(), 2);
+    QCOMPARE(index.matches(QStringLiteral("kde.org"), 1), QStringList() << QStringLiteral("http://kde.org/"));
+
+    index.removeItem(QStringLiteral("http://kde.org/"));
+    QCOMPARE(index.count(), 1);
+    QCOMPARE(index.matches(QStringLiteral("kde"), 10), QStringList() << QStringLiteral("http://kde.org/news"));
+    QCOMPARE(index.substringMatches(QStringLiteral("news"), 10), QStringList() << QStringLiteral("http://kde.org/news"));
+
+    // Removed items are reused
+    index.addItem(QStringLiteral("http://kde.org/"), 1, yesterday);
+    QCOMPARE(index.count(), 2);
+
+    index.clear();
+    QCOMPARE(index.count(), 0);
+    QVERIFY(index.matches(QStringLiteral("kde"), 10).isEmpty());
+}
+
+void CompletionIndexTest::testManyMatches()
+{
+    KonqCompletionIndex index;
+    for (int i = 0; i < 100; ++i) {
+        index.addItem(QStringLiteral("http://site%1.example/page").arg(i), i + 1, daysAgo(1));
+    }
+    const QStringList best = QStringList() << QStringLiteral("http://site99.example/page")
+                                           << QStringLiteral("http://site98.example/page")
+                                           << QStringLiteral("http://site97.example/page");
+
+    // Too many matches to go through them all
+    QCOMPARE(index.matches(QStringLiteral("s"), 3), best);
+    QCOMPARE(index.matches(QString(), 3), best);
+    QCOMPARE(index.substringMatches(QStringLiteral("page"), 3), best);
+    QCOMPARE(index.substringMatches(QStringLiteral("page example"), 3), best);
+    QCOMPARE(index.matches(QStringLiteral("site1"), 3), QStringList() << QStringLiteral("http://site19.example/page")
+                                                                       << QStringLiteral("http://site18.example/page")
+                                                                       << QStringLiteral("http://site17.example/page"));
+
+    // The rank order follows the changes
+    index.addItem(QStringLiteral("http://site5.example/page"), 1000, daysAgo(1));
+    index.removeItem(QStringLiteral("http://site99.example/page"));
+    QCOMPARE(index.matches(QStringLiteral("s"), 2), QStringList() << QStringLiteral("http://site5.example/page")
+                                                                   << QStringLiteral("http://site98.example/page"));
+    QCOMPARE(index.substringMatches(QStringLiteral("page"), 2), QStringList() << QStringLiteral("http://site5.example/page")
+                                                                               << QStringLiteral("http://site98.example/page"));
+}
+
+#include "completionindextest.moc"
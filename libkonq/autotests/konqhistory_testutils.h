@@ -0,0 +1,36 @@
+/* This file is part of KDE
+    Copyright 2020 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQHISTORY_TESTUTILS_H
+#define KONQHISTORY_TESTUTILS_H
+
+#include <konq_historyentry.h>
+
+// An entry visited once, @p secs seconds after the epoch
+inline KonqHistoryEntry makeHistoryEntry(const QString &url, int secs = 0, const QString &title = QString())
+{
+    KonqHistoryEntry entry;
+    entry.url = QUrl(url);
+    entry.title = title;
+    entry.firstVisited = QDateTime::fromMSecsSinceEpoch(1000LL * secs, Qt::UTC);
+    entry.lastVisited = entry.firstVisited;
+    return entry;
+}
+
+#endif // KONQHISTORY_TESTUTILS_H
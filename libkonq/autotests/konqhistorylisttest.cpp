@@ -0,0 +1,183 @@
+/* This file is part of KDE
+    Copyright 2020 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+
+#include <konq_historyentry.h>
+#include "konqhistory_testutils.h"
+
+#include <algorithm>
+
+class KonqHistoryListTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testFindEntry();
+    void testRemove();
+    void testMoveToEnd();
+    void testReorder();
+    void testDuplicates();
+
+private:
+    static QString url(int i);
+    static KonqHistoryList makeList(int count);
+    static void checkIndex(const KonqHistoryList &list);
+    // The numbers of the entries of list, in order
+    static QList<int> entryNumbers(const KonqHistoryList &list);
+};
+
+QTEST_MAIN(KonqHistoryListTest)
+
+QString KonqHistoryListTest::url(int i)
+{
+    return QStringLiteral("http://www.example.com/%1").arg(i);
+}
+
+KonqHistoryList KonqHistoryListTest::makeList(int count)
+{
+    KonqHistoryList list;
+    for (int i = 0; i < count; ++i) {
+        list.append(makeHistoryEntry(url(i), i));
+    }
+    return list;
+}
+
+void KonqHistoryListTest::checkIndex(const KonqHistoryList &list)
+{
+    for (int i = 0; i < list.count(); ++i) {
+        QCOMPARE(int(list.constFindEntry(list.at(i).url) - list.constBegin()), i);
+    }
+}
+
+QList<int> KonqHistoryListTest::entryNumbers(const KonqHistoryList &list)
+{
+    QList<int> numbers;
+    for (const KonqHistoryEntry &entry : list) {
+        numbers.append(entry.url.fileName().toInt());
+    }
+    return numbers;
+}
+
+void KonqHistoryListTest::testFindEntry()
+{
+    KonqHistoryList list = makeList(10);
+    checkIndex(list);
+    QVERIFY(list.findEntry(QUrl(url(10))) == list.end());
+    QCOMPARE(list.findEntry(QUrl(url(4)))->url, QUrl(url(4)));
+
+    // Copies have their own index
+    KonqHistoryList copy = list;
+    copy.removeFirst();
+    copy.append(makeHistoryEntry(url(10)));
+    checkIndex(copy);
+    checkIndex(list);
+    QCOMPARE(list.count(), 10);
+    QVERIFY(list.findEntry(QUrl(url(0))) != list.end());
+    QVERIFY(list.findEntry(QUrl(url(10))) == list.end());
+    QVERIFY(copy != list);
+}
+
+void KonqHistoryListTest::testRemove()
+{
+    KonqHistoryList list = makeList(10);
+    list.removeFirst();
+    list.removeEntry(QUrl(url(2)));
+    list.removeEntry(QUrl(url(8)));
+    list.removeEntry(QUrl(url(42)));
+    QCOMPARE(list.count(), 7);
+    QVERIFY(list.findEntry(QUrl(url(0))) == list.end());
+    QVERIFY(list.findEntry(QUrl(url(2))) == list.end());
+    checkIndex(list);
+
+    KonqHistoryList::iterator it = list.erase(list.findEntry(QUrl(url(5))));
+    QCOMPARE(it->url, QUrl(url(6)));
+    QCOMPARE(entryNumbers(list), QList<int>({1, 3, 4, 6, 7, 9}));
+    checkIndex(list);
+
+    // Removing through QList
+    list.removeAt(1);
+    QVERIFY(list.findEntry(QUrl(url(3))) == list.end());
+    checkIndex(list);
+
+    list.clear();
+    QVERIFY(list.isEmpty());
+    QVERIFY(list.findEntry(QUrl(url(3))) == list.end());
+    list.append(makeHistoryEntry(url(3)));
+    checkIndex(list);
+}
+
+void KonqHistoryListTest::testMoveToEnd()
+{
+    KonqHistoryList list = makeList(5);
+
+    KonqHistoryList::iterator it = list.moveToEnd(list.findEntry(QUrl(url(1))));
+    QCOMPARE(it->url, QUrl(url(1)));
+    QCOMPARE(list.last().url, QUrl(url(1)));
+    // Moving the last entry doesn't change anything
+    it = list.moveToEnd(it);
+    QCOMPARE(it->url, QUrl(url(1)));
+    list.moveToEnd(list.begin());
+    QCOMPARE(entryNumbers(list), QList<int>({2, 3, 4, 1, 0}));
+    checkIndex(list);
+
+    list.removeEntry(QUrl(url(0)));
+    list.moveToEnd(list.findEntry(QUrl(url(3))));
+    list.moveToEnd(list.findEntry(QUrl(url(3))));
+    QCOMPARE(entryNumbers(list), QList<int>({2, 4, 1, 3}));
+    QCOMPARE(list.at(0).url, QUrl(url(2)));
+    checkIndex(list);
+}
+
+void KonqHistoryListTest::testReorder()
+{
+    KonqHistoryList list = makeList(6);
+    list.moveToEnd(list.findEntry(QUrl(url(2))));
+
+    // Sorting goes around the index, which must notice it
+    std::sort(list.begin(), list.end(), [](const KonqHistoryEntry &lhs, const KonqHistoryEntry &rhs) {
+        return lhs.lastVisited > rhs.lastVisited;
+    });
+    QCOMPARE(entryNumbers(list), QList<int>({5, 4, 3, 2, 1, 0}));
+    checkIndex(list);
+    QVERIFY(list.findEntry(QUrl(url(6))) == list.end());
+
+    list.move(5, 0);
+    list.removeEntry(QUrl(url(4)));
+    QCOMPARE(entryNumbers(list), QList<int>({0, 5, 3, 2, 1}));
+    checkIndex(list);
+}
+
+void KonqHistoryListTest::testDuplicates()
+{
+    KonqHistoryList list = makeList(3);
+    KonqHistoryEntry entry = makeHistoryEntry(url(0));
+    entry.title = QStringLiteral("Zero");
+    list.append(entry);
+    QCOMPARE(list.count(), 4);
+
+    // As when searching backwards, the last entry is found
+    QCOMPARE(list.findEntry(entry.url)->title, entry.title);
+    list.removeEntry(entry.url);
+    QCOMPARE(list.count(), 3);
+    QVERIFY(list.findEntry(entry.url) == list.begin());
+    checkIndex(list);
+}
+
+#include "konqhistorylisttest.moc"
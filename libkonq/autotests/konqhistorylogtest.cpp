@@ -0,0 +1,258 @@
+/* This file is part of KDE
+    Copyright 2020 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QFile>
+
+#include <konq_historyentry.h>
+#include <konq_historylog_p.h>
+#include "konqhistory_testutils.h"
+
+class KonqHistoryLogTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void testMissingLog();
+    void testReplay();
+    void testTruncatedRecord();
+    void testRewrite();
+    void testReadSince();
+    void testCompact();
+
+private:
+    QTemporaryDir m_dir;
+    QString m_fileName;
+};
+
+QTEST_MAIN(KonqHistoryLogTest)
+
+void KonqHistoryLogTest::init()
+{
+    QVERIFY(m_dir.isValid());
+    m_fileName = m_dir.path() + QLatin1String("/sub/konq_history.log");
+    QFile::remove(m_fileName);
+}
+
+void KonqHistoryLogTest::testMissingLog()
+{
+    KonqHistoryList entries;
+    int records = -1;
+    QVERIFY(!KonqHistoryLog(m_fileName).read(entries, &records));
+    QCOMPARE(records, 0);
+
+    // Nothing to read, nothing missed either
+    KonqHistoryLog::Cursor cursor;
+    QVector<KonqHistoryLog::Record> newRecords;
+    QVERIFY(KonqHistoryLog(m_fileName).readSince(cursor, newRecords));
+    QVERIFY(newRecords.isEmpty());
+
+    // Not a log
+    QVERIFY(QDir().mkpath(m_dir.path() + QLatin1String("/sub")));
+    QFile file(m_fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("garbage garbage");
+    file.close();
+    QVERIFY(!KonqHistoryLog(m_fileName).read(entries));
+}
+
+void KonqHistoryLogTest::testReplay()
+{
+    KonqHistoryLog log(m_fileName);
+    KonqHistoryLog::Cursor cursor;
+    QVERIFY(log.lock(0));
+    const KonqHistoryEntry a = makeHistoryEntry(QStringLiteral("http://a.example/"), 10, QStringLiteral("A"));
+    const KonqHistoryEntry b = makeHistoryEntry(QStringLiteral("http://b.example/"), 20, QStringLiteral("B"));
+    const KonqHistoryEntry c = makeHistoryEntry(QStringLiteral("http://c.example/"), 30, QStringLiteral("C"));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(c)));
+    QVERIFY(log.append(cursor, KonqHistoryLog::ClearRecord));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(a)));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(b)));
+
+    // Visit a again: it becomes the most recent entry
+    KonqHistoryEntry a2 = a;
+    a2.numberOfTimesVisited = 2;
+    a2.lastVisited = a.lastVisited.addSecs(100);
+    QVERIFY(log.append(cursor, KonqHistoryLog::TouchRecord, KonqHistoryLog::touchPayload(a2)));
+
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(c)));
+    QVERIFY(log.append(cursor, KonqHistoryLog::RemoveRecord, KonqHistoryLog::removePayload(c.url)));
+    log.unlock();
+
+    KonqHistoryList entries;
+    int records = 0;
+    KonqHistoryLog::Cursor end;
+    QVERIFY(log.read(entries, &records, &end));
+    QCOMPARE(records, 7);
+    QCOMPARE(end.logId, cursor.logId);
+    QCOMPARE(end.offset, cursor.offset);
+    QCOMPARE(entries.count(), 2);
+    QCOMPARE(entries.at(0), b);
+    QCOMPARE(entries.at(1), a2);
+}
+
+void KonqHistoryLogTest::testTruncatedRecord()
+{
+    KonqHistoryLog log(m_fileName);
+    KonqHistoryLog::Cursor cursor;
+    QVERIFY(log.lock(0));
+    const KonqHistoryEntry a = makeHistoryEntry(QStringLiteral("http://a.example/"), 10, QStringLiteral("A"));
+    const KonqHistoryEntry b = makeHistoryEntry(QStringLiteral("http://b.example/"), 20, QStringLiteral("B"));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(a)));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(b)));
+
+    // Simulate a crash while writing the last record
+    QFile file(m_fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 3));
+    file.close();
+
+    KonqHistoryList entries;
+    int records = 0;
+    QVERIFY(log.read(entries, &records, &cursor));
+    QCOMPARE(records, 1);
+    QCOMPARE(entries.count(), 1);
+    QCOMPARE(entries.at(0), a);
+
+    // What's left of the damaged record is dropped when appending the next one
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(b)));
+    log.unlock();
+    QVERIFY(log.read(entries, &records));
+    QCOMPARE(records, 2);
+    QCOMPARE(entries.count(), 2);
+}
+
+void KonqHistoryLogTest::testRewrite()
+{
+    KonqHistoryLog log(m_fileName);
+    KonqHistoryLog::Cursor cursor;
+    QVERIFY(log.lock(0));
+    KonqHistoryEntry a = makeHistoryEntry(QStringLiteral("http://a.example/"), 10, QStringLiteral("A"));
+    for (int i = 0; i < 50; ++i) {
+        a.numberOfTimesVisited = i + 1;
+        a.lastVisited = a.firstVisited.addSecs(i);
+        QVERIFY(log.append(cursor, KonqHistoryLog::TouchRecord, KonqHistoryLog::touchPayload(a)));
+    }
+    KonqHistoryList entries;
+    entries.append(a);
+    const qint64 sizeBefore = QFile(m_fileName).size();
+
+    QVERIFY(log.rewrite(entries, &cursor));
+    log.unlock();
+    QVERIFY(QFile(m_fileName).size() < sizeBefore);
+    QCOMPARE(cursor.offset, QFile(m_fileName).size());
+
+    KonqHistoryList read;
+    int records = 0;
+    QVERIFY(log.read(read, &records));
+    QCOMPARE(records, 1);
+    QCOMPARE(read, entries);
+}
+
+void KonqHistoryLogTest::testReadSince()
+{
+    // Two instances sharing the log
+    KonqHistoryLog writer(m_fileName);
+    KonqHistoryLog reader(m_fileName);
+    KonqHistoryLog::Cursor writerCursor;
+    KonqHistoryLog::Cursor readerCursor;
+    QVector<KonqHistoryLog::Record> records;
+
+    const KonqHistoryEntry a = makeHistoryEntry(QStringLiteral("http://a.example/"), 10, QStringLiteral("A"));
+    const KonqHistoryEntry b = makeHistoryEntry(QStringLiteral("http://b.example/"), 20, QStringLiteral("B"));
+    QVERIFY(writer.lock(0));
+    QVERIFY(writer.append(writerCursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(a)));
+    writer.unlock();
+
+    QVERIFY(reader.readSince(readerCursor, records));
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(KonqHistoryLog::entryFromPayload(records.at(0).payload), a);
+    QCOMPARE(readerCursor.offset, writerCursor.offset);
+
+    // The writer's cursor is behind: it must catch up before appending
+    QVERIFY(reader.lock(0));
+    QVERIFY(reader.append(readerCursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(b)));
+    reader.unlock();
+    QVERIFY(writer.lock(0));
+    QVERIFY(!writer.append(writerCursor, KonqHistoryLog::RemoveRecord, KonqHistoryLog::removePayload(a.url)));
+    QVERIFY(writer.readSince(writerCursor, records));
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(KonqHistoryLog::urlFromPayload(records.at(0).payload), b.url);
+    QVERIFY(writer.append(writerCursor, KonqHistoryLog::RemoveRecord, KonqHistoryLog::removePayload(a.url)));
+    writer.unlock();
+
+    QVERIFY(reader.readSince(readerCursor, records));
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(int(records.at(0).type), int(KonqHistoryLog::RemoveRecord));
+    QVERIFY(reader.readSince(readerCursor, records));
+    QVERIFY(records.isEmpty());
+}
+
+void KonqHistoryLogTest::testCompact()
+{
+    KonqHistoryLog log(m_fileName);
+    KonqHistoryLog::Cursor cursor;
+    KonqHistoryEntry a = makeHistoryEntry(QStringLiteral("http://a.example/"), 10, QStringLiteral("A"));
+    const KonqHistoryEntry b = makeHistoryEntry(QStringLiteral("http://b.example/"), 20, QStringLiteral("B"));
+    QVERIFY(log.lock(0));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(a)));
+    const KonqHistoryLog::Cursor early = cursor;
+    for (int i = 0; i < 20; ++i) {
+        a.numberOfTimesVisited = i + 2;
+        a.lastVisited = a.firstVisited.addSecs(i);
+        QVERIFY(log.append(cursor, KonqHistoryLog::TouchRecord, KonqHistoryLog::touchPayload(a)));
+    }
+    log.unlock();
+    const KonqHistoryLog::Cursor late = cursor;
+
+    QVERIFY(KonqHistoryLog(m_fileName).compact());
+
+    // Appending requires catching up with the compaction first
+    QVector<KonqHistoryLog::Record> records;
+    QVERIFY(log.lock(0));
+    QVERIFY(log.readSince(cursor, records));
+    QVERIFY(records.isEmpty());
+    QVERIFY(cursor.logId != late.logId);
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(b)));
+    log.unlock();
+
+    // A cursor from before the compaction only gets the new record...
+    KonqHistoryLog::Cursor reader = late;
+    QVERIFY(log.readSince(reader, records));
+    QCOMPARE(records.count(), 1);
+    QCOMPARE(KonqHistoryLog::entryFromPayload(records.at(0).payload), b);
+    QCOMPARE(reader.offset, cursor.offset);
+
+    // ...unless the records it missed were compacted
+    reader = early;
+    QVERIFY(!log.readSince(reader, records));
+
+    KonqHistoryList entries;
+    int count = 0;
+    QVERIFY(log.read(entries, &count));
+    QCOMPARE(count, 2);
+    QCOMPARE(entries.count(), 2);
+    QCOMPARE(entries.at(0), b);
+    QCOMPARE(entries.at(1), a);
+}
+
+#include "konqhistorylogtest.moc"
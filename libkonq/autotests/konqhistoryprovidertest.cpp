@@ -0,0 +1,95 @@
+/* This file is part of KDE
+    Copyright 2020 The Konqueror developers
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to
+    the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+    Boston, MA 02110-1301, USA.
+*/
+
+#include <QTest>
+#include <QFile>
+#include <QStandardPaths>
+
+#include <konq_historyentry.h>
+#include <konq_historylog_p.h>
+#include <konq_historyprovider.h>
+#include "konqhistory_testutils.h"
+
+class KonqHistoryProviderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void testUnloadedRemove();
+    void testUnloadedClear();
+
+private:
+    static KonqHistoryList loggedEntries();
+};
+
+QTEST_GUILESS_MAIN(KonqHistoryProviderTest)
+
+KonqHistoryList KonqHistoryProviderTest::loggedEntries()
+{
+    KonqHistoryList entries;
+    KonqHistoryLog().read(entries);
+    return entries;
+}
+
+void KonqHistoryProviderTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void KonqHistoryProviderTest::init()
+{
+    QFile::remove(KonqHistoryLog::defaultFileName());
+
+    KonqHistoryLog log;
+    KonqHistoryLog::Cursor cursor;
+    QVERIFY(log.lock(0));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(makeHistoryEntry(QStringLiteral("http://a.example/"), 10))));
+    QVERIFY(log.append(cursor, KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(makeHistoryEntry(QStringLiteral("http://b.example/"), 20))));
+    log.unlock();
+    QCOMPARE(loggedEntries().count(), 2);
+}
+
+void KonqHistoryProviderTest::testUnloadedRemove()
+{
+    // Like the history KCM, which never loads the history
+    KonqHistoryProvider provider;
+    QVERIFY(!provider.isHistoryLoaded());
+    provider.emitRemoveFromHistory(QUrl(QStringLiteral("http://a.example/")));
+    QTRY_COMPARE(loggedEntries().count(), 1);
+    QCOMPARE(loggedEntries().at(0).url, QUrl(QStringLiteral("http://b.example/")));
+
+    // The removal is kept when the history is loaded
+    QVERIFY(provider.loadHistory());
+    QCOMPARE(provider.entries().count(), 1);
+    QCOMPARE(provider.entries().at(0).url, QUrl(QStringLiteral("http://b.example/")));
+}
+
+void KonqHistoryProviderTest::testUnloadedClear()
+{
+    KonqHistoryProvider provider;
+    provider.emitClear();
+    QTRY_VERIFY(loggedEntries().isEmpty());
+
+    QVERIFY(provider.loadHistory());
+    QVERIFY(provider.entries().isEmpty());
+}
+
+#include "konqhistoryprovidertest.moc"
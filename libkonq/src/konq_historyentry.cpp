@@ -20,6 +20,10 @@
 
 #include "konq_historyentry.h"
 #include <QDataStream>
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
 
 KonqHistoryEntry::KonqHistoryEntry()
     : numberOfTimesVisited(1), d(nullptr)
@@ -89,37 +93,191 @@ void KonqHistoryEntry::save(QDataStream &s, Flags flags) const
 
 ////
 
-KonqHistoryList::iterator KonqHistoryList::findEntry(const QUrl &url)
+class KonqHistoryList::Private
 {
-    // we search backwards, probably faster to find an entry
-    KonqHistoryList::iterator it = end();
-    while (it != begin()) {
-        --it;
-        if ((*it).url == url) {
-            return it;
+public:
+    Private()
+        : nextNumber(0), valid(true), hasDuplicates(false)
+    {
+    }
+
+    bool isUpToDate(const KonqHistoryList &list) const
+    {
+        return valid && numbers.count() == list.count();
+    }
+
+    void rebuild(const KonqHistoryList &list)
+    {
+        numbers.resize(list.count());
+        index.clear();
+        index.reserve(list.count());
+        hasDuplicates = false;
+        for (int i = 0; i < list.count(); ++i) {
+            numbers[i] = i;
+            // With duplicates, the last entry wins, as when searching backwards
+            if (index.contains(list.at(i).url)) {
+                hasDuplicates = true;
+            }
+            index.insert(list.at(i).url, i);
+        }
+        nextNumber = list.count();
+        valid = true;
+    }
+
+    // Returns -1 if the URL isn't in the index, otherwise the position of its
+    // number, which must still be checked against the list
+    int position(const QUrl &url) const
+    {
+        const QHash<QUrl, qint64>::const_iterator it = index.constFind(url);
+        if (it == index.constEnd()) {
+            return -1;
         }
+        const QVector<qint64>::const_iterator number = std::lower_bound(numbers.constBegin(), numbers.constEnd(), *it);
+        if (number == numbers.constEnd() || *number != *it) {
+            return numbers.count();
+        }
+        return number - numbers.constBegin();
     }
-    return end();
+
+    // The number of each entry, in list order. Entries are numbered when they're
+    // added, so the numbers are increasing and removing or moving an entry doesn't
+    // change the number of the others; its position is found by binary search
+    QVector<qint64> numbers;
+    // The number of the entry of each URL
+    QHash<QUrl, qint64> index;
+    qint64 nextNumber;
+    bool valid;
+    // Whether a URL appears twice, which isn't supposed to happen
+    bool hasDuplicates;
+};
+
+KonqHistoryList::KonqHistoryList()
+    : d(new Private)
+{
 }
 
-KonqHistoryList::const_iterator KonqHistoryList::constFindEntry(const QUrl &url) const
+KonqHistoryList::KonqHistoryList(const KonqHistoryList &other)
+    : QList<KonqHistoryEntry>(other), d(new Private)
 {
-    // we search backwards, probably faster to find an entry
-    KonqHistoryList::const_iterator it = constEnd();
-    while (it != constBegin()) {
-        --it;
-        if ((*it).url == url) {
-            return it;
+    // Built on the first lookup, the copy is often only iterated over
+    d->valid = false;
+}
+
+KonqHistoryList::~KonqHistoryList()
+{
+    delete d;
+}
+
+KonqHistoryList &KonqHistoryList::operator=(const KonqHistoryList &other)
+{
+    QList<KonqHistoryEntry>::operator=(other);
+    d->valid = false;
+    return *this;
+}
+
+int KonqHistoryList::indexOf(const QUrl &url) const
+{
+    if (!d->isUpToDate(*this)) {
+        d->rebuild(*this);
+    }
+    if (d->hasDuplicates) {
+        // we search backwards, probably faster to find an entry
+        for (int i = count() - 1; i >= 0; --i) {
+            if (at(i).url == url) {
+                return i;
+            }
         }
+        return -1;
     }
-    return constEnd();
+    int pos = d->position(url);
+    if (pos >= 0 && (pos >= count() || at(pos).url != url)) {
+        // The entries were reordered since the index was built
+        d->rebuild(*this);
+        pos = d->position(url);
+    }
+    return pos;
+}
+
+KonqHistoryList::iterator KonqHistoryList::findEntry(const QUrl &url)
+{
+    const int pos = indexOf(url);
+    return pos < 0 ? end() : begin() + pos;
+}
+
+KonqHistoryList::const_iterator KonqHistoryList::constFindEntry(const QUrl &url) const
+{
+    const int pos = indexOf(url);
+    return pos < 0 ? constEnd() : constBegin() + pos;
 }
 
 void KonqHistoryList::removeEntry(const QUrl &url)
 {
-    iterator it = findEntry(url);
-    if (it != end()) {
-        erase(it);
+    const int pos = indexOf(url);
+    if (pos >= 0) {
+        erase(begin() + pos);
+    }
+}
+
+KonqHistoryList::iterator KonqHistoryList::moveToEnd(iterator it)
+{
+    const int pos = const_iterator(it) - constBegin();
+    if (pos == count() - 1) {
+        return it;
+    }
+    if (d->isUpToDate(*this) && !d->hasDuplicates) {
+        const qint64 number = d->nextNumber++;
+        d->numbers.remove(pos);
+        d->numbers.append(number);
+        d->index.insert(it->url, number);
+    } else {
+        d->valid = false;
+    }
+    move(pos, count() - 1);
+    return end() - 1;
+}
+
+void KonqHistoryList::append(const KonqHistoryEntry &entry)
+{
+    if (d->isUpToDate(*this)) {
+        const qint64 number = d->nextNumber++;
+        QHash<QUrl, qint64>::iterator it = d->index.find(entry.url);
+        if (it != d->index.end()) {
+            d->hasDuplicates = true;
+            *it = number;
+        } else {
+            d->index.insert(entry.url, number);
+        }
+        d->numbers.append(number);
+    } else {
+        d->valid = false;
+    }
+    QList<KonqHistoryEntry>::append(entry);
+}
+
+KonqHistoryList::iterator KonqHistoryList::erase(iterator it)
+{
+    const int pos = const_iterator(it) - constBegin();
+    if (d->isUpToDate(*this) && !d->hasDuplicates) {
+        d->index.remove(it->url);
+        d->numbers.remove(pos);
+    } else {
+        d->valid = false;
     }
+    return QList<KonqHistoryEntry>::erase(begin() + pos);
 }
 
+void KonqHistoryList::removeFirst()
+{
+    Q_ASSERT(!isEmpty());
+    erase(begin());
+}
+
+void KonqHistoryList::clear()
+{
+    QList<KonqHistoryEntry>::clear();
+    d->numbers.clear();
+    d->index.clear();
+    d->nextNumber = 0;
+    d->valid = true;
+    d->hasDuplicates = false;
+}
@@ -60,9 +60,25 @@ KDE_DUMMY_QHASH_FUNCTION(KonqHistoryEntry)
 
 Q_DECLARE_METATYPE(KonqHistoryEntry)
 
+/**
+ * The list of history entries, oldest first.
+ *
+ * The list keeps an index from URL to position, so that finding an entry
+ * doesn't need to go through the whole list. Entries should be added and
+ * removed with the functions of this class for the index to stay up to date;
+ * the index is rebuilt on the next lookup if the size of the list was changed
+ * by the other QList functions, or if the entries were reordered, e.g. sorted.
+ * Changing the URL of an entry in place isn't supported.
+ */
 class LIBKONQ_EXPORT KonqHistoryList : public QList<KonqHistoryEntry>
 {
 public:
+    KonqHistoryList();
+    KonqHistoryList(const KonqHistoryList &other);
+    ~KonqHistoryList();
+
+    KonqHistoryList &operator=(const KonqHistoryList &other);
+
     /**
      * Finds an entry by URL and return an iterator to it.
      * If no matching entry is found, end() is returned.
@@ -79,6 +95,23 @@ public:
      * Finds an entry by URL and removes it
      */
     void removeEntry(const QUrl &url);
+
+    /**
+     * Moves the entry at @p it to the end of the list, i.e. makes it the most
+     * recently visited one, and returns an iterator to its new position.
+     */
+    iterator moveToEnd(iterator it);
+
+    void append(const KonqHistoryEntry &entry);
+    iterator erase(iterator it);
+    void removeFirst();
+    void clear();
+
+private:
+    int indexOf(const QUrl &url) const;
+
+    class Private;
+    Private *d;
 };
 
 #endif /* KONQ_HISTORYENTRY_H */
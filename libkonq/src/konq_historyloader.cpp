@@ -20,6 +20,7 @@
 
 #include "konq_historyloader_p.h"
 #include "konq_historyentry.h"
+#include "konq_historylog_p.h"
 
 #include <QDebug>
 #include <QDataStream>
@@ -31,13 +32,19 @@
 class KonqHistoryLoaderPrivate
 {
 public:
+    KonqHistoryLoaderPrivate() : m_logRecordCount(0), m_fromLegacyFile(false) {}
+
+    bool loadLegacyHistory();
+
     KonqHistoryList m_history;
+    int m_logRecordCount;
+    KonqHistoryLog::Cursor m_logCursor;
+    bool m_fromLegacyFile;
 };
 
 KonqHistoryLoader::KonqHistoryLoader(QObject *parent)
     : QObject(parent), d(new KonqHistoryLoaderPrivate)
 {
-    loadHistory();
 }
 
 KonqHistoryLoader::~KonqHistoryLoader()
@@ -56,7 +63,26 @@ static bool lastVisitedOrder(const KonqHistoryEntry &lhs, const KonqHistoryEntry
 
 bool KonqHistoryLoader::loadHistory()
 {
-    d->m_history.clear();
+    d->m_logRecordCount = 0;
+    d->m_logCursor = KonqHistoryLog::Cursor();
+    d->m_fromLegacyFile = false;
+
+    if (KonqHistoryLog().read(d->m_history, &d->m_logRecordCount, &d->m_logCursor)) {
+        return true;
+    }
+
+    // No history log yet: read the history file written by older versions, so that
+    // the history can be migrated
+    if (!d->loadLegacyHistory()) {
+        return false;
+    }
+    d->m_fromLegacyFile = true;
+    return true;
+}
+
+bool KonqHistoryLoaderPrivate::loadLegacyHistory()
+{
+    m_history.clear();
 
     const QString filename = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history");
     QFile file(filename);
@@ -114,7 +140,7 @@ bool KonqHistoryLoader::loadHistory()
         }
 #endif
 
-        if (historyVersion() != int(version) || (crcChecked && !crcOk)) {
+        if (KonqHistoryLoader::historyVersion() != int(version) || (crcChecked && !crcOk)) {
             qWarning() << "The history version doesn't match, aborting loading";
             file.close();
             return false;
@@ -124,12 +150,12 @@ bool KonqHistoryLoader::loadHistory()
             KonqHistoryEntry entry;
             entry.load(*stream, flags);
             // kDebug(1202) << "loaded entry:" << entry.url << ", Title:" << entry.title;
-            d->m_history.append(entry);
+            m_history.append(entry);
         }
 
         //kDebug(1202) << "loaded:" << m_history.count() << "entries.";
 
-        std::sort(d->m_history.begin(), d->m_history.end(), lastVisitedOrder);
+        std::sort(m_history.begin(), m_history.end(), lastVisitedOrder);
     }
 
     // Theoretically, we should emit update() here, but as we only ever
@@ -143,6 +169,21 @@ const KonqHistoryList &KonqHistoryLoader::entries() const
     return d->m_history;
 }
 
+int KonqHistoryLoader::logRecordCount() const
+{
+    return d->m_logRecordCount;
+}
+
+KonqHistoryLog::Cursor KonqHistoryLoader::logCursor() const
+{
+    return d->m_logCursor;
+}
+
+bool KonqHistoryLoader::isLegacyHistory() const
+{
+    return d->m_fromLegacyFile;
+}
+
 int KonqHistoryLoader::historyVersion()
 {
     return 4;
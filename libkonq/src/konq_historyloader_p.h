@@ -22,6 +22,7 @@
 #define KONQ_HISTORYLOADER_H
 
 #include "libkonq_export.h"
+#include "konq_historylog_p.h"
 #include <QObject>
 
 class KonqHistoryList;
@@ -41,7 +42,11 @@ public:
     ~KonqHistoryLoader() override;
 
     /**
-     * Load the history. No need to call this more than once...
+     * Load the history. This isn't done by the constructor, so that the history
+     * can be loaded in a worker thread.
+     *
+     * The history log is read if it exists, otherwise the history file
+     * written by older versions is.
      */
     bool loadHistory();
 
@@ -51,6 +56,28 @@ public:
      */
     const KonqHistoryList &entries() const;
 
+    /**
+     * @returns the number of records read from the history log, which is
+     * larger than the number of entries when the log needs to be compacted
+     */
+    int logRecordCount() const;
+
+    /**
+     * @returns the position in the history log after the records read, from which
+     * the records appended later by other instances can be read
+     */
+    KonqHistoryLog::Cursor logCursor() const;
+
+    /**
+     * @returns true if the history was read from the file written by older
+     * versions, and needs to be written to the history log
+     */
+    bool isLegacyHistory() const;
+
+    /**
+     * @returns the version of the history file written by older versions
+     * @see KonqHistoryLog::logVersion()
+     */
     static int historyVersion();
 
 private:
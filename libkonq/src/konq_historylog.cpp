@@ -0,0 +1,461 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as published
+   by the Free Software Foundation; either version 2 of the License or
+   ( at your option ) version 3 or, at the discretion of KDE e.V.
+   ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konq_historylog_p.h"
+#include "konq_historyentry.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUuid>
+
+#include <zlib.h> // for crc32
+
+#include <algorithm>
+#include <cstring>
+
+static const char s_logMagic[8] = { 'K', 'O', 'N', 'Q', 'H', 'L', 'O', 'G' };
+
+// The data stream version used for the whole log, so that it doesn't depend on the Qt version
+static const int s_streamVersion = QDataStream::Qt_5_0;
+
+struct KonqHistoryLogHeader {
+    KonqHistoryLogHeader() : logId(0), previousLogId(0), previousOffset(0), compactedOffset(0) {}
+
+    quint64 logId;
+    // The log this one was compacted from, if any: the records found at previousOffset
+    // and after in the previous log are found at compactedOffset and after in this one
+    quint64 previousLogId;
+    qint64 previousOffset;
+    qint64 compactedOffset;
+};
+
+// magic, version, logId, previousLogId, previousOffset, compactedOffset
+static const qint64 s_headerSize = sizeof(s_logMagic) + 4 + 4 * 8;
+
+static quint32 checksum(const QByteArray &data)
+{
+    return crc32(0, reinterpret_cast<const unsigned char *>(data.constData()), data.size());
+}
+
+static quint64 newLogId()
+{
+    const QByteArray uuid = QUuid::createUuid().toRfc4122();
+    quint64 id;
+    memcpy(&id, uuid.constData(), sizeof(id));
+    return id ? id : 1;
+}
+
+static void writeHeader(QDataStream &stream, const KonqHistoryLogHeader &header)
+{
+    stream.writeRawData(s_logMagic, sizeof(s_logMagic));
+    stream << quint32(KonqHistoryLog::logVersion());
+    stream << header.logId << header.previousLogId << header.previousOffset << header.compactedOffset;
+}
+
+static bool readHeader(QFile &file, QDataStream &stream, KonqHistoryLogHeader &header)
+{
+    char magic[sizeof(s_logMagic)];
+    quint32 version = 0;
+    if (stream.readRawData(magic, sizeof(magic)) != int(sizeof(magic)) ||
+            !std::equal(magic, magic + sizeof(magic), s_logMagic)) {
+        qWarning() << file.fileName() << "is not a history log";
+        return false;
+    }
+    stream >> version;
+    if (int(version) != KonqHistoryLog::logVersion()) {
+        qWarning() << "The history log version doesn't match, aborting loading";
+        return false;
+    }
+    stream >> header.logId >> header.previousLogId >> header.previousOffset >> header.compactedOffset;
+    return stream.status() == QDataStream::Ok;
+}
+
+static void writeRecord(QDataStream &stream, KonqHistoryLog::RecordType type, const QByteArray &payload)
+{
+    stream << quint8(type) << quint32(payload.size()) << checksum(payload);
+    stream.writeRawData(payload.constData(), payload.size());
+}
+
+// Reads the records from the current position of @p file up to its end,
+// or up to the first truncated or damaged record.
+// @p offset is set to the end of the last record read.
+static void readRecords(QFile &file, QDataStream &stream, qint64 &offset, QVector<KonqHistoryLog::Record> &records)
+{
+    while (!stream.atEnd()) {
+        quint8 type;
+        quint32 size;
+        quint32 crc;
+        stream >> type >> size >> crc;
+        if (stream.status() != QDataStream::Ok || size > quint64(file.size() - file.pos())) {
+            qWarning() << "Truncated record in" << file.fileName();
+            break;
+        }
+        QByteArray payload(size, Qt::Uninitialized);
+        if (stream.readRawData(payload.data(), size) != int(size) || checksum(payload) != crc) {
+            qWarning() << "Damaged record in" << file.fileName();
+            break;
+        }
+        // Records of unknown types were written by a newer version: they are skipped when applied
+        KonqHistoryLog::Record record;
+        record.type = static_cast<KonqHistoryLog::RecordType>(type);
+        record.payload = payload;
+        records.append(record);
+        offset = file.pos();
+    }
+}
+
+static bool lastVisitedOrder(const KonqHistoryEntry &lhs, const KonqHistoryEntry &rhs)
+{
+    return lhs.lastVisited < rhs.lastVisited;
+}
+
+KonqHistoryLog::KonqHistoryLog(const QString &fileName)
+    : m_fileName(fileName)
+{
+}
+
+KonqHistoryLog::~KonqHistoryLog()
+{
+}
+
+QString KonqHistoryLog::defaultFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror/konq_history.log");
+}
+
+int KonqHistoryLog::logVersion()
+{
+    // Version 4 is the last version of the konq_history file, which was rewritten as a whole.
+    // Version 5 logs had no identifier, and couldn't be shared by several instances.
+    return 6;
+}
+
+bool KonqHistoryLog::read(KonqHistoryList &entries, int *recordCount, Cursor *cursor) const
+{
+    entries.clear();
+    if (recordCount) {
+        *recordCount = 0;
+    }
+
+    if (!QFile::exists(m_fileName)) {
+        return false;
+    }
+    Cursor start;
+    QVector<Record> records;
+    if (!readSince(start, records) || start.logId == 0) {
+        return false;
+    }
+
+    // Replay the records on a hash, the order of the entries is only restored at the end
+    QHash<QUrl, KonqHistoryEntry> byUrl;
+    for (const Record &record : qAsConst(records)) {
+        switch (record.type) {
+        case AddRecord: {
+            const KonqHistoryEntry entry = entryFromPayload(record.payload);
+            byUrl.insert(entry.url, entry);
+            break;
+        }
+        case RemoveRecord:
+            byUrl.remove(urlFromPayload(record.payload));
+            break;
+        case TouchRecord: {
+            QUrl url;
+            quint32 numberOfTimesVisited;
+            QDateTime lastVisited;
+            touchFromPayload(record.payload, url, numberOfTimesVisited, lastVisited);
+            QHash<QUrl, KonqHistoryEntry>::iterator it = byUrl.find(url);
+            if (it != byUrl.end()) {
+                it->numberOfTimesVisited = numberOfTimesVisited;
+                it->lastVisited = lastVisited;
+            }
+            break;
+        }
+        case ClearRecord:
+            byUrl.clear();
+            break;
+        default:
+            break;
+        }
+    }
+
+    QList<KonqHistoryEntry> sorted = byUrl.values();
+    std::stable_sort(sorted.begin(), sorted.end(), lastVisitedOrder);
+    entries.reserve(sorted.size());
+    for (const KonqHistoryEntry &entry : qAsConst(sorted)) {
+        entries.append(entry);
+    }
+
+    if (recordCount) {
+        *recordCount = records.count();
+    }
+    if (cursor) {
+        *cursor = start;
+    }
+    return true;
+}
+
+bool KonqHistoryLog::readSince(Cursor &cursor, QVector<Record> &records) const
+{
+    records.clear();
+
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+        if (!file.isOpen() && file.exists()) {
+            qWarning() << "Can't open" << m_fileName;
+        }
+        // Fine if nothing was read yet: nothing was logged either
+        return cursor.logId == 0;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(s_streamVersion);
+    KonqHistoryLogHeader header;
+    if (!readHeader(file, stream, header)) {
+        return false;
+    }
+
+    qint64 offset;
+    if (cursor.logId == 0) {
+        offset = s_headerSize;
+    } else if (header.logId == cursor.logId) {
+        offset = cursor.offset;
+    } else if (header.previousLogId == cursor.logId && cursor.offset >= header.previousOffset) {
+        // Compacted since the last read, but not before the cursor
+        offset = header.compactedOffset + (cursor.offset - header.previousOffset);
+    } else {
+        return false;
+    }
+    if (offset < s_headerSize || offset > file.size() || !file.seek(offset)) {
+        return false;
+    }
+
+    cursor.logId = header.logId;
+    cursor.offset = offset;
+    readRecords(file, stream, cursor.offset, records);
+    return true;
+}
+
+bool KonqHistoryLog::lock(int timeout)
+{
+    if (!m_lock) {
+        QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+        m_lock.reset(new QLockFile(m_fileName + QLatin1String(".lock")));
+    }
+    return m_lock->tryLock(timeout);
+}
+
+void KonqHistoryLog::unlock()
+{
+    if (m_lock) {
+        m_lock->unlock();
+    }
+}
+
+bool KonqHistoryLog::append(Cursor &cursor, RecordType type, const QByteArray &payload)
+{
+    // The file is opened for each record rather than kept open: after a compaction
+    // (possibly by another instance), the records must go to the new file
+    QFile file(m_fileName);
+    if (!file.exists()) {
+        QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    }
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Can't open" << m_fileName << "for saving history";
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(s_streamVersion);
+    if (file.size() == 0) {
+        KonqHistoryLogHeader header;
+        header.logId = newLogId();
+        writeHeader(stream, header);
+        cursor.logId = header.logId;
+    } else {
+        KonqHistoryLogHeader header;
+        if (!readHeader(file, stream, header) || header.logId != cursor.logId || cursor.offset < s_headerSize || cursor.offset > file.size()) {
+            qWarning() << "The history log" << m_fileName << "was changed by another instance";
+            return false;
+        }
+        if (file.size() > cursor.offset) {
+            // Either records were appended since the cursor, or a record couldn't be written completely
+            QVector<Record> records;
+            qint64 end = cursor.offset;
+            file.seek(cursor.offset);
+            readRecords(file, stream, end, records);
+            if (!records.isEmpty()) {
+                qWarning() << "The history log" << m_fileName << "wasn't read up to its end";
+                return false;
+            }
+            file.resize(cursor.offset);
+            stream.resetStatus();
+        }
+        file.seek(cursor.offset);
+    }
+    writeRecord(stream, type, payload);
+    if (stream.status() != QDataStream::Ok || !file.flush()) {
+        return false;
+    }
+    cursor.offset = file.pos();
+    return true;
+}
+
+bool KonqHistoryLog::rewrite(const KonqHistoryList &entries, Cursor *cursor)
+{
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't open" << file.fileName() << "for saving history";
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(s_streamVersion);
+    KonqHistoryLogHeader header;
+    header.logId = newLogId();
+    writeHeader(stream, header);
+    for (const KonqHistoryEntry &entry : entries) {
+        writeRecord(stream, AddRecord, addPayload(entry));
+    }
+    const qint64 end = file.pos();
+    if (!file.commit()) {
+        return false;
+    }
+    if (cursor) {
+        cursor->logId = header.logId;
+        cursor->offset = end;
+    }
+    return true;
+}
+
+bool KonqHistoryLog::compact()
+{
+    KonqHistoryList entries;
+    Cursor replayed;
+    if (!read(entries, nullptr, &replayed)) {
+        return false;
+    }
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't open" << file.fileName() << "for saving history";
+        return false;
+    }
+
+    QByteArray compacted;
+    {
+        QDataStream stream(&compacted, QIODevice::WriteOnly);
+        stream.setVersion(s_streamVersion);
+        for (const KonqHistoryEntry &entry : qAsConst(entries)) {
+            writeRecord(stream, AddRecord, addPayload(entry));
+        }
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(s_streamVersion);
+    KonqHistoryLogHeader header;
+    header.logId = newLogId();
+    header.previousLogId = replayed.logId;
+    header.previousOffset = replayed.offset;
+    header.compactedOffset = s_headerSize + compacted.size();
+    writeHeader(stream, header);
+    stream.writeRawData(compacted.constData(), compacted.size());
+
+    if (!lock(10000)) {
+        qWarning() << "Can't lock" << m_fileName << "for compacting it";
+        file.cancelWriting();
+        return false;
+    }
+
+    // Copy what was appended while the log was replayed. The records are written
+    // the same way, so that the offsets of the cursors after previousOffset can be translated.
+    Cursor appended = replayed;
+    QVector<Record> records;
+    bool ok = readSince(appended, records) && appended.logId == replayed.logId;
+    if (ok) {
+        for (const Record &record : qAsConst(records)) {
+            writeRecord(stream, record.type, record.payload);
+        }
+        ok = stream.status() == QDataStream::Ok && file.commit();
+    } else {
+        file.cancelWriting();
+    }
+    unlock();
+    return ok;
+}
+
+QByteArray KonqHistoryLog::addPayload(const KonqHistoryEntry &entry)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(s_streamVersion);
+    entry.save(stream, KonqHistoryEntry::NoFlags);
+    return payload;
+}
+
+QByteArray KonqHistoryLog::touchPayload(const KonqHistoryEntry &entry)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(s_streamVersion);
+    stream << entry.url << entry.numberOfTimesVisited << entry.lastVisited;
+    return payload;
+}
+
+QByteArray KonqHistoryLog::removePayload(const QUrl &url)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(s_streamVersion);
+    stream << url;
+    return payload;
+}
+
+KonqHistoryEntry KonqHistoryLog::entryFromPayload(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(s_streamVersion);
+    KonqHistoryEntry entry;
+    entry.load(stream, KonqHistoryEntry::NoFlags);
+    return entry;
+}
+
+void KonqHistoryLog::touchFromPayload(const QByteArray &payload, QUrl &url, quint32 &numberOfTimesVisited, QDateTime &lastVisited)
+{
+    QDataStream stream(payload);
+    stream.setVersion(s_streamVersion);
+    stream >> url >> numberOfTimesVisited >> lastVisited;
+}
+
+QUrl KonqHistoryLog::urlFromPayload(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    stream.setVersion(s_streamVersion);
+    QUrl url;
+    stream >> url;
+    return url;
+}
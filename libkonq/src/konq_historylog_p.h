@@ -0,0 +1,165 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Library General Public License as published
+   by the Free Software Foundation; either version 2 of the License or
+   ( at your option ) version 3 or, at the discretion of KDE e.V.
+   ( which shall act as a proxy as in section 14 of the GPLv3 ), any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_HISTORYLOG_H
+#define KONQ_HISTORYLOG_H
+
+#include "libkonq_export.h"
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+class QDateTime;
+class QLockFile;
+class QUrl;
+class KonqHistoryEntry;
+class KonqHistoryList;
+
+/**
+ * @internal
+ * The Konqueror history file, as an append-only log.
+ *
+ * Instead of rewriting the whole history each time a page is visited, each change
+ * is appended to the log as a small record: an entry was added or replaced, an
+ * existing entry was visited again, an entry was removed, or the history was cleared.
+ * Reading the log means replaying these records in order.
+ *
+ * The log is shared by all the Konqueror instances: each instance appends the
+ * changes it makes, with the log locked, and the other instances only read the
+ * records appended since they last read it (see readSince()).
+ *
+ * The log grows with every change, so it is compacted from time to time, i.e.
+ * replaced by a log with one record per entry, followed by the records appended
+ * while it was written (see compact()).
+ *
+ * The file starts with a header made of a magic string, a version number, an
+ * identifier of the log and the position in the previous log at which it was
+ * compacted. Each record is made of its type, the size of its payload, a checksum
+ * of the payload and the payload itself. Reading stops at the first truncated or
+ * damaged record, which can only be the result of a crash while appending it.
+ */
+class LIBKONQ_EXPORT KonqHistoryLog
+{
+public:
+    enum RecordType {
+        AddRecord = 1,      ///< a whole entry, replacing the existing entry with the same URL
+        RemoveRecord = 2,   ///< the URL of an entry to remove
+        TouchRecord = 3,    ///< the URL, visit count and last visit date of an entry visited again
+        ClearRecord = 4     ///< no payload: all entries are removed
+    };
+
+    struct Record {
+        RecordType type;
+        QByteArray payload;
+    };
+
+    /**
+     * A position in the log, after the records read or appended so far.
+     * A position stays valid when the log is compacted after it was reached.
+     */
+    struct Cursor {
+        Cursor() : logId(0), offset(0) {}
+        quint64 logId; ///< 0 if nothing was read yet
+        qint64 offset;
+    };
+
+    /**
+     * @param fileName the log file. By default, the one in the user's data directory
+     */
+    explicit KonqHistoryLog(const QString &fileName = defaultFileName());
+    ~KonqHistoryLog();
+
+    static QString defaultFileName();
+
+    static int logVersion();
+
+    QString fileName() const
+    {
+        return m_fileName;
+    }
+
+    /**
+     * Replays the log.
+     * @param entries filled with the resulting entries, sorted by date (oldest first)
+     * @param recordCount if not null, set to the number of records read
+     * @param cursor if not null, set to the end of the records read
+     * @return false if the log doesn't exist or isn't a history log
+     */
+    bool read(KonqHistoryList &entries, int *recordCount = nullptr, Cursor *cursor = nullptr) const;
+
+    /**
+     * Reads the records appended after @p cursor, and moves it after them.
+     * The log doesn't need to be locked.
+     * @return false if the records after @p cursor aren't available anymore, because
+     * the log was removed, or compacted before they were read. The whole log must
+     * then be read again.
+     */
+    bool readSince(Cursor &cursor, QVector<Record> &records) const;
+
+    /**
+     * Locks the log for appending records, waiting up to @p timeout milliseconds
+     * for other instances to unlock it.
+     */
+    bool lock(int timeout);
+    void unlock();
+
+    /**
+     * Appends a record to the log, creating it if needed. The log must be locked,
+     * and @p cursor must be at its end, i.e. readSince() must have been called
+     * since it was locked. @p cursor is moved after the new record.
+     * The payload is built by one of the payload functions below.
+     */
+    bool append(Cursor &cursor, RecordType type, const QByteArray &payload = QByteArray());
+
+    /**
+     * Replaces the log with one holding an AddRecord for each of @p entries.
+     * The log must be locked. It is replaced atomically: if this fails, the old log stays.
+     * @param cursor if not null, set to the end of the new log
+     */
+    bool rewrite(const KonqHistoryList &entries, Cursor *cursor = nullptr);
+
+    /**
+     * Compacts the log. The log is replayed and the result is written without
+     * locking it: it is only locked at the end, to copy the records appended
+     * in the meantime and replace the log.
+     * @return false if the log couldn't be compacted, e.g. because another
+     * instance compacted it in the meantime
+     */
+    bool compact();
+
+    static QByteArray addPayload(const KonqHistoryEntry &entry);
+    static QByteArray touchPayload(const KonqHistoryEntry &entry);
+    static QByteArray removePayload(const QUrl &url);
+
+    static KonqHistoryEntry entryFromPayload(const QByteArray &payload);
+    static void touchFromPayload(const QByteArray &payload, QUrl &url, quint32 &numberOfTimesVisited, QDateTime &lastVisited);
+    static QUrl urlFromPayload(const QByteArray &payload);
+
+private:
+    Q_DISABLE_COPY(KonqHistoryLog)
+
+    QString m_fileName;
+    QScopedPointer<QLockFile> m_lock;
+};
+
+Q_DECLARE_TYPEINFO(KonqHistoryLog::Record, Q_MOVABLE_TYPE);
+
+#endif /* KONQ_HISTORYLOG_H */
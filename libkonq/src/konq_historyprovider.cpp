@@ -24,18 +24,28 @@
 #include <kconfiggroup.h>
 #include <ksharedconfig.h>
 #include "konq_historyloader_p.h"
+#include "konq_historylog_p.h"
 #include <KSharedConfig>
 
 #include <QDBusConnection>
 #include <QDBusContext>
 #include <QDBusMessage>
-#include <QDataStream>
-#include <QDir>
 #include <QDebug>
-#include <QSaveFile>
-#include <QStandardPaths>
+#include <QFile>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
 
-#include <zlib.h> // for crc32
+// The history log is compacted once it has more than this many records, and at
+// least twice as many records as there are entries
+#define HISTORY_LOG_COMPACTION_THRESHOLD 1000
+
+// How long to wait for another instance to finish writing to the history log, in ms
+#define HISTORY_LOG_LOCK_TIMEOUT 2000
+
+// Number of entries added to KParts::HistoryProvider at a time, once the history is loaded
+#define HISTORY_PROVIDER_BATCH_SIZE 500
 
 class KonqHistoryProviderPrivate : public QObject, QDBusContext
 {
@@ -44,29 +54,147 @@ class KonqHistoryProviderPrivate : public QObject, QDBusContext
 public:
     KonqHistoryProviderPrivate(KonqHistoryProvider *qq);
 
+    ~KonqHistoryProviderPrivate() override;
+
     /**
      * Resizes the history list to contain less or equal than m_maxCount
      * entries. The first (oldest) entries are removed.
+     * @returns the URLs of the removed entries
+     */
+    QList<QUrl> adjustSize();
+
+    /**
+     * The URLs of an entry, as added to KParts::HistoryProvider
+     */
+    struct VisitedUrl {
+        QUrl url;
+        QString urlString;
+        QString prettyUrlString; // empty if the same as urlString
+    };
+
+    /**
+     * The history read by the loading thread
+     */
+    struct LoadedHistory {
+        LoadedHistory() : loaded(false), logRecordCount(0), legacy(false) {}
+
+        bool loaded;
+        KonqHistoryList entries;
+        int logRecordCount;
+        KonqHistoryLog::Cursor logCursor;
+        bool legacy;
+        QVector<VisitedUrl> visitedUrls;
+    };
+
+    /**
+     * Reads the history. Called from the loading thread.
+     */
+    static void readHistory(LoadedHistory &history);
+
+    /**
+     * Replaces the history with the history read by readHistory(), and applies
+     * what was logged and changed since.
+     */
+    void finishLoading(const LoadedHistory &history);
+
+    /**
+     * Removes all the entries, including the URLs not added to KParts::HistoryProvider yet.
+     */
+    void clearEntries();
+
+    /**
+     * A change of the history made by this instance
+     */
+    struct Change {
+        enum Type { Add, Remove, Clear };
+        Type type;
+        KonqHistoryEntry entry; // for Add
+        QList<QUrl> urls;       // for Remove
+    };
+
+    /**
+     * Queues a change of the history, to be applied and logged from the event loop.
+     * The changes are applied in the order they are queued.
+     */
+    void queueChange(const Change &change);
+
+    /**
+     * Logs the changes queued before the first addition, while the history
+     * isn't loaded. Removing entries doesn't depend on them, and the history
+     * KCM, for instance, never loads them.
+     */
+    void logChangesWithoutHistory();
+
+    /**
+     * Adds @p e to the history, or merges it with the existing entry for its URL,
+     * and logs the resulting entry. The log must be locked, see beginLogging().
+     */
+    void addEntry(const KonqHistoryEntry &e);
+
+    /**
+     * Locks the history log and applies the records logged by other instances,
+     * so that the records logged until endLogging() is called are based on
+     * the latest history.
      */
-    void adjustSize();
+    void beginLogging();
 
     /**
-     * Saves the entire history.
+     * Unlocks the history log, and lets the other instances know about the
+     * records logged since beginLogging() was called.
      */
-    bool saveHistory();
+    void endLogging();
+
+    /**
+     * Appends a record to the history log, between calls to beginLogging()
+     * and endLogging().
+     */
+    void logRecord(KonqHistoryLog::RecordType type, const QByteArray &payload = QByteArray());
+
+    /**
+     * Logs the removal of the entries for @p urls.
+     */
+    void logRemoved(const QList<QUrl> &urls);
+
+    /**
+     * Applies the records logged by other instances since the log was last read.
+     */
+    void readNewRecords();
+
+    /**
+     * Reads the whole history log again, when the records logged since the log
+     * was last read aren't available anymore.
+     */
+    void reloadHistory();
+
+    void applyRecord(const KonqHistoryLog::Record &record);
+
+    /**
+     * Sets the entry for the URL of @p entry, logged by another instance.
+     */
+    void applyEntry(const KonqHistoryEntry &entry);
+
+    /**
+     * Writes the history read from the file written by older versions to the log,
+     * unless another instance did it already.
+     */
+    void migrateLegacyHistory();
+
+    /**
+     * Compacts the history log in a worker thread.
+     */
+    void compactLog();
 
 Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.HistoryManager.xml
     friend class KonqHistoryProvider;
     /**
-     * Every konqueror instance broadcasts new history entries to the other
-     * konqueror instances. Those add the entry to their list, but don't
-     * save the list, because the sender saves the list.
+     * Every konqueror instance appends the changes it makes to the history
+     * log, and then tells the other konqueror instances, which read the
+     * new records from the log.
      *
-     * @param e the new history entry
-     * @param saveId is the dbus service of the sender so that
-     * only the sender saves the new history.
+     * @param logId the identifier of the log
+     * @param offset the end of the last record appended
      */
-    void notifyHistoryEntry(const QByteArray &historyEntry);
+    void notifyHistoryLogChanged(qulonglong logId, qlonglong offset);
 
     /**
      * Called when the configuration of the maximum count changed.
@@ -81,30 +209,36 @@ Q_SIGNALS: // DBUS methods/signals,  they have to match org.kde.Konqueror.Histor
     void notifyMaxAge(int days);
 
     /**
-     * Clears the history completely. Called via DBUS by some config-module
+     * Clears the history completely. Called via DBUS by some config-module.
+     * Konqueror instances log the changes they make instead.
      */
     void notifyClear();
 
     /**
      * Notifes about a url that has to be removed from the history.
-     * The sender instance has to save the history.
+     * Konqueror instances log the changes they make instead.
      */
     void notifyRemove(const QString &url);
 
     /**
      * Notifes about a list of urls that has to be removed from the history.
-     * The sender instance has to save the history.
+     * Konqueror instances log the changes they make instead.
      */
     void notifyRemoveList(const QStringList &urls);
 
 private Q_SLOTS: // connected to DBUS signals
-    void slotNotifyHistoryEntry(const QByteArray &historyEntry);
+    void slotNotifyHistoryLogChanged(qulonglong logId, qlonglong offset);
     void slotNotifyMaxCount(int count);
     void slotNotifyMaxAge(int days);
     void slotNotifyClear();
     void slotNotifyRemove(const QString &url);
     void slotNotifyRemoveList(const QStringList &urls);
 
+    void slotCompactionFinished();
+    void slotApplyChanges();
+    void slotHistoryLoaded();
+    void slotAddVisitedUrls();
+
 public:
     KSharedConfig::Ptr konqConfig()
     {
@@ -117,11 +251,99 @@ public:
     int m_maxCount;   // maximum of history entries
     int m_maxAgeDays; // maximum age of a history entry
     KonqHistoryProvider *q;
+
+    KonqHistoryLog m_log;
+    // The end of the records read from the log or appended to it
+    KonqHistoryLog::Cursor m_logCursor;
+    int m_logRecordCount;
+    bool m_logLocked;
+    bool m_logChanged;
+    // Whether the entry being added already existed with the same title and typed URL,
+    // in which case only its visit count and date need to be logged
+    bool m_addingVisitOnly;
+
+    // A single thread, so that the log isn't compacted twice at the same time.
+    // Its destructor waits for the compaction in progress, if any.
+    QThreadPool m_compactionPool;
+    bool m_compacting;
+
+    QList<Change> m_changes;
+
+    QThreadPool m_loadingPool;
+    bool m_loaded;
+    // Set by the loading thread
+    QMutex m_loadedHistoryMutex;
+    QScopedPointer<LoadedHistory> m_loadedHistory;
+    // The URLs still to be added to KParts::HistoryProvider
+    QVector<VisitedUrl> m_visitedUrls;
+    int m_visitedUrlsDone;
+    QTimer m_visitedUrlsTimer;
+};
+
+/**
+ * @internal
+ * Compacts the history log, away from the GUI thread.
+ */
+class KonqHistoryCompaction : public QRunnable
+{
+public:
+    KonqHistoryCompaction(KonqHistoryProviderPrivate *d)
+        : m_d(d), m_fileName(d->m_log.fileName())
+    {
+    }
+
+    void run() override
+    {
+        KonqHistoryLog(m_fileName).compact();
+        // The compaction pool is owned by m_d, which is still alive: its destructor
+        // waits for this to return. Should m_d be destroyed before the call is
+        // delivered, the call is simply discarded.
+        QMetaObject::invokeMethod(m_d, "slotCompactionFinished", Qt::QueuedConnection);
+    }
+
+private:
+    KonqHistoryProviderPrivate *m_d;
+    const QString m_fileName;
+};
+
+/**
+ * @internal
+ * Reads the history, away from the GUI thread.
+ */
+class KonqHistoryLoading : public QRunnable
+{
+public:
+    KonqHistoryLoading(KonqHistoryProviderPrivate *d)
+        : m_d(d)
+    {
+    }
+
+    void run() override
+    {
+        KonqHistoryProviderPrivate::LoadedHistory *history = new KonqHistoryProviderPrivate::LoadedHistory;
+        KonqHistoryProviderPrivate::readHistory(*history);
+        {
+            QMutexLocker locker(&m_d->m_loadedHistoryMutex);
+            m_d->m_loadedHistory.reset(history);
+        }
+        // As for KonqHistoryCompaction, m_d waits for this to return before being destroyed
+        QMetaObject::invokeMethod(m_d, "slotHistoryLoaded", Qt::QueuedConnection);
+    }
+
+private:
+    KonqHistoryProviderPrivate *m_d;
 };
 
 KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
-    : QObject(), QDBusContext(), q(qq)
+    : QObject(), QDBusContext(), q(qq), m_logRecordCount(0), m_logLocked(false), m_logChanged(false),
+      m_addingVisitOnly(false), m_compacting(false), m_loaded(false), m_visitedUrlsDone(0)
 {
+    m_compactionPool.setMaxThreadCount(1);
+    m_loadingPool.setMaxThreadCount(1);
+    m_visitedUrlsTimer.setSingleShot(true);
+    m_visitedUrlsTimer.setInterval(0);
+    connect(&m_visitedUrlsTimer, &QTimer::timeout, this, &KonqHistoryProviderPrivate::slotAddVisitedUrls);
+
     // defaults
     KConfigGroup cs(konqConfig(), "HistorySettings");
     m_maxCount = cs.readEntry("Maximum of History entries", 500);
@@ -134,13 +356,19 @@ KonqHistoryProviderPrivate::KonqHistoryProviderPrivate(KonqHistoryProvider *qq)
     QDBusConnection dbus = QDBusConnection::sessionBus();
     dbus.registerObject(dbusPath, this, QDBusConnection::ExportAllSignals);
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyClear"), this, SLOT(slotNotifyClear()));
-    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryEntry"), this, SLOT(slotNotifyHistoryEntry(QByteArray)));
+    dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyHistoryLogChanged"), this, SLOT(slotNotifyHistoryLogChanged(qulonglong,qlonglong)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxAge"), this, SLOT(slotNotifyMaxAge(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyMaxCount"), this, SLOT(slotNotifyMaxCount(int)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyRemove"), this, SLOT(slotNotifyRemove(QString)));
     dbus.connect(QString(), dbusPath, dbusInterface, QStringLiteral("notifyRemoveList"), this, SLOT(slotNotifyRemoveList(QStringList)));
 }
 
+KonqHistoryProviderPrivate::~KonqHistoryProviderPrivate()
+{
+    m_loadingPool.waitForDone();
+    m_compactionPool.waitForDone();
+}
+
 ////
 
 KonqHistoryProvider::KonqHistoryProvider(QObject *parent)
@@ -158,39 +386,143 @@ const KonqHistoryList &KonqHistoryProvider::entries() const
     return d->m_history;
 }
 
+void KonqHistoryProvider::startLoadingHistory()
+{
+    d->m_loadingPool.start(new KonqHistoryLoading(d));
+}
+
 bool KonqHistoryProvider::loadHistory()
 {
-    KonqHistoryLoader loader;
-    if (!loader.loadHistory()) {
-        return false;
+    // Don't let a load in progress replace this one
+    d->m_loadingPool.waitForDone();
+    {
+        QMutexLocker locker(&d->m_loadedHistoryMutex);
+        d->m_loadedHistory.reset();
     }
 
-    d->m_history = loader.entries();
+    KonqHistoryProviderPrivate::LoadedHistory history;
+    KonqHistoryProviderPrivate::readHistory(history);
+    d->finishLoading(history);
+    return history.loaded;
+}
 
-    d->adjustSize();
+bool KonqHistoryProvider::isHistoryLoaded() const
+{
+    return d->m_loaded;
+}
 
-    QListIterator<KonqHistoryEntry> it(d->m_history);
-    while (it.hasNext()) {
-        const KonqHistoryEntry &entry = it.next();
+void KonqHistoryProviderPrivate::readHistory(LoadedHistory &history)
+{
+    KonqHistoryLoader loader;
+    history.loaded = loader.loadHistory();
+    if (!history.loaded) {
+        return;
+    }
 
-        // Fill the entries into KParts::HistoryProvider.
-        const QString urlString = entry.url.url();
-        KParts::HistoryProvider::insert(urlString);
+    history.entries = loader.entries();
+    history.logRecordCount = loader.logRecordCount();
+    history.logCursor = loader.logCursor();
+    history.legacy = loader.isLegacyHistory();
+
+    // Converting the URLs to strings is what takes time, not adding them to the provider
+    history.visitedUrls.reserve(history.entries.count());
+    for (const KonqHistoryEntry &entry : qAsConst(history.entries)) {
+        VisitedUrl visitedUrl;
+        visitedUrl.url = entry.url;
+        visitedUrl.urlString = entry.url.url();
         // DF: also insert the "pretty" version if different
         // This helps getting 'visited' links on websites which don't use fully-escaped urls.
         const QString prettyUrlString = entry.url.toDisplayString();
-        if (urlString != prettyUrlString) {
-            KParts::HistoryProvider::insert(prettyUrlString);
+        if (visitedUrl.urlString != prettyUrlString) {
+            visitedUrl.prettyUrlString = prettyUrlString;
+        }
+        history.visitedUrls.append(visitedUrl);
+    }
+}
+
+void KonqHistoryProviderPrivate::finishLoading(const LoadedHistory &history)
+{
+    m_loaded = true;
+    // Keep the current history if there is none on disk
+    if (history.loaded) {
+        m_history = history.entries;
+        m_logRecordCount = history.logRecordCount;
+        m_logCursor = history.logCursor;
+    }
+
+    adjustSize();
+
+    if (history.legacy) {
+        migrateLegacyHistory();
+    } else if (history.loaded && m_logRecordCount > qMax(2 * m_history.count(), HISTORY_LOG_COMPACTION_THRESHOLD)) {
+        // Drop the records obsoleted since the log was last compacted
+        compactLog();
+    }
+
+    // Fill the entries into KParts::HistoryProvider, without blocking the event loop for long
+    m_visitedUrls = history.visitedUrls;
+    m_visitedUrlsDone = 0;
+    slotAddVisitedUrls();
+
+    emit q->historyLoaded();
+
+    // What was logged by other instances, and changed by this one, while loading
+    readNewRecords();
+    if (!m_changes.isEmpty()) {
+        slotApplyChanges();
+    }
+}
+
+void KonqHistoryProviderPrivate::slotHistoryLoaded()
+{
+    QScopedPointer<LoadedHistory> history;
+    {
+        QMutexLocker locker(&m_loadedHistoryMutex);
+        history.swap(m_loadedHistory);
+    }
+    // Already taken over by loadHistory()
+    if (history) {
+        finishLoading(*history);
+    }
+}
+
+void KonqHistoryProviderPrivate::slotAddVisitedUrls()
+{
+    const int end = qMin(m_visitedUrlsDone + HISTORY_PROVIDER_BATCH_SIZE, m_visitedUrls.count());
+    for (; m_visitedUrlsDone < end; ++m_visitedUrlsDone) {
+        const VisitedUrl &visitedUrl = m_visitedUrls.at(m_visitedUrlsDone);
+        // Removed in the meantime
+        if (m_history.constFindEntry(visitedUrl.url) == m_history.constEnd()) {
+            continue;
+        }
+        q->KParts::HistoryProvider::insert(visitedUrl.urlString);
+        if (!visitedUrl.prettyUrlString.isEmpty()) {
+            q->KParts::HistoryProvider::insert(visitedUrl.prettyUrlString);
         }
     }
 
-    return true;
+    if (m_visitedUrlsDone < m_visitedUrls.count()) {
+        m_visitedUrlsTimer.start();
+    } else {
+        m_visitedUrls.clear();
+        m_visitedUrlsDone = 0;
+    }
 }
 
-void KonqHistoryProviderPrivate::adjustSize()
+void KonqHistoryProviderPrivate::clearEntries()
 {
+    m_history.clear();
+    m_visitedUrls.clear();
+    m_visitedUrlsDone = 0;
+    m_visitedUrlsTimer.stop();
+    q->KParts::HistoryProvider::clear(); // also emits the cleared() signal
+}
+
+QList<QUrl> KonqHistoryProviderPrivate::adjustSize()
+{
+    QList<QUrl> removed;
     if (m_history.isEmpty()) {
-        return;
+        return removed;
     }
 
     KonqHistoryEntry entry = m_history.first();
@@ -198,6 +530,7 @@ void KonqHistoryProviderPrivate::adjustSize()
 
     while (m_history.count() > qint32(m_maxCount) ||
             (m_maxAgeDays > 0 && entry.lastVisited.isValid() && entry.lastVisited < expirationDate)) { // i.e. entry is expired
+        removed.append(entry.url);
         q->removeEntry(m_history.begin());
 
         if (m_history.isEmpty()) {
@@ -205,6 +538,184 @@ void KonqHistoryProviderPrivate::adjustSize()
         }
         entry = m_history.first();
     }
+    return removed;
+}
+
+void KonqHistoryProviderPrivate::beginLogging()
+{
+    m_logLocked = m_log.lock(HISTORY_LOG_LOCK_TIMEOUT);
+    if (!m_logLocked) {
+        qWarning() << "Can't lock" << m_log.fileName() << ", the history won't be saved";
+    }
+    m_logChanged = false;
+    readNewRecords();
+}
+
+void KonqHistoryProviderPrivate::endLogging()
+{
+    if (!m_logLocked) {
+        return;
+    }
+    m_log.unlock();
+    m_logLocked = false;
+
+    if (m_logChanged) {
+        m_logChanged = false;
+        emit notifyHistoryLogChanged(m_logCursor.logId, m_logCursor.offset);
+
+        // The instance which makes the log too large compacts it
+        if (!m_compacting && m_logRecordCount > qMax(2 * m_history.count(), HISTORY_LOG_COMPACTION_THRESHOLD)) {
+            compactLog();
+        }
+    }
+}
+
+void KonqHistoryProviderPrivate::logRecord(KonqHistoryLog::RecordType type, const QByteArray &payload)
+{
+    if (!m_logLocked) {
+        return;
+    }
+    if (m_log.append(m_logCursor, type, payload)) {
+        ++m_logRecordCount;
+        m_logChanged = true;
+    }
+}
+
+void KonqHistoryProviderPrivate::logRemoved(const QList<QUrl> &urls)
+{
+    for (const QUrl &url : urls) {
+        logRecord(KonqHistoryLog::RemoveRecord, KonqHistoryLog::removePayload(url));
+    }
+}
+
+void KonqHistoryProviderPrivate::readNewRecords()
+{
+    // Read once the history is loaded, from where the loading thread stopped
+    if (!m_loaded) {
+        return;
+    }
+    const quint64 logId = m_logCursor.logId;
+    QVector<KonqHistoryLog::Record> records;
+    if (!m_log.readSince(m_logCursor, records)) {
+        reloadHistory();
+        return;
+    }
+    if (m_logCursor.logId != logId) {
+        // Compacted since it was last read
+        m_logRecordCount = m_history.count();
+    }
+
+    for (const KonqHistoryLog::Record &record : qAsConst(records)) {
+        applyRecord(record);
+    }
+    m_logRecordCount += records.count();
+}
+
+void KonqHistoryProviderPrivate::reloadHistory()
+{
+    KonqHistoryList entries;
+    m_logCursor = KonqHistoryLog::Cursor();
+    if (!m_log.read(entries, &m_logRecordCount, &m_logCursor)) {
+        m_logRecordCount = 0;
+    }
+
+    // Only notify about the entries which changed
+    for (int i = m_history.count() - 1; i >= 0; --i) {
+        if (entries.constFindEntry(m_history.at(i).url) == entries.constEnd()) {
+            q->removeEntry(m_history.begin() + i);
+        }
+    }
+    for (const KonqHistoryEntry &entry : qAsConst(entries)) {
+        applyEntry(entry);
+    }
+}
+
+void KonqHistoryProviderPrivate::applyRecord(const KonqHistoryLog::Record &record)
+{
+    switch (record.type) {
+    case KonqHistoryLog::AddRecord:
+        applyEntry(KonqHistoryLog::entryFromPayload(record.payload));
+        break;
+    case KonqHistoryLog::TouchRecord: {
+        QUrl url;
+        quint32 numberOfTimesVisited;
+        QDateTime lastVisited;
+        KonqHistoryLog::touchFromPayload(record.payload, url, numberOfTimesVisited, lastVisited);
+        KonqHistoryList::const_iterator existingEntry = m_history.constFindEntry(url);
+        if (existingEntry != m_history.constEnd()) {
+            KonqHistoryEntry entry = *existingEntry;
+            entry.numberOfTimesVisited = numberOfTimesVisited;
+            entry.lastVisited = lastVisited;
+            applyEntry(entry);
+        }
+        break;
+    }
+    case KonqHistoryLog::RemoveRecord: {
+        KonqHistoryList::iterator existingEntry = m_history.findEntry(KonqHistoryLog::urlFromPayload(record.payload));
+        if (existingEntry != m_history.end()) {
+            q->removeEntry(existingEntry);
+        }
+        break;
+    }
+    case KonqHistoryLog::ClearRecord:
+        if (!m_history.isEmpty()) {
+            clearEntries();
+        }
+        break;
+    default:
+        // Written by a newer version
+        break;
+    }
+}
+
+void KonqHistoryProviderPrivate::applyEntry(const KonqHistoryEntry &entry)
+{
+    KonqHistoryList::iterator existingEntry = m_history.findEntry(entry.url);
+    if (existingEntry == m_history.end()) {
+        m_history.append(entry);
+        q->KParts::HistoryProvider::insert(entry.url.url());
+    } else if (*existingEntry == entry) {
+        return;
+    } else {
+        *m_history.moveToEnd(existingEntry) = entry;
+    }
+
+    // The entries expired by this one were removed from the log by the instance which added it
+    adjustSize();
+
+    q->finishAddingEntry(entry, false);
+
+    emit q->entryAdded(entry);
+}
+
+void KonqHistoryProviderPrivate::migrateLegacyHistory()
+{
+    if (!m_log.lock(HISTORY_LOG_LOCK_TIMEOUT)) {
+        return;
+    }
+    if (QFile::exists(m_log.fileName())) {
+        // Migrated by another instance since the history was loaded
+        readNewRecords();
+    } else if (m_log.rewrite(m_history, &m_logCursor)) {
+        m_logRecordCount = m_history.count();
+    }
+    m_log.unlock();
+}
+
+void KonqHistoryProviderPrivate::compactLog()
+{
+    if (m_compacting) {
+        return;
+    }
+    m_compacting = true;
+    m_compactionPool.start(new KonqHistoryCompaction(this));
+}
+
+void KonqHistoryProviderPrivate::slotCompactionFinished()
+{
+    m_compacting = false;
+    // Follow the cursor to the compacted log
+    readNewRecords();
 }
 
 static QString dbusService()
@@ -214,34 +725,34 @@ static QString dbusService()
 
 void KonqHistoryProvider::emitAddToHistory(const KonqHistoryEntry &entry)
 {
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-    entry.save(stream, KonqHistoryEntry::MarshalUrlAsStrings);
-    stream << dbusService();
     // Protection against very long urls (like data:)
-    if (data.size() > 4096) {
+    if (KonqHistoryLog::addPayload(entry).size() > 4096) {
         return;
     }
-    emit d->notifyHistoryEntry(data);
+    KonqHistoryProviderPrivate::Change change;
+    change.type = KonqHistoryProviderPrivate::Change::Add;
+    change.entry = entry;
+    d->queueChange(change);
 }
 
 void KonqHistoryProvider::emitRemoveFromHistory(const QUrl &url)
 {
-    emit d->notifyRemove(url.url());
+    emitRemoveListFromHistory(QList<QUrl>() << url);
 }
 
 void KonqHistoryProvider::emitRemoveListFromHistory(const QList<QUrl> &urls)
 {
-    QStringList result;
-    foreach (const QUrl &url, urls) {
-        result << url.url();
-    }
-    emit d->notifyRemoveList(result);
+    KonqHistoryProviderPrivate::Change change;
+    change.type = KonqHistoryProviderPrivate::Change::Remove;
+    change.urls = urls;
+    d->queueChange(change);
 }
 
 void KonqHistoryProvider::emitClear()
 {
-    emit d->notifyClear();
+    KonqHistoryProviderPrivate::Change change;
+    change.type = KonqHistoryProviderPrivate::Change::Clear;
+    d->queueChange(change);
 }
 
 void KonqHistoryProvider::emitSetMaxCount(int count)
@@ -262,18 +773,98 @@ static bool isSenderOfSignal(const QDBusMessage &msg)
     return dbusService() == msg.service();
 }
 
-void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
+void KonqHistoryProviderPrivate::queueChange(const Change &change)
 {
-    KonqHistoryEntry e;
-    QDataStream stream(const_cast<QByteArray *>(&data), QIODevice::ReadOnly);
+    m_changes.append(change);
+    if (m_changes.count() == 1) {
+        QMetaObject::invokeMethod(this, "slotApplyChanges", Qt::QueuedConnection);
+    }
+}
+
+void KonqHistoryProviderPrivate::slotApplyChanges()
+{
+    // The additions are applied once the history is loaded
+    if (!m_loaded) {
+        logChangesWithoutHistory();
+        return;
+    }
+    QList<Change> changes;
+    changes.swap(m_changes);
+
+    beginLogging();
+    for (const Change &change : qAsConst(changes)) {
+        switch (change.type) {
+        case Change::Add:
+            addEntry(change.entry);
+            break;
+        case Change::Remove: {
+            QList<QUrl> removed;
+            for (const QUrl &url : change.urls) {
+                KonqHistoryList::iterator existingEntry = m_history.findEntry(url);
+                if (existingEntry != m_history.end()) {
+                    q->removeEntry(existingEntry);
+                    removed.append(url);
+                }
+            }
+            logRemoved(removed);
+            break;
+        }
+        case Change::Clear:
+            // Unless another instance cleared it already
+            if (!m_history.isEmpty()) {
+                clearEntries();
+                logRecord(KonqHistoryLog::ClearRecord);
+            }
+            break;
+        }
+    }
+    endLogging();
+}
 
-    //This is important - we need to switch to a consistent marshalling format for
-    //communicating between different konqueror instances. Since during an upgrade
-    //some "old" copies may still running, we use the old format for the DBUS transfers.
-    //This doesn't make that much difference performance-wise for single entries anyway.
-    e.load(stream, KonqHistoryEntry::MarshalUrlAsStrings);
-    //kDebug(1202) << "Got new entry from Broadcast:" << e.url;
+void KonqHistoryProviderPrivate::logChangesWithoutHistory()
+{
+    int count = 0;
+    while (count < m_changes.count() && m_changes.at(count).type != Change::Add) {
+        ++count;
+    }
+    if (count == 0) {
+        return;
+    }
+    const QList<Change> changes = m_changes.mid(0, count);
+    m_changes.erase(m_changes.begin(), m_changes.begin() + count);
+
+    // Without a log, the history is still in the file written by older versions,
+    // which the instances that loaded it will migrate
+    const bool hasLog = QFile::exists(m_log.fileName());
+
+    beginLogging();
+    if (m_logLocked) {
+        // Only move to the end of the log, the records are applied when loading
+        QVector<KonqHistoryLog::Record> records;
+        if (!m_log.readSince(m_logCursor, records)) {
+            m_logCursor = KonqHistoryLog::Cursor();
+            m_log.readSince(m_logCursor, records);
+        }
+    }
+    for (const Change &change : changes) {
+        if (change.type == Change::Clear) {
+            clearEntries();
+            logRecord(KonqHistoryLog::ClearRecord);
+        } else if (hasLog) {
+            logRemoved(change.urls);
+        } else {
+            QStringList urls;
+            for (const QUrl &url : change.urls) {
+                urls.append(url.url());
+            }
+            emit notifyRemoveList(urls);
+        }
+    }
+    endLogging();
+}
 
+void KonqHistoryProviderPrivate::addEntry(const KonqHistoryEntry &e)
+{
     KonqHistoryList::iterator existingEntry = q->findEntry(e.url);
     QString urlString = e.url.url();
     const bool newEntry = existingEntry == m_history.end();
@@ -289,39 +880,57 @@ void KonqHistoryProviderPrivate::slotNotifyHistoryEntry(const QByteArray &data)
         q->KParts::HistoryProvider::insert(urlString);
     }
 
-    if (!e.typedUrl.isEmpty()) {
+    m_addingVisitOnly = !newEntry;
+    if (!e.typedUrl.isEmpty() && e.typedUrl != entry.typedUrl) {
         entry.typedUrl = e.typedUrl;
+        m_addingVisitOnly = false;
     }
-    if (!e.title.isEmpty()) {
+    if (!e.title.isEmpty() && e.title != entry.title) {
         entry.title = e.title;
+        m_addingVisitOnly = false;
     }
     entry.numberOfTimesVisited += e.numberOfTimesVisited;
     entry.lastVisited = e.lastVisited;
 
+    // Keep the list sorted by date, so that adjustSize() only has to look at its first entries
     if (newEntry) {
         m_history.append(entry);
     } else {
-        *existingEntry = entry;
+        *m_history.moveToEnd(existingEntry) = entry;
     }
 
-    adjustSize();
+    logRemoved(adjustSize());
 
-    q->finishAddingEntry(entry, isSenderOfSignal(message()));
+    q->finishAddingEntry(entry, true);
 
     emit q->entryAdded(entry);
 }
 
+void KonqHistoryProviderPrivate::slotNotifyHistoryLogChanged(qulonglong logId, qlonglong offset)
+{
+    if (logId == m_logCursor.logId && offset <= m_logCursor.offset) {
+        // Already read, or logged by this instance
+        return;
+    }
+    readNewRecords();
+}
+
 void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
 {
     m_maxCount = count;
+    const bool isSender = isSenderOfSignal(message());
+    if (isSender) {
+        beginLogging();
+    }
     // TODO clearPending();
-    adjustSize();
+    const QList<QUrl> removed = adjustSize();
 
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum of History entries", m_maxCount);
 
-    if (isSenderOfSignal(message())) {
-        saveHistory();
+    if (isSender) {
+        logRemoved(removed);
+        endLogging();
         cs.sync();
     }
 }
@@ -329,58 +938,48 @@ void KonqHistoryProviderPrivate::slotNotifyMaxCount(int count)
 void KonqHistoryProviderPrivate::slotNotifyMaxAge(int days)
 {
     m_maxAgeDays = days;
+    const bool isSender = isSenderOfSignal(message());
+    if (isSender) {
+        beginLogging();
+    }
     // TODO clearPending();
-    adjustSize();
+    const QList<QUrl> removed = adjustSize();
 
     KConfigGroup cs(konqConfig(), "HistorySettings");
     cs.writeEntry("Maximum age of History entries", m_maxAgeDays);
 
-    if (isSenderOfSignal(message())) {
-        saveHistory();
+    if (isSender) {
+        logRemoved(removed);
+        endLogging();
         cs.sync();
     }
 }
 
+// Sent by older versions, and for histories not migrated to the log yet. Each
+// instance logs the changes if another one didn't already.
 void KonqHistoryProviderPrivate::slotNotifyClear()
 {
-    m_history.clear();
-
-    if (isSenderOfSignal(message())) {
-        saveHistory();
+    if (m_loaded) {
+        q->emitClear();
     }
-
-    q->KParts::HistoryProvider::clear(); // also emits the cleared() signal
 }
 
 void KonqHistoryProviderPrivate::slotNotifyRemove(const QString &urlStr)
 {
-    QUrl url(urlStr);
-
-    KonqHistoryList::iterator existingEntry = q->findEntry(url);
-    if (existingEntry != m_history.end()) {
-        q->removeEntry(existingEntry);
-        if (isSenderOfSignal(message())) {
-            saveHistory();
-        }
-    }
+    slotNotifyRemoveList(QStringList() << urlStr);
 }
 
 void KonqHistoryProviderPrivate::slotNotifyRemoveList(const QStringList &urls)
 {
-    bool doSave = false;
-    QStringList::const_iterator it = urls.begin();
-    for (; it != urls.end(); ++it) {
-        QUrl url(*it);
-        KonqHistoryList::iterator existingEntry = m_history.findEntry(url);
-        if (existingEntry != m_history.end()) {
-            q->removeEntry(existingEntry);
-            doSave = true;
-        }
+    if (!m_loaded) {
+        return;
     }
-
-    if (doSave && isSenderOfSignal(message())) {
-        saveHistory();
+    Change change;
+    change.type = Change::Remove;
+    for (const QString &url : urls) {
+        change.urls.append(QUrl(url));
     }
+    queueChange(change);
 }
 
 void KonqHistoryProvider::removeEntry(KonqHistoryList::iterator existingEntry)
@@ -404,60 +1003,25 @@ int KonqHistoryProvider::maxAge() const
     return d->m_maxAgeDays;
 }
 
-bool KonqHistoryProviderPrivate::saveHistory()
-{
-    const QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + QLatin1String("/konqueror");
-    QDir().mkpath(dir);
-    const QString filename = dir + QLatin1String("/konq_history");
-    QSaveFile file(filename);
-    if (!file.open(QIODevice::WriteOnly)) {
-        qWarning() << "Can't open" << file.fileName() << "for saving history";
-        return false;
-    }
-
-    QDataStream fileStream(&file);
-    fileStream << KonqHistoryLoader::historyVersion();
-
-    QByteArray data;
-    QDataStream stream(&data, QIODevice::WriteOnly);
-
-    QListIterator<KonqHistoryEntry> it(m_history);
-    while (it.hasNext()) {
-        //We use QUrl for marshalling URLs in entries in the V4
-        //file format
-        it.next().save(stream, KonqHistoryEntry::NoFlags);
-    }
-
-    quint32 crc = crc32(0, reinterpret_cast<unsigned char *>(data.data()), data.size());
-    fileStream << crc << data;
-
-    return file.commit();
-}
-
 KonqHistoryList::iterator KonqHistoryProvider::findEntry(const QUrl &url)
 {
-    // small optimization (dict lookup) for items _not_ in our history
-    if (!KParts::HistoryProvider::contains(url.url())) {
-        return d->m_history.end();
-    }
     return d->m_history.findEntry(url);
 }
 
 KonqHistoryList::const_iterator KonqHistoryProvider::constFindEntry(const QUrl &url) const
 {
-    // small optimization (dict lookup) for items _not_ in our history
-    if (!KParts::HistoryProvider::contains(url.url())) {
-        return d->m_history.constEnd();
-    }
     return d->m_history.constFindEntry(url);
 }
 
 void KonqHistoryProvider::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
-    Q_UNUSED(entry); // this arg is used by konq's reimplementation
     if (isSender) {
         // we are the sender of the broadcast, so we save
-        d->saveHistory();
+        if (d->m_addingVisitOnly) {
+            d->logRecord(KonqHistoryLog::TouchRecord, KonqHistoryLog::touchPayload(entry));
+        } else {
+            d->logRecord(KonqHistoryLog::AddRecord, KonqHistoryLog::addPayload(entry));
+        }
     }
 }
 
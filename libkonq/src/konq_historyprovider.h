@@ -93,34 +93,49 @@ public:
     void emitSetMaxAge(int days);
 
     /**
-     * Removes the history entry for @p url, if existent. Tells all other
-     * Konqueror instances via D-Bus to do the same.
-     *
-     * The history is saved after receiving the D-Bus call.
+     * Removes the history entry for @p url, if existent, from the event loop.
+     * The removal is logged, and all other Konqueror instances are told
+     * via D-Bus to read it from the log.
      */
     void emitRemoveFromHistory(const QUrl &url);
 
     /**
-     * Removes the history entries for the given list of @p urls. Tells all
-     * other Konqueror instances via D-Bus to do the same.
-     *
-     * The history is saved after receiving the D-Bus call.
+     * Removes the history entries for the given list of @p urls, from the
+     * event loop, like emitRemoveFromHistory().
      */
     void emitRemoveListFromHistory(const QList<QUrl> &urls);
 
     /**
-     * Clears the history and tells all other Konqueror instances via D-Bus
-     * to do the same.
-     * The history is saved afterwards, if necessary.
+     * Clears the history from the event loop, like emitRemoveFromHistory().
      */
     void emitClear();
 
     /**
-     * Load the whole history from disk. Call this exactly once.
+     * Loads the whole history from disk, in a worker thread.
+     * historyLoaded() is emitted once the history is available. The URLs of
+     * the entries are then added to KParts::HistoryProvider a few at a time,
+     * from the event loop.
+     *
+     * The changes made in the meantime are applied once the history is loaded.
+     */
+    void startLoadingHistory();
+
+    /**
+     * Loads the whole history from disk, and waits for it to be loaded.
      */
     bool loadHistory();
 
+    /**
+     * @returns whether the history was loaded, i.e. entries() holds the history
+     */
+    bool isHistoryLoaded() const;
+
 Q_SIGNALS:
+    /**
+     * Emitted once the history was loaded, when entries() holds the whole history
+     */
+    void historyLoaded();
+
     /**
      * Emitted after a new entry was added
      */
@@ -139,16 +154,15 @@ protected: // only to be used by konqueror's KonqHistoryManager
     virtual void removeEntry(KonqHistoryList::iterator it);
 
     /**
-     * a little optimization for KonqHistoryList::findEntry(),
-     * checking the dict of KParts::HistoryProvider before traversing the list.
-     * Can't be used everywhere, because it always returns end() for "pending"
-     * entries, as those are not added to the dict, currently.
+     * Finds an entry of the history by URL, see KonqHistoryList::findEntry().
      */
     KonqHistoryList::iterator findEntry(const QUrl &url);
     KonqHistoryList::const_iterator constFindEntry(const QUrl &url) const;
 
     /**
-     * Notifies all running instances about a new HistoryEntry via D-Bus.
+     * Adds a new HistoryEntry to the history from the event loop. The entry is
+     * logged, and all running instances are notified via D-Bus so that they
+     * read it from the log.
      */
     void emitAddToHistory(const KonqHistoryEntry &entry);
 
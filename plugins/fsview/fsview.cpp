@@ -583,7 +583,8 @@ void FSView::doUpdate()
     }
 
     if (_sm.scanRunning()) {
-        QTimer::singleShot(0, this, SLOT(doUpdate()));
+        // Don't spin while the scanner threads are still reading directories
+        QTimer::singleShot(_sm.hasScanResults() ? 0 : 10, this, SLOT(doUpdate()));
     } else {
         emit completed(_dirsFinished);
     }
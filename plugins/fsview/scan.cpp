@@ -18,26 +18,170 @@
 
 #include "scan.h"
 
-#include <QDir>
 #include <QStringList>
 #include <QSet>
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
 #include <qplatformdefs.h>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <kdebug.h>
 #include <kauthorized.h>
 #include <kurlauthorized.h>
 
 #include "inode.h"
 
+// ScanResult, ScanQueue, ScanTask
+
+/* The items of a directory, as read by a scanner thread */
+struct ScanResult {
+    ScanItem *item;
+    int generation;
+    ScanFileVector files;
+    KIO::fileoffset_t fileSize;
+    QStringList dirs;
+};
+
+/* Where the scanner threads put the directories they read */
+class ScanQueue
+{
+public:
+    void post(const ScanResult &result)
+    {
+        QMutexLocker locker(&_mutex);
+        _results.append(result);
+    }
+
+    /* Take all the results, without waiting: the GUI thread must not block
+     * while the scanner threads read big directories */
+    QList<ScanResult> tryTake()
+    {
+        QMutexLocker locker(&_mutex);
+        QList<ScanResult> results;
+        results.swap(_results);
+        return results;
+    }
+
+    bool hasResults() const
+    {
+        QMutexLocker locker(&_mutex);
+        return !_results.isEmpty();
+    }
+
+    /* incremented when a scan is stopped: results of older scans are dropped */
+    QAtomicInt generation;
+
+private:
+    mutable QMutex _mutex;
+    QList<ScanResult> _results;
+};
+
+/* Read a directory in one pass over its entries, stat'ing them
+ * relative to the directory. Symbolic links are skipped.
+ */
+static void readDirectory(const QByteArray &path, ScanResult &result)
+{
+    const int fd = ::open(path.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        ::close(fd);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+#ifdef DT_DIR
+        // Most filesystems give the type, saving a stat for directories
+        if (entry->d_type == DT_DIR) {
+            result.dirs.append(QFile::decodeName(name));
+            continue;
+        }
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+#endif
+        struct stat buff;
+        if (fstatat(fd, name, &buff, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        if (S_ISDIR(buff.st_mode)) {
+            result.dirs.append(QFile::decodeName(name));
+        } else if (S_ISREG(buff.st_mode)) {
+            result.files.append(ScanFile(QFile::decodeName(name), buff.st_size));
+            result.fileSize += buff.st_size;
+        }
+    }
+    closedir(dir);
+}
+
+class ScanTask : public QRunnable
+{
+public:
+    ScanTask(const QSharedPointer<ScanQueue> &queue, ScanItem *item, int generation)
+        : _queue(queue)
+        , _item(item)
+        , _path(QFile::encodeName(item->absPath))
+        , _generation(generation)
+    {
+    }
+
+    void run() override
+    {
+        if (_queue->generation.load() != _generation) {
+            return; // scan was stopped meanwhile
+        }
+
+        ScanResult result;
+        result.item = _item;
+        result.generation = _generation;
+        result.fileSize = 0;
+        readDirectory(_path, result);
+        _queue->post(result);
+    }
+
+private:
+    QSharedPointer<ScanQueue> _queue;
+    ScanItem *_item;
+    QByteArray _path;
+    int _generation;
+};
+
+static QThreadPool *scanThreadPool()
+{
+    static QThreadPool *pool = nullptr;
+
+    if (!pool) {
+        pool = new QThreadPool;
+        // reading directories mostly waits for the disk
+        pool->setMaxThreadCount(qMax(4, 2 * QThread::idealThreadCount()));
+    }
+    return pool;
+}
+
 // ScanManager
 
 ScanManager::ScanManager()
+    : _queue(new ScanQueue)
 {
     _topDir = nullptr;
     _listener = nullptr;
 }
 
 ScanManager::ScanManager(const QString &path)
+    : _queue(new ScanQueue)
 {
     _topDir = nullptr;
     _listener = nullptr;
@@ -74,7 +218,7 @@ bool ScanManager::scanRunning()
         return false;
     }
 
-    return _topDir->scanRunning();
+    return !_running.isEmpty() || _topDir->scanRunning();
 }
 
 void ScanManager::startScan(ScanDir *from)
@@ -105,8 +249,13 @@ void ScanManager::stopScan()
     }
 
     if (0) kDebug(90100) << "ScanManager::stopScan, scanLength "
-                             << _list.count() << endl;
+                             << scanLength() << endl;
+
+    /* the scanner threads drop what they still have to read */
+    _queue->generation.ref();
 
+    _list += _running;
+    _running.clear();
     while (!_list.isEmpty()) {
         ScanItem *si = _list.takeFirst();
         si->dir->finish();
@@ -114,15 +263,41 @@ void ScanManager::stopScan()
     }
 }
 
+bool ScanManager::hasScanResults() const
+{
+    return _queue->hasResults();
+}
+
 int ScanManager::scan(int data)
 {
-    if (_list.isEmpty()) {
-        return false;
+    const int generation = _queue->generation.load();
+    const int maxRunning = 4 * scanThreadPool()->maxThreadCount();
+
+    while (!_list.isEmpty() && _running.count() < maxRunning) {
+        ScanItem *si = _list.takeFirst();
+        if (!si->dir->startScan(si)) {
+            delete si;
+            continue;
+        }
+        _running.append(si);
+        scanThreadPool()->start(new ScanTask(_queue, si, generation));
     }
-    ScanItem *si = _list.takeFirst();
 
-    int newCount = si->dir->scan(si, _list, data);
-    delete si;
+    if (_running.isEmpty()) {
+        return 0;
+    }
+
+    int newCount = 0;
+    const QList<ScanResult> results = _queue->tryTake();
+    for (const ScanResult &result : results) {
+        if (result.generation != generation) {
+            continue;
+        }
+        ScanItem *si = result.item;
+        _running.removeOne(si);
+        newCount += si->dir->setScanResult(si, result, _list, data);
+        delete si;
+    }
 
     return newCount;
 }
@@ -255,57 +430,39 @@ bool ScanDir::isForbiddenDir(QString &d)
     return (s->contains(d));
 }
 
-int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+bool ScanDir::startScan(ScanItem *si)
 {
+    if (!isForbiddenDir(si->absPath) &&
+            KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), QUrl(),
+                                               QUrl::fromLocalFile(si->absPath))) {
+        return true;
+    }
+
     clear();
     _dirsFinished = 0;
     _fileSize = 0;
     _dirty = true;
 
-    if (isForbiddenDir(si->absPath)) {
-        if (_parent) {
-            _parent->subScanFinished();
-        }
-        return 0;
-    }
-
-    QUrl u = QUrl::fromLocalFile(si->absPath);
-    if (!KUrlAuthorized::authorizeUrlAction(QStringLiteral("list"), QUrl(), u)) {
-        if (_parent) {
-            _parent->subScanFinished();
-        }
-
-        return 0;
-    }
-
-    QDir d(si->absPath);
-    const QStringList fileList = d.entryList(QDir::Files |
-                                 QDir::Hidden | QDir::NoSymLinks);
-
-    if (fileList.count() > 0) {
-        QT_STATBUF buff;
-
-        _files.reserve(fileList.count());
-
-        QStringList::ConstIterator it;
-        for (it = fileList.constBegin(); it != fileList.constEnd(); ++it) {
-            QString tmp(si->absPath + QLatin1Char('/') + (*it));
-            if (QT_LSTAT(tmp.toStdString().c_str(), &buff) != 0) {
-                continue;
-            }
-            _files.append(ScanFile(*it, buff.st_size));
-            _fileSize += buff.st_size;
-        }
+    if (_parent) {
+        _parent->subScanFinished();
     }
+    return false;
+}
 
-    const QStringList dirList = d.entryList(QDir::Dirs |
-                                            QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+int ScanDir::setScanResult(ScanItem *si, const ScanResult &result,
+                           ScanItemList &list, int data)
+{
+    clear();
+    _dirsFinished = 0;
+    _files = result.files;
+    _fileSize = result.fileSize;
+    _dirty = true;
 
-    if (dirList.count() > 0) {
-        _dirs.reserve(dirList.count());
+    if (result.dirs.count() > 0) {
+        _dirs.reserve(result.dirs.count());
 
         QStringList::ConstIterator it;
-        for (it = dirList.constBegin(); it != dirList.constEnd(); ++it) {
+        for (it = result.dirs.constBegin(); it != result.dirs.constEnd(); ++it) {
             _dirs.append(ScanDir(*it, _manager, this, data));
             QString newpath = si->absPath;
             if (!newpath.endsWith(QChar('/'))) {
@@ -25,10 +25,13 @@
 
 #include <qfile.h>
 #include <QVector>
+#include <QSharedPointer>
 #include <kio/global.h>
 
 class ScanDir;
 class ScanFile;
+class ScanQueue;
+struct ScanResult;
 
 class ScanItem
 {
@@ -70,7 +73,9 @@ public:
 /**
  * ScanManager
  *
- * Start/Stop/Restart Scans. Example:
+ * Start/Stop/Restart Scans. The directories are read by a pool of
+ * scanner threads, the results are applied and the listeners called
+ * in the thread calling scan(). Example:
  *
  *   ScanManager m("/opt");
  *   m.startScan();
@@ -95,7 +100,7 @@ public:
     bool scanRunning();
     int scanLength() const
     {
-        return _list.count();
+        return _list.count() + _running.count();
     }
 
     /**
@@ -114,7 +119,16 @@ public:
     void stopScan();
 
     /**
-     * Scan first directory from todo list.
+     * Whether the scanner threads read directories which scan() didn't
+     * apply yet.
+     */
+    bool hasScanResults() const;
+
+    /**
+     * Hand the first directories from the todo list to the scanner
+     * threads, then apply the directories read since the last call.
+     * This doesn't wait for the scanner threads: if they didn't read
+     * any directory yet, call scan() again later.
      * Directories added to the todo list are attributed with data.
      * Returns the number of new subdirectories created for scanning.
      */
@@ -129,6 +143,8 @@ public:
 
 private:
     ScanItemList _list;
+    ScanItemList _running; /* being read by the scanner threads */
+    QSharedPointer<ScanQueue> _queue;
     ScanDir *_topDir;
     ScanListener *_listener;
 };
@@ -181,13 +197,19 @@ public:
             ScanDir *p = nullptr, int data = 0);
     ~ScanDir();
 
-    /* Get items of this directory
+    /* Check whether this directory may be read.
+     * If not, its scan is finished right away.
+     */
+    bool startScan(ScanItem *si);
+
+    /* Set the items of this directory read by a scanner thread
      * and append subdirectories to todo list.
      *
      * Directories added to the todo list are attributed with data.
      * Returns the number of new subdirectories created for scanning.
      */
-    int scan(ScanItem *si, ScanItemList &list, int data);
+    int setScanResult(ScanItem *si, const ScanResult &result,
+                      ScanItemList &list, int data);
 
     /* clear scan objects below */
     void clear();
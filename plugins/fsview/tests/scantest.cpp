@@ -22,6 +22,8 @@
 
 #include "scan.h"
 
+#include <QThread>
+
 class MyListener: public ScanListener
 {
 public:
@@ -53,5 +55,10 @@ int main(int argc, char *argv[])
 
     m.setListener(new MyListener());
     m.startScan();
-    while (m.scan(1));
+    while (m.scanRunning()) {
+        m.scan(1);
+        if (!m.hasScanResults()) {
+            QThread::msleep(10);
+        }
+    }
 }
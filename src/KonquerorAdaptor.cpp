@@ -133,6 +133,16 @@ QStringList KonquerorAdaptor::urls() const
     return lst;
 }
 
+int KonquerorAdaptor::webEngineFastPathCount() const
+{
+    return KonqMainWindow::webEngineFastPathCount();
+}
+
+int KonquerorAdaptor::webEngineFastPathFallbackCount() const
+{
+    return KonqMainWindow::webEngineFastPathFallbackCount();
+}
+
 QDBusObjectPath KonquerorAdaptor::windowForTab()
 {
     QList<KonqMainWindow *> *mainWindows = KonqMainWindow::mainWindowList();
@@ -79,6 +79,17 @@ public slots:
      */
     QStringList urls() const;
 
+    /**
+     * @return how many http(s) URLs were opened in a WebEngine view without
+     * finding out their mimetype first
+     */
+    int webEngineFastPathCount() const;
+
+    /**
+     * @return how many of those URLs WebEngine couldn't show, and were fetched again
+     */
+    int webEngineFastPathFallbackCount() const;
+
     /**
      * Find a window which can be used for a new tab. Called by kfmclient.
      */
@@ -90,6 +90,7 @@ KonqMostOftenURLSAction::KonqMostOftenURLSAction(const QString &text,
 
     connect(menu(), SIGNAL(aboutToShow()), SLOT(slotFillMenu()));
     connect(menu(), SIGNAL(triggered(QAction*)), SLOT(slotActivated(QAction*)));
+    connect(KonqHistoryManager::kself(), SIGNAL(historyLoaded()), SLOT(slotHistoryLoaded()));
     // Need to do all this upfront for a correct initial state
     init();
 }
@@ -117,15 +118,17 @@ void KonqMostOftenURLSAction::inSort(const KonqHistoryEntry &entry)
     s_mostEntries->insert(it, entry);
 }
 
-void KonqMostOftenURLSAction::parseHistory() // only ever called once
+void KonqMostOftenURLSAction::parseHistory() // called again once the history is loaded
 {
     KonqHistoryManager *mgr = KonqHistoryManager::kself();
 
     connect(mgr, SIGNAL(entryAdded(KonqHistoryEntry)),
-            SLOT(slotEntryAdded(KonqHistoryEntry)));
+            SLOT(slotEntryAdded(KonqHistoryEntry)), Qt::UniqueConnection);
     connect(mgr, SIGNAL(entryRemoved(KonqHistoryEntry)),
-            SLOT(slotEntryRemoved(KonqHistoryEntry)));
-    connect(mgr, SIGNAL(cleared()), SLOT(slotHistoryCleared()));
+            SLOT(slotEntryRemoved(KonqHistoryEntry)), Qt::UniqueConnection);
+    connect(mgr, SIGNAL(cleared()), SLOT(slotHistoryCleared()), Qt::UniqueConnection);
+
+    s_mostEntries->clear();
 
     const KonqHistoryList mgrEntries = mgr->entries();
     KonqHistoryList::const_iterator it = mgrEntries.begin();
@@ -172,6 +175,14 @@ void KonqMostOftenURLSAction::slotEntryRemoved(const KonqHistoryEntry &entry)
     setEnabled(!s_mostEntries->isEmpty());
 }
 
+void KonqMostOftenURLSAction::slotHistoryLoaded()
+{
+    init();
+    if (m_parsingDone) {
+        parseHistory();
+    }
+}
+
 void KonqMostOftenURLSAction::slotHistoryCleared()
 {
     s_mostEntries->clear();
@@ -220,6 +231,7 @@ KonqHistoryAction::KonqHistoryAction(const QString &text, QObject *parent)
     setDelayed(false);
     connect(menu(), SIGNAL(aboutToShow()), SLOT(slotFillMenu()));
     connect(menu(), SIGNAL(triggered(QAction*)), SLOT(slotActivated(QAction*)));
+    connect(KonqHistoryManager::kself(), SIGNAL(historyLoaded()), SLOT(slotHistoryLoaded()));
     setEnabled(!KonqHistoryManager::kself()->entries().isEmpty());
 }
 
@@ -243,6 +255,11 @@ void KonqHistoryAction::slotFillMenu()
     }
 }
 
+void KonqHistoryAction::slotHistoryLoaded()
+{
+    setEnabled(!KonqHistoryManager::kself()->entries().isEmpty());
+}
+
 void KonqHistoryAction::slotActivated(QAction *action)
 {
     emit activated(action->data().value<QUrl>());
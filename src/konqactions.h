@@ -83,6 +83,7 @@ Q_SIGNALS:
     void activated(const QUrl &);
 
 private Q_SLOTS:
+    void slotHistoryLoaded();
     void slotHistoryCleared();
     void slotEntryAdded(const KonqHistoryEntry &entry);
     void slotEntryRemoved(const KonqHistoryEntry &entry);
@@ -111,6 +112,7 @@ Q_SIGNALS:
     void activated(const QUrl &);
 
 private Q_SLOTS:
+    void slotHistoryLoaded();
     void slotFillMenu();
     void slotActivated(QAction *action);
 };
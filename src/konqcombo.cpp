@@ -157,6 +157,8 @@ KonqCombo::KonqCombo(QWidget *parent)
     slotCompletionModeChanged(completionMode());
 
     connect(KonqHistoryManager::kself(), SIGNAL(cleared()), SLOT(slotCleared()));
+    // The items are usually loaded before the history, which has their titles
+    connect(KonqHistoryManager::kself(), SIGNAL(historyLoaded()), SLOT(slotHistoryLoaded()));
     connect(this, &KonqCombo::cleared, this, &KonqCombo::slotCleared);
     connect(this, static_cast<void (KonqCombo::*)(int)>(&KonqCombo::highlighted), this, &KonqCombo::slotSetIcon);
 
@@ -546,6 +548,18 @@ void KonqCombo::slotCleared()
     QDBusConnection::sessionBus().send(message);
 }
 
+void KonqCombo::slotHistoryLoaded()
+{
+    for (int i = 0; i < count(); i++) {
+        if (itemData(i).toString().isEmpty()) {
+            const QString title = titleOfURL(itemText(i));
+            if (!title.isEmpty()) {
+                setItemData(i, title);
+            }
+        }
+    }
+}
+
 void KonqCombo::removeURL(const QString &url)
 {
     setUpdatesEnabled(false);
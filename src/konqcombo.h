@@ -87,6 +87,7 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     void slotCleared();
+    void slotHistoryLoaded();
     void slotSetIcon(int index);
     void slotActivated(const QString &text);
     void slotTextEdited(const QString &text);
@@ -0,0 +1,396 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konqcompletionindex.h"
+
+#include <QDateTime>
+
+#include <algorithm>
+#include <cmath>
+
+// The time it takes for the weight of an item to halve, in seconds
+#define COMPLETION_HALF_LIFE (30 * 24 * 3600)
+
+// When more than this many times maxCount items match, they're gone through
+// by rank instead, which stops at the maxCount-th match
+#define COMPLETION_WALK_FACTOR 8
+
+// The rank is the logarithm of the weight at an arbitrary date: since
+//   weight * 2^(-(now - lastUsed) / halfLife) = weight * 2^(lastUsed / halfLife) / 2^(now / halfLife)
+// the order of the items is the same whatever the date.
+static double rankOf(int weight, qint64 lastUsed)
+{
+    static const double decay = std::log(2.0) / COMPLETION_HALF_LIFE;
+    return std::log(double(qMax(weight, 1))) + lastUsed * decay;
+}
+
+KonqCompletionIndex::KonqCompletionIndex()
+{
+}
+
+KonqCompletionIndex::~KonqCompletionIndex()
+{
+}
+
+QString KonqCompletionIndex::normalized(const QString &text)
+{
+    static const char *const prefixes[] = {
+        "http://",
+        "https://",
+        "ftp://",
+        "file://",
+        "file:",
+        nullptr
+    };
+
+    QString key = text.toLower();
+    for (const char *const *prefix = prefixes; *prefix != nullptr; ++prefix) {
+        if (key.startsWith(QLatin1String(*prefix))) {
+            key.remove(0, qstrlen(*prefix));
+            break;
+        }
+    }
+    if (key.startsWith(QLatin1String("www."))) {
+        key.remove(0, 4);
+    }
+    if (key.length() > 1 && key.endsWith(QLatin1Char('/'))) {
+        key.chop(1);
+    }
+    return key;
+}
+
+QStringList KonqCompletionIndex::words(const QString &key)
+{
+    QStringList result;
+    int start = -1;
+    for (int i = 0; i <= key.length(); ++i) {
+        const bool inWord = i < key.length() && key.at(i).isLetterOrNumber();
+        if (inWord && start < 0) {
+            start = i;
+        } else if (!inWord && start >= 0) {
+            result.append(key.mid(start, i - start));
+            start = -1;
+        }
+    }
+    result.removeDuplicates();
+    return result;
+}
+
+int KonqCompletionIndex::itemFor(const QString &key)
+{
+    QMap<QString, int>::const_iterator it = m_itemsByKey.constFind(key);
+    if (it != m_itemsByKey.constEnd()) {
+        return it.value();
+    }
+
+    int id;
+    if (m_freeItems.isEmpty()) {
+        id = m_items.count();
+        m_items.append(Item());
+    } else {
+        id = m_freeItems.takeLast();
+    }
+    Item &item = m_items[id];
+    item.key = key;
+    item.best = -1;
+    item.rank = 0;
+
+    m_itemsByKey.insert(key, id);
+    const QStringList keyWords = words(key);
+    for (const QString &word : keyWords) {
+        m_itemsByWord[word].append(id);
+    }
+    return id;
+}
+
+void KonqCompletionIndex::addItem(const QString &text, int weight, const QDateTime &lastUsed)
+{
+    if (text.isEmpty()) {
+        return;
+    }
+
+    int id = m_itemsByText.value(text, -1);
+    if (id < 0) {
+        const QString key = normalized(text);
+        if (key.isEmpty()) {
+            return;
+        }
+        id = itemFor(key);
+        m_itemsByText.insert(text, id);
+
+        Variant variant;
+        variant.text = text;
+        variant.weight = 0;
+        variant.lastUsed = 0;
+        variant.rank = 0;
+        m_items[id].variants.append(variant);
+    }
+
+    Item &item = m_items[id];
+    for (Variant &variant : item.variants) {
+        if (variant.text == text) {
+            variant.weight += weight;
+            if (lastUsed.isValid()) {
+                variant.lastUsed = qMax(variant.lastUsed, lastUsed.toMSecsSinceEpoch() / 1000);
+            }
+            variant.rank = rankOf(variant.weight, variant.lastUsed);
+            break;
+        }
+    }
+    updateRank(id);
+}
+
+void KonqCompletionIndex::removeItem(const QString &text)
+{
+    QHash<QString, int>::iterator it = m_itemsByText.find(text);
+    if (it == m_itemsByText.end()) {
+        return;
+    }
+    const int id = it.value();
+    m_itemsByText.erase(it);
+
+    Item &item = m_items[id];
+    for (int i = 0; i < item.variants.count(); ++i) {
+        if (item.variants.at(i).text == text) {
+            item.variants.remove(i);
+            break;
+        }
+    }
+    if (item.variants.isEmpty()) {
+        removeItemAt(id);
+    } else {
+        updateRank(id);
+    }
+}
+
+void KonqCompletionIndex::removeItemAt(int id)
+{
+    Item &item = m_items[id];
+    if (item.best >= 0) {
+        m_itemsByRank.remove(RankKey(-item.rank, item.key));
+    }
+    m_itemsByKey.remove(item.key);
+    const QStringList keyWords = words(item.key);
+    for (const QString &word : keyWords) {
+        QMap<QString, QVector<int> >::iterator it = m_itemsByWord.find(word);
+        if (it != m_itemsByWord.end()) {
+            it.value().removeOne(id);
+            if (it.value().isEmpty()) {
+                m_itemsByWord.erase(it);
+            }
+        }
+    }
+    item.key.clear();
+    item.variants.clear();
+    m_freeItems.append(id);
+}
+
+void KonqCompletionIndex::clear()
+{
+    m_items.clear();
+    m_freeItems.clear();
+    m_itemsByText.clear();
+    m_itemsByKey.clear();
+    m_itemsByWord.clear();
+    m_itemsByRank.clear();
+}
+
+int KonqCompletionIndex::count() const
+{
+    return m_itemsByKey.count();
+}
+
+void KonqCompletionIndex::updateRank(int id)
+{
+    Item &item = m_items[id];
+    if (item.best >= 0) {
+        m_itemsByRank.remove(RankKey(-item.rank, item.key));
+    }
+    item.best = 0;
+    for (int i = 1; i < item.variants.count(); ++i) {
+        if (item.variants.at(i).rank > item.variants.at(item.best).rank) {
+            item.best = i;
+        }
+    }
+    item.rank = item.variants.at(item.best).rank;
+    m_itemsByRank.insert(RankKey(-item.rank, item.key), id);
+}
+
+bool KonqCompletionIndex::isBetter(const Candidate &lhs, const Candidate &rhs) const
+{
+    if (lhs.first != rhs.first) {
+        return lhs.first > rhs.first;
+    }
+    return m_items.at(lhs.second).key < m_items.at(rhs.second).key;
+}
+
+// best is a heap of at most maxCount candidates, with the worst one first
+void KonqCompletionIndex::addCandidate(QVector<Candidate> &best, const Candidate &candidate, int maxCount) const
+{
+    const auto compare = [this](const Candidate &lhs, const Candidate &rhs) {
+        return isBetter(lhs, rhs);
+    };
+    if (best.count() < maxCount) {
+        best.append(candidate);
+        std::push_heap(best.begin(), best.end(), compare);
+    } else if (isBetter(candidate, best.first())) {
+        std::pop_heap(best.begin(), best.end(), compare);
+        best.last() = candidate;
+        std::push_heap(best.begin(), best.end(), compare);
+    }
+}
+
+template<typename Predicate>
+void KonqCompletionIndex::addMatchesByRank(QVector<Candidate> &best, Predicate accept, int maxCount) const
+{
+    // The items after the maxCount-th match can't rank better
+    QMap<RankKey, int>::const_iterator it = m_itemsByRank.constBegin();
+    for (; it != m_itemsByRank.constEnd() && best.count() < maxCount; ++it) {
+        if (accept(it.value())) {
+            addCandidate(best, Candidate(m_items.at(it.value()).rank, it.value()), maxCount);
+        }
+    }
+}
+
+QStringList KonqCompletionIndex::matches(const QString &text, int maxCount) const
+{
+    if (maxCount <= 0) {
+        return QStringList();
+    }
+
+    const QString prefix = normalized(text);
+    QVector<Candidate> best;
+    QSet<int> found;
+    if (!addPrefixMatches(best, found, prefix, maxCount)) {
+        // Many items start with prefix, the first ones by rank are the best
+        best.clear();
+        addMatchesByRank(best, [this, &prefix](int id) {
+            return m_items.at(id).key.startsWith(prefix);
+        }, maxCount);
+        return bestItems(best);
+    }
+    QStringList result = bestItems(best);
+
+    if (result.count() < maxCount) {
+        best.clear();
+        addWordMatches(best, found, words(prefix), maxCount - result.count());
+        result += bestItems(best);
+    }
+    return result;
+}
+
+QStringList KonqCompletionIndex::substringMatches(const QString &text, int maxCount) const
+{
+    if (maxCount <= 0) {
+        return QStringList();
+    }
+
+    QVector<Candidate> best;
+    addWordMatches(best, QSet<int>(), words(normalized(text)), maxCount);
+    return bestItems(best);
+}
+
+bool KonqCompletionIndex::addPrefixMatches(QVector<Candidate> &best, QSet<int> &found, const QString &prefix, int maxCount) const
+{
+    const int limit = COMPLETION_WALK_FACTOR * maxCount;
+    // An empty prefix, e.g. "http://www.", matches everything
+    QMap<QString, int>::const_iterator it = m_itemsByKey.lowerBound(prefix);
+    for (; it != m_itemsByKey.constEnd() && it.key().startsWith(prefix); ++it) {
+        if (found.count() == limit) {
+            return false;
+        }
+        addCandidate(best, Candidate(m_items.at(it.value()).rank, it.value()), maxCount);
+        found.insert(it.value());
+    }
+    return true;
+}
+
+void KonqCompletionIndex::addWordMatches(QVector<Candidate> &best, const QSet<int> &excluded, const QStringList &queryWords, int maxCount) const
+{
+    if (queryWords.isEmpty()) {
+        return;
+    }
+
+    // The longest word is the one with the fewest items
+    QString longest;
+    for (const QString &word : queryWords) {
+        if (word.length() > longest.length()) {
+            longest = word;
+        }
+    }
+
+    const int limit = COMPLETION_WALK_FACTOR * maxCount;
+    // An item has several words starting with longest, e.g. "kde" and "kdenlive"
+    QSet<int> visited;
+    QMap<QString, QVector<int> >::const_iterator it = m_itemsByWord.lowerBound(longest);
+    for (; it != m_itemsByWord.constEnd() && it.key().startsWith(longest); ++it) {
+        for (int id : it.value()) {
+            if (excluded.contains(id) || visited.contains(id)) {
+                continue;
+            }
+            if (visited.count() == limit) {
+                // Too many items to go through, the first ones by rank are the best
+                best.clear();
+                addMatchesByRank(best, [this, &excluded, &queryWords](int id) {
+                    return !excluded.contains(id) && hasWordsStartingWith(m_items.at(id), queryWords);
+                }, maxCount);
+                return;
+            }
+            visited.insert(id);
+            const Item &item = m_items.at(id);
+            if (queryWords.count() == 1 || hasWordsStartingWith(item, queryWords)) {
+                addCandidate(best, Candidate(item.rank, id), maxCount);
+            }
+        }
+    }
+}
+
+bool KonqCompletionIndex::hasWordsStartingWith(const Item &item, const QStringList &queryWords) const
+{
+    for (const QString &word : queryWords) {
+        bool found = false;
+        int pos = item.key.indexOf(word);
+        while (pos >= 0) {
+            if (pos == 0 || !item.key.at(pos - 1).isLetterOrNumber()) {
+                found = true;
+                break;
+            }
+            pos = item.key.indexOf(word, pos + 1);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList KonqCompletionIndex::bestItems(QVector<Candidate> &best) const
+{
+    std::sort_heap(best.begin(), best.end(), [this](const Candidate &lhs, const Candidate &rhs) {
+        return isBetter(lhs, rhs);
+    });
+
+    QStringList result;
+    result.reserve(best.count());
+    for (const Candidate &candidate : qAsConst(best)) {
+        const Item &item = m_items.at(candidate.second);
+        result.append(item.variants.at(item.best).text);
+    }
+    return result;
+}
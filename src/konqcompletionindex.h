@@ -0,0 +1,137 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQ_COMPLETIONINDEX_H
+#define KONQ_COMPLETIONINDEX_H
+
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <konqprivate_export.h>
+
+class QDateTime;
+
+/**
+ * The URLs offered by the location bar popup completion, ranked by frecency.
+ *
+ * Each item is indexed by its normalized form, i.e. lower case, without the
+ * scheme, the leading "www." and the trailing slash, so that
+ * "http://www.kde.org/" and "kde.org" are the same item, shown with the text
+ * which ranks best. Matching the typed text against all the variants it could
+ * stand for, and removing the duplicates afterwards, isn't needed anymore.
+ *
+ * An item ranks higher the more often it was used, and the more recently:
+ * its weight halves every 30 days since it was last used. Since all items decay
+ * at the same rate, their order doesn't change with time, and the rank is only
+ * computed when an item changes.
+ *
+ * Items can be searched by prefix or by words (see substringMatches()), and
+ * only the best @p maxCount items are kept while going through the matches.
+ * When many items match, e.g. for the first letters typed, the items are
+ * gone through by rank instead, stopping at the @p maxCount-th match.
+ */
+class KONQUERORPRIVATE_EXPORT KonqCompletionIndex
+{
+public:
+    KonqCompletionIndex();
+    ~KonqCompletionIndex();
+
+    /**
+     * Adds @p weight uses of @p text, the last one at @p lastUsed.
+     * Items without a date, like bookmarks, rank after the history.
+     */
+    void addItem(const QString &text, int weight, const QDateTime &lastUsed);
+
+    /**
+     * Removes @p text, whatever its weight.
+     */
+    void removeItem(const QString &text);
+
+    void clear();
+
+    /**
+     * @returns the number of items, i.e. of distinct normalized texts
+     */
+    int count() const;
+
+    /**
+     * @returns the texts of the best items starting with @p text, then of the
+     * best items with words starting with it, without the scheme, "www." and
+     * case being taken into account
+     */
+    QStringList matches(const QString &text, int maxCount) const;
+
+    /**
+     * @returns the texts of the best items which have, for each word of @p text,
+     * a word starting with it. Words are separated by anything which isn't
+     * a letter or a digit.
+     */
+    QStringList substringMatches(const QString &text, int maxCount) const;
+
+    /**
+     * @returns the form of @p text items are indexed by
+     */
+    static QString normalized(const QString &text);
+
+private:
+    struct Variant {
+        QString text;
+        int weight;
+        qint64 lastUsed; // seconds since the epoch, 0 if unknown
+        double rank;
+    };
+
+    struct Item {
+        QString key;
+        QVector<Variant> variants;
+        int best; // the index of the best ranked variant
+        double rank;
+    };
+
+    typedef QPair<double, int> Candidate; // rank and item
+    typedef QPair<double, QString> RankKey; // minus the rank, and key
+
+    int itemFor(const QString &key);
+    void removeItemAt(int id);
+    void updateRank(int id);
+    bool hasWordsStartingWith(const Item &item, const QStringList &queryWords) const;
+    bool isBetter(const Candidate &lhs, const Candidate &rhs) const;
+    void addCandidate(QVector<Candidate> &best, const Candidate &candidate, int maxCount) const;
+    template<typename Predicate>
+    void addMatchesByRank(QVector<Candidate> &best, Predicate accept, int maxCount) const;
+    QStringList bestItems(QVector<Candidate> &best) const;
+    bool addPrefixMatches(QVector<Candidate> &best, QSet<int> &found, const QString &prefix, int maxCount) const;
+    void addWordMatches(QVector<Candidate> &best, const QSet<int> &excluded, const QStringList &queryWords, int maxCount) const;
+
+    static QStringList words(const QString &key);
+
+    QVector<Item> m_items;      // removed items are reused
+    QVector<int> m_freeItems;
+    QHash<QString, int> m_itemsByText;
+    QMap<QString, int> m_itemsByKey; // sorted, for prefix searches
+    QMap<QString, QVector<int> > m_itemsByWord;
+    QMap<RankKey, int> m_itemsByRank; // best first
+};
+
+#endif // KONQ_COMPLETIONINDEX_H
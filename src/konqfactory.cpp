@@ -29,6 +29,8 @@
 #include <QWidget>
 #include <QFile>
 #include <QCoreApplication>
+#include <QHash>
+#include <QVector>
 
 // KDE
 #include <k4aboutdata.h>
@@ -37,6 +39,7 @@
 #include <kmessagebox.h>
 #include <kmimetypetrader.h>
 #include <kservicetypetrader.h>
+#include <ksycoca.h>
 #include <kdeversion.h>
 #include <KParts/ReadOnlyPart>
 
@@ -74,15 +77,92 @@ KParts::ReadOnlyPart *KonqViewFactory::create(QWidget *parentWidget, QObject *pa
     return part;
 }
 
-static KonqViewFactory tryLoadingService(KService::Ptr service)
+// The trader queries and the plugin lookups are done once per process,
+// since createView is called for each new tab, split view or view mode change.
+// The offers change when ksycoca does, the loaded plugins don't.
+class KonqFactoryCache
+{
+public:
+    struct Offers {
+        KService::List parts;
+        KService::List apps;
+        QVector<bool> allowedAsDefault; // for each part
+    };
+
+    KonqFactoryCache()
+    {
+        QObject::connect(KSycoca::self(), static_cast<void (KSycoca::*)(const QStringList &)>(&KSycoca::databaseChanged),
+                         [this]() {
+            m_offers.clear();
+        });
+    }
+
+    const Offers &offers(const QString &serviceType);
+    KPluginFactory *factory(const KService::Ptr &service, QString *errorString);
+
+private:
+    QHash<QString, Offers> m_offers;
+    QHash<QString, KPluginFactory *> m_factories; // by library
+};
+
+Q_GLOBAL_STATIC(KonqFactoryCache, globalFactoryCache)
+
+const KonqFactoryCache::Offers &KonqFactoryCache::offers(const QString &serviceType)
+{
+    QHash<QString, Offers>::const_iterator it = m_offers.constFind(serviceType);
+    if (it != m_offers.constEnd()) {
+        return it.value();
+    }
+
+    Offers offers;
+#ifdef __GNUC__
+#warning Temporary hack -- must separate mimetypes and servicetypes better
+#endif
+    if (serviceType.length() > 0 && serviceType[0].isUpper()) {
+        offers.parts = KServiceTypeTrader::self()->query(serviceType,
+                       QStringLiteral("DesktopEntryName != 'kfmclient' and DesktopEntryName != 'kfmclient_dir' and DesktopEntryName != 'kfmclient_html'"));
+    } else {
+        offers.apps = KMimeTypeTrader::self()->query(serviceType, QStringLiteral("Application"),
+                      QStringLiteral("DesktopEntryName != 'kfmclient' and DesktopEntryName != 'kfmclient_dir' and DesktopEntryName != 'kfmclient_html'"));
+        offers.parts = KMimeTypeTrader::self()->query(serviceType, QStringLiteral("KParts/ReadOnlyPart"));
+    }
+
+    const KService::List &parts = offers.parts;
+    offers.allowedAsDefault.reserve(parts.count());
+    for (const KService::Ptr &service : parts) {
+        const QVariant prop = service->property(QStringLiteral("X-KDE-BrowserView-AllowAsDefault"));
+        offers.allowedAsDefault.append(!prop.isValid() || prop.toBool()); // defaults to true
+    }
+    return m_offers.insert(serviceType, offers).value();
+}
+
+KPluginFactory *KonqFactoryCache::factory(const KService::Ptr &service, QString *errorString)
 {
+    const QString library = service->library();
+    KPluginFactory *factory = m_factories.value(library);
+    if (factory) {
+        return factory;
+    }
+
     KPluginLoader pluginLoader(*service);
     pluginLoader.setLoadHints(QLibrary::ExportExternalSymbolsHint); // #110947
-    KPluginFactory *factory = pluginLoader.factory();
+    factory = pluginLoader.factory();
+    if (factory) {
+        m_factories.insert(library, factory);
+    } else {
+        *errorString = pluginLoader.errorString();
+    }
+    return factory;
+}
+
+static KonqViewFactory tryLoadingService(KService::Ptr service)
+{
+    QString errorString;
+    KPluginFactory *factory = globalFactoryCache()->factory(service, &errorString);
     if (!factory) {
         KMessageBox::error(nullptr,
                            i18n("There was an error loading the module %1.\nThe diagnostics is:\n%2",
-                                service->name(), pluginLoader.errorString()));
+                                service->name(), errorString));
         return KonqViewFactory();
     } else {
         return KonqViewFactory(service->library(), factory);
@@ -99,10 +179,10 @@ KonqViewFactory KonqFactory::createView(const QString &serviceType,
     qCDebug(KONQUEROR_LOG) << "Trying to create view for" << serviceType << serviceName;
 
     // We need to get those in any case
-    KService::List offers, appOffers;
-
-    // Query the trader
-    getOffers(serviceType, &offers, &appOffers);
+    // A copy, the cache can be cleared while loading the part (e.g. from the error message box)
+    const KonqFactoryCache::Offers cachedOffers = globalFactoryCache()->offers(serviceType);
+    const KService::List offers = cachedOffers.parts;
+    const KService::List appOffers = cachedOffers.apps;
 
     if (partServiceOffers) {
         (*partServiceOffers) = offers;
@@ -149,13 +229,10 @@ KonqViewFactory KonqFactory::createView(const QString &serviceType,
         // When looking for konq_sidebartng or konq_aboutpage, we don't want to end up
         // with khtml or another Browser/View part in case of an error...
     } else {
-        KService::List::Iterator it = offers.begin();
-        for (; viewFactory.isNull() /* exit as soon as we get one */ && it != offers.end(); ++it) {
-            service = (*it);
+        for (int i = 0; viewFactory.isNull() /* exit as soon as we get one */ && i < offers.count(); ++i) {
+            service = offers.at(i);
             // Allowed as default ?
-            QVariant prop = service->property(QStringLiteral("X-KDE-BrowserView-AllowAsDefault"));
-            qCDebug(KONQUEROR_LOG) << service->desktopEntryName() << " : X-KDE-BrowserView-AllowAsDefault is valid : " << prop.isValid();
-            if (!prop.isValid() || prop.toBool()) {   // defaults to true
+            if (cachedOffers.allowedAsDefault.at(i)) {
                 //qCDebug(KONQUEROR_LOG) << "Trying to open lib for service " << service->name();
                 viewFactory = tryLoadingService(service);
                 // If this works, we exit the loop.
@@ -198,21 +275,11 @@ void KonqFactory::getOffers(const QString &serviceType,
                             KService::List *partServiceOffers,
                             KService::List *appServiceOffers)
 {
-#ifdef __GNUC__
-#warning Temporary hack -- must separate mimetypes and servicetypes better
-#endif
-    if (partServiceOffers && serviceType.length() > 0 && serviceType[0].isUpper()) {
-        *partServiceOffers = KServiceTypeTrader::self()->query(serviceType,
-                             QStringLiteral("DesktopEntryName != 'kfmclient' and DesktopEntryName != 'kfmclient_dir' and DesktopEntryName != 'kfmclient_html'"));
-        return;
-
+    const KonqFactoryCache::Offers &offers = globalFactoryCache()->offers(serviceType);
+    if (partServiceOffers) {
+        *partServiceOffers = offers.parts;
     }
     if (appServiceOffers) {
-        *appServiceOffers = KMimeTypeTrader::self()->query(serviceType, QStringLiteral("Application"),
-                            QStringLiteral("DesktopEntryName != 'kfmclient' and DesktopEntryName != 'kfmclient_dir' and DesktopEntryName != 'kfmclient_html'"));
-    }
-
-    if (partServiceOffers) {
-        *partServiceOffers = KMimeTypeTrader::self()->query(serviceType, QStringLiteral("KParts/ReadOnlyPart"));
+        *appServiceOffers = offers.apps;
     }
 }
@@ -58,7 +58,8 @@ public:
     enum Option {
         None = 0x0,
         saveURLs = 0x01, // TODO rename to SaveUrls
-        saveHistoryItems = 0x02 // TODO rename to SaveHistoryItems
+        saveHistoryItems = 0x02, // TODO rename to SaveHistoryItems
+        trackSessionChanges = 0x04 // the config is the autosaved session: skip the views which didn't change, see KonqView::saveConfig
     };
     Q_DECLARE_FLAGS(Options, Option)
 
@@ -21,6 +21,7 @@
 #include "konqhistorymanager.h"
 #include <kbookmarkmanager.h>
 
+#include <QCoreApplication>
 #include <QTimer>
 #include "konqdebug.h"
 #include <kconfig.h>
@@ -34,16 +35,33 @@ KonqHistoryManager::KonqHistoryManager(KBookmarkManager *bookmarkManager, QObjec
 {
     m_updateTimer = new QTimer(this);
 
+    // Visiting a bookmarked page only updates its access metadata in memory,
+    // the bookmarks file is written at most every 30 seconds, or when quitting
+    m_bookmarksSaveTimer = new QTimer(this);
+    m_bookmarksSaveTimer->setSingleShot(true);
+    m_bookmarksSaveTimer->setInterval(30000);
+    connect(m_bookmarksSaveTimer, &QTimer::timeout, this, &KonqHistoryManager::slotSaveBookmarks);
+    connect(qApp, &QCoreApplication::aboutToQuit, this, [this]() {
+        if (m_bookmarksSaveTimer->isActive()) {
+            slotSaveBookmarks();
+        }
+    });
+    if (m_bookmarkManager) {
+        // The bookmarks were saved with our changes, or reloaded without them
+        connect(m_bookmarkManager, &KBookmarkManager::changed, m_bookmarksSaveTimer, &QTimer::stop);
+    }
+
     // take care of the completion object
     m_pCompletion = new KCompletion;
     m_pCompletion->setOrder(KCompletion::Weighted);
 
-    // and load the history
-    loadHistory();
-
     connect(m_updateTimer, &QTimer::timeout, this, &KonqHistoryManager::slotEmitUpdated);
     connect(this, &KonqHistoryManager::cleared, this, &KonqHistoryManager::slotCleared);
     connect(this, &KonqHistoryManager::entryRemoved, this, &KonqHistoryManager::slotEntryRemoved);
+    connect(this, &KonqHistoryManager::historyLoaded, this, &KonqHistoryManager::slotHistoryLoaded);
+
+    // and load the history, without delaying the first window
+    startLoadingHistory();
 }
 
 KonqHistoryManager::~KonqHistoryManager()
@@ -52,23 +70,15 @@ KonqHistoryManager::~KonqHistoryManager()
     clearPending();
 }
 
-bool KonqHistoryManager::loadHistory()
+void KonqHistoryManager::slotHistoryLoaded()
 {
-    clearPending();
-    m_pCompletion->clear();
-
-    if (!KonqHistoryProvider::loadHistory()) {
-        return false;
-    }
-
+    // The bookmarks may have been added already
     QListIterator<KonqHistoryEntry> it(entries());
     while (it.hasNext()) {
         const KonqHistoryEntry &entry = it.next();
         const QString prettyUrlString = entry.url.toDisplayString();
-        addToCompletion(prettyUrlString, entry.typedUrl, entry.numberOfTimesVisited);
+        addToCompletion(prettyUrlString, entry.typedUrl, entry.lastVisited, entry.numberOfTimesVisited);
     }
-
-    return true;
 }
 
 void KonqHistoryManager::addPending(const QUrl &url, const QString &typedUrl,
@@ -226,17 +236,21 @@ QStringList KonqHistoryManager::allURLs() const
 #endif
 
 void KonqHistoryManager::addToCompletion(const QString &url, const QString &typedUrl,
-        int numberOfTimesVisited)
+        const QDateTime &lastVisited, int numberOfTimesVisited)
 {
     m_pCompletion->addItem(url, numberOfTimesVisited);
+    m_completionIndex.addItem(url, numberOfTimesVisited, lastVisited);
     // typed urls have a higher priority
     m_pCompletion->addItem(typedUrl, numberOfTimesVisited + 10);
+    m_completionIndex.addItem(typedUrl, numberOfTimesVisited + 10, lastVisited);
 }
 
 void KonqHistoryManager::removeFromCompletion(const QString &url, const QString &typedUrl)
 {
     m_pCompletion->removeItem(url);
     m_pCompletion->removeItem(typedUrl);
+    m_completionIndex.removeItem(url);
+    m_completionIndex.removeItem(typedUrl);
 }
 
 void KonqHistoryManager::addToUpdateList(const QString &url)
@@ -251,12 +265,13 @@ void KonqHistoryManager::slotCleared()
 {
     clearPending();
     m_pCompletion->clear();
+    m_completionIndex.clear();
 }
 
 void KonqHistoryManager::finishAddingEntry(const KonqHistoryEntry &entry, bool isSender)
 {
     const QString urlString = entry.url.url();
-    addToCompletion(entry.url.toDisplayString(), entry.typedUrl);
+    addToCompletion(entry.url.toDisplayString(), entry.typedUrl, entry.lastVisited);
     addToUpdateList(urlString);
     KonqHistoryProvider::finishAddingEntry(entry, isSender);
 
@@ -268,12 +283,18 @@ void KonqHistoryManager::finishAddingEntry(const KonqHistoryEntry &entry, bool i
 
     if (isSender) {
         // note, bk save does not notify, and we don't want to!
-        if (updated) {
-            m_bookmarkManager->save();
+        if (updated && !m_bookmarksSaveTimer->isActive()) {
+            m_bookmarksSaveTimer->start();
         }
     }
 }
 
+void KonqHistoryManager::slotSaveBookmarks()
+{
+    m_bookmarksSaveTimer->stop();
+    m_bookmarkManager->save();
+}
+
 void KonqHistoryManager::slotEntryRemoved(const KonqHistoryEntry &entry)
 {
     const QString urlString = entry.url.url();
@@ -29,6 +29,7 @@
 
 #include "konq_historyentry.h"
 #include "konq_historyprovider.h"
+#include "konqcompletionindex.h"
 
 class QTimer;
 class KBookmarkManager;
@@ -101,6 +102,15 @@ public:
         return m_pCompletion;
     }
 
+    /**
+     * @returns the index used for the popup and substring completion, which holds
+     * the same items as completionObject(), ranked by frecency
+     */
+    KonqCompletionIndex *completionIndex()
+    {
+        return &m_completionIndex;
+    }
+
     // HistoryProvider interface, let konq handle this
     /**
      * Reimplemented in such a way that all URLs that would be filtered
@@ -113,11 +123,6 @@ public:
     void clear() override {}
 
 private:
-    /**
-     * Loads the history and fills the completion object.
-     */
-    bool loadHistory();
-
     /**
      * Does the work for @ref addPending() and @ref confirmPending().
      *
@@ -159,11 +164,22 @@ private Q_SLOTS:
     void slotCleared();
     void slotEntryRemoved(const KonqHistoryEntry &entry);
 
+    /**
+     * Fills the completion object with the history, once it is loaded.
+     */
+    void slotHistoryLoaded();
+
+    /**
+     * Writes the bookmarks, with the access metadata updated since they were last written
+     */
+    void slotSaveBookmarks();
+
 private:
     void finishAddingEntry(const KonqHistoryEntry &entry, bool isSender) override;
     void clearPending();
 
-    void addToCompletion(const QString &url, const QString &typedUrl, int numberOfTimesVisited = 1);
+    void addToCompletion(const QString &url, const QString &typedUrl, const QDateTime &lastVisited,
+                         int numberOfTimesVisited = 1);
     void removeFromCompletion(const QString &url, const QString &typedUrl);
 
     /**
@@ -175,6 +191,7 @@ private:
     QMap<QString, KonqHistoryEntry *> m_pending;
 
     KCompletion *m_pCompletion; // the completion object we sync with
+    KonqCompletionIndex m_completionIndex;
 
     /**
      * A timer that will emit the KParts::HistoryProvider::updated() signal
@@ -182,6 +199,11 @@ private:
      */
     QTimer *m_updateTimer;
 
+    /**
+     * Running while the bookmarks have access metadata updates which weren't written
+     */
+    QTimer *m_bookmarksSaveTimer;
+
     KBookmarkManager *m_bookmarkManager;
 
     static const int s_historyVersion;
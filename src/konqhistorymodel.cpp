@@ -240,8 +240,14 @@ KonqHistoryModel::KonqHistoryModel(QObject *parent)
             this, SLOT(slotEntryAdded(KonqHistoryEntry)));
     connect(provider, SIGNAL(entryRemoved(KonqHistoryEntry)),
             this, SLOT(slotEntryRemoved(KonqHistoryEntry)));
+    connect(provider, SIGNAL(historyLoaded()), this, SLOT(slotHistoryLoaded()));
 
-    KonqHistoryList entries(provider->entries());
+    fillEntries();
+}
+
+void KonqHistoryModel::fillEntries()
+{
+    KonqHistoryList entries(KonqHistoryProvider::self()->entries());
 
     KonqHistoryList::const_iterator it = entries.constBegin();
     const KonqHistoryList::const_iterator end = entries.constEnd();
@@ -469,3 +475,11 @@ QModelIndex KonqHistoryModel::indexFor(KHM::GroupEntry *entry) const
     return createIndex(row, 0, entry);
 }
 
+void KonqHistoryModel::slotHistoryLoaded()
+{
+    beginResetModel();
+    delete m_root;
+    m_root = new KHM::RootEntry();
+    fillEntries();
+    endResetModel();
+}
@@ -55,9 +55,11 @@ public Q_SLOTS:
 private Q_SLOTS:
     void slotEntryAdded(const KonqHistoryEntry &);
     void slotEntryRemoved(const KonqHistoryEntry &);
+    void slotHistoryLoaded();
 
 private:
     enum SignalEmission { EmitSignals, DontEmitSignals };
+    void fillEntries();
     KHM::Entry *entryFromIndex(const QModelIndex &index, bool returnRootIfNull = false) const;
     KHM::GroupEntry *getGroupItem(const QUrl &url, SignalEmission se);
     QModelIndex indexFor(KHM::HistoryEntry *entry) const;
@@ -25,6 +25,7 @@
 #include "konqmouseeventfilter.h"
 #include "konqclosedwindowsmanager.h"
 #include "konqsessionmanager.h"
+#include "konqtabhibernator.h"
 #include "konqsessiondlg.h"
 #include "konqdraggablelabel.h"
 #include "konqcloseditem.h"
@@ -136,7 +137,6 @@
 #include <kparts/browseropenorsavequestion.h>
 #include <KParts/OpenUrlEvent>
 #include <KParts/BrowserHostExtension>
-#include <KCompletionMatches>
 #include <kacceleratormanager.h>
 #include <kuser.h>
 #include <kxmlguifactory.h>
@@ -159,6 +159,8 @@ template class QList<KToggleAction *>;
 
 static KBookmarkManager *s_bookmarkManager = nullptr;
 QList<KonqMainWindow *> *KonqMainWindow::s_lstMainWindows = nullptr;
+int KonqMainWindow::s_webEngineFastPathCount = 0;
+int KonqMainWindow::s_webEngineFastPathFallbackCount = 0;
 KConfig *KonqMainWindow::s_comboConfig = nullptr;
 KCompletion *KonqMainWindow::s_pCompletion = nullptr;
 
@@ -166,6 +168,9 @@ KonqOpenURLRequest KonqOpenURLRequest::null;
 
 static const unsigned short int s_closedItemsListLength = 10;
 
+// The number of history items offered by the popup and substring completion
+static const int s_maxCompletionItems = 50;
+
 static void raiseWindow(KonqMainWindow *window)
 {
     if (!window) {
@@ -305,6 +310,7 @@ KonqMainWindow::KonqMainWindow(const QUrl &initialURL)
     //qCDebug(KONQUEROR_LOG) << this << "created";
 
     KonqSessionManager::self();
+    KonqTabHibernator::self();
     m_fullyConstructed = true;
 }
 
@@ -630,6 +636,24 @@ void KonqMainWindow::openUrl(KonqView *_view, const QUrl &_url,
         }
     }
 
+    // Fast path for web pages: a WebEngine view fetches them itself, instead of KonqRun fetching them
+    // first only to find out their mimetype. Such requests carry the "konq-webengine-fastpath" metadata,
+    // so that the part hands back what it can't show (see WebEnginePage::download) with the
+    // "konq-webengine-fallback" metadata. Its other downloads carry "konq-webengine-download" instead:
+    // both go through KonqRun as usual, but only the former counts as a fallback.
+    if (mimeType.isEmpty() && view && !req.browserArgs.doPost() &&
+            (url.scheme() == QLatin1String("http") || url.scheme() == QLatin1String("https"))) {
+        if (req.args.metaData().contains(QStringLiteral("konq-webengine-fallback"))) {
+            ++s_webEngineFastPathFallbackCount;
+            qCDebug(KONQUEROR_LOG) << "WebEngine can't show" << url << "- fallbacks:" << s_webEngineFastPathFallbackCount << "of" << s_webEngineFastPathCount;
+        } else if (!req.args.metaData().contains(QStringLiteral("konq-webengine-download")) &&
+                KonqSettings::openHttpUrlsInWebEngine() && view->service()->desktopEntryName() == QLatin1String("webenginepart")) {
+            ++s_webEngineFastPathCount;
+            mimeType = QStringLiteral("text/html");
+            req.args.metaData().insert(QStringLiteral("konq-webengine-fastpath"), QStringLiteral("true"));
+        }
+    }
+
     const bool hasMimeType = (!mimeType.isEmpty() && mimeType != QLatin1String("application/octet-stream"));
     KService::Ptr offer;
     bool associatedAppIsKonqueror = false;
@@ -3013,17 +3037,17 @@ void KonqMainWindow::slotMakeCompletion(const QString &text)
         if (completion.isNull() && !m_pURLCompletion->isRunning()) {
             // No match() signal will come from m_pURLCompletion
             // ask the global one
-            // tell the static completion object about the current completion mode
-            completion = s_pCompletion->makeCompletion(text);
 
             // some special handling necessary for CompletionPopup
             if (m_combo->completionMode() == KCompletion::CompletionPopup ||
                     m_combo->completionMode() == KCompletion::CompletionPopupAuto) {
                 m_combo->setCompletedItems(historyPopupCompletionItems(text));
-            }
-
-            else if (!completion.isNull()) {
-                m_combo->setCompletedText(completion);
+            } else {
+                // tell the static completion object about the current completion mode
+                completion = s_pCompletion->makeCompletion(text);
+                if (!completion.isNull()) {
+                    m_combo->setCompletedText(completion);
+                }
             }
         } else {
             // To be continued in slotMatch()...
@@ -3049,7 +3073,7 @@ void KonqMainWindow::slotSubstringcompletion(const QString &text)
         items = m_pURLCompletion->substringCompletion(text);
     }
 
-    items += s_pCompletion->substringCompletion(text);
+    items += KonqHistoryManager::kself()->completionIndex()->substringMatches(text, s_maxCompletionItems);
     if (!filesFirst && m_pURLCompletion) {
         items += m_pURLCompletion->substringCompletion(text);
     }
@@ -4677,6 +4701,7 @@ void KonqMainWindow::reparseConfiguration()
     KonqSettings::self()->load();
     m_pViewManager->applyConfiguration();
     KonqMouseEventFilter::self()->reparseConfiguration();
+    KonqTabHibernator::self()->reparseConfiguration();
 
     if (m_combo) {
         m_combo->setFont(QFontDatabase::systemFont(QFontDatabase::GeneralFont));
@@ -4700,6 +4725,14 @@ void KonqMainWindow::saveProperties(KConfigGroup &config)
     }
 }
 
+void KonqMainWindow::saveChangedProperties(KConfigGroup &config)
+{
+    if (m_fullyConstructed) {
+        KonqFrameBase::Options flags = KonqFrameBase::saveHistoryItems | KonqFrameBase::trackSessionChanges;
+        m_pViewManager->saveViewConfigToGroup(config, flags);
+    }
+}
+
 void KonqMainWindow::readProperties(const KConfigGroup &configGroup)
 {
     m_pViewManager->loadViewConfigFromGroup(configGroup, QString() /*no profile name*/);
@@ -5155,6 +5188,8 @@ void KonqMainWindow::addBookmarksIntoCompletion(const KBookmarkGroup &group)
 
         QString u = url.toDisplayString();
         s_pCompletion->addItem(u);
+        // the index also finds u without its scheme
+        KonqHistoryManager::kself()->completionIndex()->addItem(u, 1, QDateTime());
 
         if (url.isLocalFile()) {
             s_pCompletion->addItem(url.toLocalFile());
@@ -5203,153 +5238,15 @@ static QString hp_tryPrepend(const QString &s)
     return (s.startsWith(QLatin1String("www.")) ? "http://" : "http://www.") + s;
 }
 
-static void hp_removeDupe(KCompletionMatches &l, const QString &dupe,
-                          KCompletionMatches::Iterator it_orig)
-{
-    KCompletionMatches::Iterator it = it_orig + 1;
-    while (it != l.end()) {
-        if ((*it).value() == dupe) {
-            (*it_orig).first = qMax((*it_orig).first, (*it).key());
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// remove duplicates like 'http://www.kde.org' and 'http://www.kde.org/'
-// (i.e. the trailing slash)
-// some duplicates are also created by prepending protocols
-static void hp_removeDuplicates(KCompletionMatches &l)
-{
-    QString http = QStringLiteral("http://");
-    QString ftp = QStringLiteral("ftp://ftp.");
-    QString file = QStringLiteral("file:");
-    QString file2 = QStringLiteral("file://");
-    l.removeDuplicates();
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-            ++it) {
-        QString str = (*it).value();
-        if (str.startsWith(http)) {
-            if (str.indexOf('/', 7) < 0) {    // http://something<noslash>
-                hp_removeDupe(l, str + '/', it);
-                hp_removeDupe(l, str.mid(7) + '/', it);
-            } else if (str[ str.length() - 1 ] == '/') {
-                hp_removeDupe(l, str.left(str.length() - 1), it);
-                hp_removeDupe(l, str.left(str.length() - 1).mid(7), it);
-            }
-            hp_removeDupe(l, str.mid(7), it);
-        } else if (str.startsWith(ftp)) { // ftp://ftp.
-            hp_removeDupe(l, str.mid(6), it);    // remove dupes without ftp://
-        } else if (str.startsWith(file2)) {
-            hp_removeDupe(l, str.mid(7), it);    // remove dupes without file://
-        } else if (str.startsWith(file)) {
-            hp_removeDupe(l, str.mid(5), it);    // remove dupes without file:
-        }
-    }
-}
-
-static void hp_removeCommonPrefix(KCompletionMatches &l, const QString &prefix)
-{
-    for (KCompletionMatches::Iterator it = l.begin();
-            it != l.end();
-        ) {
-        if ((*it).value().startsWith(prefix)) {
-            it = l.erase(it);
-            continue;
-        }
-        ++it;
-    }
-}
-
-// don't include common prefixes like 'http://', i.e. when s == 'h', include
-// http://hotmail.com but don't include everything just starting with 'http://'
-static void hp_checkCommonPrefixes(KCompletionMatches &matches, const QString &s)
-{
-    static const char *const prefixes[] = {
-        "http://",
-        "https://",
-        "www.",
-        "ftp://",
-        "http://www.",
-        "https://www.",
-        "ftp://ftp.",
-        "file:",
-        "file://",
-        nullptr
-    };
-    for (const char *const *pos = prefixes;
-            *pos != nullptr;
-            ++pos) {
-        QString prefix = *pos;
-        if (prefix.startsWith(s)) {
-            hp_removeCommonPrefix(matches, prefix);
-        }
-    }
-}
-
 QStringList KonqMainWindow::historyPopupCompletionItems(const QString &s)
 {
-    const QString http = QStringLiteral("http://");
-    const QString https = QStringLiteral("https://");
-    const QString www = QStringLiteral("http://www.");
-    const QString wwws = QStringLiteral("https://www.");
-    const QString ftp = QStringLiteral("ftp://");
-    const QString ftpftp = QStringLiteral("ftp://ftp.");
-    const QString file = QStringLiteral("file:"); // without /, because people enter /usr etc.
-    const QString file2 = QStringLiteral("file://");
     if (s.isEmpty()) {
         return QStringList();
     }
-    KCompletionMatches matches = s_pCompletion->allWeightedMatches(s);
-    hp_checkCommonPrefixes(matches, s);
-    bool checkDuplicates = false;
-    if (!s.startsWith(ftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftp + s);
-        if (QStringLiteral("ftp.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, ftpftp);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(https)) {
-        matches += s_pCompletion->allWeightedMatches(https + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, wwws);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(http)) {
-        matches += s_pCompletion->allWeightedMatches(http + s);
-        if (QStringLiteral("www.").startsWith(s)) {
-            hp_removeCommonPrefix(matches, www);
-        }
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(www)) {
-        matches += s_pCompletion->allWeightedMatches(www + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(wwws)) {
-        matches += s_pCompletion->allWeightedMatches(wwws + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(ftpftp)) {
-        matches += s_pCompletion->allWeightedMatches(ftpftp + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file)) {
-        matches += s_pCompletion->allWeightedMatches(file + s);
-        checkDuplicates = true;
-    }
-    if (!s.startsWith(file2)) {
-        matches += s_pCompletion->allWeightedMatches(file2 + s);
-        checkDuplicates = true;
-    }
-    if (checkDuplicates) {
-        hp_removeDuplicates(matches);
-    }
-    QStringList items = matches.list();
+    // The index ignores the scheme and "www.", so e.g. "kde" finds both
+    // http://www.kde.org and https://kde.org, once, and 'h' doesn't find
+    // everything starting with http://
+    QStringList items = KonqHistoryManager::kself()->completionIndex()->matches(s, s_maxCompletionItems);
     if (items.count() == 0
             && !s.contains(':') && !s.isEmpty() && s[ 0 ] != '/') {
         QString pre = hp_tryPrepend(s);
@@ -151,6 +151,13 @@ public:
     void saveProperties(KConfigGroup &config) override;
     void readProperties(const KConfigGroup &config) override;
 
+    /**
+     * Like saveProperties(), but for the autosaved session: the views which didn't
+     * change since they were last saved in @p config aren't saved again
+     * (see KonqFrameBase::trackSessionChanges)
+     */
+    void saveChangedProperties(KConfigGroup &config);
+
     void setInitialFrameName(const QString &name);
 
     void reparseConfiguration();
@@ -249,6 +256,19 @@ public:
         return s_lstMainWindows;
     }
 
+    /**
+     * @return how many http(s) URLs were given directly to a web engine view,
+     * and how many of them it handed back because it couldn't show them
+     */
+    static int webEngineFastPathCount()
+    {
+        return s_webEngineFastPathCount;
+    }
+    static int webEngineFastPathFallbackCount()
+    {
+        return s_webEngineFastPathFallbackCount;
+    }
+
     void linkableViewCountChanged();
     void viewCountChanged();
 
@@ -693,6 +713,8 @@ private: // members
     QActionGroup *m_sessionsGroup;
 
     static QList<KonqMainWindow *> *s_lstMainWindows;
+    static int s_webEngineFastPathCount;
+    static int s_webEngineFastPathFallbackCount;
 
     QUrl m_currentDir; // stores current dir for relative URLs whenever applicable
 
@@ -44,30 +44,56 @@ KonqPixmapProvider *KonqPixmapProvider::self()
 
 KonqPixmapProvider::KonqPixmapProvider()
     : KPixmapProvider()
+    , m_pixmaps(200)
+    , m_userInputUrls(500)
 {
+    connect(KIconLoader::global(), &KIconLoader::iconLoaderSettingsChanged, this, [this]() {
+        m_pixmaps.clear();
+    });
 }
 
 KonqPixmapProvider::~KonqPixmapProvider()
 {
 }
 
+void KonqPixmapProvider::setIconName(const QUrl &url, const QString &icon)
+{
+    QHash<QUrl, QString>::iterator it = iconMap.find(url);
+    if (it == iconMap.end()) {
+        iconMap.insert(url, icon);
+        m_urlsByHost[url.host()].append(url);
+    } else {
+        *it = icon;
+    }
+}
+
+// The favicon files keep their name when they're downloaded again
+void KonqPixmapProvider::iconUpdated(const QString &icon)
+{
+    const QList<QPair<QString, int> > keys = m_pixmaps.keys();
+    for (const QPair<QString, int> &key : keys) {
+        if (key.first == icon) {
+            m_pixmaps.remove(key);
+        }
+    }
+}
+
 void KonqPixmapProvider::downloadHostIcon(const QUrl &hostUrl)
 {
     KIO::FavIconRequestJob *job = new KIO::FavIconRequestJob(hostUrl);
     connect(job, &KIO::FavIconRequestJob::result, this, [job, this](KJob *) {
         bool modified = false;
         const QUrl _hostUrl = job->hostUrl();
-        QMap<QUrl, QString>::iterator itEnd = iconMap.end();
-        for (QMap<QUrl, QString>::iterator it = iconMap.begin(); it != itEnd; ++it) {
-            const QUrl url(it.key());
-            if (url.host() == _hostUrl.host()) {
-                // For host default-icons still query the favicon manager to get
-                // the correct icon for pages that have an own one.
-                const QString icon = KIO::favIconForUrl(url);
-                if (!icon.isEmpty() && *it != icon) {
-                    *it = icon;
-                    modified = true;
-                }
+        iconUpdated(job->iconFile());
+        const QList<QUrl> urls = m_urlsByHost.value(_hostUrl.host());
+        for (const QUrl &url : urls) {
+            // For host default-icons still query the favicon manager to get
+            // the correct icon for pages that have an own one.
+            const QString icon = KIO::favIconForUrl(url);
+            QString &currentIcon = iconMap[url];
+            if (!icon.isEmpty() && currentIcon != icon) {
+                currentIcon = icon;
+                modified = true;
             }
         }
         if (modified) {
@@ -83,13 +109,14 @@ void KonqPixmapProvider::setIconForUrl(const QUrl &hostUrl, const QUrl &iconUrl)
     connect(job, &KIO::FavIconRequestJob::result, this, [job, this](KJob *) {
         bool modified = false;
         const QUrl _hostUrl = job->hostUrl();
-        QMap<QUrl, QString>::iterator itEnd = iconMap.end();
-        for (QMap<QUrl, QString>::iterator it = iconMap.begin(); it != itEnd; ++it) {
-            const QUrl url(it.key());
-            if (url.host() == _hostUrl.host() && url.path() == _hostUrl.path()) {
-                const QString icon = job->iconFile();
-                if (!icon.isEmpty() && *it != icon) {
-                    *it = icon;
+        const QString icon = job->iconFile();
+        iconUpdated(icon);
+        const QList<QUrl> urls = m_urlsByHost.value(_hostUrl.host());
+        for (const QUrl &url : urls) {
+            if (url.path() == _hostUrl.path()) {
+                QString &currentIcon = iconMap[url];
+                if (!icon.isEmpty() && currentIcon != icon) {
+                    currentIcon = icon;
                     modified = true;
                 }
             }
@@ -106,9 +133,9 @@ void KonqPixmapProvider::setIconForUrl(const QUrl &hostUrl, const QUrl &iconUrl)
 // finally, inserts the url/icon pair into the cache
 QString KonqPixmapProvider::iconNameFor(const QUrl &url)
 {
-    QMap<QUrl, QString>::iterator it = iconMap.find(url);
+    QHash<QUrl, QString>::const_iterator it = iconMap.constFind(url);
     QString icon;
-    if (it != iconMap.end()) {
+    if (it != iconMap.constEnd()) {
         icon = it.value();
         if (!icon.isEmpty()) {
             return icon;
@@ -127,19 +154,25 @@ QString KonqPixmapProvider::iconNameFor(const QUrl &url)
     }
 
     // cache the icon found for url
-    iconMap.insert(url, icon);
+    setIconName(url, icon);
 
     return icon;
 }
 
 QPixmap KonqPixmapProvider::pixmapFor(const QString &url, int size)
 {
-    return loadIcon(iconNameFor(QUrl::fromUserInput(url)), size);
+    QUrl *parsedUrl = m_userInputUrls.object(url);
+    if (!parsedUrl) {
+        parsedUrl = new QUrl(QUrl::fromUserInput(url));
+        m_userInputUrls.insert(url, parsedUrl);
+    }
+    return loadIcon(iconNameFor(*parsedUrl), size);
 }
 
 void KonqPixmapProvider::load(KConfigGroup &kc, const QString &key)
 {
     iconMap.clear();
+    m_urlsByHost.clear();
     const QStringList list = kc.readPathEntry(key, QStringList());
     QStringList::const_iterator it = list.begin();
     QStringList::const_iterator itEnd = list.end();
@@ -149,7 +182,7 @@ void KonqPixmapProvider::load(KConfigGroup &kc, const QString &key)
             break;
         }
         const QString icon(*it);
-        iconMap.insert(QUrl::fromUserInput(url), icon);
+        setIconName(QUrl::fromUserInput(url), icon);
         ++it;
     }
 }
@@ -162,7 +195,7 @@ void KonqPixmapProvider::save(KConfigGroup &kc, const QString &key,
     QStringList list;
     QStringList::const_iterator itEnd = items.end();
     for (QStringList::const_iterator it = items.begin(); it != itEnd; ++it) {
-        QMap<QUrl, QString>::const_iterator mit = iconMap.constFind(QUrl::fromUserInput(*it));
+        QHash<QUrl, QString>::const_iterator mit = iconMap.constFind(QUrl::fromUserInput(*it));
         if (mit != iconMap.constEnd()) {
             list.append(mit.key().url());
             list.append(mit.value());
@@ -174,6 +207,7 @@ void KonqPixmapProvider::save(KConfigGroup &kc, const QString &key,
 void KonqPixmapProvider::clear()
 {
     iconMap.clear();
+    m_urlsByHost.clear();
 }
 
 QPixmap KonqPixmapProvider::loadIcon(const QString &icon, int size)
@@ -181,6 +215,12 @@ QPixmap KonqPixmapProvider::loadIcon(const QString &icon, int size)
     if (size == 0) {
         size = KIconLoader::SizeSmall;
     }
-    return QIcon::fromTheme(icon).pixmap(size);
+    const QPair<QString, int> key(icon, size);
+    QPixmap *pixmap = m_pixmaps.object(key);
+    if (!pixmap) {
+        pixmap = new QPixmap(QIcon::fromTheme(icon).pixmap(size));
+        m_pixmaps.insert(key, pixmap);
+    }
+    return *pixmap;
 }
 
@@ -24,7 +24,9 @@
 
 #include <kpixmapprovider.h>
 
-#include <QMap>
+#include <QCache>
+#include <QHash>
+#include <QPair>
 #include <QPixmap>
 #include <QUrl>
 
@@ -78,11 +80,19 @@ Q_SIGNALS:
 
 private:
     QPixmap loadIcon(const QString &icon, int size);
+    void setIconName(const QUrl &url, const QString &icon);
+    void iconUpdated(const QString &icon);
 
     KonqPixmapProvider();
     friend class KonqPixmapProviderSingleton;
 
-    QMap<QUrl, QString> iconMap;
+    QHash<QUrl, QString> iconMap;
+    // The URLs of iconMap for each host, so that a favicon update only looks at those
+    QHash<QString, QList<QUrl> > m_urlsByHost;
+    // The pixmaps last used, by icon name and size
+    QCache<QPair<QString, int>, QPixmap> m_pixmaps;
+    // The URLs for the texts last given to pixmapFor
+    QCache<QString, QUrl> m_userInputUrls;
 };
 
 #endif // KONQ_PIXMAPPROVIDER_H
@@ -24,6 +24,7 @@
 #include "konqsessionmanager_interface.h"
 #include "konqsessionmanageradaptor.h"
 #include "konqviewmanager.h"
+#include "konqview.h"
 #include "konqsettingsxt.h"
 
 #include <kglobal.h>
@@ -55,6 +56,7 @@
 #include <QDesktopWidget>
 #include <QStandardPaths>
 #include <QSessionManager>
+#include <QRunnable>
 #include <KSharedConfig>
 
 class KonqSessionManagerPrivate
@@ -75,6 +77,27 @@ public:
 
 K_GLOBAL_STATIC(KonqSessionManagerPrivate, myKonqSessionManagerPrivate)
 
+// Writes the autosaved session to disk, so that the GUI thread doesn't wait for it
+class KonqAutosaveWriter : public QRunnable
+{
+public:
+    KonqAutosaveWriter(KConfig *config, KonqSessionManager *manager)
+        : m_config(config), m_manager(manager)
+    {
+    }
+
+    void run() override
+    {
+        m_config->sync();
+        m_config->markAsClean();
+        QMetaObject::invokeMethod(m_manager, "slotAutosaveWritten", Qt::QueuedConnection);
+    }
+
+private:
+    KConfig *m_config;
+    KonqSessionManager *m_manager;
+};
+
 static QString viewIdFor(const QString &sessionFile, const QString &viewId)
 {
     return (sessionFile + viewId);
@@ -357,7 +380,10 @@ KonqSessionManager::KonqSessionManager()
     , m_autosaveEnabled(false) // so that enableAutosave works
     , m_createdOwnedByDir(false)
     , m_sessionConfig(nullptr)
+    , m_writingAutosave(false)
 {
+    m_autosavePool.setMaxThreadCount(1);
+
     // Initialize dbus interfaces
     new KonqSessionManagerAdaptor(this);
 
@@ -383,6 +409,7 @@ KonqSessionManager::KonqSessionManager()
 
 KonqSessionManager::~KonqSessionManager()
 {
+    waitForAutosave();
     if (m_sessionConfig) {
         QFile::remove(m_sessionConfig->name());
     }
@@ -405,6 +432,7 @@ void KonqSessionManager::disableAutosave()
 
     m_autosaveEnabled = false;
     m_autoSaveTimer.stop();
+    waitForAutosave();
     if (m_sessionConfig) {
         QFile::remove(m_sessionConfig->name());
         delete m_sessionConfig;
@@ -422,8 +450,11 @@ void KonqSessionManager::enableAutosave()
     QString filename = QLatin1String("autosave/") + m_baseService;
     const QString filePath = QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QLatin1Char('/') + filename;
 
+    waitForAutosave();
     delete m_sessionConfig;
     m_sessionConfig = new KConfig(filePath, KConfig::SimpleConfig);
+    m_autosavedWindows.clear();
+    m_autosavedViewPrefixes.clear();
     //qCDebug(KONQUEROR_LOG) << "config filename:" << m_sessionConfig->name();
 
     m_autosaveEnabled = true;
@@ -449,7 +480,9 @@ KonqSessionManager *KonqSessionManager::self()
 
 void KonqSessionManager::autoSaveSession()
 {
-    if (!m_autosaveEnabled) {
+    // If the previous autosave is still being written, this one will be done
+    // at the next timeout
+    if (!m_autosaveEnabled || m_writingAutosave) {
         return;
     }
 
@@ -458,17 +491,91 @@ void KonqSessionManager::autoSaveSession()
         m_autoSaveTimer.stop();
     }
 
-    saveCurrentSessionToFile(m_sessionConfig);
-    m_sessionConfig->sync();
-    m_sessionConfig->markAsClean();
+    saveChangesToAutosave();
+    if (m_sessionConfig->isDirty()) {
+        m_writingAutosave = true;
+        m_autosavePool.start(new KonqAutosaveWriter(m_sessionConfig, this));
+    } else {
+        // Nothing changed since the session was last written
+        deleteOwnedSessions();
+    }
+
+    if (isActive) {
+        m_autoSaveTimer.start();
+    }
+}
 
+void KonqSessionManager::slotAutosaveWritten()
+{
+    m_writingAutosave = false;
     // Now that we have saved current session it's safe to remove our owned_by
     // directory
     deleteOwnedSessions();
+}
 
-    if (isActive) {
-        m_autoSaveTimer.start();
+void KonqSessionManager::waitForAutosave()
+{
+    m_autosavePool.waitForDone();
+    m_writingAutosave = false;
+}
+
+static QStringList viewPrefixes(KonqMainWindow *window)
+{
+    QStringList prefixes;
+    foreach (KonqView *view, window->viewMap()) {
+        // Views which aren't saved with the window don't have a prefix
+        if (!view->sessionPrefix().isEmpty()) {
+            prefixes << view->sessionPrefix();
+        }
+    }
+    prefixes.sort();
+    return prefixes;
+}
+
+void KonqSessionManager::saveChangesToAutosave()
+{
+    QList<KonqMainWindow *> mainWindows;
+    if (KonqMainWindow::mainWindowList()) {
+        foreach (KonqMainWindow *window, *KonqMainWindow::mainWindowList()) {
+            if (!window->isPreloaded()) {
+                mainWindows << window;
+            }
+        }
     }
+    if (mainWindows.isEmpty()) {
+        return;
+    }
+
+    QHash<KonqMainWindow *, QStringList> viewPrefixesByWindow;
+    for (int i = 0; i < mainWindows.count(); ++i) {
+        KonqMainWindow *window = mainWindows.at(i);
+        KConfigGroup configGroup(m_sessionConfig, "Window" + QString::number(i));
+        const bool sameWindow = m_autosavedWindows.value(i) == window;
+        if (sameWindow) {
+            window->saveChangedProperties(configGroup);
+        }
+        QStringList prefixes = viewPrefixes(window);
+        // A different window, or views added or removed: save everything again,
+        // so that nothing is left from the views which aren't there anymore
+        if (!sameWindow || prefixes != m_autosavedViewPrefixes.value(window)) {
+            configGroup.deleteGroup();
+            foreach (KonqView *view, window->viewMap()) {
+                view->setSessionDirty();
+            }
+            window->saveChangedProperties(configGroup);
+            prefixes = viewPrefixes(window);
+        }
+        viewPrefixesByWindow.insert(window, prefixes);
+    }
+
+    for (int i = mainWindows.count(); i < m_autosavedWindows.count(); ++i) {
+        m_sessionConfig->deleteGroup("Window" + QString::number(i));
+    }
+    m_autosavedWindows = mainWindows;
+    m_autosavedViewPrefixes = viewPrefixesByWindow;
+
+    KConfigGroup configGroup(m_sessionConfig, "General");
+    configGroup.writeEntry("Number of Windows", mainWindows.count());
 }
 
 void KonqSessionManager::saveCurrentSessions(const QString &path)
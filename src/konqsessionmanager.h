@@ -25,6 +25,8 @@
 #include <QTimer>
 #include <QStringList>
 #include <QString>
+#include <QThreadPool>
+#include <QHash>
 
 #include <kconfig.h>
 #include <kdialog.h>
@@ -210,6 +212,23 @@ private:
     }
 
     void saveCurrentSessionToFile(KConfig *config, const QList<KonqMainWindow *> &mainWindows = QList<KonqMainWindow *>());
+
+    /**
+     * Updates m_sessionConfig with the changes since the last autosave.
+     * Only the views which changed are saved again, unless the windows, or
+     * the views in a window, changed: in that case the whole window is saved.
+     */
+    void saveChangesToAutosave();
+
+    /**
+     * Waits for the autosaved session to be written to disk, if it's being written
+     */
+    void waitForAutosave();
+private Q_SLOTS:
+    /**
+     * Called when the autosaved session has been written to disk
+     */
+    void slotAutosaveWritten();
 private:
     QTimer m_autoSaveTimer;
     QString m_autosaveDir;
@@ -217,6 +236,13 @@ private:
     bool m_autosaveEnabled;
     bool m_createdOwnedByDir;
     KConfig *m_sessionConfig;
+    // The autosaved session is written to disk in a thread: m_sessionConfig
+    // mustn't be used while m_writingAutosave is true
+    QThreadPool m_autosavePool;
+    bool m_writingAutosave;
+    // The windows in m_sessionConfig, in order, and the prefixes of their views
+    QList<KonqMainWindow *> m_autosavedWindows;
+    QHash<KonqMainWindow *, QStringList> m_autosavedViewPrefixes;
 
 Q_SIGNALS: // DBUS signals
     /**
@@ -0,0 +1,308 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "konqtabhibernator.h"
+#include "konqtabhibernatoradaptor.h"
+#include "konqmainwindow.h"
+#include "konqviewmanager.h"
+#include "konqview.h"
+#include "konqtabs.h"
+#include "konqframevisitor.h"
+#include "konqsettingsxt.h"
+#include "konqdebug.h"
+
+#include <kglobal.h>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDBusConnection>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QRunnable>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+// How often the limits are checked, in milliseconds
+#define HIBERNATION_CHECK_INTERVAL 10000
+
+// The memory used by Konqueror and its child processes in KB, or -1 if it isn't known
+static qint64 readResidentMemory()
+{
+#ifdef Q_OS_LINUX
+    // The web engine runs in child processes, and in their children,
+    // so add the resident set size of all the descendants of this process
+    static const qint64 pageSize = sysconf(_SC_PAGESIZE) / 1024;
+    QHash<qint64, qint64> parents;
+    QHash<qint64, qint64> sizes;
+    const QStringList processes = QDir(QStringLiteral("/proc")).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString &process : processes) {
+        bool ok;
+        const qint64 pid = process.toLongLong(&ok);
+        if (!ok) {
+            continue;
+        }
+        QFile file(QLatin1String("/proc/") + process + QLatin1String("/stat"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        // The name, in parentheses, can contain spaces: the other fields follow the last ')'
+        const QByteArray stat = file.readAll();
+        const QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+        if (fields.count() < 22) {
+            continue;
+        }
+        parents.insert(pid, fields.at(1).toLongLong());
+        sizes.insert(pid, fields.at(21).toLongLong() * pageSize);
+    }
+
+    const qint64 self = QCoreApplication::applicationPid();
+    qint64 total = 0;
+    for (auto it = sizes.constBegin(); it != sizes.constEnd(); ++it) {
+        qint64 pid = it.key();
+        while (pid > 1 && pid != self) {
+            pid = parents.value(pid, 0);
+        }
+        if (pid == self) {
+            total += it.value();
+        }
+    }
+    return total;
+#else
+    return -1;
+#endif
+}
+
+// Reads the memory used by Konqueror, so that the GUI thread doesn't scan /proc
+class KonqResidentMemoryReader : public QRunnable
+{
+public:
+    explicit KonqResidentMemoryReader(KonqTabHibernator *hibernator)
+        : m_hibernator(hibernator)
+    {
+    }
+
+    void run() override
+    {
+        QMetaObject::invokeMethod(m_hibernator, "slotResidentMemoryRead", Qt::QueuedConnection, Q_ARG(qint64, readResidentMemory()));
+    }
+
+private:
+    KonqTabHibernator *m_hibernator;
+};
+
+class KonqTabHibernatorSingleton
+{
+public:
+    KonqTabHibernator self;
+};
+
+K_GLOBAL_STATIC(KonqTabHibernatorSingleton, globalTabHibernator)
+
+KonqTabHibernator *KonqTabHibernator::self()
+{
+    return &globalTabHibernator->self;
+}
+
+KonqTabHibernator::KonqTabHibernator()
+    : QObject(nullptr)
+    , m_maxResidentTabs(0)
+    , m_memoryBudget(0)
+    , m_hibernationCount(0)
+{
+    new KonqTabHibernatorAdaptor(this);
+    QDBusConnection::sessionBus().registerObject(QStringLiteral("/KonqTabHibernator"), this);
+
+    m_checkTimer.setInterval(HIBERNATION_CHECK_INTERVAL);
+    connect(&m_checkTimer, &QTimer::timeout, this, &KonqTabHibernator::slotCheckTabs);
+    m_memoryPool.setMaxThreadCount(1);
+    reparseConfiguration();
+}
+
+void KonqTabHibernator::reparseConfiguration()
+{
+    m_maxResidentTabs = KonqSettings::maxResidentTabs();
+    m_memoryBudget = qint64(KonqSettings::memoryBudget()) * 1024;
+    if (m_maxResidentTabs > 0 || m_memoryBudget > 0) {
+        m_checkTimer.start();
+    } else {
+        m_checkTimer.stop();
+    }
+}
+
+void KonqTabHibernator::tabActivated(KonqFrameBase *tab)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QList<KonqView *> views = KonqViewCollector::collect(tab);
+    for (KonqView *view : views) {
+        view->setLastActivationTime(now);
+    }
+}
+
+QList<KonqTabHibernator::Tab> KonqTabHibernator::tabs() const
+{
+    QList<Tab> result;
+    const QList<KonqMainWindow *> *mainWindows = KonqMainWindow::mainWindowList();
+    if (!mainWindows) {
+        return result;
+    }
+    for (KonqMainWindow *mainWindow : *mainWindows) {
+        // A preloaded window isn't shown yet, its tab doesn't count
+        if (mainWindow->isPreloaded()) {
+            continue;
+        }
+        KonqFrameTabs *tabContainer = mainWindow->viewManager()->existingTabContainer();
+        if (!tabContainer) {
+            continue;
+        }
+        const int currentIndex = tabContainer->currentIndex();
+        for (int i = 0; i < tabContainer->count(); ++i) {
+            Tab tab;
+            tab.frame = tabContainer->tabAt(i);
+            tab.lastActivationTime = 0;
+            tab.current = (i == currentIndex);
+            tab.resident = false;
+            const QList<KonqView *> views = KonqViewCollector::collect(tab.frame);
+            for (KonqView *view : views) {
+                tab.lastActivationTime = qMax(tab.lastActivationTime, view->lastActivationTime());
+                if (!view->isHistoryRestorePending()) {
+                    tab.resident = true;
+                }
+            }
+            result.append(tab);
+        }
+    }
+    return result;
+}
+
+bool KonqTabHibernator::hibernate(const Tab &tab)
+{
+    bool hibernated = false;
+    const QList<KonqView *> views = KonqViewCollector::collect(tab.frame);
+    for (KonqView *view : views) {
+        if (!view->isHistoryRestorePending() && view->hibernate()) {
+            hibernated = true;
+        }
+    }
+    if (hibernated) {
+        ++m_hibernationCount;
+    }
+    return hibernated;
+}
+
+QList<KonqTabHibernator::Tab> KonqTabHibernator::hibernationCandidates(int *residentTabs) const
+{
+    const QList<Tab> allTabs = tabs();
+    int resident = 0;
+    QList<Tab> candidates;
+    for (const Tab &tab : allTabs) {
+        if (tab.resident) {
+            ++resident;
+            if (!tab.current) {
+                candidates.append(tab);
+            }
+        }
+    }
+
+    // Least recently shown first
+    std::sort(candidates.begin(), candidates.end(), [](const Tab &lhs, const Tab &rhs) {
+        return lhs.lastActivationTime < rhs.lastActivationTime;
+    });
+    if (residentTabs) {
+        *residentTabs = resident;
+    }
+    return candidates;
+}
+
+void KonqTabHibernator::slotCheckTabs()
+{
+    if (m_maxResidentTabs > 0) {
+        int residentTabs = 0;
+        const QList<Tab> candidates = hibernationCandidates(&residentTabs);
+        for (int i = 0; i < candidates.count() && residentTabs > m_maxResidentTabs; ++i) {
+            if (hibernate(candidates.at(i))) {
+                --residentTabs;
+            }
+        }
+    }
+
+    // Reading the memory of all the processes takes a while: it's done in a thread,
+    // and the tabs are checked against the budget when it's finished
+    if (m_memoryBudget > 0 && m_memoryPool.activeThreadCount() == 0) {
+        m_memoryPool.start(new KonqResidentMemoryReader(this));
+    }
+}
+
+void KonqTabHibernator::slotResidentMemoryRead(qint64 memory)
+{
+    if (m_memoryBudget <= 0 || memory <= m_memoryBudget) {
+        return;
+    }
+    // The web engine processes take a while to free their memory,
+    // so only one tab is hibernated until the next check
+    const QList<Tab> candidates = hibernationCandidates(nullptr);
+    for (const Tab &tab : candidates) {
+        if (hibernate(tab)) {
+            break;
+        }
+    }
+}
+
+int KonqTabHibernator::hibernateBackgroundTabs()
+{
+    int count = 0;
+    const QList<Tab> allTabs = tabs();
+    for (const Tab &tab : allTabs) {
+        if (tab.resident && !tab.current && hibernate(tab)) {
+            ++count;
+        }
+    }
+    qCDebug(KONQUEROR_LOG) << "Hibernated" << count << "tabs";
+    return count;
+}
+
+int KonqTabHibernator::residentTabCount() const
+{
+    const QList<Tab> allTabs = tabs();
+    return std::count_if(allTabs.begin(), allTabs.end(), [](const Tab &tab) {
+        return tab.resident;
+    });
+}
+
+int KonqTabHibernator::hibernatedTabCount() const
+{
+    const QList<Tab> allTabs = tabs();
+    return std::count_if(allTabs.begin(), allTabs.end(), [](const Tab &tab) {
+        return !tab.resident;
+    });
+}
+
+int KonqTabHibernator::hibernationCount() const
+{
+    return m_hibernationCount;
+}
+
+qint64 KonqTabHibernator::residentMemory() const
+{
+    return readResidentMemory();
+}
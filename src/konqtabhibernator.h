@@ -0,0 +1,102 @@
+/* This file is part of the KDE project
+   Copyright 2020 The Konqueror developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KONQTABHIBERNATOR_H
+#define KONQTABHIBERNATOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QThreadPool>
+
+class KonqFrameBase;
+
+/**
+ * Frees the memory used by the tabs which weren't shown for the longest time,
+ * when there are more than TabHibernationSettings/MaxResidentTabs tabs with a
+ * loaded page, or when Konqueror and its web engine processes use more than
+ * TabHibernationSettings/MemoryBudget MB.
+ *
+ * A hibernated tab keeps its history, title and icon, and its page is opened
+ * again when the tab is shown (see KonqView::hibernate()).
+ *
+ * This class is a singleton, use self() to access its only instance.
+ * It is available on D-Bus as /KonqTabHibernator.
+ */
+class KonqTabHibernator : public QObject
+{
+    Q_OBJECT
+
+public:
+    static KonqTabHibernator *self();
+
+    void reparseConfiguration();
+
+    /**
+     * Called when @p tab is shown
+     */
+    void tabActivated(KonqFrameBase *tab);
+
+public Q_SLOTS:
+    /**
+     * Hibernates all the tabs which aren't the current one of their window
+     * @return the number of tabs hibernated
+     */
+    int hibernateBackgroundTabs();
+
+    int residentTabCount() const;
+    int hibernatedTabCount() const;
+
+    /**
+     * @return the number of tabs hibernated since Konqueror was started
+     */
+    int hibernationCount() const;
+
+    /**
+     * @return the memory used by Konqueror and its child processes in KB,
+     * or -1 if it isn't known on this platform
+     */
+    qint64 residentMemory() const;
+
+private Q_SLOTS:
+    void slotCheckTabs();
+    void slotResidentMemoryRead(qint64 memory);
+
+private:
+    explicit KonqTabHibernator();
+    friend class KonqTabHibernatorSingleton;
+
+    struct Tab {
+        KonqFrameBase *frame;
+        qint64 lastActivationTime;
+        bool current;
+        bool resident;
+    };
+    QList<Tab> tabs() const;
+    // The resident tabs which aren't current, least recently shown first
+    QList<Tab> hibernationCandidates(int *residentTabs) const;
+    bool hibernate(const Tab &tab);
+
+    QTimer m_checkTimer;
+    QThreadPool m_memoryPool;
+    int m_maxResidentTabs;
+    qint64 m_memoryBudget; // in KB
+    int m_hibernationCount;
+};
+
+#endif /* KONQTABHIBERNATOR_H */
@@ -41,6 +41,7 @@
 #include "konqmisc.h"
 #include "konqsettingsxt.h"
 #include "konqframevisitor.h"
+#include "konqtabhibernator.h"
 
 #include <kacceleratormanager.h>
 #include <konqpixmapprovider.h>
@@ -534,6 +535,8 @@ void KonqFrameTabs::slotCurrentChanged(int index)
     KonqFrameBase *currentFrame = tabAt(index);
     if (currentFrame && !m_pViewManager->isLoadingProfile()) {
         m_pActiveChild = currentFrame;
+        m_pViewManager->restorePendingHistory(currentFrame);
+        KonqTabHibernator::self()->tabActivated(currentFrame);
         currentFrame->activateChild();
     }
 
@@ -51,6 +51,7 @@
 #include <QFile>
 #include <QDropEvent>
 #include <QDBusConnection>
+#include <QDateTime>
 #include <QMimeData>
 #ifdef KActivities_FOUND
 #endif
@@ -112,6 +113,9 @@ KonqView::KonqView(KonqViewFactory &viewFactory,
     m_bBuiltinView = false;
     m_bURLDropHandling = false;
     m_bErrorURL = false;
+    m_bSessionDirty = true;
+    m_bHistoryRestorePending = false;
+    m_lastActivationTime = QDateTime::currentMSecsSinceEpoch();
 
 #ifdef KActivities_FOUND
     m_activityResourceInstance = new KActivities::ResourceInstance(mainWindow->winId(), this);
@@ -185,6 +189,7 @@ void KonqView::openUrl(const QUrl &url, const QString &locationBarURL,
     } else {
         m_bLockHistory = false;
     }
+    m_bHistoryRestorePending = false;
 
     if (m_pPart) {
         m_pPart->setProperty("nameFilter", nameFilter);
@@ -587,6 +592,7 @@ void KonqView::slotCompleted(bool hasPending)
 
         emit viewCompleted(this);
     }
+    m_bSessionDirty = true;
     setLoading(false, hasPending);
 
     if (!m_bGotIconURL && !m_bAborted) {
@@ -632,6 +638,7 @@ void KonqView::setLocationBarURL(const QString &locationBarURL)
 {
     //qCDebug(KONQUEROR_LOG) << locationBarURL << "this=" << this;
     m_sLocationBarURL = locationBarURL;
+    m_bSessionDirty = true;
     if (m_pMainWindow->currentView() == this) {
         //qCDebug(KONQUEROR_LOG) << "is current view" << this;
         m_pMainWindow->setLocationBarURL(m_sLocationBarURL);
@@ -689,6 +696,7 @@ void KonqView::setCaption(const QString &caption)
     }
 
     m_caption = adjustedCaption;
+    m_bSessionDirty = true;
     if (!m_bPassiveMode) {
         frame()->setTitle(adjustedCaption, nullptr);
     }
@@ -737,6 +745,7 @@ void KonqView::appendHistoryEntry(HistoryEntry *historyEntry)
     }
 
     m_lstHistory.append(historyEntry);
+    m_bSessionDirty = true;
 }
 
 void KonqView::updateHistoryEntry(bool saveLocationBarURL)
@@ -744,13 +753,15 @@ void KonqView::updateHistoryEntry(bool saveLocationBarURL)
     Q_ASSERT(!m_bLockHistory);   // should never happen
 
     HistoryEntry *current = currentHistoryEntry();
-    if (!current) {
+    // The part doesn't show the current entry yet, keep it as it was loaded
+    if (!current || m_bHistoryRestorePending) {
         return;
     }
 
     current->reload = false; // We have a state for it now.
     if (browserExtension()) {
         current->buffer = QByteArray(); // Start with empty buffer.
+        current->bufferCompressed = false;
         QDataStream stream(&current->buffer, QIODevice::WriteOnly);
 
         browserExtension()->saveState(stream);
@@ -825,10 +836,25 @@ void KonqView::go(int steps)
     restoreHistory();
 }
 
+void KonqView::setHistoryIndex(int index)
+{
+    // The state of the part is saved again at each navigation: keep only the one of the
+    // current entry uncompressed, the parts may store their whole history in it
+    if (index != m_lstHistoryIndex) {
+        HistoryEntry *previous = m_lstHistory.value(m_lstHistoryIndex);
+        if (previous) {
+            previous->compressBuffer();
+        }
+    }
+    m_lstHistoryIndex = index;
+    m_bSessionDirty = true;
+}
+
 void KonqView::restoreHistory()
 {
     HistoryEntry h(*currentHistoryEntry());   // make a copy of the current history entry, as the data
     // the pointer points to will change with the following calls
+    m_bHistoryRestorePending = false;
 
 #ifdef DEBUG_HISTORY
     qCDebug(KONQUEROR_LOG) << "Restoring servicetype/name, and location bar URL from history:" << h.locationBarURL;
@@ -848,7 +874,8 @@ void KonqView::restoreHistory()
 
     if (h.reload == false && browserExtension()) {
         //qCDebug(KONQUEROR_LOG) << "Restoring view from stream";
-        QDataStream stream(h.buffer);
+        const QByteArray buffer = h.uncompressedBuffer();
+        QDataStream stream(buffer);
 
         browserExtension()->restoreState(stream);
 
@@ -972,6 +999,7 @@ void KonqView::setPassiveMode(bool mode)
     // the part should be removed from the part manager,
     // and if the other way round, it should be readded to the part manager...
     m_bPassiveMode = mode;
+    m_bSessionDirty = true;
 
     if (mode && m_pMainWindow->viewCount() > 1 && m_pMainWindow->currentView() == this) {
         KParts::Part *part = m_pMainWindow->viewManager()->chooseNextView(this)->part();    // switch active part
@@ -985,6 +1013,7 @@ void KonqView::setPassiveMode(bool mode)
 void KonqView::setLinkedView(bool mode)
 {
     m_bLinkedView = mode;
+    m_bSessionDirty = true;
     if (m_pMainWindow->currentView() == this) {
         m_pMainWindow->linkViewAction()->setChecked(mode);
     }
@@ -994,6 +1023,7 @@ void KonqView::setLinkedView(bool mode)
 void KonqView::setLockedLocation(bool b)
 {
     m_bLockedLocation = b;
+    m_bSessionDirty = true;
 }
 
 void KonqView::aboutToOpenURL(const QUrl &url, const KParts::OpenUrlArguments &args)
@@ -1305,7 +1335,9 @@ void HistoryEntry::saveConfig(KConfigGroup &config, const QString &prefix, const
         config.writeEntry(QStringLiteral("Url").prepend(prefix), url.url());
         config.writeEntry(QStringLiteral("LocationBarURL").prepend(prefix), locationBarURL);
         config.writeEntry(QStringLiteral("Title").prepend(prefix), title);
-        config.writeEntry(QStringLiteral("Buffer").prepend(prefix), buffer);
+        // The part's state of the current entry is kept uncompressed in memory,
+        // where it's updated at every navigation, and compressed only when it's written
+        config.writeEntry(QStringLiteral("CompressedBuffer").prepend(prefix), (bufferCompressed || buffer.isEmpty()) ? buffer : qCompress(buffer, 1));
         config.writeEntry(QStringLiteral("StrServiceType").prepend(prefix), strServiceType);
         config.writeEntry(QStringLiteral("StrServiceName").prepend(prefix), strServiceName);
         config.writeEntry(QStringLiteral("PostData").prepend(prefix), postData);
@@ -1316,6 +1348,19 @@ void HistoryEntry::saveConfig(KConfigGroup &config, const QString &prefix, const
     }
 }
 
+void HistoryEntry::compressBuffer()
+{
+    if (!bufferCompressed && !buffer.isEmpty()) {
+        buffer = qCompress(buffer, 1);
+        bufferCompressed = true;
+    }
+}
+
+QByteArray HistoryEntry::uncompressedBuffer() const
+{
+    return bufferCompressed ? qUncompress(buffer) : buffer;
+}
+
 void HistoryEntry::loadItem(const KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options)
 {
     if (options & KonqFrameBase::saveURLs) {
@@ -1329,7 +1374,15 @@ void HistoryEntry::loadItem(const KConfigGroup &config, const QString &prefix, c
         url = QUrl(config.readEntry(QStringLiteral("Url").prepend(prefix), ""));
         locationBarURL = config.readEntry(QStringLiteral("LocationBarURL").prepend(prefix), "");
         title = config.readEntry(QStringLiteral("Title").prepend(prefix), "");
-        buffer = config.readEntry(QStringLiteral("Buffer").prepend(prefix), QByteArray());
+        const QString compressedBufferKey = QStringLiteral("CompressedBuffer").prepend(prefix);
+        if (config.hasKey(compressedBufferKey)) {
+            // Uncompressed only when it's restored, see KonqView::restoreHistory
+            buffer = config.readEntry(compressedBufferKey, QByteArray());
+            bufferCompressed = !buffer.isEmpty();
+        } else {
+            buffer = config.readEntry(QStringLiteral("Buffer").prepend(prefix), QByteArray());
+            bufferCompressed = false;
+        }
         strServiceType = config.readEntry(QStringLiteral("StrServiceType").prepend(prefix), "");
         strServiceName = config.readEntry(QStringLiteral("StrServiceName").prepend(prefix), "");
         postData = config.readEntry(QStringLiteral("PostData").prepend(prefix), QByteArray());
@@ -1344,6 +1397,23 @@ void HistoryEntry::loadItem(const KConfigGroup &config, const QString &prefix, c
 
 void KonqView::saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options)
 {
+    if (options & KonqFrameBase::trackSessionChanges) {
+        // The entries written by the last autosave are still valid
+        if (!m_bSessionDirty && prefix == m_sessionPrefix) {
+            return;
+        }
+        // Remove what's left from the view previously saved with this prefix, e.g. history items
+        const QString historyPrefix = QLatin1String("HistoryItem") + prefix;
+        const QStringList keys = config.keyList();
+        for (const QString &key : keys) {
+            if (key.startsWith(prefix) || key.startsWith(historyPrefix)) {
+                config.deleteEntry(key);
+            }
+        }
+        m_bSessionDirty = false;
+        m_sessionPrefix = prefix;
+    }
+
     config.writeEntry(QStringLiteral("ServiceType").prepend(prefix), serviceType());
     config.writeEntry(QStringLiteral("ServiceName").prepend(prefix), service()->desktopEntryName());
     config.writeEntry(QStringLiteral("PassiveMode").prepend(prefix), isPassiveMode());
@@ -1352,7 +1422,8 @@ void KonqView::saveConfig(KConfigGroup &config, const QString &prefix, const Kon
     config.writeEntry(QStringLiteral("LockedLocation").prepend(prefix), isLockedLocation());
 
     if (options & KonqFrameBase::saveURLs) {
-        config.writePathEntry(QStringLiteral("URL").prepend(prefix), url().url());
+        const QUrl savedUrl = m_bHistoryRestorePending ? currentHistoryEntry()->url : url();
+        config.writePathEntry(QStringLiteral("URL").prepend(prefix), savedUrl.url());
     } else if (options & KonqFrameBase::saveHistoryItems) {
         if (m_pPart && !m_bLockHistory) {
             updateHistoryEntry(true);
@@ -1376,7 +1447,7 @@ void KonqView::saveConfig(KConfigGroup &config, const QString &prefix, const Kon
     }
 }
 
-void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &prefix)
+void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &prefix, bool restoreNow)
 {
     // First, remove any history
     qDeleteAll(m_lstHistory);
@@ -1415,7 +1486,50 @@ void KonqView::loadHistoryConfig(const KConfigGroup &config, const QString &pref
 
     // set and load the correct history index
     setHistoryIndex(currentIndex);
-    restoreHistory();
+    if (restoreNow) {
+        restoreHistory();
+        return;
+    }
+
+    // Only show what the tab will contain, the part opens it in restorePendingHistory()
+    const HistoryEntry *current = currentHistoryEntry();
+    m_bHistoryRestorePending = true;
+    setLocationBarURL(current->locationBarURL);
+    setPageSecurity(current->pageSecurity);
+    setCaption(current->title.isEmpty() ? current->locationBarURL : current->title);
+}
+
+void KonqView::restorePendingHistory()
+{
+    if (m_bHistoryRestorePending) {
+        restoreHistory();
+    }
+}
+
+bool KonqView::hibernate()
+{
+    if (m_bHistoryRestorePending) {
+        return true;
+    }
+    // Without a browser extension the part can't save the state of its page.
+    // Restoring a page which was posted would post it again.
+    if (m_bLoading || m_bLockHistory || m_pRun || m_bPassiveMode || m_bToggleView ||
+            !browserExtension() || !currentHistoryEntry() || m_doPost) {
+        return false;
+    }
+
+    KService::List partServiceOffers, appServiceOffers;
+    KService::Ptr service;
+    KonqFactory konqFactory;
+    KonqViewFactory viewFactory = konqFactory.createView(m_serviceType, m_service->desktopEntryName(), &service, &partServiceOffers, &appServiceOffers, true /*forceAutoEmbed*/);
+    if (viewFactory.isNull()) {
+        return false;
+    }
+
+    updateHistoryEntry(true);
+    switchView(viewFactory);
+    m_bHistoryRestorePending = true;
+    return true;
 }
 
 QString KonqView::internalViewMode() const
@@ -57,11 +57,14 @@ class ResourceInstance;
 struct HistoryEntry {
     void loadItem(const KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
     void saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
+    void compressBuffer();
+    QByteArray uncompressedBuffer() const;
 
     QUrl url;
     QString locationBarURL; // can be different from url when showing a index.html
     QString title;
-    QByteArray buffer;
+    QByteArray buffer; // the state of the part, compressed unless it was saved while the entry was current
+    bool bufferCompressed = false;
     QString strServiceType;
     QString strServiceName;
     QByteArray postData;
@@ -187,10 +190,7 @@ public:
      */
     void restoreHistory();
 
-    void setHistoryIndex(int index)
-    {
-        m_lstHistoryIndex = index;
-    }
+    void setHistoryIndex(int index);
 
     /**
      * @return the history of this view
@@ -218,6 +218,24 @@ public:
      */
     void copyHistory(KonqView *other);
 
+    /**
+     * Marks the view as changed since it was last autosaved, so that the next
+     * autosave writes it again (see KonqFrameBase::trackSessionChanges)
+     */
+    void setSessionDirty()
+    {
+        m_bSessionDirty = true;
+    }
+
+    /**
+     * @return the prefix of the view's entries in the autosaved session,
+     * or an empty string if it wasn't autosaved yet
+     */
+    QString sessionPrefix() const
+    {
+        return m_sessionPrefix;
+    }
+
     /**
      * Set the KonqRun instance that is running something for this view
      * The main window uses this to store the KonqRun for each child view.
@@ -385,6 +403,7 @@ public:
     void setToggleView(bool b)
     {
         m_bToggleView = b;
+        m_bSessionDirty = true;
     }
     bool isToggleView() const
     {
@@ -503,7 +522,47 @@ public:
      * Saves config in a KConfigGroup
      */
     void saveConfig(KConfigGroup &config, const QString &prefix, const KonqFrameBase::Options &options);
-    void loadHistoryConfig(const KConfigGroup &config, const QString &prefix);
+
+    /**
+     * Loads the history saved by saveConfig.
+     * @param restoreNow if false, only the title and the location of the current
+     * history entry are shown, and the URL isn't opened until restorePendingHistory()
+     * is called, e.g. when the tab is first shown
+     */
+    void loadHistoryConfig(const KConfigGroup &config, const QString &prefix, bool restoreNow = true);
+
+    /**
+     * @return true if the history was loaded but the current entry wasn't opened yet
+     */
+    bool isHistoryRestorePending() const
+    {
+        return m_bHistoryRestorePending;
+    }
+
+    /**
+     * Opens the current history entry, if loadHistoryConfig didn't do it
+     */
+    void restorePendingHistory();
+
+    /**
+     * Replaces the part with a new, empty one, to free the memory used by the page it shows.
+     * The history is kept, and the current entry is opened again by restorePendingHistory().
+     * @return false if the part can't be replaced right now, e.g. because it's loading
+     */
+    bool hibernate();
+
+    /**
+     * @return when the tab of this view was last shown, in milliseconds since the epoch
+     */
+    qint64 lastActivationTime() const
+    {
+        return m_lastActivationTime;
+    }
+
+    void setLastActivationTime(qint64 time)
+    {
+        m_lastActivationTime = time;
+    }
 
     static QStringList childFrameNames(KParts::ReadOnlyPart *part);
 
@@ -652,6 +711,13 @@ private:
     uint m_bURLDropHandling: 1;
     uint m_bDisableScrolling: 1;
     uint m_bErrorURL: 1;
+    uint m_bSessionDirty: 1;
+    uint m_bHistoryRestorePending: 1;
+    qint64 m_lastActivationTime;
+    /**
+     * The prefix the view was last autosaved with
+     */
+    QString m_sessionPrefix;
     KService::List m_partServiceOffers;
     KService::List m_appServiceOffers;
     KService::Ptr m_service;
@@ -28,6 +28,7 @@
 #include "konqtabs.h"
 #include "konqsettingsxt.h"
 #include "konqframevisitor.h"
+#include "konqtabhibernator.h"
 #include <konq_events.h>
 
 #include <QFileInfo>
@@ -59,8 +60,15 @@ KonqViewManager::KonqViewManager(KonqMainWindow *mainWindow)
     m_pMainWindow = mainWindow;
 
     m_bLoadingProfile = false;
+    m_bDelayHistoryRestore = false;
+    m_tabsToRestore = 0;
     m_tabContainer = nullptr;
 
+    // One tab at a time, to leave some room to the tab being used
+    m_restoreTabsTimer.setSingleShot(true);
+    m_restoreTabsTimer.setInterval(500);
+    connect(&m_restoreTabsTimer, &QTimer::timeout, this, &KonqViewManager::slotRestoreNextPendingTab);
+
     setIgnoreExplictFocusRequests(true);
 
     connect(this, SIGNAL(activePartChanged(KParts::Part*)),
@@ -1102,6 +1110,44 @@ void KonqViewManager::loadRootItem(const KConfigGroup &cfg, KonqFrameContainerBa
     // This flag disables calls to viewCountChanged while creating the views,
     // so we do it once at the end:
     viewCountChanged();
+
+    if (rootItem.startsWith(QLatin1String("Tabs"))) {
+        m_tabsToRestore = KonqSettings::backgroundRestoredTabs();
+    }
+    if (m_tabsToRestore > 0) {
+        m_restoreTabsTimer.start();
+    }
+}
+
+bool KonqViewManager::restorePendingHistory(KonqFrameBase *frame)
+{
+    bool restored = false;
+    const QList<KonqView *> views = KonqViewCollector::collect(frame);
+    for (KonqView *view : views) {
+        if (view->isHistoryRestorePending()) {
+            view->restorePendingHistory();
+            restored = true;
+        }
+    }
+    return restored;
+}
+
+void KonqViewManager::slotRestoreNextPendingTab()
+{
+    if (!m_tabContainer || m_tabsToRestore <= 0) {
+        return;
+    }
+
+    // The tabs following the current one are the most likely to be shown next
+    for (int i = m_tabContainer->currentIndex() + 1; i < m_tabContainer->count(); ++i) {
+        if (restorePendingHistory(m_tabContainer->tabAt(i))) {
+            if (--m_tabsToRestore > 0) {
+                m_restoreTabsTimer.start();
+            }
+            return;
+        }
+    }
+    m_tabsToRestore = 0;
 }
 
 void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *parent,
@@ -1178,7 +1224,7 @@ void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *
         if (openUrl) {
             const QString keyHistoryItems = QStringLiteral("NumberOfHistoryItems").prepend(prefix);
             if (cfg.hasKey(keyHistoryItems)) {
-                childView->loadHistoryConfig(cfg, prefix);
+                childView->loadHistoryConfig(cfg, prefix, !m_bDelayHistoryRestore);
                 m_pMainWindow->updateHistoryActions();
             } else {
                 // determine URL
@@ -1265,9 +1311,13 @@ void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *
             parent->insertChildFrame(m_tabContainer);
         }
 
+        // Only the current tab opens its URL now, the others when they're first shown
+        // (see KonqFrameTabs::slotCurrentChanged), so that restoring many tabs is fast
+        const bool delayHistoryRestore = m_bDelayHistoryRestore;
         const QStringList childList = cfg.readEntry(QStringLiteral("Children").prepend(prefix), QStringList());
-        for (QStringList::const_iterator it = childList.begin(); it != childList.end(); ++it) {
-            loadItem(cfg, tabContainer(), *it, defaultURL, openUrl, forcedUrl, forcedService);
+        for (int i = 0; i < childList.count(); ++i) {
+            m_bDelayHistoryRestore = (i != index);
+            loadItem(cfg, tabContainer(), childList.at(i), defaultURL, openUrl, forcedUrl, forcedService);
             QWidget *currentPage = m_tabContainer->currentWidget();
             if (currentPage != nullptr) {
                 KonqView *activeChildView = dynamic_cast<KonqFrameBase *>(currentPage)->activeChildView();
@@ -1277,11 +1327,14 @@ void KonqViewManager::loadItem(const KConfigGroup &cfg, KonqFrameContainerBase *
                 }
             }
         }
+        m_bDelayHistoryRestore = delayHistoryRestore;
 
         QWidget *w = m_tabContainer->widget(index);
         if (w) {
             m_tabContainer->setActiveChild(dynamic_cast<KonqFrameBase *>(w));
             m_tabContainer->setCurrentIndex(index);
+            // slotCurrentChanged doesn't see it while the profile is loading
+            KonqTabHibernator::self()->tabActivated(dynamic_cast<KonqFrameBase *>(w));
             m_tabContainer->show();
         } else {
             qCWarning(KONQUEROR_LOG) << "Profile Loading Error: Unknown current item index" << index;
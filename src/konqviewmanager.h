@@ -27,6 +27,7 @@
 
 #include <QMap>
 #include <QPointer>
+#include <QTimer>
 #include <QUrl>
 
 #include <KService>
@@ -158,6 +159,14 @@ public:
      */
     KonqFrameTabs *tabContainer();
 
+    /**
+     * Returns the tabwidget, or nullptr if it wasn't created yet.
+     */
+    KonqFrameTabs *existingTabContainer() const
+    {
+        return m_tabContainer;
+    }
+
     /**
      * Returns true if the tabwidget exists and the tabbar is visible
      */
@@ -283,9 +292,18 @@ public Q_SLOTS:
      */
     void openClosedTab(const KonqClosedTabItem &closedTab);
 
+    /**
+     * Opens the current history entry of the views in @p frame which were
+     * restored without opening it, see KonqView::restorePendingHistory()
+     * @return true if there was such a view
+     */
+    bool restorePendingHistory(KonqFrameBase *frame);
+
 private Q_SLOTS:
     void emitActivePartChanged();
 
+    void slotRestoreNextPendingTab();
+
     void slotPassiveModePartDeleted();
 
     void slotActivePartChanged(KParts::Part *newPart);
@@ -358,6 +376,12 @@ private:
 
     bool m_bLoadingProfile;
 
+    // Set while loading the tabs which aren't shown, whose URLs are opened later
+    bool m_bDelayHistoryRestore;
+    // The number of tabs following the current one still to be opened in the background
+    int m_tabsToRestore;
+    QTimer m_restoreTabsTimer;
+
     QMap<QString /*display name*/, QString /*path to file*/> m_mapProfileNames;
 };
 
@@ -0,0 +1,518 @@
+/*
+ * This file is part of the KDE project
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <settings/webengine_filter.h>
+
+#include <QTest>
+#include <QTemporaryDir>
+#include <QFile>
+
+#include <cstring>
+
+using namespace KDEPrivate;
+
+// Offsets of some fields of the header of the cache files, see CompiledHeader in webengine_filter.cpp
+static const int s_versionOffset = 8;
+static const int s_nodeCountOffset = 40;
+static const int s_nodesOffsetOffset = 44;
+static const int s_edgeCountOffset = 48;
+static const int s_edgesOffsetOffset = 52;
+static const int s_filterCountOffset = 64;
+
+// Offsets of the links of a node, see CompiledNode in webengine_filter.cpp
+static const int s_nodeSize = 24;
+static const int s_failOffset = 8;
+static const int s_dictLinkOffset = 12;
+
+static quint32 readField(const QByteArray &data, int offset)
+{
+    quint32 value;
+    std::memcpy(&value, data.constData() + offset, sizeof(value));
+    return value;
+}
+
+static void writeField(QByteArray &data, int offset, quint32 value)
+{
+    std::memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+class WebEngineFilterTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void shouldFollowFailureLinks();
+    void shouldFollowDictionaryLinks();
+    void shouldCompareBeyondTheKey();
+    void shouldMatchAfterLoadingCache();
+    void shouldRejectCacheWithOtherSignature();
+    void shouldRejectCorruptedCache_data();
+    void shouldRejectCorruptedCache();
+    void shouldMatchPattern_data();
+    void shouldMatchPattern();
+    void shouldCheckOptions_data();
+    void shouldCheckOptions();
+    void shouldFindThirdPartyRequests_data();
+    void shouldFindThirdPartyRequests();
+    void shouldMatchImportantFiltersOnly();
+    void shouldStripExceptionMarker();
+    void shouldSkipCommentsAndElementHidingRules();
+    void shouldHideElements_data();
+    void shouldHideElements();
+    void shouldShareStyleSheetsOnlyWhenEquivalent();
+
+private:
+    static void fillSet(FilterSet &set);
+    static void fillSet(ElementHidingSet &set);
+    // The selectors hidden by the stylesheet for host, sorted
+    static QStringList hiddenSelectors(const ElementHidingSet &set, const QString &host);
+    static void checkSet(FilterSet &set);
+
+    QTemporaryDir m_dir;
+    QByteArray m_signature;
+};
+
+QTEST_GUILESS_MAIN(WebEngineFilterTest)
+
+void WebEngineFilterTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_signature = QByteArray(20, 's');
+}
+
+void WebEngineFilterTest::shouldFollowFailureLinks()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("abcx"));
+    set.addFilter(QStringLiteral("bcd"));
+
+    // After abc, the automaton must fall back to bc to find bcd
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://h/abcd")), QStringLiteral("bcd"));
+    // and from ab to nothing, then start over
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://h/ababcx")), QStringLiteral("abcx"));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://h/abcbcx")));
+}
+
+void WebEngineFilterTest::shouldFollowDictionaryLinks()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("xabc$script"));
+    set.addFilter(QStringLiteral("abc$script"));
+    set.addFilter(QStringLiteral("bc"));
+
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://h/xabc")), QStringLiteral("bc"));
+    QVERIFY(set.isUrlMatched(FilterRequest(QStringLiteral("http://h/xabc"), ScriptRequest)));
+    // The filters whose keys end in the current state don't apply: the ones whose keys
+    // are suffixes of it, reached through the dictionary links, must be checked, too
+    QVERIFY(set.isUrlMatched(FilterRequest(QStringLiteral("http://h/xabc"), ImageRequest)));
+    QVERIFY(!set.isUrlMatched(FilterRequest(QStringLiteral("http://h/xabd"), ImageRequest)));
+}
+
+void WebEngineFilterTest::shouldCompareBeyondTheKey()
+{
+    // Only the beginning of long filters is in the automaton
+    FilterSet set;
+    set.addFilter(QStringLiteral("/advertisements/banners/"));
+    set.addFilter(QStringLiteral("/advertisements/popups/"));
+
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("http://h/advertisements/popups/1.png")),
+             QStringLiteral("/advertisements/popups/"));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://h/advertisements/other/1.png")));
+}
+
+void WebEngineFilterTest::fillSet(FilterSet &set)
+{
+    set.addFilter(QStringLiteral("||ads.example.com^"));
+    set.addFilter(QStringLiteral("/banner\\d+\\.gif/"));
+    set.addFilter(QStringLiteral("/track*.js$~image"));
+    set.addFilter(QStringLiteral("counter"));
+}
+
+void WebEngineFilterTest::checkSet(FilterSet &set)
+{
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://img.ads.example.com/a.png")), QStringLiteral("||ads.example.com^"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://h/banner12.gif")), QStringLiteral("/banner\\d+\\.gif/"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://h/tracker/x.js")), QStringLiteral("/track*.js$~image"));
+    QCOMPARE(set.urlMatchedBy(QStringLiteral("https://h/counter.php")), QStringLiteral("counter"));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("https://example.com/banner.gif")));
+    QVERIFY(!set.isUrlMatched(FilterRequest(QStringLiteral("https://h/tracker/x.js"), ImageRequest)));
+}
+
+void WebEngineFilterTest::shouldMatchAfterLoadingCache()
+{
+    const QString fileName = m_dir.filePath(QStringLiteral("roundtrip"));
+    FilterSet set;
+    fillSet(set);
+    QVERIFY(set.saveCache(fileName, m_signature));
+
+    FilterSet loaded;
+    QVERIFY(loaded.loadCache(fileName, m_signature));
+    checkSet(loaded);
+
+    // Adding a filter to a set read from a cache keeps the filters which were there
+    loaded.addFilter(QStringLiteral("popup"));
+    checkSet(loaded);
+    QVERIFY(loaded.isUrlMatched(QStringLiteral("https://h/popup.html")));
+}
+
+void WebEngineFilterTest::shouldRejectCacheWithOtherSignature()
+{
+    const QString fileName = m_dir.filePath(QStringLiteral("signature"));
+    FilterSet set;
+    fillSet(set);
+    QVERIFY(set.saveCache(fileName, m_signature));
+
+    FilterSet loaded;
+    QVERIFY(!loaded.loadCache(fileName, QByteArray(20, 'o')));
+    QVERIFY(!loaded.isUrlMatched(QStringLiteral("https://h/counter.php")));
+}
+
+void WebEngineFilterTest::shouldRejectCorruptedCache_data()
+{
+    QTest::addColumn<QString>("corruption");
+
+    QTest::newRow("empty") << QStringLiteral("empty");
+    QTest::newRow("truncated header") << QStringLiteral("truncated header");
+    QTest::newRow("truncated") << QStringLiteral("truncated");
+    QTest::newRow("trailing data") << QStringLiteral("trailing data");
+    QTest::newRow("magic") << QStringLiteral("magic");
+    QTest::newRow("version") << QStringLiteral("version");
+    QTest::newRow("node count") << QStringLiteral("node count");
+    QTest::newRow("edge count") << QStringLiteral("edge count");
+    QTest::newRow("filter count") << QStringLiteral("filter count");
+    QTest::newRow("edge target") << QStringLiteral("edge target");
+    QTest::newRow("fail cycle") << QStringLiteral("fail cycle");
+    QTest::newRow("dictionary cycle") << QStringLiteral("dictionary cycle");
+}
+
+void WebEngineFilterTest::shouldRejectCorruptedCache()
+{
+    QFETCH(QString, corruption);
+
+    const QString fileName = m_dir.filePath(QStringLiteral("corrupted"));
+    FilterSet set;
+    fillSet(set);
+    QVERIFY(set.saveCache(fileName, m_signature));
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QByteArray data = file.readAll();
+    file.close();
+
+    if (corruption == QLatin1String("empty")) {
+        data.clear();
+    } else if (corruption == QLatin1String("truncated header")) {
+        data.truncate(100);
+    } else if (corruption == QLatin1String("truncated")) {
+        data.chop(4);
+    } else if (corruption == QLatin1String("trailing data")) {
+        data.append(QByteArray(4, '\0'));
+    } else if (corruption == QLatin1String("magic")) {
+        data[0] = 'X';
+    } else if (corruption == QLatin1String("version")) {
+        writeField(data, s_versionOffset, readField(data, s_versionOffset) + 1);
+    } else if (corruption == QLatin1String("node count")) {
+        writeField(data, s_nodeCountOffset, 0x10000000u);
+    } else if (corruption == QLatin1String("edge count")) {
+        writeField(data, s_edgeCountOffset, 0xffffffffu);
+    } else if (corruption == QLatin1String("filter count")) {
+        writeField(data, s_filterCountOffset, 0);
+    } else if (corruption == QLatin1String("edge target")) {
+        QVERIFY(readField(data, s_edgeCountOffset) > 0);
+        // The target follows the character of the first edge
+        writeField(data, readField(data, s_edgesOffsetOffset) + 4, 0xfffffff0u);
+    } else if (corruption == QLatin1String("fail cycle") || corruption == QLatin1String("dictionary cycle")) {
+        QVERIFY(readField(data, s_nodeCountOffset) > 2);
+        // Make the links of the first two states after the root point at each other
+        const int link = corruption == QLatin1String("fail cycle") ? s_failOffset : s_dictLinkOffset;
+        const int nodes = readField(data, s_nodesOffsetOffset);
+        writeField(data, nodes + s_nodeSize + link, 2);
+        writeField(data, nodes + 2 * s_nodeSize + link, 1);
+    }
+
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(data);
+    file.close();
+
+    FilterSet loaded;
+    QVERIFY(!loaded.loadCache(fileName, m_signature));
+    QVERIFY(!loaded.isUrlMatched(QStringLiteral("https://h/counter.php")));
+}
+
+void WebEngineFilterTest::shouldMatchPattern_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<bool>("matched");
+
+    QTest::newRow("domain anchor") << QStringLiteral("||example.com^") << QStringLiteral("http://example.com/") << true;
+    QTest::newRow("domain anchor, subdomain") << QStringLiteral("||example.com^") << QStringLiteral("https://www.example.com:8080/a") << true;
+    QTest::newRow("domain anchor, other domain") << QStringLiteral("||example.com^") << QStringLiteral("http://notexample.com/") << false;
+    QTest::newRow("domain anchor, not a separator") << QStringLiteral("||example.com^") << QStringLiteral("http://example.com.evil.org/") << false;
+    QTest::newRow("domain anchor, not in host") << QStringLiteral("||example.com^") << QStringLiteral("http://h/?u=http://example.com/") << false;
+    QTest::newRow("domain anchor, path") << QStringLiteral("||example.com/ads") << QStringLiteral("http://www.example.com/ads/1.png") << true;
+    QTest::newRow("domain anchor, path elsewhere") << QStringLiteral("||example.com/ads") << QStringLiteral("http://h/example.com/ads") << false;
+    QTest::newRow("domain anchor, wildcard") << QStringLiteral("||ads.*/banner") << QStringLiteral("http://ads.example.com/banner") << true;
+    QTest::newRow("start anchor") << QStringLiteral("|http://ads.") << QStringLiteral("http://ads.example.com/") << true;
+    QTest::newRow("start anchor, not at start") << QStringLiteral("|http://ads.") << QStringLiteral("https://h/?r=http://ads.x") << false;
+    QTest::newRow("end anchor") << QStringLiteral("swf|") << QStringLiteral("http://h/movie.swf") << true;
+    QTest::newRow("end anchor, not at end") << QStringLiteral("swf|") << QStringLiteral("http://h/movie.swf?x=1") << false;
+    QTest::newRow("both anchors") << QStringLiteral("|http://h/a.swf|") << QStringLiteral("http://h/a.swf") << true;
+    QTest::newRow("both anchors, longer") << QStringLiteral("|http://h/a.swf|") << QStringLiteral("http://h/a.swf2") << false;
+    QTest::newRow("separator") << QStringLiteral("^ad^") << QStringLiteral("http://h/ad/1") << true;
+    QTest::newRow("separator, query") << QStringLiteral("^ad^") << QStringLiteral("http://h/ad?1") << true;
+    QTest::newRow("separator, end of url") << QStringLiteral("^ad^") << QStringLiteral("http://h/x/ad") << true;
+    QTest::newRow("separator, letter") << QStringLiteral("^ad^") << QStringLiteral("http://h/adx") << false;
+    QTest::newRow("separator, dot") << QStringLiteral("^ad^") << QStringLiteral("http://h/ad.png") << false;
+    QTest::newRow("wildcard") << QStringLiteral("/ads/*/banner") << QStringLiteral("http://h/ads/x/y/banner.gif") << true;
+    QTest::newRow("wildcard, order") << QStringLiteral("/ads/*/banner") << QStringLiteral("http://h/banner/x/ads/") << false;
+    QTest::newRow("wildcard, overlap") << QStringLiteral("/ads/*/banner") << QStringLiteral("http://h/ads/banner") << false;
+    QTest::newRow("wildcards only") << QStringLiteral("*") << QStringLiteral("http://h/") << true;
+    QTest::newRow("case insensitive") << QStringLiteral("BaNNer") << QStringLiteral("http://h/BANNER.gif") << true;
+    QTest::newRow("match case") << QStringLiteral("Banner$match-case") << QStringLiteral("http://h/Banner.gif") << true;
+    QTest::newRow("match case, other case") << QStringLiteral("Banner$match-case") << QStringLiteral("http://h/banner.gif") << false;
+    QTest::newRow("regexp") << QStringLiteral("/\\/ad[0-9]+\\.png$/") << QStringLiteral("http://h/ad12.png") << true;
+    QTest::newRow("regexp, case insensitive") << QStringLiteral("/\\/ad[0-9]+\\.png$/") << QStringLiteral("http://h/AD12.PNG") << true;
+    QTest::newRow("regexp, no match") << QStringLiteral("/\\/ad[0-9]+\\.png$/") << QStringLiteral("http://h/ad12.png?x") << false;
+    QTest::newRow("regexp with options") << QStringLiteral("/ad[0-9]+/$image") << QStringLiteral("http://h/ad1") << false;
+    QTest::newRow("unknown option") << QStringLiteral("ads$unknown") << QStringLiteral("http://h/ads") << false;
+}
+
+void WebEngineFilterTest::shouldMatchPattern()
+{
+    QFETCH(QString, filter);
+    QFETCH(QString, url);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(filter);
+    QCOMPARE(set.isUrlMatched(url), matched);
+}
+
+void WebEngineFilterTest::shouldCheckOptions_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<QString>("firstPartyHost");
+    QTest::addColumn<bool>("matched");
+
+    // The URL is always http://ads.other.com/ads
+    QTest::newRow("third-party") << QStringLiteral("ads$third-party") << int(OtherRequest) << QStringLiteral("www.site.com") << true;
+    QTest::newRow("third-party, same domain") << QStringLiteral("ads$third-party") << int(OtherRequest) << QStringLiteral("cdn.other.com") << false;
+    QTest::newRow("third-party, no page") << QStringLiteral("ads$third-party") << int(OtherRequest) << QString() << false;
+    QTest::newRow("first-party") << QStringLiteral("ads$~third-party") << int(OtherRequest) << QStringLiteral("cdn.other.com") << true;
+    QTest::newRow("first-party, other domain") << QStringLiteral("ads$~third-party") << int(OtherRequest) << QStringLiteral("www.site.com") << false;
+    QTest::newRow("domain") << QStringLiteral("ads$domain=site.com|~shop.site.com") << int(OtherRequest) << QStringLiteral("www.site.com") << true;
+    QTest::newRow("domain, itself") << QStringLiteral("ads$domain=site.com|~shop.site.com") << int(OtherRequest) << QStringLiteral("site.com") << true;
+    QTest::newRow("domain, excluded") << QStringLiteral("ads$domain=site.com|~shop.site.com") << int(OtherRequest) << QStringLiteral("shop.site.com") << false;
+    QTest::newRow("domain, excluded subdomain") << QStringLiteral("ads$domain=site.com|~shop.site.com") << int(OtherRequest) << QStringLiteral("a.shop.site.com") << false;
+    QTest::newRow("domain, other") << QStringLiteral("ads$domain=site.com|~shop.site.com") << int(OtherRequest) << QStringLiteral("notsite.com") << false;
+    QTest::newRow("domain, upper case") << QStringLiteral("ads$domain=Site.com") << int(OtherRequest) << QStringLiteral("WWW.SITE.COM") << true;
+    QTest::newRow("domain, excluded only") << QStringLiteral("ads$domain=~site.com") << int(OtherRequest) << QStringLiteral("other.org") << true;
+    QTest::newRow("domain, excluded only, excluded") << QStringLiteral("ads$domain=~site.com") << int(OtherRequest) << QStringLiteral("site.com") << false;
+    QTest::newRow("domain, no page") << QStringLiteral("ads$domain=site.com") << int(OtherRequest) << QString() << false;
+    QTest::newRow("types") << QStringLiteral("ads$image,script") << int(ImageRequest) << QString() << true;
+    QTest::newRow("types, other type") << QStringLiteral("ads$image,script") << int(StylesheetRequest) << QString() << false;
+    QTest::newRow("excluded type") << QStringLiteral("ads$~image") << int(OtherRequest) << QString() << true;
+    QTest::newRow("excluded type, excluded") << QStringLiteral("ads$~image") << int(ImageRequest) << QString() << false;
+    QTest::newRow("all options") << QStringLiteral("||other.com/ads$script,third-party,domain=site.com") << int(ScriptRequest)
+                                 << QStringLiteral("site.com") << true;
+    QTest::newRow("all options, first party") << QStringLiteral("||other.com/ads$script,third-party,domain=site.com") << int(ScriptRequest)
+                                              << QStringLiteral("other.com") << false;
+}
+
+void WebEngineFilterTest::shouldCheckOptions()
+{
+    QFETCH(QString, filter);
+    QFETCH(int, type);
+    QFETCH(QString, firstPartyHost);
+    QFETCH(bool, matched);
+
+    FilterSet set;
+    set.addFilter(filter);
+    const FilterRequest request(QStringLiteral("http://ads.other.com/ads"), FilterRequestType(type), firstPartyHost);
+    QCOMPARE(set.isUrlMatched(request), matched);
+}
+
+void WebEngineFilterTest::shouldFindThirdPartyRequests_data()
+{
+    QTest::addColumn<QString>("url");
+    QTest::addColumn<QString>("firstPartyHost");
+    QTest::addColumn<bool>("thirdParty");
+
+    QTest::newRow("subdomain") << QStringLiteral("http://ads.site.com/ads") << QStringLiteral("www.site.com") << false;
+    QTest::newRow("public suffix") << QStringLiteral("http://ads.other.co.uk/ads") << QStringLiteral("www.site.co.uk") << true;
+    QTest::newRow("public suffix, same domain") << QStringLiteral("http://ads.site.co.uk/ads") << QStringLiteral("site.co.uk") << false;
+    QTest::newRow("unknown top-level domain") << QStringLiteral("http://ads.other.lan/ads") << QStringLiteral("www.site.lan") << true;
+    QTest::newRow("single label") << QStringLiteral("http://intranet/ads") << QStringLiteral("intranet") << false;
+    QTest::newRow("IP address") << QStringLiteral("http://10.0.0.5/ads") << QStringLiteral("192.168.1.5") << true;
+    QTest::newRow("IP address, same host") << QStringLiteral("http://10.0.0.5/ads") << QStringLiteral("10.0.0.5") << false;
+    QTest::newRow("IP address, same last byte") << QStringLiteral("http://10.0.0.5/ads") << QStringLiteral("5") << true;
+}
+
+void WebEngineFilterTest::shouldFindThirdPartyRequests()
+{
+    QFETCH(QString, url);
+    QFETCH(QString, firstPartyHost);
+    QFETCH(bool, thirdParty);
+
+    FilterSet set;
+    set.addFilter(QStringLiteral("ads$third-party"));
+    const FilterRequest request(url, OtherRequest, firstPartyHost);
+    QCOMPARE(set.isUrlMatched(request), thirdParty);
+}
+
+void WebEngineFilterTest::shouldMatchImportantFiltersOnly()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("banner"));
+    set.addFilter(QStringLiteral("||tracker.com^$important"));
+
+    QVERIFY(set.isUrlMatched(FilterRequest(QStringLiteral("http://h/banner.png")), false));
+    QVERIFY(!set.isUrlMatched(FilterRequest(QStringLiteral("http://h/banner.png")), true));
+    QVERIFY(set.isUrlMatched(FilterRequest(QStringLiteral("http://www.tracker.com/")), true));
+}
+
+void WebEngineFilterTest::shouldStripExceptionMarker()
+{
+    // Exceptions go in a set of their own, without the @@
+    FilterSet white;
+    white.addFilter(QStringLiteral("@@||example.com/ads/allowed^"));
+
+    QCOMPARE(white.urlMatchedBy(QStringLiteral("http://www.example.com/ads/allowed/1.png")),
+             QStringLiteral("||example.com/ads/allowed^"));
+    QVERIFY(!white.isUrlMatched(QStringLiteral("http://www.example.com/ads/other/1.png")));
+}
+
+void WebEngineFilterTest::shouldSkipCommentsAndElementHidingRules()
+{
+    FilterSet set;
+    set.addFilter(QStringLiteral("[Adblock Plus 2.0]"));
+    set.addFilter(QStringLiteral("! ads"));
+    set.addFilter(QStringLiteral("example.com##.ads"));
+    set.addFilter(QStringLiteral("example.com#@#.ads"));
+    set.addFilter(QStringLiteral("@@"));
+    set.addFilter(QStringLiteral("   "));
+
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.com/ads")));
+    QVERIFY(!set.isUrlMatched(QStringLiteral("http://example.com/[Adblock")));
+}
+
+void WebEngineFilterTest::fillSet(ElementHidingSet &set)
+{
+    QVERIFY(set.addRule(QStringLiteral("##.ad")));
+    QVERIFY(set.addRule(QStringLiteral("##.sponsored")));
+    QVERIFY(set.addRule(QStringLiteral("example.com##.banner")));
+    QVERIFY(set.addRule(QStringLiteral("~shop.example.com##.popup")));
+    QVERIFY(set.addRule(QStringLiteral("www.example.com##.top")));
+    QVERIFY(set.addRule(QStringLiteral("Example.com,~news.example.com##.side")));
+    QVERIFY(set.addRule(QStringLiteral("example.com#@#.ad")));
+    QVERIFY(set.addRule(QStringLiteral("other.org#@#.banner")));
+    QVERIFY(set.addRule(QStringLiteral("##.allowed")));
+    QVERIFY(set.addRule(QStringLiteral("#@#.allowed")));
+    // Extended selectors are ignored
+    QVERIFY(set.addRule(QStringLiteral("example.com##div:-abp-has(.ad)")));
+    QVERIFY(!set.addRule(QStringLiteral("||example.com^")));
+}
+
+QStringList WebEngineFilterTest::hiddenSelectors(const ElementHidingSet &set, const QString &host)
+{
+    const QString suffix = QStringLiteral(" { display: none !important; }");
+    QStringList selectors;
+    const QStringList rules = set.styleSheet(host).split(QLatin1Char('\n'), QString::SkipEmptyParts);
+    for (const QString &rule : rules) {
+        if (rule.endsWith(suffix))
+            selectors += rule.left(rule.length() - suffix.length()).split(QStringLiteral(", "));
+    }
+    selectors.sort();
+    return selectors;
+}
+
+void WebEngineFilterTest::shouldHideElements_data()
+{
+    QTest::addColumn<QString>("host");
+    QTest::addColumn<QStringList>("selectors");
+
+    QTest::newRow("other site") << QStringLiteral("www.site.org")
+                                << QStringList{QStringLiteral(".ad"), QStringLiteral(".popup"), QStringLiteral(".sponsored")};
+    QTest::newRow("generic exception") << QStringLiteral("other.org")
+                                       << QStringList{QStringLiteral(".ad"), QStringLiteral(".popup"), QStringLiteral(".sponsored")};
+    QTest::newRow("domain") << QStringLiteral("example.com")
+                            << QStringList{QStringLiteral(".banner"), QStringLiteral(".popup"), QStringLiteral(".side"),
+                                           QStringLiteral(".sponsored")};
+    QTest::newRow("subdomain") << QStringLiteral("mail.example.com")
+                               << QStringList{QStringLiteral(".banner"), QStringLiteral(".popup"), QStringLiteral(".side"),
+                                              QStringLiteral(".sponsored")};
+    QTest::newRow("named subdomain") << QStringLiteral("WWW.Example.com")
+                                     << QStringList{QStringLiteral(".banner"), QStringLiteral(".popup"), QStringLiteral(".side"),
+                                                    QStringLiteral(".sponsored"), QStringLiteral(".top")};
+    QTest::newRow("subdomain of named subdomain") << QStringLiteral("a.www.example.com")
+                                                  << QStringList{QStringLiteral(".banner"), QStringLiteral(".popup"),
+                                                                 QStringLiteral(".side"), QStringLiteral(".sponsored"),
+                                                                 QStringLiteral(".top")};
+    QTest::newRow("excluded from generic rule") << QStringLiteral("shop.example.com")
+                                                << QStringList{QStringLiteral(".banner"), QStringLiteral(".side"),
+                                                               QStringLiteral(".sponsored")};
+    QTest::newRow("excluded from domain rule") << QStringLiteral("news.example.com")
+                                               << QStringList{QStringLiteral(".banner"), QStringLiteral(".popup"),
+                                                              QStringLiteral(".sponsored")};
+}
+
+void WebEngineFilterTest::shouldHideElements()
+{
+    QFETCH(QString, host);
+    QFETCH(QStringList, selectors);
+
+    ElementHidingSet set;
+    fillSet(set);
+    QCOMPARE(hiddenSelectors(set, host), selectors);
+}
+
+void WebEngineFilterTest::shouldShareStyleSheetsOnlyWhenEquivalent()
+{
+    // The stylesheets are remembered by domain: asking for them in any order must give the same results
+    ElementHidingSet set;
+    fillSet(set);
+    const QStringList hosts = {
+        QStringLiteral("mail.example.com"), QStringLiteral("www.example.com"), QStringLiteral("shop.example.com"),
+        QStringLiteral("example.com"), QStringLiteral("a.shop.example.com"), QStringLiteral("a.www.example.com")
+    };
+    QVector<QStringList> expected;
+    for (const QString &host : hosts) {
+        ElementHidingSet fresh;
+        fillSet(fresh);
+        expected.append(hiddenSelectors(fresh, host));
+    }
+    for (int i = 0; i < hosts.size(); ++i)
+        QCOMPARE(hiddenSelectors(set, hosts.at(i)), expected.at(i));
+    for (int i = hosts.size() - 1; i >= 0; --i)
+        QCOMPARE(hiddenSelectors(set, hosts.at(i)), expected.at(i));
+
+    // Adding a rule forgets the stylesheets
+    QVERIFY(set.addRule(QStringLiteral("mail.example.com##.mail")));
+    QVERIFY(hiddenSelectors(set, QStringLiteral("mail.example.com")).contains(QStringLiteral(".mail")));
+    QVERIFY(!hiddenSelectors(set, QStringLiteral("www.example.com")).contains(QStringLiteral(".mail")));
+}
+
+#include "webengine_filter_test.moc"
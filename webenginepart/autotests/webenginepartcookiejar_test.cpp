@@ -152,11 +152,13 @@ void TestWebEnginePartCookieJar::testCookieAddedToStoreAreAddedToKCookieServer()
     const QList<int> fields{0,1,2,3,4,5,6,7};
     
     emit m_store->cookieAdded(cookie);
-    const QDBusReply<QStringList> res = m_server->call(QDBus::Block, "findCookies", QVariant::fromValue(fields), domain, host, cookie.path(), QString(cookie.name()));
-    QVERIFY2(!m_server->lastError().isValid(), m_server->lastError().message().toLatin1());
-    QStringList resFields = res.value();
-    
-    QVERIFY(!resFields.isEmpty());
+    //Cookies are sent to KCookieServer asynchronously
+    auto findCookie = [this, &fields, &domain, &host, &cookie](){
+        const QDBusReply<QStringList> res = m_server->call(QDBus::Block, "findCookies", QVariant::fromValue(fields), domain, host, cookie.path(), QString(cookie.name()));
+        return res.isValid() ? res.value() : QStringList();
+    };
+    QStringList resFields;
+    QTRY_VERIFY_WITH_TIMEOUT(!(resFields = findCookie()).isEmpty(), 5000);
     QCOMPARE(fields.count(), resFields.count());
     
     QCOMPARE(resFields.at(0), domain);
@@ -289,10 +291,8 @@ void TestWebEnginePartCookieJar::testCookieRemovedFromStoreAreRemovedFromKCookie
     //Emit QWebEngineCookieStore::cookieRemoved signal and check that cookie has indeed been removed
     emit m_store->cookieRemoved(cookie);
 
-    //Check that cookie is no longer in KCookieServer
-    reply = findCookies();
-    QVERIFY2(reply.isValid(), qPrintable(reply.error().message()));
-    QVERIFY2(!reply.value().contains(name), "Cookie wasn't removed from server");
+    //Check that cookie is no longer in KCookieServer. The removal is asynchronous
+    QTRY_VERIFY2_WITH_TIMEOUT((reply = findCookies()).isValid() && !reply.value().contains(name), "Cookie wasn't removed from server", 5000);
 }
 
 QDBusError TestWebEnginePartCookieJar::addCookieToKCookieServer(const QNetworkCookie& _cookie, const QString& host)
@@ -332,6 +332,8 @@ void TestWebEnginePartCookieJar::testPersistentCookiesAreAddedToStoreOnCreation(
         expected << c;
     }
     m_jar = new WebEnginePartCookieJar(m_profile, this);
+    //Cookies are loaded from KCookieServer asynchronously
+    QTRY_VERIFY(m_jar->m_testCookiesLoaded);
     QList<QNetworkCookie> cookiesInsertedIntoJar;
     for(const QNetworkCookie &c: qAsConst(m_jar->m_testCookies)){
         if(QString(c.name()).startsWith(baseCookieName)) {
@@ -358,6 +360,8 @@ void TestWebEnginePartCookieJar::testSessionCookiesAreNotAddedToStoreOnCreation(
     QDBusError e = addCookieToKCookieServer(data.cookie(), data.host);
     QVERIFY2(!e.isValid(), qPrintable(e.message()));
     m_jar = new WebEnginePartCookieJar(m_profile, this);
+    //Cookies are loaded from KCookieServer asynchronously
+    QTRY_VERIFY(m_jar->m_testCookiesLoaded);
     QList<QNetworkCookie> cookiesInsertedIntoJar;
     for(const QNetworkCookie &c: qAsConst(m_jar->m_testCookies)) {
         if (c.name() == data.name) {
@@ -367,3 +371,31 @@ void TestWebEnginePartCookieJar::testSessionCookiesAreNotAddedToStoreOnCreation(
     QVERIFY2(cookiesInsertedIntoJar.isEmpty(), "Session cookies inserted into cookie store");
 }
 
+void TestWebEnginePartCookieJar::testCookiesChangedWhileLoadingAreNotOverwritten()
+{
+    delete m_jar;
+    CookieData data{m_cookieName + "-startup-changed", "old-value", ".yyy.xxx.com", "/abc/def/", "zzz.yyy.xxx.com", currentDateTime().addYears(1), true};
+    QDBusError e = addCookieToKCookieServer(data.cookie(), data.host);
+    QVERIFY2(!e.isValid(), qPrintable(e.message()));
+    m_jar = new WebEnginePartCookieJar(m_profile, this);
+    //The store receives a newer version of the cookie before the answer from KCookieServer arrives
+    QNetworkCookie newer = data.cookie();
+    newer.setValue("new-value");
+    m_jar->addCookie(newer);
+    QTRY_VERIFY(m_jar->m_testCookiesLoaded);
+    for(const QNetworkCookie &c: qAsConst(m_jar->m_testCookies)) {
+        QVERIFY2(c.name() != data.name, "Cookie from KCookieServer replaced a newer one");
+    }
+}
+
+void TestWebEnginePartCookieJar::testPendingCookiesAreSentBeforeQuitting()
+{
+    QVERIFY2(m_server->isValid(), qPrintable(m_server->lastError().message()));
+    CookieData data{m_cookieName + "-quit", "test-value", ".yyy.xxx.com", "/abc/def/", "zzz.yyy.xxx.com", currentDateTime().addYears(1), true};
+    emit m_store->cookieAdded(data.cookie());
+    //Called when the application emits aboutToQuit: after that, the event loop won't deliver answers anymore
+    m_jar->sendAllPendingCookies();
+    const QDBusReply<QStringList> reply = m_server->call(QDBus::Block, "findCookies", QVariant::fromValue(QList<int>{2}), data.domain, data.host, data.path, data.name);
+    QVERIFY2(reply.isValid(), qPrintable(reply.error().message()));
+    QVERIFY2(reply.value().contains(data.name), "Cookie wasn't sent to server before quitting");
+}
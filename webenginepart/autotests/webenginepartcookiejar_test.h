@@ -63,6 +63,8 @@ private Q_SLOTS:
     void testCookieRemovedFromStoreAreRemovedFromKCookieServer();
     void testPersistentCookiesAreAddedToStoreOnCreation();
     void testSessionCookiesAreNotAddedToStoreOnCreation();
+    void testCookiesChangedWhileLoadingAreNotOverwritten();
+    void testPendingCookiesAreSentBeforeQuitting();
     
 private:
     
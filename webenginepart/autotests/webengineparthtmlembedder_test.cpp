@@ -0,0 +1,128 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <webengineparthtmlembedder.h>
+
+#include <QTest>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QUrl>
+
+class WebEnginePartHtmlEmbedderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testEmbed_data();
+    void testEmbed();
+    void testChunks();
+    void testMalformedQuotes();
+
+private:
+    //Rewrites html passing it to the embedder in chunks of chunkSize bytes
+    static QByteArray rewrite(const QByteArray &html, int chunkSize);
+
+    QTemporaryDir m_dir;
+    QByteArray m_fileUrl;
+    QByteArray m_dataUrl;
+};
+
+QTEST_GUILESS_MAIN(WebEnginePartHtmlEmbedderTest)
+
+QByteArray WebEnginePartHtmlEmbedderTest::rewrite(const QByteArray &html, int chunkSize)
+{
+    WebEnginePartHtmlEmbedder embedder;
+    QByteArray res;
+    for (int i = 0; i < html.size(); i += chunkSize) {
+        res += embedder.process(html.mid(i, chunkSize));
+    }
+    res += embedder.finish();
+    return res;
+}
+
+void WebEnginePartHtmlEmbedderTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    const QString path = m_dir.path() + QLatin1String("/style.txt");
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("body {}");
+    file.close();
+    m_fileUrl = QUrl::fromLocalFile(path).toEncoded();
+    m_dataUrl = "data:text/plain;charset=UTF-8;base64," + QByteArray("body {}").toBase64();
+}
+
+void WebEnginePartHtmlEmbedderTest::testEmbed_data()
+{
+    QTest::addColumn<QByteArray>("html");
+    QTest::addColumn<QByteArray>("expected");
+
+    const QByteArray url = m_fileUrl;
+    const QByteArray data = m_dataUrl;
+    QTest::newRow("link") << "<head><link rel=\"stylesheet\" href=\"" + url + "\"></head>"
+                          << "<head><link rel=\"stylesheet\" href=\"" + data + "\"></head>";
+    QTest::newRow("img, unquoted") << "<IMG alt='a > b' SRC=" + url + ">"
+                                   << "<IMG alt='a > b' SRC=" + data + ">";
+    QTest::newRow("remote") << QByteArray("<img src=\"http://example.com/a.png\">")
+                            << QByteArray("<img src=\"http://example.com/a.png\">");
+    QTest::newRow("relative") << QByteArray("<img src=\"a.png\">") << QByteArray("<img src=\"a.png\">");
+    QTest::newRow("other attribute") << "<img alt=\"" + url + "\">" << "<img alt=\"" + url + "\">";
+    QTest::newRow("comment") << "<!-- <img src=\"" + url + "\"> --><img src=\"" + url + "\">"
+                             << "<!-- <img src=\"" + url + "\"> --><img src=\"" + data + "\">";
+    QTest::newRow("script") << "<script>var s = '<img src=\"" + url + "\">';</SCRIPT><img src=\"" + url + "\">"
+                            << "<script>var s = '<img src=\"" + url + "\">';</SCRIPT><img src=\"" + data + "\">";
+    QTest::newRow("style") << "<style>a < b {}</style><link href=" + url + ">"
+                           << "<style>a < b {}</style><link href=" + data + ">";
+    QTest::newRow("text") << QByteArray("a < b <br/> c") << QByteArray("a < b <br/> c");
+    QTest::newRow("incomplete tag") << QByteArray("<p>text<img src=\"a") << QByteArray("<p>text<img src=\"a");
+}
+
+void WebEnginePartHtmlEmbedderTest::testEmbed()
+{
+    QFETCH(QByteArray, html);
+    QFETCH(QByteArray, expected);
+    QCOMPARE(rewrite(html, html.size()), expected);
+}
+
+void WebEnginePartHtmlEmbedderTest::testChunks()
+{
+    //Tags, comments and end tags split between chunks
+    const QByteArray html = "<html><!-- comment --><script>if (a </ b) {}</script><p>text</p><img src=\"" + m_fileUrl + "\"></html>";
+    const QByteArray expected = "<html><!-- comment --><script>if (a </ b) {}</script><p>text</p><img src=\"" + m_dataUrl + "\"></html>";
+    for (int chunkSize = 1; chunkSize <= html.size(); ++chunkSize) {
+        QCOMPARE(rewrite(html, chunkSize), expected);
+    }
+}
+
+void WebEnginePartHtmlEmbedderTest::testMalformedQuotes()
+{
+    //These must be left alone, and must not hang
+    const QByteArray tags[] = {
+        QByteArray("<img x=a\"b y=\">"),
+        QByteArray("<img src=\"" + m_fileUrl + " alt='>"),
+        QByteArray("<link href='>"),
+    };
+    for (const QByteArray &tag : tags) {
+        QCOMPARE(rewrite(tag, tag.size()), tag);
+    }
+}
+
+#include "webengineparthtmlembedder_test.moc"
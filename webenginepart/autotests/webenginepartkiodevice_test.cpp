@@ -0,0 +1,87 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <webenginepartkiodevice.h>
+
+#include <KIO/TransferJob>
+
+#include <QTest>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QFile>
+
+class WebEnginePartKIODeviceTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testLargeUnknownDataNotRead();
+    void testLargeDataReadWhileArriving();
+
+private:
+    QTemporaryDir m_dir;
+    QString m_path;
+    QByteArray m_data;
+};
+
+QTEST_GUILESS_MAIN(WebEnginePartKIODeviceTest)
+
+void WebEnginePartKIODeviceTest::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    //More than the buffer the device keeps before suspending the job, with a mimetype nobody knows
+    m_data.resize(3 * 1024 * 1024);
+    for (int i = 0; i < m_data.size(); ++i) {
+        m_data[i] = static_cast<char>(i % 251);
+    }
+    m_path = m_dir.path() + QLatin1String("/data.konqtest-unknown");
+    QFile file(m_path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(m_data), qint64(m_data.size()));
+    file.close();
+}
+
+void WebEnginePartKIODeviceTest::testLargeUnknownDataNotRead()
+{
+    //The handler doesn't reply, so nobody reads the device, until it knows the mimetype: the job must finish anyway
+    KIO::TransferJob *job = KIO::get(QUrl::fromLocalFile(m_path), KIO::NoReload, KIO::HideProgressInfo);
+    WebEnginePartKIODevice dev(job);
+    QSignalSpy spyFinished(&dev, &QIODevice::readChannelFinished);
+    QVERIFY(spyFinished.wait());
+    QVERIFY(dev.isFinished());
+    QCOMPARE(dev.readAll(), m_data);
+    QVERIFY(dev.atEnd());
+}
+
+void WebEnginePartKIODeviceTest::testLargeDataReadWhileArriving()
+{
+    KIO::TransferJob *job = KIO::get(QUrl::fromLocalFile(m_path), KIO::NoReload, KIO::HideProgressInfo);
+    WebEnginePartKIODevice dev(job);
+    QByteArray read;
+    connect(&dev, &QIODevice::readyRead, this, [&dev, &read](){read += dev.readAll();});
+    QSignalSpy spyFinished(&dev, &QIODevice::readChannelFinished);
+    QVERIFY(spyFinished.wait());
+    read += dev.readAll();
+    QCOMPARE(read, m_data);
+    QVERIFY(dev.atEnd());
+}
+
+#include "webenginepartkiodevice_test.moc"
@@ -20,325 +20,1401 @@
    Boston, MA 02110-1301, USA.
 */
 
+
 #include "webengine_filter.h"
 
-#include <QHash>
-#include <QBitArray>
+#include <QFile>
+#include <QHostAddress>
+#include <QSaveFile>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
 
-// rolling hash parameters
-#define HASH_P (1997)
-#define HASH_Q (17509)
-// HASH_MOD = (HASH_P^7) % HASH_Q
-#define HASH_MOD (523)
+#include <private/qtldurl_p.h>
 
+#include <algorithm>
+#include <cstring>
 
 using namespace KDEPrivate;
 
-// Updateable Multi-String Matcher based on Rabin-Karp's algorithm
-class StringsMatcher {
-public:
-    // add filter to matching set
-    void addString(const QString& pattern)
-    {
-        if (pattern.length() < 8) {
-            // handle short string differently
-            shortStringFilters.append(pattern);
+// Filters are compiled into a single flat block of memory, laid out as described
+// by the structures below. The very same layout is used in memory and in the cache
+// files, so that a cached set can be used straight from a mapping of the file.
+// All offsets are in bytes from the start of the block, all sections are 4-byte aligned.
+
+#define FILTER_CACHE_VERSION 2
+// Byte order marker: a cache written on a machine with different endianness is rejected
+#define FILTER_CACHE_BYTE_ORDER 0x01020304
+// Only this many characters of a filter are inserted in the automaton; the rest is
+// compared when the automaton reports a candidate. This keeps the trie shallow.
+#define MAX_KEY_LENGTH 16
+// Characters below this value have a direct entry for the root state
+#define ROOT_TABLE_SIZE 128
+#define NO_NODE 0xffffffffu
+// The request types a filter applies to are stored in the upper bits of its flags
+#define TYPE_SHIFT 16
+// Number of hosts whose element hiding stylesheet is remembered
+#define STYLESHEET_CACHE_SIZE 32
+// Selectors are grouped in CSS rules of this size: an invalid selector only
+// invalidates the rule it's part of
+#define SELECTORS_PER_CSS_RULE 50
+
+static const char s_filterCacheMagic[8] = { 'K', 'W', 'E', 'F', 'I', 'L', 'T', 'R' };
+
+namespace {
+
+enum CompiledFilterFlag {
+    RegExpFilter = 0x001,     // a /.../ filter, checked with a QRegularExpression
+    WildcardFilter = 0x002,   // the pattern contains * or ^
+    StartAnchor = 0x004,      // |pattern
+    EndAnchor = 0x008,        // pattern|
+    DomainAnchor = 0x010,     // ||pattern
+    MatchCase = 0x020,        // $match-case
+    ThirdPartyOnly = 0x040,   // $third-party
+    FirstPartyOnly = 0x080,   // $~third-party
+    Important = 0x100,        // $important
+    HostIndexed = 0x200       // ||host^...: looked up by host instead of through the automaton
+};
+
+struct CompiledHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    char signature[20];
+    quint32 totalSize;
+    quint32 nodeCount, nodesOffset;
+    quint32 edgeCount, edgesOffset;
+    quint32 outputCount, outputsOffset;
+    quint32 filterCount, filtersOffset;
+    quint32 hostCount, hostsOffset;
+    quint32 genericCount, genericOffset;
+    quint32 stringsLength, stringsOffset; // length in UTF-16 code units
+    quint32 rootTable[ROOT_TABLE_SIZE];
+};
+
+// A state of the automaton. Node 0 is the root.
+struct CompiledNode {
+    quint32 firstEdge;
+    quint32 edgeCount;
+    quint32 fail;         // state to fall back to when no edge matches
+    quint32 dictLink;     // nearest state on the fail chain having outputs, 0 if none
+    quint32 firstOutput;
+    quint32 outputCount;  // filters whose key ends in this state
+};
+
+// Edges of a node are sorted by character
+struct CompiledEdge {
+    quint16 ch;
+    quint16 unused;
+    quint32 target;
+};
+
+// Entries of the host index are sorted by hash
+struct CompiledHost {
+    quint32 hash;
+    quint32 filter;
+};
+
+struct CompiledFilter {
+    quint32 flags;          // CompiledFilterFlag, and the request types from TYPE_SHIFT on
+    quint32 textOffset;     // the pattern, without anchors and options, in the string table
+    quint32 textLength;
+    quint32 keyOffset;      // start of the key inside the pattern; for host indexed
+    quint32 keyLength;      // filters, the key is the host
+    quint32 domainsOffset;  // the value of the $domain= option
+    quint32 domainsLength;
+    quint32 sourceOffset;   // the filter as it was added, reported by urlMatchedBy()
+    quint32 sourceLength;
+};
+
+}
+
+static inline quint16 asciiToLower(quint16 c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static QString asciiToLower(const QString& str)
+{
+    QString lower(str);
+    ushort *p = reinterpret_cast<ushort*>(lower.data());
+    for (int i = 0; i < lower.length(); ++i)
+        p[i] = asciiToLower(p[i]);
+    return lower;
+}
+
+// In Adblock Plus syntax, ^ matches anything but a letter, a digit or one of _-.%
+static inline bool isSeparator(quint16 c)
+{
+    if (c >= 128)
+        return false;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return false;
+    return c != '_' && c != '-' && c != '.' && c != '%';
+}
+
+// FNV-1a; qHash can't be used because its seed changes from process to process
+static quint32 hostHash(const QChar *str, int len)
+{
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < len; ++i) {
+        hash ^= str[i].unicode();
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the registrable part of host, e.g. example.co.uk for www.example.co.uk
+static QString registrableDomain(const QString& host)
+{
+    // An IP address has no public suffix, only the whole address identifies the site
+    if (host.startsWith(QLatin1Char('[')) || QHostAddress().setAddress(host))
+        return host;
+
+    // The longest public suffix and the label before it. As in the public suffix
+    // list, an unknown top-level domain is a public suffix too
+    int previous = -1;
+    int start = 0;
+    for (;;) {
+        const int dot = host.indexOf(QLatin1Char('.'), start);
+        if (dot < 0 || qIsEffectiveTLD(host.midRef(start)))
+            return previous < 0 ? host : host.mid(previous);
+        previous = start;
+        start = dot + 1;
+    }
+}
+
+// Whether host is domain or one of its subdomains
+static bool isOnDomain(const QString& host, const QString& domain)
+{
+    return host == domain
+        || (host.endsWith(domain) && host.at(host.length() - domain.length() - 1) == QLatin1Char('.'));
+}
+
+// Same as above, for a domain which is part of a longer string
+static bool isOnDomain(const QString& host, const quint16 *domain, int length)
+{
+    const int hostLength = host.length();
+    if (length > hostLength || (length < hostLength && host.at(hostLength - length - 1) != QLatin1Char('.')))
+        return false;
+    return std::equal(domain, domain + length, host.utf16() + hostLength - length);
+}
+
+FilterRequest::FilterRequest(const QString& url_, FilterRequestType type_, const QString& firstPartyHost_)
+    : url(url_), lowerUrl(asciiToLower(url_)), hostStart(0), hostEnd(0), type(type_),
+      firstPartyHost(asciiToLower(firstPartyHost_)), m_thirdParty(-1)
+{
+    const int schemeEnd = lowerUrl.indexOf(QLatin1String("://"));
+    if (schemeEnd < 0)
+        return;
+    int start = schemeEnd + 3;
+    int end = start;
+    while (end < lowerUrl.length()) {
+        const QChar c = lowerUrl.at(end);
+        if (c == QLatin1Char('/') || c == QLatin1Char('?') || c == QLatin1Char('#') || c == QLatin1Char(':'))
+            break;
+        // user info: the host comes after it
+        if (c == QLatin1Char('@'))
+            start = end + 1;
+        ++end;
+    }
+    hostStart = start;
+    hostEnd = end;
+}
+
+bool FilterRequest::isThirdParty() const
+{
+    if (m_thirdParty < 0) {
+        if (firstPartyHost.isEmpty() || hostStart == hostEnd) {
+            m_thirdParty = 0;
         } else {
-            // use modified Rabin-Karp's algorithm with 8-length string hash
-            // i.e. store hash of first 8 chars in the HashMap for fast look-up
-            stringFilters.append(pattern);
-            int ind = stringFilters.size() - 1;
-            int current = 0;
-
-            // compute hash using rolling hash
-            // hash for string: x0,x1,x2...xn-1 will be:
-            // (p^(n-1)*x0 + p^(n-2)*x1 + ... + p * xn-2 + xn-1) % q
-            // where p and q some wisely-chosen integers
-            /*for (int k = 0; k < 8; ++k)*/
-            int len = pattern.length();
-            for (int k = len - 8; k < len; ++k)
-                current = (current * HASH_P + pattern[k].unicode()) % HASH_Q;
-
-            // insert computed hash value into HashMap
-            QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-            if (it == stringFiltersHash.end()) {
-                QVector<int> list;
-                list.append(ind);
-                stringFiltersHash.insert(current + 1, list);
-                fastLookUp.setBit(current);
-            } else {
-                it->append(ind);
-            }
+            const QString host = lowerUrl.mid(hostStart, hostEnd - hostStart);
+            m_thirdParty = registrableDomain(host) != registrableDomain(firstPartyHost);
         }
     }
+    return m_thirdParty;
+}
 
+// Checks whether a piece of a pattern matches str at pos. Pieces are the parts of a pattern
+// between *s: they have a fixed length, since all their characters are literal except ^, which
+// stands for a single separator. A ^ ending the pattern can also match the end of str.
+// Returns the position in str following the match, or -1.
+static int pieceMatchesAt(const quint16 *piece, int len, const QChar *str, int strLen, int pos, bool endsPattern)
+{
+    for (int j = 0; j < len; ++j) {
+        if (pos + j == strLen)
+            return (endsPattern && j == len - 1 && piece[j] == '^') ? strLen : -1;
+        const quint16 p = piece[j];
+        const quint16 c = str[pos + j].unicode();
+        if (p == '^' ? !isSeparator(c) : p != c)
+            return -1;
+    }
+    return pos + len;
+}
 
-    // check if string match at least one string from matching set
-    bool isMatched(const QString& str, QString *by = nullptr) const
+// Multi-string matcher based on the Aho-Corasick algorithm.
+//
+// Every filter which is not a regular expression gets a key, which is (the beginning of)
+// its longest literal part, and the keys are inserted in the automaton. Scanning a URL
+// reports every position where a key ends; the rest of the filter is only checked then.
+// Filters anchored to a host are looked up in a separate index. Regular expressions, and
+// filters without any literal part, are "generic" filters, checked against every URL.
+class FilterMatcher {
+public:
+    FilterMatcher()
+        : m_data(nullptr), m_cacheFile(nullptr), m_sourcesValid(true), m_dirty(false)
     {
-        // check short strings first
-        for (int i = 0; i < shortStringFilters.size(); ++i) {
-            if (str.contains(shortStringFilters[i]))
-            {
-                if (by != nullptr) *by = shortStringFilters[i];
-                return true;
+    }
+
+    ~FilterMatcher()
+    {
+        clear();
+    }
+
+    void addRule(const QString& rule)
+    {
+        loadSources();
+        m_sources.append(rule);
+        m_dirty = true;
+    }
+
+    // (Re)builds the compiled form from the sources, if they changed. Once compiled, the
+    // matcher is only read from, and can be used from several threads at the same time
+    void compile()
+    {
+        if (!m_dirty)
+            return;
+        m_dirty = false;
+
+        QVector<ParsedFilter> parsedFilters;
+        QStringList sources;
+        parsedFilters.reserve(m_sources.size());
+        sources.reserve(m_sources.size());
+        for (const QString &rule : qAsConst(m_sources)) {
+            ParsedFilter parsed;
+            if (parseFilter(rule, parsed)) {
+                parsedFilters.append(parsed);
+                sources.append(rule);
             }
         }
+        m_sources = sources;
+        const int filterCount = parsedFilters.size();
 
-        int len = str.length();
-        int k;
+        QVector<quint32> keyed;
+        QVector<quint32> generic;
+        QVector<CompiledHost> hosts;
+        for (int i = 0; i < filterCount; ++i) {
+            const ParsedFilter &parsed = parsedFilters.at(i);
+            if (parsed.flags & HostIndexed) {
+                CompiledHost host;
+                host.hash = hostHash(parsed.pattern.unicode(), parsed.keyLength);
+                host.filter = i;
+                hosts.append(host);
+            } else if (parsed.keyLength > 0) {
+                keyed.append(i);
+            } else {
+                generic.append(i);
+            }
+        }
+        std::sort(hosts.begin(), hosts.end(), [](const CompiledHost &a, const CompiledHost &b) {
+            return a.hash < b.hash || (a.hash == b.hash && a.filter < b.filter);
+        });
 
-        int current = 0;
-        int next = 0;
-        // compute hash for first 8 characters
-        for (k = 0; k < 8 && k < len; ++k)
-            current = (current * HASH_P + str[k].unicode()) % HASH_Q;
+        // Keys are inserted in lower case: the URL is scanned in lower case, and
+        // $match-case filters are checked against the original URL afterwards
+        auto keyOf = [&parsedFilters](quint32 index) {
+            const ParsedFilter &parsed = parsedFilters.at(index);
+            return asciiToLower(parsed.pattern.mid(parsed.keyOffset, parsed.keyLength));
+        };
 
-        QHash<int, QVector<int> >::const_iterator hashEnd = stringFiltersHash.end();
-        // main Rabin-Karp's algorithm loop
-        for (k = 7; k < len; ++k, current = next) {
-            // roll the hash if not at the end
-            // (calculate hash for the next iteration)
-            if (k + 1 < len)
-                next = (HASH_P * ((current + HASH_Q - ((HASH_MOD * str[k - 7].unicode()) % HASH_Q)) % HASH_Q) + str[k + 1].unicode()) % HASH_Q;
+        // Inserting the keys in lexicographic order means that the child we may descend
+        // into is always the last one created for a node: the trie can be built with
+        // plain sibling lists, and the edges of each node come out already sorted
+        QVector<QString> keys(filterCount);
+        for (quint32 index : qAsConst(keyed))
+            keys[index] = keyOf(index);
+        std::sort(keyed.begin(), keyed.end(), [&keys](quint32 a, quint32 b) {
+            return keys.at(a) < keys.at(b);
+        });
 
-            if (!fastLookUp.testBit(current))
-                continue;
+        QVector<quint16> chars(1, 0);
+        QVector<quint32> firstChild(1, NO_NODE);
+        QVector<quint32> nextSibling(1, NO_NODE);
+        QVector<quint32> lastChild(1, NO_NODE);
+        QVector<quint32> firstOutput(1, 0);
+        QVector<quint32> outputCount(1, 0);
+        QVector<quint32> outputs;
+        outputs.reserve(keyed.size());
+        for (quint32 index : qAsConst(keyed)) {
+            const QString &key = keys.at(index);
+            quint32 cur = 0;
+            for (int k = 0; k < key.length(); ++k) {
+                const quint16 c = key.at(k).unicode();
+                const quint32 last = lastChild.at(cur);
+                if (last != NO_NODE && chars.at(last) == c) {
+                    cur = last;
+                    continue;
+                }
+                const quint32 node = chars.size();
+                chars.append(c);
+                firstChild.append(NO_NODE);
+                nextSibling.append(NO_NODE);
+                lastChild.append(NO_NODE);
+                firstOutput.append(0);
+                outputCount.append(0);
+                if (last == NO_NODE)
+                    firstChild[cur] = node;
+                else
+                    nextSibling[last] = node;
+                lastChild[cur] = node;
+                cur = node;
+            }
+            // Filters with the same key are adjacent, so their outputs are contiguous
+            if (outputCount.at(cur) == 0)
+                firstOutput[cur] = outputs.size();
+            ++outputCount[cur];
+            outputs.append(index);
+        }
 
-            // look-up the hash in the HashMap and check all strings
-            QHash<int, QVector<int> >::const_iterator it = stringFiltersHash.find(current + 1);
-
-            // check possible strings
-            if (it != hashEnd) {
-                for (int j = 0; j < it->size(); ++j) {
-                    int index = it->value(j);
-                    // check if we got simple string or REs prefix
-                    if (index >= 0) {
-                        int flen = stringFilters[index].length();
-                        if (k - flen + 1 >= 0 && stringFilters[index] == str.midRef(k - flen + 1 , flen))
-                        {
-                            if (by != nullptr) *by = stringFilters[index];
-                            return true;
-                        }
-                    } else {
-                        index = -index - 1;
-                        int flen = rePrefixes[index].length();
-                        if (k - 8 + flen < len && rePrefixes[index] == str.midRef(k - 7, flen))
-                        {
-                            int remStart = k - 7 + flen;
-                            QString remainder = QString::fromRawData(str.unicode() + remStart,
-                                                                    str.length() - remStart);
-                            if (reFilters[index].exactMatch(remainder)) {
-                                if (by != nullptr) *by = rePrefixes[index]+reFilters[index].pattern();
-                                return true;
-                            }
+        const quint32 nodeCount = chars.size();
+        QVector<CompiledNode> nodes(nodeCount);
+        QVector<CompiledEdge> edges;
+        edges.reserve(nodeCount - 1);
+        for (quint32 n = 0; n < nodeCount; ++n) {
+            CompiledNode &node = nodes[n];
+            node.firstEdge = edges.size();
+            for (quint32 child = firstChild.at(n); child != NO_NODE; child = nextSibling.at(child)) {
+                CompiledEdge e;
+                e.ch = chars.at(child);
+                e.unused = 0;
+                e.target = child;
+                edges.append(e);
+            }
+            node.edgeCount = edges.size() - node.firstEdge;
+            node.fail = 0;
+            node.dictLink = 0;
+            node.firstOutput = firstOutput.at(n);
+            node.outputCount = outputCount.at(n);
+        }
+
+        auto go = [&](quint32 state, quint16 c) -> quint32 {
+            const CompiledEdge *first = edges.constData() + nodes.at(state).firstEdge;
+            const CompiledEdge *last = first + nodes.at(state).edgeCount;
+            const CompiledEdge *it = std::lower_bound(first, last, c,
+                                                      [](const CompiledEdge &e, quint16 ch) { return e.ch < ch; });
+            return (it != last && it->ch == c) ? it->target : NO_NODE;
+        };
+
+        // Compute the failure and dictionary links breadth-first, so that the links
+        // of the shallower states are always known
+        QVector<quint32> queue;
+        queue.reserve(nodeCount);
+        queue.append(0);
+        for (int q = 0; q < queue.size(); ++q) {
+            const quint32 parent = queue.at(q);
+            const CompiledNode parentNode = nodes.at(parent);
+            for (quint32 k = 0; k < parentNode.edgeCount; ++k) {
+                const CompiledEdge &e = edges.at(parentNode.firstEdge + k);
+                quint32 fail = 0;
+                if (parent != 0) {
+                    quint32 f = parentNode.fail;
+                    for (;;) {
+                        const quint32 next = go(f, e.ch);
+                        if (next != NO_NODE) {
+                            fail = next;
+                            break;
                         }
+                        if (f == 0)
+                            break;
+                        f = nodes.at(f).fail;
                     }
                 }
+                CompiledNode &child = nodes[e.target];
+                child.fail = fail;
+                child.dictLink = nodes.at(fail).outputCount ? fail : nodes.at(fail).dictLink;
+                queue.append(e.target);
+            }
+        }
+
+        // Lay out the strings of the filters
+        QVector<CompiledFilter> filters(filterCount);
+        QVector<quint16> strings;
+        auto addString = [&strings](const QString &str, quint32 &offset, quint32 &length) {
+            offset = strings.size();
+            length = str.length();
+            const ushort *utf16 = str.utf16();
+            for (int k = 0; k < str.length(); ++k)
+                strings.append(utf16[k]);
+        };
+        for (int i = 0; i < filterCount; ++i) {
+            const ParsedFilter &parsed = parsedFilters.at(i);
+            CompiledFilter &f = filters[i];
+            f.flags = parsed.flags;
+            f.keyOffset = parsed.keyOffset;
+            f.keyLength = parsed.keyLength;
+            addString(parsed.pattern, f.textOffset, f.textLength);
+            addString(parsed.domains, f.domainsOffset, f.domainsLength);
+            addString(m_sources.at(i), f.sourceOffset, f.sourceLength);
+        }
+
+        CompiledHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, s_filterCacheMagic, sizeof(h.magic));
+        h.version = FILTER_CACHE_VERSION;
+        h.byteOrder = FILTER_CACHE_BYTE_ORDER;
+        h.nodeCount = nodeCount;
+        h.edgeCount = edges.size();
+        h.outputCount = outputs.size();
+        h.filterCount = filterCount;
+        h.hostCount = hosts.size();
+        h.genericCount = generic.size();
+        h.stringsLength = strings.size();
+        for (int c = 0; c < ROOT_TABLE_SIZE; ++c)
+            h.rootTable[c] = go(0, c);
+
+        quint32 offset = sizeof(h);
+        auto place = [&offset](quint32 bytes) {
+            const quint32 start = offset;
+            offset += (bytes + 3) & ~3u;
+            return start;
+        };
+        h.nodesOffset = place(nodes.size() * sizeof(CompiledNode));
+        h.edgesOffset = place(edges.size() * sizeof(CompiledEdge));
+        h.outputsOffset = place(outputs.size() * sizeof(quint32));
+        h.filtersOffset = place(filters.size() * sizeof(CompiledFilter));
+        h.hostsOffset = place(hosts.size() * sizeof(CompiledHost));
+        h.genericOffset = place(generic.size() * sizeof(quint32));
+        h.stringsOffset = place(strings.size() * sizeof(quint16));
+        h.totalSize = offset;
+
+        QByteArray blob(h.totalSize, '\0');
+        char *out = blob.data();
+        std::memcpy(out, &h, sizeof(h));
+        std::memcpy(out + h.nodesOffset, nodes.constData(), nodes.size() * sizeof(CompiledNode));
+        std::memcpy(out + h.edgesOffset, edges.constData(), edges.size() * sizeof(CompiledEdge));
+        std::memcpy(out + h.outputsOffset, outputs.constData(), outputs.size() * sizeof(quint32));
+        std::memcpy(out + h.filtersOffset, filters.constData(), filters.size() * sizeof(CompiledFilter));
+        std::memcpy(out + h.hostsOffset, hosts.constData(), hosts.size() * sizeof(CompiledHost));
+        std::memcpy(out + h.genericOffset, generic.constData(), generic.size() * sizeof(quint32));
+        std::memcpy(out + h.stringsOffset, strings.constData(), strings.size() * sizeof(quint16));
+
+        m_blob = blob;
+        m_data = m_blob.constData();
+        compileRegExps();
+    }
+
+    void clear()
+    {
+        m_data = nullptr;
+        m_blob.clear();
+        if (m_cacheFile) {
+            m_cacheFile->close(); // also unmaps the file
+            delete m_cacheFile;
+            m_cacheFile = nullptr;
+        }
+        m_regExps.clear();
+        m_sources.clear();
+        m_sourcesValid = true;
+        m_dirty = false;
+    }
+
+    // check if the request matches at least one filter from the set
+    bool isMatched(const FilterRequest& request, bool importantOnly, QString *by = nullptr)
+    {
+        compile();
+        if (!m_data)
+            return false;
+
+        const CompiledHeader *h = header();
+        const CompiledNode *nodes = section<CompiledNode>(h->nodesOffset);
+        const quint32 *outputs = section<quint32>(h->outputsOffset);
+        const QChar *s = request.lowerUrl.unicode();
+        const int len = request.lowerUrl.length();
+
+        // Filters anchored to the host, or to one of its parent domains
+        if (h->hostCount) {
+            const CompiledHost *hosts = section<CompiledHost>(h->hostsOffset);
+            const CompiledHost *hostsEnd = hosts + h->hostCount;
+            for (int start = request.hostStart; start < request.hostEnd; ++start) {
+                if (start != request.hostStart && s[start - 1] != QLatin1Char('.'))
+                    continue;
+                const int hostLen = request.hostEnd - start;
+                const quint32 hash = hostHash(s + start, hostLen);
+                const CompiledHost *it = std::lower_bound(hosts, hostsEnd, hash,
+                                                          [](const CompiledHost &e, quint32 v) { return e.hash < v; });
+                for (; it != hostsEnd && it->hash == hash; ++it) {
+                    const CompiledFilter &f = filter(it->filter);
+                    if (int(f.keyLength) != hostLen || !std::equal(s + start, s + request.hostEnd, pattern(f),
+                                                                   [](QChar a, quint16 b) { return a.unicode() == b; }))
+                        continue;
+                    if (appliesTo(f, request, importantOnly) && verify(f, request, 0, start)) {
+                        if (by != nullptr) *by = source(f);
+                        return true;
+                    }
+                }
+            }
+        }
+
+        quint32 state = 0;
+        for (int i = 0; i < len; ++i) {
+            const quint16 c = s[i].unicode();
+            for (;;) {
+                const quint32 next = transition(state, c);
+                if (next != NO_NODE) {
+                    state = next;
+                    break;
+                }
+                if (state == 0)
+                    break;
+                state = nodes[state].fail;
+            }
+
+            quint32 out = nodes[state].outputCount ? state : nodes[state].dictLink;
+            while (out) {
+                const CompiledNode &node = nodes[out];
+                for (quint32 k = 0; k < node.outputCount; ++k) {
+                    const CompiledFilter &f = filter(outputs[node.firstOutput + k]);
+                    if (!appliesTo(f, request, importantOnly))
+                        continue;
+                    // find the piece containing the key, and where it starts in the URL
+                    const quint16 *text = pattern(f);
+                    int pieceStart = f.keyOffset;
+                    while (pieceStart > 0 && text[pieceStart - 1] != '*')
+                        --pieceStart;
+                    const int urlPos = i - int(f.keyLength) + 1 - (int(f.keyOffset) - pieceStart);
+                    if (urlPos >= 0 && verify(f, request, pieceStart, urlPos)) {
+                        if (by != nullptr) *by = source(f);
+                        return true;
+                    }
+                }
+                out = node.dictLink;
+            }
+        }
+
+        const quint32 *generic = section<quint32>(h->genericOffset);
+        for (quint32 k = 0; k < h->genericCount; ++k) {
+            const CompiledFilter &f = filter(generic[k]);
+            if (!appliesTo(f, request, importantOnly))
+                continue;
+            bool matched = false;
+            if (f.flags & RegExpFilter) {
+                matched = m_regExps.at(k).match(request.url).hasMatch();
+            } else if (f.textLength == 0) {
+                // a filter made only of wildcards matches everything
+                matched = true;
+            } else {
+                for (int start = 0; start <= len && !matched; ++start)
+                    matched = verify(f, request, 0, start);
+            }
+            if (matched) {
+                if (by != nullptr) *by = source(f);
+                return true;
             }
         }
 
         return false;
     }
 
-    // add filter to matching set with wildcards (*,?) in it
-    void addWildedString(const QString& prefix, const QRegExp& rx)
+    bool load(const QString& fileName, const QByteArray& signature)
     {
-        rePrefixes.append(prefix);
-        reFilters.append(rx);
-        int index = -rePrefixes.size();
-
-        int current = 0;
-        for (int k = 0; k < 8; ++k)
-            current = (current * HASH_P + prefix[k].unicode()) % HASH_Q;
-
-        // insert computed hash value into HashMap
-        QHash<int, QVector<int> >::iterator it = stringFiltersHash.find(current + 1);
-        if (it == stringFiltersHash.end()) {
-            QVector<int> list;
-            list.append(index);
-            stringFiltersHash.insert(current + 1, list);
-            fastLookUp.setBit(current);
-        } else {
-            it->append(index);
+        clear();
+
+        QFile *file = new QFile(fileName);
+        if (!file->open(QIODevice::ReadOnly)) {
+            delete file;
+            return false;
         }
+
+        const qint64 size = file->size();
+        const uchar *map = (size >= qint64(sizeof(CompiledHeader))) ? file->map(0, size) : nullptr;
+        if (!map || !isValid(reinterpret_cast<const char*>(map), size, signature)) {
+            file->close();
+            delete file;
+            return false;
+        }
+
+        m_cacheFile = file;
+        m_data = reinterpret_cast<const char*>(map);
+        m_sourcesValid = false;
+        compileRegExps();
+        return true;
     }
 
-    void clear()
+    bool save(const QString& fileName, const QByteArray& signature)
     {
-        stringFilters.clear();
-        shortStringFilters.clear();
-        reFilters.clear();
-        rePrefixes.clear();
-        stringFiltersHash.clear();
-        fastLookUp.resize(HASH_Q);
-        fastLookUp.fill(0, 0, HASH_Q);
+        compile();
+        if (!m_data || signature.size() != int(sizeof(CompiledHeader::signature)))
+            return false;
+
+        CompiledHeader h = *header();
+        std::memcpy(h.signature, signature.constData(), sizeof(h.signature));
+
+        // QSaveFile replaces the file atomically: a process still having the old cache
+        // mapped keeps reading the old content instead of crashing
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        file.write(m_data + sizeof(h), h.totalSize - sizeof(h));
+        return file.commit();
     }
 
 private:
-    QVector<QString> stringFilters;
-    QVector<QString> shortStringFilters;
-    QVector<QRegExp> reFilters;
-    QVector<QString> rePrefixes;
-    QBitArray fastLookUp;
+    // A filter, as parsed from its source
+    struct ParsedFilter {
+        QString pattern;
+        QString domains;
+        quint32 flags;
+        int keyOffset;
+        int keyLength;
+    };
 
-    QHash<int, QVector<int> > stringFiltersHash;
-};
+    // The sources are not kept when the filters are read from a cache; read them back
+    // from the compiled data when the set needs to be changed
+    void loadSources()
+    {
+        if (m_sourcesValid)
+            return;
+        const CompiledHeader *h = header();
+        QStringList sources;
+        sources.reserve(h->filterCount);
+        for (quint32 i = 0; i < h->filterCount; ++i)
+            sources.append(source(filter(i)));
+        clear();
+        m_sources = sources;
+        m_dirty = true;
+    }
+
+    const CompiledHeader *header() const
+    {
+        return reinterpret_cast<const CompiledHeader*>(m_data);
+    }
 
+    template<typename T>
+    const T *section(quint32 offset) const
+    {
+        return reinterpret_cast<const T*>(m_data + offset);
+    }
 
-// We only want a subset of features of wildcards -- just the 
-// star, so we escape the rest before passing to QRegExp. 
-// The \ is escaped due to a QRegExp bug.
-// ### we really should rather parse it ourselves, in order to 
-// handle adblock-special things like | and ^ properly.
-static QRegExp fromAdBlockWildcard(const QString& wcStr) {
-    QRegExp rx;
-    rx.setPatternSyntax(QRegExp::Wildcard);
-
-    QString out;
-    for (int p = 0; p < wcStr.length(); ++p) {
-        QChar c = wcStr[p];
-        if (c == QLatin1Char('?'))
-            out += QLatin1String("[?]");
-        else if (c == QLatin1Char('['))
-            out += QLatin1String("[[]");
-        else if (c == QLatin1Char('\\'))
-            out += QLatin1String("[\\]");
-        else
-            out += c;
+    const CompiledFilter &filter(quint32 index) const
+    {
+        return section<CompiledFilter>(header()->filtersOffset)[index];
     }
 
-    rx.setPattern(out);
-    return rx;
-}
+    const quint16 *pattern(const CompiledFilter &f) const
+    {
+        return section<quint16>(header()->stringsOffset) + f.textOffset;
+    }
+
+    QString string(quint32 offset, quint32 length) const
+    {
+        const quint16 *strings = section<quint16>(header()->stringsOffset);
+        return QString(reinterpret_cast<const QChar*>(strings + offset), length);
+    }
+
+    QString source(const CompiledFilter &f) const
+    {
+        return string(f.sourceOffset, f.sourceLength);
+    }
+
+    quint32 transition(quint32 state, quint16 c) const
+    {
+        const CompiledHeader *h = header();
+        if (state == 0 && c < ROOT_TABLE_SIZE)
+            return h->rootTable[c];
+
+        const CompiledNode &node = section<CompiledNode>(h->nodesOffset)[state];
+        const CompiledEdge *first = section<CompiledEdge>(h->edgesOffset) + node.firstEdge;
+        const CompiledEdge *last = first + node.edgeCount;
+        const CompiledEdge *it = std::lower_bound(first, last, c,
+                                                  [](const CompiledEdge &e, quint16 ch) { return e.ch < ch; });
+        return (it != last && it->ch == c) ? it->target : NO_NODE;
+    }
+
+    // Checks the options of a filter, which are cheaper to check than its pattern
+    bool appliesTo(const CompiledFilter &f, const FilterRequest& request, bool importantOnly) const
+    {
+        if (!((f.flags >> TYPE_SHIFT) & request.type))
+            return false;
+        if (importantOnly && !(f.flags & Important))
+            return false;
+        if ((f.flags & (ThirdPartyOnly | FirstPartyOnly))
+            && request.isThirdParty() != bool(f.flags & ThirdPartyOnly))
+            return false;
+        if (f.domainsLength == 0)
+            return true;
+
+        // $domain=a.com|~b.a.com: the page must be on a.com but not on b.a.com. This is
+        // checked for every candidate, so the list is walked where it's stored
+        const QString &host = request.firstPartyHost;
+        const quint16 *domains = section<quint16>(header()->stringsOffset) + f.domainsOffset;
+        const int length = f.domainsLength;
+        bool hasIncluded = false;
+        bool included = false;
+        for (int start = 0; start <= length;) {
+            int end = start;
+            while (end < length && domains[end] != '|')
+                ++end;
+            const bool excluded = end > start && domains[start] == '~';
+            const int domainStart = excluded ? start + 1 : start;
+            const bool onDomain = isOnDomain(host, domains + domainStart, end - domainStart);
+            if (excluded) {
+                if (onDomain)
+                    return false;
+            } else {
+                hasIncluded = true;
+                included = included || onDomain;
+            }
+            start = end + 1;
+        }
+        return !hasIncluded || included;
+    }
+
+    // Whether pos is a valid start for a filter which is anchored
+    bool isAnchorPosition(const CompiledFilter &f, const FilterRequest& request, int pos) const
+    {
+        if (f.flags & StartAnchor)
+            return pos == 0;
+        if (f.flags & DomainAnchor)
+            return pos >= request.hostStart && pos < request.hostEnd
+                && (pos == request.hostStart || request.lowerUrl.at(pos - 1) == QLatin1Char('.'));
+        return true;
+    }
+
+    // Checks whether the pattern of f matches the request, given that the piece starting at
+    // pieceStart in the pattern is at position urlPos of the URL.
+    bool verify(const CompiledFilter &f, const FilterRequest& request, int pieceStart, int urlPos) const
+    {
+        const QString &url = (f.flags & MatchCase) ? request.url : request.lowerUrl;
+        const QChar *str = url.unicode();
+        const int strLen = url.length();
+        const quint16 *text = pattern(f);
+        const int textLen = f.textLength;
+
+        int pieceEnd = pieceStart;
+        while (pieceEnd < textLen && text[pieceEnd] != '*')
+            ++pieceEnd;
+        int right = pieceMatchesAt(text + pieceStart, pieceEnd - pieceStart, str, strLen, urlPos, pieceEnd == textLen);
+        if (right < 0)
+            return false;
+        if (pieceStart == 0 && !isAnchorPosition(f, request, urlPos))
+            return false;
+
+        // The pieces on the left must appear, in order, before this one. Taking the closest
+        // occurrence each time leaves the most room for the following ones.
+        int left = urlPos;
+        int tEnd = pieceStart;
+        while (tEnd > 0) {
+            while (tEnd > 0 && text[tEnd - 1] == '*')
+                --tEnd;
+            if (tEnd == 0)
+                break;
+            int tStart = tEnd;
+            while (tStart > 0 && text[tStart - 1] != '*')
+                --tStart;
+            const int len = tEnd - tStart;
+            int pos = left - len;
+            for (; pos >= 0; --pos) {
+                if ((tStart != 0 || isAnchorPosition(f, request, pos))
+                    && pieceMatchesAt(text + tStart, len, str, strLen, pos, false) >= 0)
+                    break;
+            }
+            if (pos < 0)
+                return false;
+            left = pos;
+            tEnd = tStart;
+        }
+
+        // Same for the pieces on the right
+        int tStart = pieceEnd;
+        while (tStart < textLen) {
+            while (tStart < textLen && text[tStart] == '*')
+                ++tStart;
+            if (tStart == textLen)
+                break;
+            int tStop = tStart;
+            while (tStop < textLen && text[tStop] != '*')
+                ++tStop;
+            const int len = tStop - tStart;
+            const bool last = tStop == textLen;
+            int end = -1;
+            if (last && (f.flags & EndAnchor)) {
+                // the last piece must end the URL; a final ^ may match its end
+                for (int pos = qMax(right, strLen - len); pos <= strLen - len + 1 && end != strLen; ++pos)
+                    end = pieceMatchesAt(text + tStart, len, str, strLen, pos, true);
+                if (end != strLen)
+                    return false;
+            } else {
+                for (int pos = right; pos <= strLen && end < 0; ++pos)
+                    end = pieceMatchesAt(text + tStart, len, str, strLen, pos, last);
+                if (end < 0)
+                    return false;
+            }
+            right = end;
+            tStart = tStop;
+        }
+
+        return !(f.flags & EndAnchor) || right == strLen;
+    }
+
+    void compileRegExps()
+    {
+        const CompiledHeader *h = header();
+        const quint32 *generic = section<quint32>(h->genericOffset);
+        m_regExps.clear();
+        m_regExps.reserve(h->genericCount);
+        for (quint32 k = 0; k < h->genericCount; ++k) {
+            const CompiledFilter &f = filter(generic[k]);
+            if (f.flags & RegExpFilter) {
+                QRegularExpression rx(string(f.textOffset, f.textLength),
+                                      (f.flags & MatchCase) ? QRegularExpression::NoPatternOption
+                                                            : QRegularExpression::CaseInsensitiveOption);
+                rx.optimize();
+                m_regExps.append(rx);
+            } else {
+                m_regExps.append(QRegularExpression());
+            }
+        }
+    }
+
+    bool isValid(const char *data, qint64 size, const QByteArray& signature) const
+    {
+        const CompiledHeader *h = reinterpret_cast<const CompiledHeader*>(data);
+        if (std::memcmp(h->magic, s_filterCacheMagic, sizeof(h->magic)) != 0
+            || h->version != FILTER_CACHE_VERSION || h->byteOrder != FILTER_CACHE_BYTE_ORDER
+            || h->totalSize != size || signature.size() != int(sizeof(h->signature))
+            || std::memcmp(h->signature, signature.constData(), sizeof(h->signature)) != 0)
+            return false;
+
+        auto fits = [size](quint32 offset, quint32 count, quint32 itemSize) {
+            return offset % 4 == 0 && quint64(offset) + quint64(count) * itemSize <= quint64(size);
+        };
+        if (h->nodeCount == 0 || !fits(h->nodesOffset, h->nodeCount, sizeof(CompiledNode))
+            || !fits(h->edgesOffset, h->edgeCount, sizeof(CompiledEdge))
+            || !fits(h->outputsOffset, h->outputCount, sizeof(quint32))
+            || !fits(h->filtersOffset, h->filterCount, sizeof(CompiledFilter))
+            || !fits(h->hostsOffset, h->hostCount, sizeof(CompiledHost))
+            || !fits(h->genericOffset, h->genericCount, sizeof(quint32))
+            || !fits(h->stringsOffset, h->stringsLength, sizeof(quint16)))
+            return false;
+
+        // Make sure a corrupted file can't make us read outside of the mapping
+        const CompiledNode *nodes = reinterpret_cast<const CompiledNode*>(data + h->nodesOffset);
+        for (quint32 i = 0; i < h->nodeCount; ++i) {
+            const CompiledNode &n = nodes[i];
+            if (quint64(n.firstEdge) + n.edgeCount > h->edgeCount || n.fail >= h->nodeCount
+                || n.dictLink >= h->nodeCount || quint64(n.firstOutput) + n.outputCount > h->outputCount)
+                return false;
+        }
+        const CompiledEdge *edges = reinterpret_cast<const CompiledEdge*>(data + h->edgesOffset);
+        for (quint32 i = 0; i < h->edgeCount; ++i) {
+            if (edges[i].target >= h->nodeCount)
+                return false;
+        }
+        // Following the fail and dictionary links must always end at the root, or isMatched() would
+        // never return: the edges must form a tree, and the links must lead to shallower states
+        QVector<quint32> depth(h->nodeCount, NO_NODE);
+        QVector<quint32> queue;
+        queue.reserve(h->nodeCount);
+        depth[0] = 0;
+        queue.append(0);
+        for (int q = 0; q < queue.size(); ++q) {
+            const quint32 parent = queue.at(q);
+            const CompiledNode &n = nodes[parent];
+            for (quint32 k = 0; k < n.edgeCount; ++k) {
+                const quint32 target = edges[n.firstEdge + k].target;
+                if (depth.at(target) != NO_NODE)
+                    return false;
+                depth[target] = depth.at(parent) + 1;
+                queue.append(target);
+            }
+        }
+        if (quint32(queue.size()) != h->nodeCount || nodes[0].fail != 0 || nodes[0].dictLink != 0)
+            return false;
+        for (quint32 i = 1; i < h->nodeCount; ++i) {
+            if (depth.at(nodes[i].fail) >= depth.at(i) || depth.at(nodes[i].dictLink) >= depth.at(i))
+                return false;
+        }
+        const quint32 *outputs = reinterpret_cast<const quint32*>(data + h->outputsOffset);
+        for (quint32 i = 0; i < h->outputCount; ++i) {
+            if (outputs[i] >= h->filterCount)
+                return false;
+        }
+        const CompiledHost *hosts = reinterpret_cast<const CompiledHost*>(data + h->hostsOffset);
+        for (quint32 i = 0; i < h->hostCount; ++i) {
+            if (hosts[i].filter >= h->filterCount)
+                return false;
+        }
+        const quint32 *generic = reinterpret_cast<const quint32*>(data + h->genericOffset);
+        for (quint32 i = 0; i < h->genericCount; ++i) {
+            if (generic[i] >= h->filterCount)
+                return false;
+        }
+        const CompiledFilter *filters = reinterpret_cast<const CompiledFilter*>(data + h->filtersOffset);
+        for (quint32 i = 0; i < h->filterCount; ++i) {
+            const CompiledFilter &f = filters[i];
+            if (quint64(f.textOffset) + f.textLength > h->stringsLength
+                || quint64(f.keyOffset) + f.keyLength > f.textLength
+                || quint64(f.domainsOffset) + f.domainsLength > h->stringsLength
+                || quint64(f.sourceOffset) + f.sourceLength > h->stringsLength)
+                return false;
+        }
+        for (int c = 0; c < ROOT_TABLE_SIZE; ++c) {
+            if (h->rootTable[c] != NO_NODE && h->rootTable[c] >= h->nodeCount)
+                return false;
+        }
+        return true;
+    }
+
+    // Parses the options following the $ of a filter. Returns false if the options
+    // contain anything unknown, in which case the filter must be dropped
+    static bool parseOptions(const QString& options, ParsedFilter& parsed)
+    {
+        static const struct {
+            const char *name;
+            FilterRequestType type;
+        } types[] = {
+            { "other", OtherRequest },
+            { "script", ScriptRequest },
+            { "image", ImageRequest },
+            { "stylesheet", StylesheetRequest },
+            { "xmlhttprequest", XmlHttpRequest },
+            { "subdocument", SubdocumentRequest },
+            { "object", ObjectRequest },
+            { "object-subrequest", ObjectRequest },
+            { "media", MediaRequest },
+            { "font", FontRequest },
+            { "ping", PingRequest },
+            { "websocket", WebSocketRequest }
+        };
+
+        quint32 includedTypes = 0;
+        quint32 excludedTypes = 0;
+        const QStringList list = options.split(QLatin1Char(','));
+        for (const QString &option : list) {
+            const bool inverse = option.startsWith(QLatin1Char('~'));
+            const QString name = asciiToLower(inverse ? option.mid(1) : option);
+            bool isType = false;
+            for (const auto &t : types) {
+                if (name == QLatin1String(t.name)) {
+                    (inverse ? excludedTypes : includedTypes) |= t.type;
+                    isType = true;
+                    break;
+                }
+            }
+            if (isType)
+                continue;
+            if (name == QLatin1String("third-party")) {
+                parsed.flags |= inverse ? FirstPartyOnly : ThirdPartyOnly;
+            } else if (name == QLatin1String("match-case") && !inverse) {
+                parsed.flags |= MatchCase;
+            } else if (name == QLatin1String("important") && !inverse) {
+                parsed.flags |= Important;
+            } else if (name.startsWith(QLatin1String("domain=")) && !inverse) {
+                parsed.domains = name.mid(7);
+            } else if (name == QLatin1String("collapse")) {
+                // only affects how blocked elements are displayed
+            } else {
+                return false;
+            }
+        }
+
+        quint32 typeMask = includedTypes ? includedTypes : quint32(AllRequests);
+        typeMask &= ~excludedTypes;
+        if (!typeMask)
+            return false;
+        parsed.flags = (parsed.flags & ((1u << TYPE_SHIFT) - 1)) | (typeMask << TYPE_SHIFT);
+        return true;
+    }
+
+    // Parses a filter, already stripped of @@. Returns false for filters which can't be handled
+    static bool parseFilter(const QString& rule, ParsedFilter& parsed)
+    {
+        parsed.flags = quint32(AllRequests) << TYPE_SHIFT;
+        parsed.keyOffset = 0;
+        parsed.keyLength = 0;
+        QString filter = rule;
+
+        const int dollar = filter.lastIndexOf(QLatin1Char('$'));
+        if (dollar >= 0) {
+            if (parseOptions(filter.mid(dollar + 1), parsed)) {
+                filter.truncate(dollar);
+            } else if (!(filter.length() > 2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/')))) {
+                // a $ which doesn't start options can only belong to a regular expression
+                return false;
+            } else {
+                parsed.domains.clear();
+                parsed.flags = quint32(AllRequests) << TYPE_SHIFT;
+            }
+        }
+
+        // Is it a regexp filter?
+        if (filter.length() > 2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/'))) {
+            parsed.pattern = filter.mid(1, filter.length() - 2);
+            parsed.flags |= RegExpFilter;
+            return true;
+        }
+
+        // Nope, a wildcard one.
+        if (filter.startsWith(QLatin1String("||"))) {
+            parsed.flags |= DomainAnchor;
+            filter.remove(0, 2);
+        } else if (filter.startsWith(QLatin1Char('|'))) {
+            parsed.flags |= StartAnchor;
+            filter.remove(0, 1);
+        }
+        if (filter.endsWith(QLatin1Char('|'))) {
+            parsed.flags |= EndAnchor;
+            filter.chop(1);
+        }
+
+        // Strip wildcards at the ends, together with the anchors they make useless
+        int first = 0;
+        int last = filter.length() - 1;
+        while (first < filter.length() && filter.at(first) == QLatin1Char('*'))
+            ++first;
+        while (last >= first && filter.at(last) == QLatin1Char('*'))
+            --last;
+        if (first > 0)
+            parsed.flags &= ~(StartAnchor | DomainAnchor);
+        if (last < filter.length() - 1)
+            parsed.flags &= ~EndAnchor;
+        filter = filter.mid(first, last - first + 1);
+
+        parsed.pattern = (parsed.flags & MatchCase) ? filter : asciiToLower(filter);
+        if (filter.contains(QLatin1Char('*')) || filter.contains(QLatin1Char('^')))
+            parsed.flags |= WildcardFilter;
+
+        // ||host^, ||host/ and ||host: can be looked up by host
+        if (parsed.flags & DomainAnchor) {
+            int h = 0;
+            while (h < filter.length() && !QStringLiteral("^/:*|?").contains(filter.at(h)))
+                ++h;
+            if (h > 0 && h < filter.length() && QStringLiteral("^/:").contains(filter.at(h))) {
+                parsed.flags |= HostIndexed;
+                parsed.keyLength = h;
+                parsed.pattern.replace(0, h, asciiToLower(filter.left(h)));
+                return true;
+            }
+        }
+
+        // The key is the longest literal part of the pattern
+        int p = 0;
+        while (p < filter.length()) {
+            while (p < filter.length() && (filter.at(p) == QLatin1Char('*') || filter.at(p) == QLatin1Char('^')))
+                ++p;
+            const int start = p;
+            while (p < filter.length() && filter.at(p) != QLatin1Char('*') && filter.at(p) != QLatin1Char('^'))
+                ++p;
+            if (p - start > parsed.keyLength) {
+                parsed.keyOffset = start;
+                parsed.keyLength = p - start;
+            }
+        }
+        parsed.keyLength = qMin(parsed.keyLength, MAX_KEY_LENGTH);
+        return true;
+    }
+
+    // Either m_blob.constData() or the mapping of m_cacheFile; nullptr if nothing has been compiled
+    const char *m_data;
+    QByteArray m_blob;
+    QFile *m_cacheFile;
+    // Compiled generic filters, in the same order as the generic section
+    QVector<QRegularExpression> m_regExps;
+    // The filters, as passed to addRule()
+    QStringList m_sources;
+    // Whether m_sources reflects the content of the set
+    bool m_sourcesValid;
+    // Whether m_sources changed since the last compilation
+    bool m_dirty;
+};
+
 
 FilterSet::FilterSet()
-    :stringFiltersMatcher(new StringsMatcher)
+    :matcher(new FilterMatcher)
 {
 }
 
 FilterSet::~FilterSet()
 {
-    delete stringFiltersMatcher;
+    delete matcher;
 }
 
 void FilterSet::addFilter(const QString& filterStr)
 {
-    QString filter = filterStr;
+    QString filter = filterStr.trimmed();
+    if (filter.isEmpty())
+        return;
 
-    /** ignore special lines starting with "[", "!", "&", or "#" or contain "#" (comments or features are not supported by KHTML's AdBlock */
+    /** ignore special lines starting with "[", "!", "&", or "#" or contain "#" (comments or element hiding rules are handled elsewhere) */
     QChar firstChar = filter.at(0);
     if (firstChar == QLatin1Char('[') || firstChar == QLatin1Char('!') || firstChar == QLatin1Char('&') || firstChar == QLatin1Char('#') || filter.contains(QLatin1Char('#')))
         return;
 
     // Strip leading @@
-    int first = 0;
-    int last  = filter.length() - 1;
     if (filter.startsWith(QLatin1String("@@")))
-        first = 2;
-
-    // Strip options, we ignore them for now.
-    // TODO: Add support for filters with options. See #310230.
-    int dollar = filter.lastIndexOf(QLatin1Char('$'));
-    if (dollar != -1) {
-        return;
-    }
+        filter.remove(0, 2);
 
     // Perhaps nothing left?
-    if (first > last)
+    if (filter.isEmpty())
         return;
 
-    filter = filter.mid(first, last - first + 1);
+    // The filter is only parsed when the set is compiled
+    matcher->addRule(filter);
+}
+
+bool FilterSet::isUrlMatched(const QString& url)
+{
+    return matcher->isMatched(FilterRequest(url), false);
+}
 
-    // Is it a regexp filter?
-    if (filter.length()>2 && filter.startsWith(QLatin1Char('/')) && filter.endsWith(QLatin1Char('/')))
-    {
-        QString inside = filter.mid(1, filter.length()-2);
-        QRegExp rx(inside);
-        reFilters.append(rx);
-//         qCDebug(WEBENGINEPART_LOG) << "R:" << inside;
-    }
-    else
-    {
-        // Nope, a wildcard one.
-        // Note: For these, we also need to handle |.
+bool FilterSet::isUrlMatched(const FilterRequest& request, bool importantOnly)
+{
+    return matcher->isMatched(request, importantOnly);
+}
 
-        // Strip wildcards at the ends
-        first = 0;
-        last  = filter.length() - 1;
+QString FilterSet::urlMatchedBy(const QString& url)
+{
+    QString by;
+    matcher->isMatched(FilterRequest(url), false, &by);
+    return by;
+}
 
-        while (first < filter.length() && filter[first] == QLatin1Char('*'))
-            ++first;
+void FilterSet::clear()
+{
+    matcher->clear();
+}
 
-        while (last >= 0 && filter[last] == QLatin1Char('*'))
-            --last;
+void FilterSet::compile()
+{
+    matcher->compile();
+}
 
-        if (first > last)
-            filter = QStringLiteral("*"); // erm... Well, they asked for it.
-        else
-            filter = filter.mid(first, last - first + 1);
-
-        // Now, do we still have any wildcard stuff left?
-        if (filter.contains(QLatin1String("*")))
-        {
-            // check if we can use RK first (and then check full RE for the rest) for better performance
-            int aPos = filter.indexOf('*');
-            if (aPos < 0)
-                aPos = filter.length();
-            if (aPos > 7) {
-                QRegExp rx = fromAdBlockWildcard(filter.mid(aPos) + QLatin1Char('*'));
-                // We pad the final r.e. with * so we can check for an exact match
-                stringFiltersMatcher->addWildedString(filter.mid(0, aPos), rx);
-            } else {
-                QRegExp rx = fromAdBlockWildcard(filter);
-                reFilters.append(rx);
-            }
-        }
+bool FilterSet::loadCache(const QString& fileName, const QByteArray& signature)
+{
+    return matcher->load(fileName, signature);
+}
+
+bool FilterSet::saveCache(const QString& fileName, const QByteArray& signature)
+{
+    return matcher->save(fileName, signature);
+}
+
+ElementHidingSet::ElementHidingSet()
+    : m_genericStyleSheetValid(false), m_styleSheets(STYLESHEET_CACHE_SIZE)
+{
+}
+
+bool ElementHidingSet::addRule(const QString& ruleStr)
+{
+    const QString rule = ruleStr.trimmed();
+    bool exception = false;
+    int sep = rule.indexOf(QLatin1String("##"));
+    const int exceptionSep = rule.indexOf(QLatin1String("#@#"));
+    if (exceptionSep >= 0 && (sep < 0 || exceptionSep < sep)) {
+        exception = true;
+        sep = exceptionSep;
+    }
+    if (sep < 0)
+        return false;
+
+    const QString selector = rule.mid(sep + (exception ? 3 : 2)).trimmed();
+    // Skip extended selectors, which aren't CSS, and anything which could escape the rule
+    if (selector.isEmpty() || selector.contains(QLatin1Char('{')) || selector.contains(QLatin1Char('}'))
+        || selector.contains(QLatin1String(":-abp-")))
+        return true;
+
+    Rule parsed;
+    parsed.selector = selector;
+    QStringList includedDomains;
+    const QStringList domains = rule.left(sep).toLower().split(QLatin1Char(','), QString::SkipEmptyParts);
+    for (const QString &domain : domains) {
+        if (domain.startsWith(QLatin1Char('~')))
+            parsed.excludedDomains.append(domain.mid(1));
         else
-        {
-            // Fast path
-            stringFiltersMatcher->addString(filter);
-        }
+            includedDomains.append(domain);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_rules.append(rule);
+    for (const QString &domain : qAsConst(includedDomains))
+        m_domains.insert(domain);
+    for (const QString &domain : qAsConst(parsed.excludedDomains))
+        m_domains.insert(domain);
+    if (exception) {
+        // Exceptions can't be excluded from domains
+        if (includedDomains.isEmpty())
+            m_genericExceptions.insert(selector);
+        for (const QString &domain : qAsConst(includedDomains))
+            m_domainExceptions[domain].insert(selector);
+    } else if (!includedDomains.isEmpty()) {
+        for (const QString &domain : qAsConst(includedDomains))
+            m_domainRules[domain].append(parsed);
+    } else if (parsed.excludedDomains.isEmpty()) {
+        m_genericSelectors.append(selector);
+    } else {
+        m_genericRules.append(parsed);
     }
+    m_genericStyleSheetValid = false;
+    m_styleSheets.clear();
+    return true;
 }
 
-bool FilterSet::isUrlMatched(const QString& url)
+void ElementHidingSet::clear()
 {
-    if (stringFiltersMatcher->isMatched(url))
-        return true;
+    QMutexLocker locker(&m_mutex);
+    m_rules.clear();
+    m_genericSelectors.clear();
+    m_genericRules.clear();
+    m_domainRules.clear();
+    m_domainExceptions.clear();
+    m_genericExceptions.clear();
+    m_domains.clear();
+    m_genericStyleSheet.clear();
+    m_genericStyleSheetValid = false;
+    m_styleSheets.clear();
+}
 
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
-            return true;
+void ElementHidingSet::appendRules(const QVector<Rule>& rules, const QString& host, const QSet<QString>& exceptions,
+                                   QStringList& selectors)
+{
+    for (const Rule &rule : rules) {
+        if (exceptions.contains(rule.selector))
+            continue;
+        bool excluded = false;
+        for (const QString &domain : rule.excludedDomains) {
+            if (isOnDomain(host, domain)) {
+                excluded = true;
+                break;
+            }
+        }
+        if (!excluded)
+            selectors.append(rule.selector);
     }
+}
 
-    return false;
+QString ElementHidingSet::buildStyleSheet(const QStringList& selectors)
+{
+    QString css;
+    for (int i = 0; i < selectors.size(); i += SELECTORS_PER_CSS_RULE) {
+        const int end = qMin(i + SELECTORS_PER_CSS_RULE, selectors.size());
+        for (int j = i; j < end; ++j) {
+            if (j != i)
+                css += QLatin1String(", ");
+            css += selectors.at(j);
+        }
+        css += QLatin1String(" { display: none !important; }\n");
+    }
+    return css;
 }
 
-QString FilterSet::urlMatchedBy(const QString& url)
+QString ElementHidingSet::styleSheet(const QString& hostStr) const
 {
-    QString by;
+    const QString fullHost = hostStr.toLower();
+    const QString registrable = registrableDomain(fullHost);
+    QMutexLocker locker(&m_mutex);
 
-    if (stringFiltersMatcher->isMatched(url, &by))
-        return by;
+    // The stylesheet only depends on which parent domains of the host are named by rules, so
+    // it's the same as the one of the longest of them. That is the registrable domain, unless
+    // rules name a subdomain of it, which few do: all the hosts of a site share a stylesheet
+    QString host = registrable;
+    for (int start = 0; start < fullHost.length() - registrable.length();) {
+        const QString domain = fullHost.mid(start);
+        if (m_domains.contains(domain)) {
+            host = domain;
+            break;
+        }
+        start = fullHost.indexOf(QLatin1Char('.'), start) + 1;
+        if (start == 0)
+            break;
+    }
+    if (const QString *cached = m_styleSheets.object(host))
+        return *cached;
 
-    for (int c = 0; c < reFilters.size(); ++c)
-    {
-        if (url.contains(reFilters[c]))
-        {
-            by = reFilters[c].pattern();
+    // The host and its parent domains
+    QStringList domains;
+    for (int start = 0; start < host.length();) {
+        domains.append(host.mid(start));
+        const int dot = host.indexOf(QLatin1Char('.'), start);
+        if (dot < 0)
             break;
+        start = dot + 1;
+    }
+
+    QSet<QString> exceptions = m_genericExceptions;
+    bool hasDomainExceptions = false;
+    for (const QString &domain : qAsConst(domains)) {
+        const auto it = m_domainExceptions.constFind(domain);
+        if (it != m_domainExceptions.constEnd()) {
+            exceptions.unite(*it);
+            hasDomainExceptions = true;
         }
     }
 
-    return by;
+    QString css;
+    if (!hasDomainExceptions) {
+        if (!m_genericStyleSheetValid) {
+            QStringList selectors;
+            for (const QString &selector : m_genericSelectors) {
+                if (!m_genericExceptions.contains(selector))
+                    selectors.append(selector);
+            }
+            m_genericStyleSheet = buildStyleSheet(selectors);
+            m_genericStyleSheetValid = true;
+        }
+        css = m_genericStyleSheet;
+    } else {
+        QStringList selectors;
+        for (const QString &selector : m_genericSelectors) {
+            if (!exceptions.contains(selector))
+                selectors.append(selector);
+        }
+        css = buildStyleSheet(selectors);
+    }
+
+    QStringList selectors;
+    appendRules(m_genericRules, host, exceptions, selectors);
+    for (const QString &domain : qAsConst(domains)) {
+        const auto it = m_domainRules.constFind(domain);
+        if (it != m_domainRules.constEnd())
+            appendRules(*it, host, exceptions, selectors);
+    }
+    css += buildStyleSheet(selectors);
+
+    m_styleSheets.insert(host, new QString(css));
+    return css;
 }
 
-void FilterSet::clear()
+bool ElementHidingSet::loadCache(const QString& fileName, const QByteArray& signature)
+{
+    clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QTextStream ts(&file);
+    ts.setCodec("UTF-8");
+    if (ts.readLine() != QString::fromLatin1(signature.toHex()))
+        return false;
+    while (!ts.atEnd())
+        addRule(ts.readLine());
+    return true;
+}
+
+bool ElementHidingSet::saveCache(const QString& fileName, const QByteArray& signature) const
 {
-    reFilters.clear();
-    stringFiltersMatcher->clear();
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QTextStream ts(&file);
+    ts.setCodec("UTF-8");
+    ts << QString::fromLatin1(signature.toHex()) << '\n';
+    QMutexLocker locker(&m_mutex);
+    for (const QString &rule : m_rules)
+        ts << rule << '\n';
+    ts.flush();
+    return file.commit();
 }
 
 // kate: indent-width 4; replace-tabs on; tab-width 4; space-indent on;
@@ -24,17 +24,72 @@
 #define WEBENGNINE_FILTER_H
 
 #include <QString>
-#include <QRegExp>
+#include <QByteArray>
+#include <QStringList>
 #include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QCache>
+#include <QMutex>
 #include <webenginepart.h>
+#include "kwebenginepartlib_export.h"
 
-class StringsMatcher;
+class FilterMatcher;
 
 namespace KDEPrivate
 {
+// The kinds of resources a filter can be restricted to, using the $script, $image, ... options
+enum FilterRequestType {
+    OtherRequest = 0x001,
+    ScriptRequest = 0x002,
+    ImageRequest = 0x004,
+    StylesheetRequest = 0x008,
+    XmlHttpRequest = 0x010,
+    SubdocumentRequest = 0x020,
+    ObjectRequest = 0x040,
+    MediaRequest = 0x080,
+    FontRequest = 0x100,
+    PingRequest = 0x200,
+    WebSocketRequest = 0x400,
+    AllRequests = 0x7ff
+};
+
+// A request to be checked against a FilterSet: the URL, what it is loaded as and
+// the host of the page loading it, which determines whether the request is a
+// third-party one and which $domain= filters apply.
+class KWEBENGINEPARTLIB_EXPORT FilterRequest {
+public:
+    explicit FilterRequest(const QString& url, FilterRequestType type = OtherRequest,
+                           const QString& firstPartyHost = QString());
+
+    bool isThirdParty() const;
+
+    QString url;
+    // url with ASCII letters in lower case, for case-insensitive filters
+    QString lowerUrl;
+    // Position of the host in url; both are 0 if the URL has no host
+    int hostStart;
+    int hostEnd;
+    FilterRequestType type;
+    QString firstPartyHost;
+
+private:
+    // -1 until isThirdParty() is first called
+    mutable int m_thirdParty;
+};
+
 // This represents a set of filters that may match URLs.
-// Currently it supports a subset of AddBlock Plus functionality.
-class FilterSet {
+// It supports the Adblock Plus filter syntax: | and || anchors, ^ separators, and the
+// $third-party, $domain=, $important, $match-case and resource type options.
+// Element hiding rules are not handled here.
+//
+// Filters are compiled into an Aho-Corasick automaton, so that matching a URL
+// takes time linear in its length, however many filters there are. Filters anchored
+// to a host (||example.com^) are instead indexed by that host and only looked up for
+// the suffixes of the host of the request. The compiled form can be written to a
+// cache file and later used directly from a memory mapping of that file, skipping
+// the parsing of the filter lists.
+class KWEBENGINEPARTLIB_EXPORT FilterSet {
 public:
     FilterSet();
     ~FilterSet();
@@ -44,13 +99,82 @@ public:
     void addFilter(const QString& filter);
 
     bool isUrlMatched(const QString& url);
+    // If importantOnly is true, only filters with the $important option are considered
+    bool isUrlMatched(const FilterRequest& request, bool importantOnly = false);
     QString urlMatchedBy(const QString& url);
 
     void clear();
 
+    // Filters are compiled the first time the set is used after being changed. Compiling
+    // them beforehand allows a set which is not changed anymore to be shared by threads.
+    void compile();
+
+    // Replaces the content of the set with the compiled filters stored in fileName,
+    // provided they were saved with the given signature. Returns false if the
+    // cache is missing, stale or corrupted, in which case the set is left empty.
+    bool loadCache(const QString& fileName, const QByteArray& signature);
+    // Writes the compiled filters to fileName, tagging them with signature
+    bool saveCache(const QString& fileName, const QByteArray& signature);
+
+private:
+    FilterMatcher* matcher;
+};
+
+// This represents a set of element hiding rules, in Adblock Plus syntax: "##selector"
+// hides the elements matched by selector on every page, "example.com,~a.example.com##selector"
+// only on pages from example.com and its subdomains but a.example.com, and
+// "example.com#@#selector" is an exception, hiding nothing on example.com.
+//
+// Rules are indexed by domain, and the rules applying to a host are combined in a
+// single stylesheet, which is remembered for the most recently used domains: hosts
+// under the same registrable domain share it, unless a rule names one of them.
+class KWEBENGINEPARTLIB_EXPORT ElementHidingSet {
+public:
+    ElementHidingSet();
+
+    // Parses and registers an element hiding rule. Returns false if rule isn't one
+    bool addRule(const QString& rule);
+
+    void clear();
+
+    // The stylesheet hiding the elements which must be hidden on pages from host.
+    // This can be called from several threads.
+    QString styleSheet(const QString& host) const;
+
+    // Like FilterSet::loadCache() and FilterSet::saveCache(). The rules are stored as they
+    // were added, since they're parsed much faster than they're extracted from the lists
+    bool loadCache(const QString& fileName, const QByteArray& signature);
+    bool saveCache(const QString& fileName, const QByteArray& signature) const;
+
 private:
-    QVector<QRegExp> reFilters;
-    StringsMatcher* stringFiltersMatcher;
+    struct Rule {
+        QString selector;
+        QStringList excludedDomains;
+    };
+
+    static void appendRules(const QVector<Rule>& rules, const QString& host, const QSet<QString>& exceptions,
+                            QStringList& selectors);
+    static QString buildStyleSheet(const QStringList& selectors);
+
+    // The rules as they were added
+    QStringList m_rules;
+    // Selectors to hide everywhere
+    QStringList m_genericSelectors;
+    // Selectors to hide everywhere but on some domains
+    QVector<Rule> m_genericRules;
+    // Rules restricted to some domains, under each of those domains
+    QHash<QString, QVector<Rule> > m_domainRules;
+    // The selectors which must not be hidden, by domain, and on every page
+    QHash<QString, QSet<QString> > m_domainExceptions;
+    QSet<QString> m_genericExceptions;
+    // Every domain named by a rule, be it included, excluded or an exception
+    QSet<QString> m_domains;
+
+    mutable QMutex m_mutex;
+    // The stylesheet for m_genericSelectors, which most pages share
+    mutable QString m_genericStyleSheet;
+    mutable bool m_genericStyleSheetValid;
+    mutable QCache<QString, QString> m_styleSheets;
 };
 
 }
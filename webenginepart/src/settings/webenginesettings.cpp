@@ -33,6 +33,19 @@
 #include <QWebEngineSettings>
 #include <QFontDatabase>
 #include <QFileInfo>
+#include <QDir>
+#include <QRegExp>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+#include <QSet>
+#include <QMultiHash>
+#include <QVector>
 
 // browser window color defaults -- Bernd
 #define HTML_DEFAULT_LNK_COLOR Qt::blue
@@ -48,6 +61,9 @@
 #define HTML_DEFAULT_VIEW_FANTASY_FONT "Sans Serif"
 #define HTML_DEFAULT_MIN_FONT_SIZE 7 // everything smaller is usually unreadable.
 
+// How often to check whether AdBlocK filter lists need to be downloaded again, in ms
+#define AD_FILTER_REFRESH_INTERVAL (60 * 60 * 1000)
+
 /**
  * @internal
  * Contains all settings which are both available globally and per-domain
@@ -80,6 +96,266 @@ struct KPerDomainSettings {
 
 typedef QMap<QString,KPerDomainSettings> PolicyMap;
 
+/**
+ * @internal
+ * The per-domain settings indexed by domain, so that finding the settings for
+ * a host takes a hash lookup per label of its name, without allocating.
+ *
+ * A domain applies to the hosts whose name ends with it, at a label boundary:
+ * "kde.org" applies to "kde.org" and "www.kde.org", while ".kde.org" and
+ * "*.kde.org" only apply to the subdomains of kde.org. The longest matching
+ * domain wins.
+ */
+class DomainPolicyIndex
+{
+public:
+    void build(const PolicyMap &policies);
+    void clear();
+
+    /**
+     * @returns the settings for @p hostname, whatever its case, or nullptr if
+     * no domain applies to it
+     */
+    const KPerDomainSettings *find(const QString &hostname) const;
+
+private:
+    const KPerDomainSettings *findSuffix(const QString &hostname, int pos) const;
+    static uint hash(const QChar *chars, int length);
+
+    struct Entry {
+        QString domain;
+        KPerDomainSettings settings;
+    };
+    QVector<Entry> m_entries;
+    QMultiHash<uint, int> m_entriesByHash;
+};
+
+void DomainPolicyIndex::clear()
+{
+    m_entries.clear();
+    m_entriesByHash.clear();
+}
+
+void DomainPolicyIndex::build(const PolicyMap &policies)
+{
+    clear();
+    m_entries.reserve(policies.count());
+    for (PolicyMap::const_iterator it = policies.constBegin(); it != policies.constEnd(); ++it) {
+        QString domain = it.key().toLower();
+        if (domain.startsWith(QLatin1Char('*'))) {
+            domain.remove(0, 1);
+        }
+        if (domain.isEmpty() || domain == QLatin1String(".")) {
+            continue;
+        }
+        if (findSuffix(domain, 0)) {
+            continue; // "*.kde.org" and ".kde.org" are the same domain
+        }
+        Entry entry;
+        entry.domain = domain;
+        entry.settings = it.value();
+        m_entriesByHash.insert(hash(domain.constData(), domain.length()), m_entries.count());
+        m_entries.append(entry);
+    }
+}
+
+const KPerDomainSettings *DomainPolicyIndex::find(const QString &hostname) const
+{
+    if (m_entries.isEmpty() || hostname.isEmpty()) {
+        return nullptr;
+    }
+
+    // First check whether there is a perfect match, then try the suffixes
+    // starting at each dot, with and without it
+    const KPerDomainSettings *settings = findSuffix(hostname, 0);
+    int dot_idx = 0;
+    while (!settings && (dot_idx = hostname.indexOf(QLatin1Char('.'), dot_idx)) >= 0) {
+        settings = findSuffix(hostname, dot_idx);
+        ++dot_idx;
+        if (!settings && dot_idx < hostname.length()) {
+            settings = findSuffix(hostname, dot_idx);
+        }
+    }
+    return settings;
+}
+
+const KPerDomainSettings *DomainPolicyIndex::findSuffix(const QString &hostname, int pos) const
+{
+    const int length = hostname.length() - pos;
+    const QStringRef suffix(&hostname, pos, length);
+    const uint h = hash(hostname.constData() + pos, length);
+    QMultiHash<uint, int>::const_iterator it = m_entriesByHash.constFind(h);
+    for (; it != m_entriesByHash.constEnd() && it.key() == h; ++it) {
+        const Entry &entry = m_entries.at(it.value());
+        if (suffix.compare(entry.domain, Qt::CaseInsensitive) == 0) {
+            return &entry.settings;
+        }
+    }
+    return nullptr;
+}
+
+uint DomainPolicyIndex::hash(const QChar *chars, int length)
+{
+    uint h = 0;
+    for (int i = 0; i < length; ++i) {
+        h = 31 * h + chars[i].toLower().unicode();
+    }
+    return h;
+}
+
+/**
+ * @internal
+ * The AdBlocK filters in use. Once published, the lists are never modified again:
+ * changing the filters means building new lists and replacing the old ones.
+ */
+struct AdFilterLists {
+    KDEPrivate::FilterSet blackList;
+    KDEPrivate::FilterSet whiteList;
+    KDEPrivate::ElementHidingSet elementHiding;
+};
+
+/**
+ * @internal
+ * The AdBlocK state shared between the settings, the threads WebEngine intercepts
+ * requests on and the threads loading the filters.
+ */
+struct AdFilterState {
+    AdFilterState() : loadSerial(0) {}
+
+    QSharedPointer<AdFilterLists> currentLists() const
+    {
+        QMutexLocker locker(&mutex);
+        return lists;
+    }
+
+    // Only guards the pointer: matching takes a reference to the lists and happens
+    // without holding it
+    mutable QMutex mutex;
+    QSharedPointer<AdFilterLists> lists;
+    // Incremented each time the lists are replaced
+    QAtomicInt generation;
+    // Incremented each time a load is started, so that a slow load can't replace
+    // the result of a more recent one
+    QAtomicInt loadSerial;
+};
+
+/**
+ * @internal
+ * A filter list to download
+ */
+struct AdFilterListSource {
+    QUrl url;
+    QString localFile;
+};
+
+/**
+ * @internal
+ * Builds new AdBlocK filter lists from the custom filters and the downloaded list files
+ * and publishes them, away from the GUI thread.
+ */
+class AdFilterLoader : public QRunnable
+{
+public:
+    AdFilterLoader(const QSharedPointer<AdFilterState> &state, const QStringList &customFilters, const QStringList &listFiles)
+        : m_state(state), m_serial(state->loadSerial.fetchAndAddOrdered(1) + 1),
+          m_customFilters(customFilters), m_listFiles(listFiles)
+    {
+    }
+
+    void run() override
+    {
+        QSharedPointer<AdFilterLists> lists(new AdFilterLists);
+        load(lists.data());
+        lists->blackList.compile();
+        lists->whiteList.compile();
+
+        QMutexLocker locker(&m_state->mutex);
+        if (m_state->loadSerial.load() != m_serial)
+            return;
+        m_state->lists.swap(lists);
+        m_state->generation.ref();
+        // the old lists, if any, are released here unless a request is still using them
+    }
+
+private:
+    static void addFilter(AdFilterLists *lists, const QString& filter)
+    {
+        /** element hiding rules contain "##" or "#@#" */
+        if (lists->elementHiding.addRule(filter))
+            return;
+        /** white list lines start with "@@" */
+        if (filter.startsWith(QLatin1String("@@")))
+            lists->whiteList.addFilter(filter);
+        else
+            lists->blackList.addFilter(filter);
+    }
+
+    /** load list file and process each line */
+    static void loadList(AdFilterLists *lists, const QString& filename)
+    {
+        QFile file(filename);
+        if (file.open(QIODevice::ReadOnly)) {
+            QTextStream ts(&file);
+            QString line = ts.readLine();
+            while (!line.isEmpty()) {
+                //kDebug() << "Adding filter:" << line;
+                addFilter(lists, line);
+                line = ts.readLine();
+            }
+            file.close();
+        }
+    }
+
+    /** load custom filters and filter lists, using the compiled caches when they are up to date */
+    void load(AdFilterLists *lists) const
+    {
+        /** the caches are only valid for the very same filters and list files */
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        for (const QString &filter : m_customFilters) {
+            hash.addData(QByteArrayLiteral("F:"));
+            hash.addData(filter.toUtf8());
+            hash.addData(QByteArrayLiteral("\n"));
+        }
+        for (const QString &fileName : m_listFiles) {
+            const QFileInfo info(fileName);
+            hash.addData(QByteArrayLiteral("L:"));
+            hash.addData(fileName.toUtf8());
+            hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+            hash.addData(QByteArray::number(info.size()));
+            hash.addData(QByteArrayLiteral("\n"));
+        }
+        const QByteArray signature = hash.result();
+
+        const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + QLatin1String("/khtml/");
+        const QString blackListCache = cacheDir + QLatin1String("adblock-blacklist.cache");
+        const QString whiteListCache = cacheDir + QLatin1String("adblock-whitelist.cache");
+
+        const QString elementHidingCache = cacheDir + QLatin1String("adblock-elemhide.cache");
+
+        if (lists->blackList.loadCache(blackListCache, signature) && lists->whiteList.loadCache(whiteListCache, signature)
+            && lists->elementHiding.loadCache(elementHidingCache, signature))
+            return;
+
+        lists->blackList.clear();
+        lists->whiteList.clear();
+        lists->elementHiding.clear();
+        for (const QString &filter : m_customFilters)
+            addFilter(lists, filter);
+        for (const QString &fileName : m_listFiles)
+            loadList(lists, fileName);
+
+        QDir().mkpath(cacheDir);
+        if (!lists->blackList.saveCache(blackListCache, signature) || !lists->whiteList.saveCache(whiteListCache, signature)
+            || !lists->elementHiding.saveCache(elementHidingCache, signature))
+            qCDebug(WEBENGINEPART_LOG) << "Cannot write the filter caches in" << cacheDir;
+    }
+
+    const QSharedPointer<AdFilterState> m_state;
+    const int m_serial;
+    const QStringList m_customFilters;
+    const QStringList m_listFiles;
+};
+
 class WebEngineSettingsData
 {
 public:  
@@ -136,11 +412,18 @@ public:
     QColor m_vLinkColor;
 
     PolicyMap domainPolicy;
+    DomainPolicyIndex domainPolicyIndex;
     QStringList fonts;
     QStringList defaultFonts;
 
-    KDEPrivate::FilterSet adBlackList;
-    KDEPrivate::FilterSet adWhiteList;
+    QSharedPointer<AdFilterState> adFilterState;
+    // What the current filter lists are made of
+    QStringList adCustomFilters;
+    QStringList adFilterListFiles;
+    // The filter lists to refresh once they're older than adFilterListMaxAgeDays
+    QList<AdFilterListSource> adFilterListSources;
+    QSet<QString> adFilterListDownloads;
+    int adFilterListMaxAgeDays;
     QList< QPair< QString, QChar > > m_fallbackAccessKeysAssignments;
 
     KSharedConfig::Ptr nonPasswordStorableSites;
@@ -150,46 +433,74 @@ class WebEngineSettingsPrivate : public QObject, public WebEngineSettingsData
 {
     Q_OBJECT
 public:
-    void adblockFilterLoadList(const QString& filename)
+    WebEngineSettingsPrivate()
     {
-        /** load list file and process each line */
-        QFile file(filename);
-        if (file.open(QIODevice::ReadOnly)) {
-            QTextStream ts(&file);
-            QString line = ts.readLine();
-            while (!line.isEmpty()) {
-                //kDebug() << "Adding filter:" << line;
-                /** white list lines start with "@@" */
-                if (line.startsWith(QLatin1String("@@")))
-                    adWhiteList.addFilter(line);
-                else
-                    adBlackList.addFilter(line);
-                line = ts.readLine();
+        adFilterState.reset(new AdFilterState);
+        adFilterListMaxAgeDays = 1;
+
+        /** filter lists also get refreshed when the application runs for a long time */
+        adFilterRefreshTimer.setInterval(AD_FILTER_REFRESH_INTERVAL);
+        QObject::connect(&adFilterRefreshTimer, &QTimer::timeout, this, &WebEngineSettingsPrivate::adblockFilterRefresh);
+    }
+
+    /** build new filter lists in a worker thread; the current ones stay in use until then */
+    void adblockFilterReload()
+    {
+        QThreadPool::globalInstance()->start(new AdFilterLoader(adFilterState, adCustomFilters, adFilterListFiles));
+    }
+
+    QTimer adFilterRefreshTimer;
+
+public Q_SLOTS:
+    /** download the filter lists which are missing or too old */
+    void adblockFilterRefresh()
+    {
+        for (const AdFilterListSource &source : qAsConst(adFilterListSources)) {
+            if (adFilterListDownloads.contains(source.localFile))
+                continue;
+
+            /** determine existence and age of cache file */
+            const QFileInfo fileInfo(source.localFile);
+
+            /** if no cache list file exists or if it is too old ... */
+            if (!fileInfo.exists() || fileInfo.lastModified().daysTo(QDateTime::currentDateTime()) > adFilterListMaxAgeDays)
+            {
+                /** ... in this case, refetch list asynchronously */
+                // kDebug() << "Fetching filter list from" << source.url << "to" << source.localFile;
+                KIO::StoredTransferJob *job = KIO::storedGet( source.url, KIO::Reload, KIO::HideProgressInfo );
+                QObject::connect( job, SIGNAL(result(KJob*)), this, SLOT(adblockFilterResult(KJob*)) );
+                /** for later reference, store name of cache file */
+                job->setProperty("webenginesettings_adBlock_filename", source.localFile);
+                adFilterListDownloads.insert(source.localFile);
             }
-            file.close();
         }
     }
 
-public Q_SLOTS:
     void adblockFilterResult(KJob *job)
     {
         KIO::StoredTransferJob *tJob = qobject_cast<KIO::StoredTransferJob*>(job);
         Q_ASSERT(tJob);
 
+        const QString localFileName = tJob->property( "webenginesettings_adBlock_filename" ).toString();
+        adFilterListDownloads.remove(localFileName);
+
         if ( job->error() == KJob::NoError )
         {
             const QByteArray byteArray = tJob->data();
-            const QString localFileName = tJob->property( "webenginesettings_adBlock_filename" ).toString();
 
             QFile file(localFileName);
             if ( file.open(QFile::WriteOnly) )
             {
                 const bool success = (file.write(byteArray) == byteArray.size());
-                if ( success )
-                    adblockFilterLoadList(localFileName);
+                file.close();
+                if ( success ) {
+                    /** parsing the new list happens in a worker thread */
+                    if (!adFilterListFiles.contains(localFileName))
+                        adFilterListFiles.append(localFileName);
+                    adblockFilterReload();
+                }
                 else
                     qCWarning(WEBENGINEPART_LOG) << "Could not write" << byteArray.size() << "to file" << localFileName;
-                file.close();
             }
             else
                 qCDebug(WEBENGINEPART_LOG) << "Cannot open file" << localFileName << "for filter list";
@@ -347,13 +658,14 @@ void WebEngineSettings::init( KConfig * config, bool reset )
   {
       d->m_hideAdsEnabled = cgFilter.readEntry("Shrink", false);
 
-      d->adBlackList.clear();
-      d->adWhiteList.clear();
-
       /** read maximum age for filter list files, minimum is one day */
-      int htmlFilterListMaxAgeDays = cgFilter.readEntry(QStringLiteral("HTMLFilterListMaxAgeDays")).toInt();
-      if (htmlFilterListMaxAgeDays < 1)
-          htmlFilterListMaxAgeDays = 1;
+      d->adFilterListMaxAgeDays = cgFilter.readEntry(QStringLiteral("HTMLFilterListMaxAgeDays")).toInt();
+      if (d->adFilterListMaxAgeDays < 1)
+          d->adFilterListMaxAgeDays = 1;
+
+      d->adCustomFilters.clear();
+      d->adFilterListFiles.clear();
+      d->adFilterListSources.clear();
 
       QMapIterator<QString,QString> it (cgFilter.entryMap());
       while (it.hasNext())
@@ -365,10 +677,7 @@ void WebEngineSettings::init( KConfig * config, bool reset )
 
           if (name.startsWith(QLatin1String("Filter")))
           {
-              if (url.startsWith(QLatin1String("@@")))
-                  d->adWhiteList.addFilter(url);
-              else
-                  d->adBlackList.addFilter(url);
+              d->adCustomFilters.append(url);
           }
           else if (name.startsWith(QLatin1String("HTMLFilterListName-")) && (id = name.midRef(19).toInt()) > 0)
           {
@@ -383,26 +692,23 @@ void WebEngineSettings::init( KConfig * config, bool reset )
                   QString localFile = cgFilter.readEntry(QStringLiteral("HTMLFilterListLocalFilename-").append(QString::number(id)));
                   localFile = QStandardPaths::locate(QStandardPaths::ConfigLocation, "khtml/" + localFile);
 
-                  /** determine existence and age of cache file */
-                  QFileInfo fileInfo(localFile);
-
                   /** load cached file if it exists, irrespective of age */
-                  if (fileInfo.exists())
-                      d->adblockFilterLoadList( localFile );
-
-                  /** if no cache list file exists or if it is too old ... */
-                  if (!fileInfo.exists() || fileInfo.lastModified().daysTo(QDateTime::currentDateTime()) > htmlFilterListMaxAgeDays)
-                  {
-                      /** ... in this case, refetch list asynchronously */
-                      // kDebug() << "Fetching filter list from" << url << "to" << localFile;
-                      KIO::StoredTransferJob *job = KIO::storedGet( url, KIO::Reload, KIO::HideProgressInfo );
-                      QObject::connect( job, SIGNAL(result(KJob*)), d, SLOT(adblockFilterResult(KJob*)) );
-                      /** for later reference, store name of cache file */
-                      job->setProperty("webenginesettings_adBlock_filename", localFile);
-                  }
+                  if (QFileInfo::exists(localFile))
+                      d->adFilterListFiles.append( localFile );
+
+                  d->adFilterListSources.append({url, localFile});
               }
           }
       }
+
+      /** the lists in use are replaced once the new ones are ready */
+      d->adblockFilterReload();
+      d->adblockFilterRefresh();
+      d->adFilterRefreshTimer.start();
+  }
+  else if (!d->m_adFilterEnabled)
+  {
+      d->adFilterRefreshTimer.stop();
   }
 
   KConfigGroup cgHtml( config, "HTML Settings" );
@@ -667,6 +973,8 @@ void WebEngineSettings::init( KConfig * config, bool reset )
 #endif
       }
     }
+
+    d->domainPolicyIndex.build(d->domainPolicy);
   }
 
 #if 0
@@ -769,36 +1077,13 @@ static const KPerDomainSettings& lookup_hostname_policy(const WebEngineSettingsP
     return d->global;
   }
 
-  const PolicyMap::const_iterator notfound = d->domainPolicy.constEnd();
-
-  // First check whether there is a perfect match.
-  PolicyMap::const_iterator it = d->domainPolicy.find(hostname);
-  if( it != notfound ) {
+  const KPerDomainSettings *settings = d->domainPolicyIndex.find(hostname);
+  if (settings) {
 #ifdef DEBUG_SETTINGS
-    kDebug() << "perfect match";
-    (*it).dump(hostname);
+    kDebug() << "match";
+    settings->dump(hostname);
 #endif
-    // yes, use it (unless dunno)
-    return *it;
-  }
-
-  // Now, check for partial match.  Chop host from the left until
-  // there's no dots left.
-  QString host_part = hostname;
-  int dot_idx = -1;
-  while( (dot_idx = host_part.indexOf(QChar('.'))) >= 0 ) {
-    host_part.remove(0,dot_idx);
-    it = d->domainPolicy.find(host_part);
-    Q_ASSERT(notfound == d->domainPolicy.end());
-    if( it != notfound ) {
-#ifdef DEBUG_SETTINGS
-      kDebug() << "partial match";
-      (*it).dump(host_part);
-#endif
-      return *it;
-    }
-    // assert(host_part[0] == QChar('.'));
-    host_part.remove(0,1); // Chop off the dot.
+    return *settings;
   }
 
   // No domain-specific entry: use global domain
@@ -835,19 +1120,50 @@ bool WebEngineSettings::isHideAdsEnabled() const
 }
 
 bool WebEngineSettings::isAdFiltered( const QString &url ) const
+{
+    return isAdFiltered(KDEPrivate::FilterRequest(url));
+}
+
+bool WebEngineSettings::isAdFiltered( const KDEPrivate::FilterRequest &request ) const
 {
     if (!d->m_adFilterEnabled)
         return false;
 
-    if (url.startsWith(QLatin1String("data:")))
+    if (request.url.startsWith(QLatin1String("data:")))
         return false;
 
-    return d->adBlackList.isUrlMatched(url) && !d->adWhiteList.isUrlMatched(url);
+    const QSharedPointer<AdFilterLists> lists = d->adFilterState->currentLists();
+    if (!lists || !lists->blackList.isUrlMatched(request))
+        return false;
+    if (!lists->whiteList.isUrlMatched(request))
+        return true;
+    // Exception rules don't apply to $important filters
+    return lists->blackList.isUrlMatched(request, true);
+}
+
+QString WebEngineSettings::elementHidingStyleSheet( const QString &host ) const
+{
+    if (!d->m_adFilterEnabled || !d->m_hideAdsEnabled)
+        return QString();
+
+    const QSharedPointer<AdFilterLists> lists = d->adFilterState->currentLists();
+    if (!lists)
+        return QString();
+    return lists->elementHiding.styleSheet(host);
+}
+
+int WebEngineSettings::adFilterGeneration() const
+{
+    return d->adFilterState->generation.load();
 }
 
 QString WebEngineSettings::adFilteredBy( const QString &url, bool *isWhiteListed ) const
 {
-    QString m = d->adWhiteList.urlMatchedBy(url);
+    const QSharedPointer<AdFilterLists> lists = d->adFilterState->currentLists();
+    if (!lists)
+        return QString();
+
+    QString m = lists->whiteList.urlMatchedBy(url);
 
     if (!m.isEmpty()) {
         if (isWhiteListed != nullptr)
@@ -855,7 +1171,7 @@ QString WebEngineSettings::adFilteredBy( const QString &url, bool *isWhiteListed
         return m;
     }
 
-    m = d->adBlackList.urlMatchedBy(url);
+    m = lists->blackList.urlMatchedBy(url);
     if (m.isEmpty())
         return QString();
 
@@ -891,10 +1207,8 @@ void WebEngineSettings::addAdFilter( const QString &url )
         config.writeEntry("Count",last+1);
         config.sync();
 
-        if (url.startsWith(QLatin1String("@@")))
-            d->adWhiteList.addFilter(url);
-        else
-            d->adBlackList.addFilter(url);
+        d->adCustomFilters.append(url);
+        d->adblockFilterReload();
     }
     else
     {
@@ -906,12 +1220,12 @@ void WebEngineSettings::addAdFilter( const QString &url )
 
 bool WebEngineSettings::isJavaEnabled( const QString& hostname ) const
 {
-  return lookup_hostname_policy(d,hostname.toLower()).m_bEnableJava;
+  return lookup_hostname_policy(d,hostname).m_bEnableJava;
 }
 
 bool WebEngineSettings::isJavaScriptEnabled( const QString& hostname ) const
 {
-  return lookup_hostname_policy(d,hostname.toLower()).m_bEnableJavaScript;
+  return lookup_hostname_policy(d,hostname).m_bEnableJavaScript;
 }
 
 bool WebEngineSettings::isJavaScriptDebugEnabled( const QString& /*hostname*/ ) const
@@ -928,27 +1242,27 @@ bool WebEngineSettings::isJavaScriptErrorReportingEnabled( const QString& /*host
 
 bool WebEngineSettings::isPluginsEnabled( const QString& hostname ) const
 {
-  return lookup_hostname_policy(d,hostname.toLower()).m_bEnablePlugins;
+  return lookup_hostname_policy(d,hostname).m_bEnablePlugins;
 }
 
 KParts::HtmlSettingsInterface::JSWindowOpenPolicy WebEngineSettings::windowOpenPolicy(const QString& hostname) const {
-  return lookup_hostname_policy(d,hostname.toLower()).m_windowOpenPolicy;
+  return lookup_hostname_policy(d,hostname).m_windowOpenPolicy;
 }
 
 KParts::HtmlSettingsInterface::JSWindowMovePolicy WebEngineSettings::windowMovePolicy(const QString& hostname) const {
-  return lookup_hostname_policy(d,hostname.toLower()).m_windowMovePolicy;
+  return lookup_hostname_policy(d,hostname).m_windowMovePolicy;
 }
 
 KParts::HtmlSettingsInterface::JSWindowResizePolicy WebEngineSettings::windowResizePolicy(const QString& hostname) const {
-  return lookup_hostname_policy(d,hostname.toLower()).m_windowResizePolicy;
+  return lookup_hostname_policy(d,hostname).m_windowResizePolicy;
 }
 
 KParts::HtmlSettingsInterface::JSWindowStatusPolicy WebEngineSettings::windowStatusPolicy(const QString& hostname) const {
-  return lookup_hostname_policy(d,hostname.toLower()).m_windowStatusPolicy;
+  return lookup_hostname_policy(d,hostname).m_windowStatusPolicy;
 }
 
 KParts::HtmlSettingsInterface::JSWindowFocusPolicy WebEngineSettings::windowFocusPolicy(const QString& hostname) const {
-  return lookup_hostname_policy(d,hostname.toLower()).m_windowFocusPolicy;
+  return lookup_hostname_policy(d,hostname).m_windowFocusPolicy;
 }
 
 int WebEngineSettings::mediumFontSize() const
@@ -33,6 +33,10 @@ class KConfigGroup;
 struct KPerDomainSettings;
 class WebEngineSettingsPrivate;
 
+namespace KDEPrivate {
+class FilterRequest;
+}
+
 /**
  * Settings for the HTML view.
  */
@@ -82,10 +86,15 @@ public:
 
     // AdBlocK Filtering
     bool isAdFiltered( const QString &url ) const;
+    bool isAdFiltered( const KDEPrivate::FilterRequest &request ) const;
     bool isAdFilterEnabled() const;
     bool isHideAdsEnabled() const;
     void addAdFilter( const QString &url );
     QString adFilteredBy( const QString &url, bool *isWhiteListed = nullptr ) const;
+    // Changes every time the filter lists are modified; used to invalidate cached verdicts
+    int adFilterGeneration() const;
+    // The stylesheet hiding ads on pages from host, empty unless ads are to be hidden
+    QString elementHidingStyleSheet( const QString &host ) const;
 
     // Access Keys
     bool accessKeysEnabled() const;
@@ -33,6 +33,8 @@
 #include <QWebEngineCertificateError>
 #include <QWebEngineSettings>
 #include <QWebEngineProfile>
+#include <QWebEngineScript>
+#include <QWebEngineScriptCollection>
 
 #include <KMessageBox>
 #include <KRun>
@@ -63,6 +65,8 @@
 #include <QWebEngineHistoryItem>
 #include <QWebEngineDownloadItem>
 #include <QUrlQuery>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <KConfigGroup>
 //#include <QWebSecurityOrigin>
 #include "utils.h"
@@ -74,7 +78,8 @@ WebEnginePage::WebEnginePage(WebEnginePart *part, QWidget *parent)
          m_ignoreError(false),
          m_part(part),
          m_passwdServerClient(new KPasswdServerClient),
-         m_wallet(nullptr)
+         m_wallet(nullptr),
+         m_fastPathNavigation(false)
 {
     if (view())
         WebEngineSettings::self()->computeFontSizes(view()->logicalDpiY());
@@ -116,6 +121,44 @@ void WebEnginePage::setSslInfo (const WebSslInfo& info)
     m_sslInfo = info;
 }
 
+void WebEnginePage::updateElementHidingScript(const QUrl& url)
+{
+    static const QString scriptName = QStringLiteral("konqueror-element-hiding");
+
+    QWebEngineScriptCollection &collection = scripts();
+    const QList<QWebEngineScript> oldScripts = collection.findScripts(scriptName);
+    for (const QWebEngineScript &script : oldScripts)
+        collection.remove(script);
+
+    const QString css = WebEngineSettings::self()->elementHidingStyleSheet(url.host());
+    if (css.isEmpty())
+        return;
+
+    // The stylesheet is in place before the page is parsed, so that hidden elements are
+    // never laid out. At document creation time, there may be no element to add it to yet
+    static const QString source = QStringLiteral(
+        "(function() {"
+        "    var style = document.createElement('style');"
+        "    style.textContent = %1[0];"
+        "    var insert = function() { (document.head || document.documentElement).appendChild(style); };"
+        "    if (document.documentElement) { insert(); return; }"
+        "    var observer = new MutationObserver(function() {"
+        "        if (document.documentElement) { observer.disconnect(); insert(); }"
+        "    });"
+        "    observer.observe(document, { childList: true });"
+        "})();");
+    // Encoding the stylesheet as JSON takes care of escaping it
+    const QByteArray json = QJsonDocument(QJsonArray{css}).toJson(QJsonDocument::Compact);
+
+    QWebEngineScript script;
+    script.setName(scriptName);
+    script.setInjectionPoint(QWebEngineScript::DocumentCreation);
+    script.setWorldId(QWebEngineScript::ApplicationWorld);
+    script.setRunsOnSubFrames(true);
+    script.setSourceCode(source.arg(QString::fromUtf8(json)));
+    collection.insert(script);
+}
+
 static void checkForDownloadManager(QWidget* widget, QString& cmd)
 {
     cmd.clear();
@@ -149,9 +192,15 @@ void WebEnginePage::download(const QUrl& url, bool newWindow)
             return;
         }
     }
+    // If Konqueror gave the URL to the part without knowing its mimetype (see setFastPathNavigation()),
+    // tell it to find it out itself and to open the URL with something else. Other downloads are only
+    // marked so that Konqueror doesn't give them back to the part
+    KParts::OpenUrlArguments args;
+    args.metaData().insert(m_fastPathNavigation ? QL1S("konq-webengine-fallback") : QL1S("konq-webengine-download"), QL1S("true"));
+    m_fastPathNavigation = false;
     KParts::BrowserArguments bArgs;
     bArgs.setForcesNewWindow(newWindow);
-    emit part()->browserExtension()->openUrlRequest(url, KParts::OpenUrlArguments(), bArgs);
+    emit part()->browserExtension()->openUrlRequest(url, args, bArgs);
 }
 
 QWebEnginePage *WebEnginePage::createWindow(WebWindowType type)
@@ -267,6 +316,9 @@ bool WebEnginePage::acceptNavigationRequest(const QUrl& url, NavigationType type
 
     // Honor the enabling/disabling of plugins per host.
     settings()->setAttribute(QWebEngineSettings::PluginsEnabled, WebEngineSettings::self()->isPluginsEnabled(reqUrl.host()));
+
+    if (isMainFrame)
+        updateElementHidingScript(reqUrl);
 #ifndef DOWNLOADITEM_KNOWS_PAGE
     emit navigationRequested(this, url);
 #endif
@@ -344,6 +396,9 @@ void WebEnginePage::setPart(WebEnginePart* part)
 
 void WebEnginePage::slotLoadFinished(bool ok)
 {
+    if (ok) {
+        m_fastPathNavigation = false;
+    }
     QUrl requestUrl = url();
     requestUrl.setUserInfo(QString());
     const bool shouldResetSslInfo = (m_sslInfo.isValid() && !domainSchemeMatch(requestUrl, m_sslInfo.url()));
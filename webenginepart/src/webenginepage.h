@@ -75,6 +75,14 @@ public:
     */
     void setLoadUrlCalledByPart(const QUrl &url){m_urlLoadedByPart = url;}
 
+    /**
+    * @brief Tells the page whether Konqueror gave the URL the part is loading without knowing its mimetype
+    *
+    * @see m_fastPathNavigation
+    * @param fastPath whether the URL was opened by Konqueror's fast path for web pages
+    */
+    void setFastPathNavigation(bool fastPath){m_fastPathNavigation = fastPath;}
+
 Q_SIGNALS:
     /**
      * This signal is emitted whenever a user cancels/aborts a load resource
@@ -143,6 +151,17 @@ private:
     bool handleMailToUrl (const QUrl& , NavigationType type) const;
     void setPageJScriptPolicy(const QUrl& url);
 
+    /**
+     * @brief Prepares the stylesheet hiding ads for the page about to be loaded
+     *
+     * The stylesheet, built from the element hiding rules which apply to the host of
+     * @p url, is injected by a script run when the document is created. If ads aren't
+     * to be hidden, the script is removed.
+     *
+     * @param url the URL about to be loaded in the main frame
+     */
+    void updateElementHidingScript(const QUrl& url);
+
 private:
     enum WebEnginePageSecurity { PageUnencrypted, PageEncrypted, PageMixed };
 
@@ -165,6 +184,14 @@ private:
     * 
     */
     QUrl m_urlLoadedByPart;
+
+    /**
+    * @brief Whether Konqueror gave the URL being loaded to the part without knowing its mimetype
+    *
+    * If so, download() hands the URL back to Konqueror as a fallback. This variable is reset when a page
+    * finishes loading successfully or when download() is called.
+    */
+    bool m_fastPathNavigation;
 };
 
 
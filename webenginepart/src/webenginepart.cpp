@@ -40,6 +40,7 @@
 #include "webenginewallet.h"
 #include "webengineparterrorschemehandler.h"
 #include "webenginepartcookiejar.h"
+#include "webengineparturlinterceptor.h"
 
 #include "ui/searchbar.h"
 #include "ui/passwordbar.h"
@@ -133,6 +134,7 @@ WebEnginePart::WebEnginePart(QWidget *parentWidget, QObject *parent,
         prof->installUrlSchemeHandler("error", new WebEnginePartErrorSchemeHandler(prof));
         prof->installUrlSchemeHandler("help", new WebEnginePartKIOHandler(prof));
     }
+    WebEnginePartUrlInterceptor::installOn(prof);
     static WebEnginePartCookieJar s_cookieJar(prof, nullptr);
     KAboutData about = KAboutData(QStringLiteral("webenginepart"),
                                   i18nc("Program Name", "WebEnginePart"),
@@ -440,6 +442,7 @@ bool WebEnginePart::openUrl(const QUrl &_u)
     setUrl(u);
     m_doLoadFinishedActions = true;
     page()->setLoadUrlCalledByPart(u);
+    page()->setFastPathNavigation(args.metaData().contains(QL1S("konq-webengine-fastpath")));
     m_webView->loadUrl(u, args, bargs);
     return true;
 }
@@ -134,6 +134,9 @@ int WebEngineBrowserExtension::yOffset()
     return KParts::BrowserExtension::yOffset();
 }
 
+// Written after the history data by saveState, which used to write it compressed
+static const quint8 s_uncompressedHistoryData = 1;
+
 void WebEngineBrowserExtension::saveState(QDataStream &stream)
 {
     // TODO: Save information such as form data from the current page.
@@ -141,11 +144,15 @@ void WebEngineBrowserExtension::saveState(QDataStream &stream)
     const int historyIndex = (history ? history->currentItemIndex() : -1);
     const QUrl historyUrl = (history && historyIndex > -1) ? QUrl(history->currentItem().url()) : m_part->url();
 
+    // Konqueror compresses the state when its history entry stops being the current one
+    // or when it's written to disk, see KonqView::setHistoryIndex and HistoryEntry::saveConfig
+    saveHistory();
     stream << historyUrl
            << static_cast<qint32>(xOffset())
            << static_cast<qint32>(yOffset())
            << historyIndex
-           << m_historyData;
+           << m_historyData
+           << s_uncompressedHistoryData;
 }
 
 void WebEngineBrowserExtension::restoreState(QDataStream &stream)
@@ -154,13 +161,19 @@ void WebEngineBrowserExtension::restoreState(QDataStream &stream)
     QByteArray historyData;
     qint32 xOfs = -1, yOfs = -1, historyItemIndex = -1;
     stream >> u >> xOfs >> yOfs >> historyItemIndex >> historyData;
+    quint8 historyDataFormat = 0;
+    if (!stream.atEnd()) {
+        stream >> historyDataFormat;
+    }
 
     QWebEngineHistory* history = (view() ? view()->page()->history() : nullptr);
     if (history) {
         bool success = false;
         if (history->count() == 0) {   // Handle restoration: crash recovery, tab close undo, session restore
             if (!historyData.isEmpty()) {
-                historyData = qUncompress(historyData); // uncompress the history data...
+                if (historyDataFormat != s_uncompressedHistoryData) {
+                    historyData = qUncompress(historyData); // saved by an older version
+                }
                 QBuffer buffer (&historyData);
                 if (buffer.open(QIODevice::ReadOnly)) {
                     QDataStream stream (&buffer);
@@ -784,25 +797,23 @@ void WebEngineBrowserExtension::slotSpellCheckDone(const QString&)
 void WebEngineBrowserExtension::saveHistory()
 {
     QWebEngineHistory* history = (view() ? view()->history() : nullptr);
+    if (!history || history->count() == 0) {
+        return;
+    }
 
-    if (history && history->count() > 0) {
-        //kDebug() << "Current history: index=" << history->currentItemIndex() << "url=" << history->currentItem().url();
-        QByteArray histData;
-        QBuffer buff (&histData);
-        m_historyData.clear();
-        if (buff.open(QIODevice::WriteOnly)) {
-            QDataStream stream (&buff);
-            stream << *history;
-            m_historyData = qCompress(histData, 9);
-        }
-        QWidget* mainWidget = m_part ? m_part->widget() : nullptr;
-        QWidget* frameWidget = mainWidget ? mainWidget->parentWidget() : nullptr;
-        if (frameWidget) {
-            emit saveHistory(frameWidget, m_historyData);
-            // kDebug() << "# of items:" << history->count() << "current item:" << history->currentItemIndex() << "url:" << history->currentItem().url();
-        }
-    } else {
-        Q_ASSERT(false); // should never happen!!!
+    //kDebug() << "Current history: index=" << history->currentItemIndex() << "url=" << history->currentItem().url();
+    // Kept uncompressed: it's only compressed if it's written to disk
+    m_historyData.clear();
+    QBuffer buff (&m_historyData);
+    if (buff.open(QIODevice::WriteOnly)) {
+        QDataStream stream (&buff);
+        stream << *history;
+    }
+    QWidget* mainWidget = m_part ? m_part->widget() : nullptr;
+    QWidget* frameWidget = mainWidget ? mainWidget->parentWidget() : nullptr;
+    if (frameWidget) {
+        emit saveHistory(frameWidget, m_historyData);
+        // kDebug() << "# of items:" << history->count() << "current item:" << history->currentItemIndex() << "url:" << history->currentItem().url();
     }
 }
 
@@ -32,8 +32,19 @@
 #include <QDateTime>
 #include <QTimeZone>
 #include <QApplication>
+#include <QStandardPaths>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusMessage>
+#include <KDirWatch>
 #include <kio_version.h>
 
+//How long to wait for more cookies before sending the queued ones to KCookieServer, in milliseconds
+#define COOKIE_SEND_DELAY 50
+
+//How long KCookieServer may take to answer when it may ask the user about a cookie (10 minutes)
+#define COOKIE_ASK_TIMEOUT (10*60*1000)
+
 const QVariant WebEnginePartCookieJar::s_findCookieFields = QVariant::fromValue(QList<int>{
         static_cast<int>(CookieDetails::domain),
         static_cast<int>(CookieDetails::path),
@@ -62,12 +73,24 @@ WebEnginePartCookieJar::WebEnginePartCookieJar(QWebEngineProfile *prof, QObject
 {
     prof->setPersistentCookiesPolicy(QWebEngineProfile::NoPersistentCookies);
     connect(qApp, &QApplication::lastWindowClosed, this, &WebEnginePartCookieJar::deleteSessionCookies);
+    connect(qApp, &QCoreApplication::aboutToQuit, this, &WebEnginePartCookieJar::sendAllPendingCookies);
     connect(m_cookieStore, &QWebEngineCookieStore::cookieAdded, this, &WebEnginePartCookieJar::addCookie);
     connect(m_cookieStore, &QWebEngineCookieStore::cookieRemoved, this, &WebEnginePartCookieJar::removeCookie);
     if(!m_cookieServer.isValid()){
         qCDebug(WEBENGINEPART_LOG) << "Couldn't connect to KCookieServer";
     }
     
+    m_sendTimer.setSingleShot(true);
+    m_sendTimer.setInterval(COOKIE_SEND_DELAY);
+    connect(&m_sendTimer, &QTimer::timeout, this, &WebEnginePartCookieJar::sendPendingCookies);
+    
+    //KCookieServer saves the domain advice in its configuration file
+    m_cookieConfigFile = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) + QLatin1String("/kcookiejarrc");
+    KDirWatch::self()->addFile(m_cookieConfigFile);
+    connect(KDirWatch::self(), &KDirWatch::dirty, this, &WebEnginePartCookieJar::cookiePolicyChanged);
+    connect(KDirWatch::self(), &KDirWatch::created, this, &WebEnginePartCookieJar::cookiePolicyChanged);
+    connect(KDirWatch::self(), &KDirWatch::deleted, this, &WebEnginePartCookieJar::cookiePolicyChanged);
+    
     loadKIOCookies();
     
     //QWebEngineCookieStore::setCookieFilter only exists from Qt 5.11.0
@@ -79,6 +102,20 @@ WebEnginePartCookieJar::WebEnginePartCookieJar(QWebEngineProfile *prof, QObject
 
 WebEnginePartCookieJar::~WebEnginePartCookieJar()
 {
+    KDirWatch::self()->removeFile(m_cookieConfigFile);
+}
+
+void WebEnginePartCookieJar::sendAllPendingCookies()
+{
+    //Don't lose the cookies still waiting for their domain advice: let KCookieServer apply its policy to them
+    for (const PendingCookie &c : qAsConst(m_pendingCookies)) {
+        if (!m_domainAdvice.contains(c.url.host())) {
+            m_domainAdvice.insert(c.url.host(), QStringLiteral("Dunno"));
+        }
+    }
+    //The application won't process the answers to asynchronous calls anymore
+    m_quitting = true;
+    sendPendingCookies();
 }
 
 #if QTWEBENGINE_VERSION >= QT_VERSION_CHECK(5,11,0)
@@ -93,11 +130,25 @@ void WebEnginePartCookieJar::deleteSessionCookies()
     if (!m_cookieServer.isValid()) {
         return;
     }
+    //Session cookies not sent yet would outlive the session
+    for (int i = m_pendingCookies.count() - 1; i >= 0; --i) {
+        if (m_pendingCookies.at(i).cookie.isSessionCookie()) {
+            m_pendingCookies.removeAt(i);
+        }
+    }
+    sendPendingCookies();
     foreach(qlonglong id, m_windowsWithSessionCookies) {
         m_cookieServer.call(QDBus::NoBlock, "deleteSessionCookies", id);
     }
 }
 
+void WebEnginePartCookieJar::cookiePolicyChanged(const QString& path)
+{
+    if (path == m_cookieConfigFile) {
+        m_domainAdvice.clear();
+    }
+}
+
 QUrl WebEnginePartCookieJar::constructUrlForCookie(const QNetworkCookie& cookie) const
 {
     QUrl url;
@@ -142,10 +193,17 @@ void WebEnginePartCookieJar::addCookie(const QNetworkCookie& _cookie)
     //in the constructor (QWebEngineCookieStore::setCookie is asynchronous, though,
     //so we're not in the constructor anymore)), so don't attempt to add
     //the cookie back to KCookieServer; instead, remove it from the list.
-    if (m_cookiesLoadedFromKCookieServer.removeOne(_cookie)) {
+    QHash<CookieIdentifier, QNetworkCookie>::iterator loaded = m_cookiesLoadedFromKCookieServer.find(CookieIdentifier(_cookie));
+    if (loaded != m_cookiesLoadedFromKCookieServer.end() && loaded.value() == _cookie) {
+        m_cookiesLoadedFromKCookieServer.erase(loaded);
         return;
     } 
     
+    //The cookie in the store is newer than the one KCookieServer may be about to send
+    if (m_loadingKIOCookies) {
+        m_cookiesChangedWhileLoading.insert(CookieIdentifier(_cookie));
+    }
+    
 #ifdef BUILD_TESTING
         m_testCookies.clear();
 #endif
@@ -175,76 +233,169 @@ void WebEnginePartCookieJar::addCookie(const QNetworkCookie& _cookie)
     //NOTE: the removal of the domain (when not starting with a dot) must be done *after* creating
     //the URL, as constructUrlForCookie needs the domain
     removeCookieDomain(cookie);
-    QByteArray header("Set-Cookie: ");
-    header += cookie.toRawForm();
-    header += "\n";
     qlonglong winId = findWinID();
     if (!cookie.expirationDate().isValid()) {
         m_windowsWithSessionCookies.insert(winId);
     }
 //     qCDebug(WEBENGINEPART_LOG) << url;
-    QString advice = askAdvice(url);
-    if (advice == "Reject"){
-        m_pendingRejectedCookies << CookieIdentifier(_cookie);
-        m_cookieStore->deleteCookie(_cookie);
-    } else if (advice == "AcceptForSession" && !cookie.isSessionCookie()) {
-        cookie.setExpirationDate(QDateTime());
-        addCookie(cookie);
-    } else {
-        int oldTimeout = m_cookieServer.timeout();
-        if (advice == "Ask") {
-            //Give the user time (10 minutes = 600 000ms) to analyze the cookie
-            m_cookieServer.setTimeout(10*60*1000);
+    m_pendingCookies.append({_cookie, cookie, url, winId});
+    if (!m_sendTimer.isActive()) {
+        m_sendTimer.start();
+    }
+}
+
+void WebEnginePartCookieJar::sendPendingCookies()
+{
+    m_sendTimer.stop();
+    if (!m_cookieServer.isValid()) {
+        m_pendingCookies.clear();
+        m_pendingRemovals.clear();
+        return;
+    }
+    
+    for (const PendingCookie &c : qAsConst(m_pendingRemovals)) {
+        if (m_quitting) {
+            m_cookieServer.call(QDBus::Block, "deleteCookie", c.cookie.domain(), c.url.host(), c.cookie.path(), QString(c.cookie.name()));
+            continue;
         }
-        m_cookieServer.call(QDBus::Block, "addCookies", url.toString(), header, winId);
-        m_cookieServer.setTimeout(oldTimeout);
-        if (m_cookieServer.lastError().isValid()) {
-            qCDebug(WEBENGINEPART_LOG) << m_cookieServer.lastError();
-            return;
+        QDBusPendingCall pcall = m_cookieServer.asyncCall("deleteCookie", c.cookie.domain(), c.url.host(), c.cookie.path(), QString(c.cookie.name()));
+        QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+        connect(w, &QDBusPendingCallWatcher::finished, this, &WebEnginePartCookieJar::cookieRemovalFailed);
+    }
+    m_pendingRemovals.clear();
+    
+    //Cookies with the same URL, window and advice are sent together
+    QList<QList<PendingCookie>> batches;
+    QStringList adviceForBatches;
+    QHash<QString, int> batchIndexes;
+    QList<PendingCookie> waiting;
+    for (const PendingCookie &pending : qAsConst(m_pendingCookies)) {
+        QHash<QString, QString>::const_iterator it = m_domainAdvice.constFind(pending.url.host());
+        if (it == m_domainAdvice.constEnd()) {
+            waiting.append(pending);
+            requestAdvice(pending.url);
+            continue;
+        }
+        const QString advice = it.value();
+        PendingCookie c(pending);
+        if (advice == "Reject") {
+            rejectCookie(c.storeCookie);
+            continue;
+        } else if (advice == "AcceptForSession" && !c.cookie.isSessionCookie()) {
+            c.cookie.setExpirationDate(QDateTime());
+            m_windowsWithSessionCookies.insert(c.winId);
+        }
+        const QString key = advice + ' ' + QString::number(c.winId) + ' ' + c.url.toString();
+        QHash<QString, int>::const_iterator batch = batchIndexes.constFind(key);
+        if (batch == batchIndexes.constEnd()) {
+            batchIndexes.insert(key, batches.count());
+            batches.append(QList<PendingCookie>{c});
+            adviceForBatches.append(advice);
+        } else {
+            batches[batch.value()].append(c);
         }
-        if (!advice.startsWith("Accept") && !cookieInKCookieJar(id, url)) {
-            m_pendingRejectedCookies << id;
-            m_cookieStore->deleteCookie(_cookie);
-        } 
+    }
+    m_pendingCookies = waiting;
+    
+    for (int i = 0; i < batches.count(); ++i) {
+        sendCookies(batches.at(i), adviceForBatches.at(i));
     }
 }
 
-QString WebEnginePartCookieJar::askAdvice(const QUrl& url)
+void WebEnginePartCookieJar::sendCookies(const QList<PendingCookie>& cookies, const QString& advice)
 {
-    if (!m_cookieServer.isValid()) {
-        return QString();
+    const QUrl url = cookies.first().url;
+    QByteArray header;
+    for (const PendingCookie &c : cookies) {
+        header += "Set-Cookie: ";
+        header += c.cookie.toRawForm();
+        header += "\n";
     }
-    QDBusReply<QString> rep = m_cookieServer.call(QDBus::Block, "getDomainAdvice", url.toString());
-    if (rep.isValid()) {
-        return rep.value();
-    } else {
-        qCDebug(WEBENGINEPART_LOG) << rep.error().message();
-        return QString();
+    
+    QDBusMessage msg = QDBusMessage::createMethodCall(m_cookieServer.service(), m_cookieServer.path(), m_cookieServer.interface(), "addCookies");
+    msg << url.toString() << header << cookies.first().winId;
+    //Unless the cookies are accepted, KCookieServer may ask the user: give them time (10 minutes) to analyze the cookies
+    const int timeout = advice.startsWith("Accept") ? m_cookieServer.timeout() : COOKIE_ASK_TIMEOUT;
+    if (m_quitting) {
+        const QDBusMessage reply = m_cookieServer.connection().call(msg, QDBus::Block, timeout);
+        if (reply.type() == QDBusMessage::ErrorMessage) {
+            qCDebug(WEBENGINEPART_LOG) << reply.errorMessage();
+        }
+        return;
     }
+    QDBusPendingCall pcall = m_cookieServer.connection().asyncCall(msg, timeout);
+    QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+    connect(w, &QDBusPendingCallWatcher::finished, this, [this, cookies, advice](QDBusPendingCallWatcher *watcher){
+        watcher->deleteLater();
+        QDBusPendingReply<> r = *watcher;
+        if (r.isError()) {
+            qCDebug(WEBENGINEPART_LOG) << r.error();
+            return;
+        }
+        if (advice == "Ask") {
+            //The user may have chosen a policy for the whole domain
+            m_domainAdvice.remove(cookies.first().url.host());
+        }
+        if (!advice.startsWith("Accept")) {
+            for (const PendingCookie &c : cookies) {
+                checkCookieAccepted(c);
+            }
+        }
+    });
 }
 
-bool WebEnginePartCookieJar::cookieInKCookieJar(const WebEnginePartCookieJar::CookieIdentifier& id, const QUrl& url)
+void WebEnginePartCookieJar::requestAdvice(const QUrl& url)
 {
-    if (!m_cookieServer.isValid()) {
-        return false;
+    const QString host = url.host();
+    if (m_adviceRequests.contains(host)) {
+        return;
     }
+    m_adviceRequests.insert(host);
+    QDBusPendingCall pcall = m_cookieServer.asyncCall("getDomainAdvice", url.toString());
+    QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+    connect(w, &QDBusPendingCallWatcher::finished, this, [this, host](QDBusPendingCallWatcher *watcher){
+        watcher->deleteLater();
+        m_adviceRequests.remove(host);
+        QDBusPendingReply<QString> r = *watcher;
+        if (r.isError()) {
+            qCDebug(WEBENGINEPART_LOG) << r.error().message();
+        }
+        m_domainAdvice.insert(host, r.isError() ? QString() : r.value());
+        sendPendingCookies();
+    });
+}
+
+void WebEnginePartCookieJar::rejectCookie(const QNetworkCookie& cookie)
+{
+    m_pendingRejectedCookies << CookieIdentifier(cookie);
+    m_cookieStore->deleteCookie(cookie);
+}
+
+void WebEnginePartCookieJar::checkCookieAccepted(const PendingCookie& cookie)
+{
     QList<int> fields = { 
         static_cast<int>(CookieDetails::name),
         static_cast<int>(CookieDetails::domain),
         static_cast<int>(CookieDetails::path)
     };
-    QDBusReply<QStringList> rep = m_cookieServer.call(QDBus::Block, "findCookies", QVariant::fromValue(fields), id.domain, url.toString(QUrl::FullyEncoded), id.path, id.name);
-    if (!rep.isValid()) {
-        qCDebug(WEBENGINEPART_LOG) << rep.error().message();
-        return false;
-    }
-    QStringList cookies = rep.value();
-    for(int i = 0; i < cookies.length()-2; i+=3){
-        if (CookieIdentifier(cookies.at(i), cookies.at(i+1), cookies.at(i+2)) == id) {
-            return true;
+    const CookieIdentifier id(cookie.storeCookie);
+    QDBusPendingCall pcall = m_cookieServer.asyncCall("findCookies", QVariant::fromValue(fields), id.domain, cookie.url.toString(QUrl::FullyEncoded), id.path, id.name);
+    QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+    connect(w, &QDBusPendingCallWatcher::finished, this, [this, id, cookie](QDBusPendingCallWatcher *watcher){
+        watcher->deleteLater();
+        QDBusPendingReply<QStringList> r = *watcher;
+        if (r.isError()) {
+            qCDebug(WEBENGINEPART_LOG) << r.error().message();
+            return;
         }
-    }
-    return false;
+        const QStringList cookies = r.value();
+        for(int i = 0; i < cookies.length()-2; i+=3){
+            if (CookieIdentifier(cookies.at(i), cookies.at(i+1), cookies.at(i+2)) == id) {
+                return;
+            }
+        }
+        rejectCookie(cookie.storeCookie);
+    });
 }
 
 void WebEnginePartCookieJar::removeCookie(const QNetworkCookie& _cookie)
@@ -257,6 +408,11 @@ void WebEnginePartCookieJar::removeCookie(const QNetworkCookie& _cookie)
         return;
     }
     
+    //Don't let the cookies being loaded from KCookieServer bring the cookie back
+    if (m_loadingKIOCookies) {
+        m_cookiesChangedWhileLoading.insert(CookieIdentifier(_cookie));
+    }
+    
     if (!m_cookieServer.isValid()) {
         return;
     }
@@ -269,9 +425,17 @@ void WebEnginePartCookieJar::removeCookie(const QNetworkCookie& _cookie)
     }
     removeCookieDomain(cookie);
     
-    QDBusPendingCall pcall = m_cookieServer.asyncCall("deleteCookie", cookie.domain(), url.host(), cookie.path(), QString(cookie.name()));
-    QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
-    connect(w, &QDBusPendingCallWatcher::finished, this, &WebEnginePartCookieJar::cookieRemovalFailed);
+    //A cookie which hasn't been sent yet doesn't need to be, but an older version of it may be in KCookieJar
+    const CookieIdentifier id(_cookie);
+    for (int i = m_pendingCookies.count() - 1; i >= 0; --i) {
+        if (CookieIdentifier(m_pendingCookies.at(i).storeCookie) == id) {
+            m_pendingCookies.removeAt(i);
+        }
+    }
+    m_pendingRemovals.append({_cookie, cookie, url, 0});
+    if (!m_sendTimer.isActive()) {
+        m_sendTimer.start();
+    }
 }
 
 void WebEnginePartCookieJar::cookieRemovalFailed(QDBusPendingCallWatcher *watcher)
@@ -285,46 +449,73 @@ void WebEnginePartCookieJar::cookieRemovalFailed(QDBusPendingCallWatcher *watche
 
 void WebEnginePartCookieJar::loadKIOCookies()
 {
-    CookieList cookies = findKIOCookies();
-    foreach(const QNetworkCookie& cookie, cookies){
-        QDateTime currentTime = QDateTime::currentDateTime();
-        //Don't attempt to add expired cookies
-        if (cookie.expirationDate().isValid() && cookie.expirationDate() < currentTime) {
-            continue;
+    if (!m_cookieServer.isValid()) {
+        return;
+    }
+    //Two asynchronous calls, whatever the number of cookies: one for the domains, one for the cookies of all of them
+    m_loadingKIOCookies = true;
+    QDBusPendingCall pcall = m_cookieServer.asyncCall("findDomains");
+    QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+    connect(w, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher){
+        watcher->deleteLater();
+        QDBusPendingReply<QStringList> r = *watcher;
+        if (r.isError()) {
+            qCDebug(WEBENGINEPART_LOG) << r.error().message();
+            m_loadingKIOCookies = false;
+            m_cookiesChangedWhileLoading.clear();
+            return;
         }
-        m_cookiesLoadedFromKCookieServer << cookie;
+        const QStringList domains = r.value();
+        if (domains.isEmpty()) {
+            m_loadingKIOCookies = false;
+            m_cookiesChangedWhileLoading.clear();
 #ifdef BUILD_TESTING
-        m_testCookies << cookie;
+            m_testCookiesLoaded = true;
 #endif
-        m_cookieStore->setCookie(cookie);
-    }
+            return;
+        }
+        //KCookieServer::findCookies accepts a list of domains separated by spaces
+        QDBusPendingCall pcall = m_cookieServer.asyncCall("findCookies", s_findCookieFields, domains.join(' '), "", "", "");
+        QDBusPendingCallWatcher *w = new QDBusPendingCallWatcher(pcall, this);
+        connect(w, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher){
+            watcher->deleteLater();
+            QDBusPendingReply<QStringList> r = *watcher;
+            if (r.isError()) {
+                qCDebug(WEBENGINEPART_LOG) << r.error().message();
+                m_loadingKIOCookies = false;
+                m_cookiesChangedWhileLoading.clear();
+                return;
+            }
+            insertKIOCookies(r.value());
+        });
+    });
 }
 
-WebEnginePartCookieJar::CookieList WebEnginePartCookieJar::findKIOCookies()
+void WebEnginePartCookieJar::insertKIOCookies(const QStringList& data)
 {
-    CookieList res;
-    if (!m_cookieServer.isValid()) {
-        return res;
-    }
-    QDBusReply<QStringList> rep = m_cookieServer.call(QDBus::Block, "findDomains");
-    if(!rep.isValid()){
-        qCDebug(WEBENGINEPART_LOG) << rep.error().message();
-        return res;
-    }
-    QStringList domains = rep.value();
-    uint fieldsCount = 8;
-    foreach( const QString &d, domains){
-    QDBusReply<QStringList> rep = m_cookieServer.call(QDBus::Block, "findCookies", s_findCookieFields, d, "", "", "");
-        if (!rep.isValid()) {
-            qCDebug(WEBENGINEPART_LOG) << rep.error().message();
-            return res;
+    const int fieldsCount = 8;
+    const QDateTime currentTime = QDateTime::currentDateTime();
+    for (int i = 0; i + fieldsCount <= data.count(); i += fieldsCount) {
+        const QNetworkCookie cookie = parseKIOCookie(data, i);
+        //Don't attempt to add expired cookies
+        if (cookie.expirationDate().isValid() && cookie.expirationDate() < currentTime) {
+            continue;
         }
-        QStringList data = rep.value();
-        for(int i = 0; i < data.count(); i+=fieldsCount){
-            res << parseKIOCookie(data, i);
+        //Nor cookies which the store changed since the loading started: what's in the store is newer
+        if (m_cookiesChangedWhileLoading.contains(CookieIdentifier(cookie))) {
+            continue;
         }
+        m_cookiesLoadedFromKCookieServer.insert(CookieIdentifier(cookie), cookie);
+#ifdef BUILD_TESTING
+        m_testCookies << cookie;
+#endif
+        m_cookieStore->setCookie(cookie);
     }
-    return res;
+    m_loadingKIOCookies = false;
+    m_cookiesChangedWhileLoading.clear();
+#ifdef BUILD_TESTING
+    m_testCookiesLoaded = true;
+#endif
 }
 
 QNetworkCookie WebEnginePartCookieJar::parseKIOCookie(const QStringList& data, int start)
@@ -31,6 +31,7 @@
 #include <QVector>
 #include <QDBusInterface>
 #include <QSet>
+#include <QTimer>
 #include <QtWebEngine/QtWebEngineVersion>
 
 #include "kwebenginepartlib_export.h"
@@ -71,6 +72,9 @@ private slots:
     * 
     * This slot is called in response to `QWebEngineCookieStore::cookieAdded` signal.
     * 
+    * The cookie isn't sent to `KCookieServer` immediately: it's queued, and sent together with the other cookies
+    * added in the meantime by sendPendingCookies()
+    * 
     * @param cookie cookie the cookie to add
     * 
     * @internal KIO requires an URL when adding a cookie; unfortunately, the `cookieAdded` signal doesn't provide one. To solve this problem, an URL is created
@@ -90,9 +94,43 @@ private slots:
     * 
     * @internal As for addCookie() there's a problem here, because `QWebEngineCookieStore::cookieRemoved` doesn't provide a fqdn for the cookie. This value is obtained 
     * from #m_cookiesUrl.
+    * 
+    * As for addCookie(), the removal is queued. If the cookie itself is still queued, it's removed from the queue
     */
     void removeCookie(const QNetworkCookie &cookie);
     
+    /**
+    * @brief Sends the queued cookies to `KCookieServer`
+    * 
+    * Removals are sent first, then the cookies whose domain advice is known are sent, with one asynchronous call to
+    * `KCookieServer::addCookies` for all the cookies with the same URL and window. The cookies whose domain advice isn't
+    * known yet stay in the queue until it is (see requestAdvice()).
+    * 
+    * Cookies rejected because of the advice are removed from the store immediately; if the advice isn't to accept the cookies,
+    * `KCookieServer` may reject them or ask the user, so they're looked for in `KCookieJar` once it answers (see checkCookieAccepted())
+    */
+    void sendPendingCookies();
+    
+    /**
+    * @brief Sends all the queued cookies to `KCookieServer` before the application quits
+    * 
+    * This slot is called in response to `QCoreApplication::aboutToQuit`. The cookies whose domain advice isn't known are sent
+    * with the `"Dunno"` advice, so that `KCookieServer` applies its policy to them, and the calls are blocking, since the
+    * answers to asynchronous calls wouldn't be delivered anymore. This can't be done by the destructor, which is only
+    * called after the application has been destroyed.
+    */
+    void sendAllPendingCookies();
+    
+    /**
+    * @brief Forgets the domain advice received from `KCookieServer`
+    * 
+    * This slot is called when the `KCookieJar` configuration file changes, which happens when the user changes the cookie policy,
+    * either from the KCM or when asked about a cookie
+    * 
+    * @param path the path of the file which changed
+    */
+    void cookiePolicyChanged(const QString &path);
+    
     /**
     * @brief Removes all session cookies from `KCookieJar`
     * 
@@ -126,6 +164,34 @@ private:
     static qlonglong findWinID();
     
     using CookieList = QList<QNetworkCookie>;
+    
+    /**
+    * @brief A cookie waiting to be sent to `KCookieServer`
+    */
+    struct PendingCookie {
+        
+        /**
+        * @brief The cookie as it is in the store
+        */
+        QNetworkCookie storeCookie;
+        
+        /**
+        * @brief The cookie as it must be sent to `KCookieServer`
+        * 
+        * @sa removeCookieDomain()
+        */
+        QNetworkCookie cookie;
+        
+        /**
+        * @brief The URL to pass to `KCookieServer`, as returned by constructUrlForCookie()
+        */
+        QUrl url;
+        
+        /**
+        * @brief The ID of the window to pass to `KCookieServer::addCookies`
+        */
+        qlonglong winId;
+    };
 
     /**
     * @brief An identifier for a cookie
@@ -188,39 +254,60 @@ private:
     using CookieIdentifierList = QList<CookieIdentifier>;
 
     /**
-    * @brief Checks whether a cookie with the given identifier is in the KCookieJar
+    * @brief Checks whether a cookie sent to `KCookieServer` was accepted, and removes it from the store if it wasn't
     * 
-    * @note If the _id_'s domain doesn't start with a dot, a dot is prepended to it. This is because
-    * `KCookieJar` always wants a dot in front of the domain.
+    * The check is done asynchronously, using `KCookieServer::findCookies`
     * 
-    * @param id the identifiere of the cookie
-    * @param url the origin of the cookie
-    * @return `true` if a cookie with the given identifier is in the KCookieJar and `false` otherwise
+    * @param cookie the cookie to check
     */
-    bool cookieInKCookieJar(const CookieIdentifier &id, const QUrl &url);
+    void checkCookieAccepted(const PendingCookie &cookie);
     
     /**
-    * @brief The advice from `KCookieJar` for a URL
+    * @brief Asks `KCookieServer` for the advice for a URL, unless it has already been asked
     * 
-    * @param url The URL to get the advice for
-    * @return The advice for _url_. It can be one of `"Accept"`, `"AcceptForSession"`, `"Reject"`, `"Ask"`, `"Dunno"` or an empty
+    * The call is asynchronous: when the answer arrives, it's stored in #m_domainAdvice and the cookies waiting
+    * for it are sent. The advice can be one of `"Accept"`, `"AcceptForSession"`, `"Reject"`, `"Ask"`, `"Dunno"` or an empty
     * string if an error happens while contacting the `KCookieServer`
+    * 
+    * @param url The URL to get the advice for
     */
-    QString askAdvice(const QUrl &url);
+    void requestAdvice(const QUrl &url);
+    
+    /**
+    * @brief Sends cookies with the same URL and window to `KCookieServer` with a single asynchronous call
+    * 
+    * The call is blocking if the application is quitting (see #m_quitting)
+    * 
+    * @param cookies the cookies to send
+    * @param advice the domain advice for the cookies' URL
+    */
+    void sendCookies(const QList<PendingCookie> &cookies, const QString &advice);
+    
+    /**
+    * @brief Removes a cookie rejected by `KCookieJar` from the store
+    * 
+    * @param cookie the cookie, as it is in the store
+    */
+    void rejectCookie(const QNetworkCookie &cookie);
     
     /**
     * @brief Inserts all cookies contained in `KCookieJar` to the store
     * 
     * @note this function should only be called by the constructor
-    * @note this function is asynchronous because it calls `QWebEngineCookieStore::setCookie`
+    * @note this function is asynchronous: it asks `KCookieServer` for the cookies of all domains with a single
+    * asynchronous `findCookies` call, and the cookies are inserted by insertKIOCookies() when the answer arrives
     */
     void loadKIOCookies();
     
     /**
-    * @brief Finds all cookies stored in `KCookieJar`
-    * @return a list of the cookies in `KCookieJar`
+    * @brief Inserts the cookies returned by `KCookieServer::findCookies` in the store
+    * 
+    * Expired cookies are skipped, and so are the cookies added to or removed from the store after
+    * loadKIOCookies() was called, since the data can be older than them
+    * 
+    * @param data the data returned by `KCookieServer::findCookies` called with #s_findCookieFields
     */
-    CookieList findKIOCookies();
+    void insertKIOCookies(const QStringList &data);
     
     /**
     * @brief Enum describing the possible fields to pas to `KCookieServer::findCookies` using DBus.
@@ -324,12 +411,65 @@ private:
     QSet<qlonglong> m_windowsWithSessionCookies;
     
     /**
-    * @brief A list of cookies loaded from KCookieServer when this instance is created
+    * @brief The cookies added to the store which haven't been sent to `KCookieServer` yet
+    */
+    QList<PendingCookie> m_pendingCookies;
+    
+    /**
+    * @brief The cookies removed from the store which haven't been removed from `KCookieServer` yet
+    */
+    QList<PendingCookie> m_pendingRemovals;
+    
+    /**
+    * @brief The timer used to send the queued cookies in batches
+    */
+    QTimer m_sendTimer;
+    
+    /**
+    * @brief The domain advice received from `KCookieServer`, by host
+    * 
+    * It's cleared when the `KCookieJar` configuration changes
+    */
+    QHash<QString, QString> m_domainAdvice;
+    
+    /**
+    * @brief The hosts for which the domain advice has been requested and not received yet
+    */
+    QSet<QString> m_adviceRequests;
+    
+    /**
+    * @brief The `KCookieJar` configuration file, watched to know when the domain advice changes
+    */
+    QString m_cookieConfigFile;
+    
+    /**
+    * @brief The cookies loaded from KCookieServer when this instance is created, and not yet added back by the store
+    * 
+    * They're looked up by identifier each time a cookie is added to the store
+    */
+    QHash<CookieIdentifier, QNetworkCookie> m_cookiesLoadedFromKCookieServer;
+    
+    /**
+    * @brief Whether the cookies are being loaded from KCookieServer, i.e. loadKIOCookies() was called and
+    * insertKIOCookies() hasn't been called yet
+    */
+    bool m_loadingKIOCookies = false;
+    
+    /**
+    * @brief The cookies which were added to or removed from the store while the cookies were being loaded from KCookieServer
+    */
+    QSet<CookieIdentifier> m_cookiesChangedWhileLoading;
+    
+    /**
+    * @brief Whether the application is quitting, so that the calls to `KCookieServer` must be blocking
+    * 
+    * @see sendAllPendingCookies()
     */
-    CookieList m_cookiesLoadedFromKCookieServer;
+    bool m_quitting = false;
     
 #ifdef BUILD_TESTING
     QList<QNetworkCookie> m_testCookies;
+    bool m_testCookiesLoaded = false;
     friend class TestWebEnginePartCookieJar;
 #endif
     
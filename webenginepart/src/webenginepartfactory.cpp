@@ -39,8 +39,8 @@ QObject *WebEngineFactory::create(const char* iface, QWidget *parentWidget, QObj
 
     // NOTE: The code below is what makes it possible to properly integrate QtWebEngine's PORTING_TODO
     // history management with any KParts based application.
-    QByteArray histData (m_historyBufContainer.value(parentWidget));
-    if (!histData.isEmpty()) histData = qUncompress(histData);
+    // The history is cached uncompressed, recreating the part of a frame is frequent
+    const QByteArray histData (m_historyBufContainer.value(parentWidget));
     WebEnginePart* part = new WebEnginePart(parentWidget, parent, histData);
     WebEngineBrowserExtension* ext = qobject_cast<WebEngineBrowserExtension*>(part->browserExtension());
     if (ext) {
@@ -20,101 +20,218 @@
 
 #include "webengineparthtmlembedder.h"
 
-#include <KIO/StoredTransferJob>
-
-#include <QWebEngineUrlRequestJob>
-#include <QBuffer>
+#include <QFile>
 #include <QFileInfo>
-#include <QWebEnginePage>
-#include <QWebEngineProfile>
-#include <QJsonDocument>
 #include <QMimeDatabase>
-#include <QMetaObject>
+#include <QUrl>
 
-static const char s_extractUrlsJs[] = "extractUrlsForTag = function(name, attr){\n"
-    "  var elems = document.getElementsByTagName(name);\n"
-    "  var urls = [];\n"
-    "  for(var i = 0; i < elems.length; i++){\n"
-    "    var url = elems[i].getAttribute(attr);\n"
-    "    if(url.length > 0) urls.push(url);\n"
-    "  }\n"
-    "  return urls;\n"
-    "};\n"
-    "extractUrlsForTag(\"link\", \"href\").concat(extractUrlsForTag(\"img\", \"src\"));";
-    
-static const char s_replaceUrlsJs[] = "urlMap = %1;\n"
-    "replaceUrlsForTag = function(name, attr){\n"
-    "  var elems = document.getElementsByTagName(name);\n"
-    "  var urls = [];\n"
-    "  for(var i = 0; i < elems.length; i++){\n"
-    "    var url = elems[i].getAttribute(attr);\n"
-    "    var repl = urlMap[url];\n"
-    "    if(repl) elems[i].setAttribute(attr, repl);\n"
-    "  }\n"
-    "}\n"
-    "replaceUrlsForTag(\"link\", \"href\");\n"
-    "replaceUrlsForTag(\"map\", \"src\");";
+#include <cctype>
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
 
-WebEnginePartHtmlEmbedder::WebEnginePartHtmlEmbedder(QObject* parent) : 
-        QObject(parent), 
-        m_profile(new QWebEngineProfile(this)),
-        m_page(new QWebEnginePage(m_profile, this))
+//Returns the position of the '>' closing the tag starting at start, or -1 if the tag isn't complete
+static int tagEnd(const QByteArray &html, int start)
 {
-    connect(this, &WebEnginePartHtmlEmbedder::urlsExtracted, this, &WebEnginePartHtmlEmbedder::startReplacingUrls);
-    connect(this, &WebEnginePartHtmlEmbedder::urlsReplaced, this, &WebEnginePartHtmlEmbedder::startRetrievingHtml);
+    char quote = 0;
+    for (int i = start + 1; i < html.size(); ++i) {
+        const char c = html.at(i);
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            return i;
+        }
+    }
+    return -1;
 }
 
-void WebEnginePartHtmlEmbedder::startEmbedding(const QByteArray& html, const QString& mimeType)
+//Returns the lowercase name of the tag starting at start
+static QByteArray tagName(const QByteArray &html, int start)
 {
-    //Try avoiding problems with redirection (see documentation for this class)
-    connect(m_page, &QWebEnginePage::loadFinished, this, &WebEnginePartHtmlEmbedder::startExtractingUrls);
-    m_page->setContent(html, mimeType, QUrl::fromLocalFile("/"));
+    int end = start + 1;
+    while (end < html.size() && !isSpace(html.at(end)) && html.at(end) != '>' && html.at(end) != '/') {
+        ++end;
+    }
+    return html.mid(start + 1, end - start - 1).toLower();
 }
 
-void WebEnginePartHtmlEmbedder::startExtractingUrls()
+WebEnginePartHtmlEmbedder::WebEnginePartHtmlEmbedder()
 {
-    //Try avoiding problems with redirection (see documentation for this class) 
-    disconnect(m_page, &QWebEnginePage::loadFinished, this, &WebEnginePartHtmlEmbedder::startExtractingUrls);
-    auto lambda = [this](const QVariant &res){emit urlsExtracted(res.toStringList());};
-    m_page->runJavaScript(s_extractUrlsJs, lambda);
 }
 
-void WebEnginePartHtmlEmbedder::startReplacingUrls(const QStringList& urls)
+QByteArray WebEnginePartHtmlEmbedder::process(const QByteArray& html)
 {
-    QStringList uniqueUrls(urls);
-    uniqueUrls.removeDuplicates();
-    QHash<QString, QVariant> map;
-    foreach(const QString &url, uniqueUrls){
-        QUrl u(url);
-        QString data = dataUrl(u);
-        if (!data.isEmpty()) {
-            map[url] = QVariant(data);
+    m_pending += html;
+    QByteArray res;
+    res.reserve(m_pending.size());
+    int pos = 0;
+    while (pos < m_pending.size()) {
+        if (!m_rawTextElement.isEmpty()) {
+            //Copy everything up to the end tag
+            const QByteArray endTag = "</" + m_rawTextElement;
+            int end = -1;
+            for (int i = m_pending.indexOf("</", pos); i >= 0; i = m_pending.indexOf("</", i + 2)) {
+                if (m_pending.mid(i, endTag.size()).toLower() == endTag) {
+                    end = i;
+                    break;
+                }
+            }
+            if (end < 0) {
+                //The end tag may be split between two chunks
+                const int keep = qMax(pos, m_pending.size() - endTag.size());
+                res += m_pending.mid(pos, keep - pos);
+                pos = keep;
+                break;
+            }
+            res += m_pending.mid(pos, end - pos);
+            pos = end;
+            m_rawTextElement.clear();
         }
+        
+        const int start = m_pending.indexOf('<', pos);
+        if (start < 0) {
+            res += m_pending.mid(pos);
+            pos = m_pending.size();
+            break;
+        }
+        res += m_pending.mid(pos, start - pos);
+        pos = start;
+        
+        if (m_pending.size() - start < 4) {
+            break;
+        }
+        //A '<' not followed by a tag name is just text
+        const char next = m_pending.at(start + 1);
+        if (!isalpha(static_cast<unsigned char>(next)) && next != '/' && next != '!' && next != '?') {
+            res += '<';
+            pos = start + 1;
+            continue;
+        }
+        if (m_pending.mid(start, 4) == "<!--") {
+            const int end = m_pending.indexOf("-->", start + 4);
+            if (end < 0) {
+                break;
+            }
+            res += m_pending.mid(start, end + 3 - start);
+            pos = end + 3;
+            continue;
+        }
+        
+        const int end = tagEnd(m_pending, start);
+        if (end < 0) {
+            break;
+        }
+        const QByteArray tag = m_pending.mid(start, end + 1 - start);
+        const QByteArray name = tagName(m_pending, start);
+        if (name == "link") {
+            res += rewriteTag(tag, "href");
+        } else if (name == "img") {
+            res += rewriteTag(tag, "src");
+        } else {
+            if (name == "script" || name == "style") {
+                m_rawTextElement = name;
+            }
+            res += tag;
+        }
+        pos = end + 1;
     }
-    QJsonDocument doc = QJsonDocument::fromVariant(QVariant::fromValue(map));
-    QString js = QString(s_replaceUrlsJs).arg(QString(doc.toJson()));
-    m_page->runJavaScript(js, [this](const QVariant &){emit urlsReplaced();});
+    m_pending.remove(0, pos);
+    return res;
 }
 
-void WebEnginePartHtmlEmbedder::startRetrievingHtml()
+QByteArray WebEnginePartHtmlEmbedder::finish()
 {
-    auto callback = [this](const QString &html){emit finished(html);};
-    m_page->toHtml(callback);
+    QByteArray res = m_pending;
+    m_pending.clear();
+    m_rawTextElement.clear();
+    m_dataUrls.clear();
+    return res;
 }
 
-QString WebEnginePartHtmlEmbedder::dataUrl(const QUrl& url) const
+QByteArray WebEnginePartHtmlEmbedder::rewriteTag(const QByteArray& tag, const QByteArray& attribute)
 {
-    if (url.scheme() != "file") {
-        return QString();
+    int pos = 1;
+    while (pos < tag.size() && !isSpace(tag.at(pos)) && tag.at(pos) != '>' && tag.at(pos) != '/') {
+        ++pos;
+    }
+    while (pos < tag.size() - 1) {
+        while (pos < tag.size() - 1 && (isSpace(tag.at(pos)) || tag.at(pos) == '/')) {
+            ++pos;
+        }
+        const int nameStart = pos;
+        while (pos < tag.size() - 1 && !isSpace(tag.at(pos)) && tag.at(pos) != '=' && tag.at(pos) != '>' && tag.at(pos) != '/') {
+            ++pos;
+        }
+        const QByteArray name = tag.mid(nameStart, pos - nameStart).toLower();
+        while (pos < tag.size() - 1 && isSpace(tag.at(pos))) {
+            ++pos;
+        }
+        if (name.isEmpty() || tag.at(pos) != '=') {
+            if (name.isEmpty()) {
+                ++pos;
+            }
+            continue;
+        }
+        ++pos;
+        while (pos < tag.size() - 1 && isSpace(tag.at(pos))) {
+            ++pos;
+        }
+        int valueStart = pos;
+        int valueEnd;
+        if (tag.at(pos) == '"' || tag.at(pos) == '\'') {
+            valueEnd = tag.indexOf(tag.at(pos), pos + 1);
+            //A quote which isn't closed: leave the tag alone
+            if (valueEnd < 0) {
+                return tag;
+            }
+            valueStart = pos + 1;
+            pos = valueEnd + 1;
+        } else {
+            while (pos < tag.size() - 1 && !isSpace(tag.at(pos))) {
+                ++pos;
+            }
+            valueEnd = pos;
+        }
+        if (name != attribute) {
+            continue;
+        }
+        const QString url = QString::fromUtf8(tag.mid(valueStart, valueEnd - valueStart)).replace(QLatin1String("&amp;"), QLatin1String("&"));
+        const QByteArray data = dataUrl(url);
+        if (data.isEmpty()) {
+            return tag;
+        }
+        //The data URL doesn't contain quotes, so it can replace an unquoted value, too
+        return tag.left(valueStart) + data + tag.mid(valueEnd);
+    }
+    return tag;
+}
+
+QByteArray WebEnginePartHtmlEmbedder::dataUrl(const QString& url)
+{
+    QHash<QString, QByteArray>::const_iterator it = m_dataUrls.constFind(url);
+    if (it != m_dataUrls.constEnd()) {
+        return it.value();
+    }
+    QByteArray &res = m_dataUrls[url];
+    
+    const QUrl u(url);
+    if (u.scheme() != "file") {
+        return res;
     }
-    QString path = url.toLocalFile();
+    QString path = u.toLocalFile();
     if (QFileInfo(path).isRelative()) {
-        return QString();
+        return res;
     }
     QFile file(path);
     if (!file.open(QIODevice::ReadOnly)) {
-        return QString();
+        return res;
     }
-    QByteArray content = file.readAll().toBase64();
-    return "data:" + QMimeDatabase().mimeTypeForFile(path).name()+";charset=UTF-8;base64," + content;
+    res = "data:" + QMimeDatabase().mimeTypeForFile(path).name().toUtf8() + ";charset=UTF-8;base64," + file.readAll().toBase64();
+    return res;
 }
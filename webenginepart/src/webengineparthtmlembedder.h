@@ -21,125 +21,65 @@
 #ifndef WEBENGINEPARTHTMLEMBEDDER_H
 #define WEBENGINEPARTHTMLEMBEDDER_H
 
-#include "utils.h"
-
-#include <QObject>
-
-class QWebEnginePage;
-class QWebEngineProfile;
+#include <QByteArray>
+#include <QHash>
+#include <QString>
 
 /**
  * @brief Class which embeds content from local files referenced in (X)HTML code inside the
  * page itself using `data` URLs
  * 
- * This class works asynchronously: startEmbedding() starts the embedding process and the finished()
- * signal is emitted when the embedding has finished with the resulting (X)HTML code as argument.
+ * The code is rewritten while it's being received: each chunk is passed to process(), which returns
+ * the code which can already be sent to the page, and finish() returns what's left at the end.
  * 
  * @internal
  * 
- * This class parses the HTML generated by KIO using `QWebEnginePage`, then replaces URLs pointing 
- * to local files with their content embedded as `data` URLs. Currently, this is only done for 
- * `link` (stylesheet) and `img` elements.
- * 
- * The main complications with this approach is that the to query the `QWebEnginePage` for
- * the HTML elements it contains one must use javascript and that the related functions
- * are all asynchronous. For this reason, we must rely on signals to tell when each step is done:
+ * The code is scanned once, looking for `link` and `img` start tags: absolute `file` URLs in their `href` and `src`
+ * attributes are replaced with `data` URLs. Comments and the contents of `script` and `style` elements are copied
+ * unchanged. The rest of the code is copied as it is, so the page doesn't need to be parsed by a `QWebEnginePage` and
+ * serialized back. A tag which isn't complete at the end of a chunk is kept until the next one.
  * 
- * `QWebEnginePage::setHtml` -> `QWebEnginePage::loadFinished` -> startExtractingUrls() -> urlsExtracted() ->
- * startReplacingUrls() -> urlsReplaced() -> startRetrievingHtml() -> htmlRetrieved() -> sendReply()
+ * Each file is read the first time it's referenced, and only once for each document.
  * 
- * A problem can arise if the (X)HTML code contains a `<meta>` element with attribute `http-equiv="refresh"`.
- * Since QWebEnginePage is not just a parser, it honors this refresh request and, after emitting the `loadFinished`
- * signal, it refreshes the page, which means that `loadFinished` is emitted again and again. To avoid
- * doing the embedding every time, the `loadFinished` signal is disconnected after the first time it's
- * emitted and the connection is remade the next time startEmbedding() is called. 
- *
- * @note This class uses and internal `QWebEnginePage` and an associated, off the record, `QWebEngineProfile`
- * so as not interfere with the rest of the part
+ * @note Serving the files through a local URL scheme instead of embedding them isn't possible, since this class
+ * is only needed by Qt versions where `QWebEngineUrlScheme` isn't available.
  */
-class WebEnginePartHtmlEmbedder : public QObject
+class WebEnginePartHtmlEmbedder
 {
-    Q_OBJECT
-
 public:
     
     /**
      * Constructor
-     *
-     * @param parent the parent object
      */
-    WebEnginePartHtmlEmbedder(QObject* parent = nullptr);
+    WebEnginePartHtmlEmbedder();
     
     /**
-    * @brief Destructor
-    */
-    ~WebEnginePartHtmlEmbedder() override {}
-    
-    /**
-    * @brief Starts the embedding process asynchronously
+    * @brief Rewrites a chunk of (X)HTML code
     * 
-    * The finished() signal is emitted when the HTML with embedded URLs is ready
-    * 
-    * @param html: the HTML code 
-    * @param mimeType: the mime type (to distinguish between HTML and XHTML)
+    * @param html the code which follows the one passed to the previous call
+    * @return the rewritten code which is complete. It can be empty
     */
-    void startEmbedding(const QByteArray &html, const QString &mimeType);
-    
-signals:
+    QByteArray process(const QByteArray &html);
     
     /**
-    * @brief Signal emitted when the javascript code which extracts `link` and `img` URLs finishes running
+    * @brief Returns the code kept by the last call to process(), since there's nothing after it
     * 
-    * @param urls all the urls in `img` and `link` elements in the HTML code. The list contains URLs with any scheme and may contain duplicates
-    */
-    void urlsExtracted(const QStringList &urls);
-    
-    /**
-    * @brief Signal emitted when the javascript code which replaces `file` URLs with `data` URLS in the HTML code finishes
-    */
-    void urlsReplaced();
-    
-    /**
-    * @brief Signal emitted when the HTML code with the embedded data is ready
-    * 
-    * Users of this class should connect to this signal to retrieve the HTML code.
+    * After calling this function, the object can be used for another document
     * 
-    * @param html the HTML code of the page
+    * @return the code left
     */
-    void finished(const QString &html);
-
-private slots:
+    QByteArray finish();
     
-    /**
-    * @brief Extracts the Urls for `link` and `img` elements
-    * 
-    * This function is asynchronous, as it uses `QWebEnginePage::runJavascript`. urlsExtracted() will be emitted when the javascript code has run.
-    * 
-    * This function is called in response to the `loadFinished` signal of the internal `QWebEnginePage`
-    */
-    void startExtractingUrls();
+private:
     
     /**
-    * @brief Replaces the `file` URLs in the list with `data` URLs
-    * 
-    * This function is asynchronous, as it uses `QWebEnginePage::runJavascript`. urlsReplaced() will be emitted when the javascript code has run.
-    * 
-    * This function is called in response to the urlsExtracted() signal
-    * 
-    * @param urls the URLs to replace. Only the appropriate ones (see dataUrl()) will be replaced.
-    */
-    void startReplacingUrls(const QStringList &urls);
-
-    /**
-    * @brief Calls the `QWebEnginePage::toHtml` on the internal page
-    * 
-    * This function is asynchronous. htmlRetrieved() will be emitted when the HTML is ready
+    * @brief Rewrites the attributes of a `link` or `img` start tag
     * 
-    * This function is called in response to the urlsReplaced() signal.
+    * @param tag the whole tag, from `<` to `>`
+    * @param attribute the name of the attribute to rewrite, in lowercase
+    * @return the tag with the URL in @p attribute replaced, if needed
     */
-    void startRetrievingHtml();
-    
-private:
+    QByteArray rewriteTag(const QByteArray &tag, const QByteArray &attribute);
     
     /**
     * @brief Converts an url to a `data` URL embedding its contents
@@ -155,24 +95,24 @@ private:
     * @param url the url to convert
     * @return the converted URL or an empty string if the URL can't be converted according to the rules above
     */
-    QString dataUrl(const QUrl &url) const;
+    QByteArray dataUrl(const QString &url);
     
     /**
-    * @brief The `QWebEngineProfile` used by the page which parses the HTML code
-    * 
-    * @internal 
-    * The default profile can't be used because of possible interferences (for example, it can cause problems if
-    * this class is used by an URL scheme handler whose output is HTML containing its own URL scheme; this is the
-    * case of the `help` scheme, for example)
+    * @brief The code received but not processed yet, because it ends with an incomplete tag
     */
-    QWebEngineProfile *m_profile;
+    QByteArray m_pending;
     
     /**
-    * @brief The `QWebEnginePage` used to parse the HTML code produced by kioslaves
+    * @brief The name of the `script` or `style` element whose contents are being copied, or an empty string
+    */
+    QByteArray m_rawTextElement;
+    
+    /**
+    * @brief The `data` URLs created for the current document, by original URL
     * 
+    * Empty values mean that the URL can't be embedded
     */
-    QWebEnginePage *m_page;
-
+    QHash<QString, QByteArray> m_dataUrls;
 };
 
 #endif // WEBENGINEPARTHTMLEMBEDDER_H
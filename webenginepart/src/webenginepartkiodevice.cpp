@@ -0,0 +1,138 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+*/
+
+#include "webenginepartkiodevice.h"
+
+#include <KIO/TransferJob>
+
+#include <cstring>
+
+//The job is suspended when more than this number of bytes is waiting to be read...
+#define KIO_DEVICE_MAX_BUFFER_SIZE (1024 * 1024)
+//...and resumed when less than this is left
+#define KIO_DEVICE_RESUME_BUFFER_SIZE (256 * 1024)
+
+WebEnginePartKIODevice::WebEnginePartKIODevice(KIO::TransferJob* job, QObject* parent) : QIODevice(parent),
+    m_job(job), m_readPos(0), m_finished(false), m_read(false)
+{
+    connect(job, &KIO::TransferJob::data, this, &WebEnginePartKIODevice::jobData);
+    connect(job, &KJob::result, this, &WebEnginePartKIODevice::jobFinished);
+    open(QIODevice::ReadOnly);
+}
+
+WebEnginePartKIODevice::~WebEnginePartKIODevice()
+{
+    if (m_job && !m_finished) {
+        m_job->kill();
+    }
+}
+
+qint64 WebEnginePartKIODevice::bytesAvailable() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_buffer.size() - m_readPos + QIODevice::bytesAvailable();
+}
+
+bool WebEnginePartKIODevice::atEnd() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_finished && m_buffer.size() - m_readPos + QIODevice::bytesAvailable() == 0;
+}
+
+bool WebEnginePartKIODevice::isFinished() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_finished;
+}
+
+qint64 WebEnginePartKIODevice::readData(char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&m_mutex);
+    m_read = true;
+    const qint64 available = m_buffer.size() - m_readPos;
+    if (available == 0) {
+        return m_finished ? -1 : 0;
+    }
+    const int size = static_cast<int>(qMin(available, maxSize));
+    memcpy(data, m_buffer.constData() + m_readPos, size);
+    m_readPos += size;
+    if (m_readPos == m_buffer.size()) {
+        m_buffer.clear();
+        m_readPos = 0;
+    } else if (m_readPos > m_buffer.size() / 2) {
+        m_buffer.remove(0, m_readPos);
+        m_readPos = 0;
+    }
+    const bool resume = !m_finished && m_buffer.size() - m_readPos < KIO_DEVICE_RESUME_BUFFER_SIZE;
+    locker.unlock();
+    //This is usually called from a QtWebEngine thread: the job must be resumed from its own thread
+    if (resume) {
+        QMetaObject::invokeMethod(this, "resumeJobIfNeeded", Qt::QueuedConnection);
+    }
+    return size;
+}
+
+qint64 WebEnginePartKIODevice::writeData(const char*, qint64)
+{
+    return -1;
+}
+
+void WebEnginePartKIODevice::resumeJobIfNeeded()
+{
+    if (!m_job || !m_job->isSuspended()) {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    if (m_buffer.size() - m_readPos < KIO_DEVICE_RESUME_BUFFER_SIZE) {
+        locker.unlock();
+        m_job->resume();
+    }
+}
+
+void WebEnginePartKIODevice::jobData(KIO::Job*, const QByteArray& _data)
+{
+    const QByteArray data = m_filter && !_data.isEmpty() ? m_filter(_data, false) : _data;
+    if (data.isEmpty()) {
+        return;
+    }
+    QMutexLocker locker(&m_mutex);
+    m_buffer.append(data);
+    //Until someone reads the device, nobody will resume the job: this happens when the request hasn't been replied to yet
+    const bool suspend = m_read && m_buffer.size() - m_readPos > KIO_DEVICE_MAX_BUFFER_SIZE;
+    locker.unlock();
+    if (m_job && suspend && !m_job->isSuspended()) {
+        m_job->suspend();
+    }
+    emit readyRead();
+}
+
+void WebEnginePartKIODevice::jobFinished(KJob*)
+{
+    const QByteArray data = m_filter ? m_filter(QByteArray(), true) : QByteArray();
+    {
+        QMutexLocker locker(&m_mutex);
+        m_buffer.append(data);
+        m_finished = true;
+    }
+    if (!data.isEmpty()) {
+        emit readyRead();
+    }
+    emit readChannelFinished();
+}
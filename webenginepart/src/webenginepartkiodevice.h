@@ -0,0 +1,173 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WEBENGINEPARTKIODEVICE_H
+#define WEBENGINEPARTKIODEVICE_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QPointer>
+#include <QMutex>
+
+#include <functional>
+
+class KJob;
+
+namespace KIO {
+    class Job;
+    class TransferJob;
+};
+
+/**
+ * @brief Sequential, read-only device which makes the data produced by a `KIO::TransferJob` available as it arrives
+ * 
+ * This allows to pass the output of an ioslave to `QWebEngineUrlRequestJob::reply` without waiting for the whole
+ * data to be available. The data is buffered until it's read: if the buffer grows too much, the job is suspended
+ * until the data has been read. The job is never suspended before the device is first read, since until then
+ * nothing would resume it.
+ * 
+ * The device is opened by the constructor. When the job finishes, `readChannelFinished` is emitted and, once all
+ * the data has been read, atEnd() returns `true`.
+ * 
+ * The data can be transformed while it arrives using setFilter().
+ *
+ * QtWebEngine reads the device from one of its own threads, while the job runs in the thread of the device: the
+ * buffer is protected by a mutex, and the job is only suspended and resumed from the thread of the device.
+ */
+class WebEnginePartKIODevice : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    
+    /**
+     * Constructor
+     *
+     * @param job the job producing the data
+     * @param parent the parent object
+     */
+    WebEnginePartKIODevice(KIO::TransferJob *job, QObject *parent = nullptr);
+    
+    ~WebEnginePartKIODevice() override;
+    
+    bool isSequential() const override {return true;}
+    
+    qint64 bytesAvailable() const override;
+    
+    /**
+     * @brief Override of `QIODevice::atEnd`
+     * 
+     * @return `true` if the job has finished and all the data has been read
+     */
+    bool atEnd() const override;
+    
+    /**
+     * @brief Whether the job has finished
+     * 
+     * @return `true` if the job has finished and `false` otherwise
+     */
+    bool isFinished() const;
+    
+    /**
+     * @brief A function which transforms the data produced by the job
+     * 
+     * It's called with each chunk of data produced by the job, with @p last being `false`, and once more when the job finishes,
+     * with an empty chunk and @p last being `true`. It returns the data to make available, which can be empty.
+     */
+    using Filter = std::function<QByteArray (const QByteArray &data, bool last)>;
+    
+    /**
+     * @brief Sets the function used to transform the data produced by the job
+     * 
+     * This should be called before the job produces any data, for example when it emits the `mimetype` signal
+     * 
+     * @param filter the function
+     */
+    void setFilter(const Filter &filter) {m_filter = filter;}
+    
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+    
+private slots:
+    
+    /**
+     * @brief Appends data produced by the job to the buffer
+     * 
+     * If the buffer has grown too much and the device has already been read, the job is suspended
+     */
+    void jobData(KIO::Job *job, const QByteArray &data);
+    
+    /**
+     * @brief Slot called when the job finishes
+     */
+    void jobFinished(KJob *job);
+    
+    /**
+     * @brief Resumes the job if enough of the buffered data has been read
+     * 
+     * Called by readData() through the event loop of the thread of the device, which the job belongs to
+     */
+    void resumeJobIfNeeded();
+    
+private:
+    
+    /**
+     * @brief The job producing the data
+     * 
+     * It becomes `nullptr` when the job is deleted
+     */
+    QPointer<KIO::TransferJob> m_job;
+    
+    /**
+     * @brief The data produced by the job and not read yet
+     * 
+     * The bytes before #m_readPos have already been read: they're only removed from the buffer
+     * when they're at least half of it, so that reading a small chunk doesn't move all the rest
+     */
+    QByteArray m_buffer;
+    
+    /**
+     * @brief The position of the first unread byte in #m_buffer
+     */
+    int m_readPos;
+    
+    /**
+     * @brief Whether the job has finished
+     */
+    bool m_finished;
+    
+    /**
+     * @brief Whether any data has been read from the device
+     */
+    bool m_read;
+    
+    /**
+     * @brief The function used to transform the data, if any
+     */
+    Filter m_filter;
+    
+    /**
+     * @brief Protects #m_buffer, #m_readPos, #m_finished and #m_read
+     */
+    mutable QMutex m_mutex;
+};
+
+#endif // WEBENGINEPARTKIODEVICE_H
@@ -19,6 +19,8 @@
 */
 
 #include "webenginepartkiohandler.h"
+#include "webenginepartkiodevice.h"
+#include <webenginepart_debug.h>
 
 #ifndef USE_QWEBENGINE_URL_SCHEME
 #include "webengineparthtmlembedder.h"
@@ -26,96 +28,98 @@
 
 #include <QMimeDatabase>
 #include <QWebEngineUrlRequestJob>
-#include <QBuffer>
 #include <QtWebEngine/QtWebEngineVersion>
 
-#include <KIO/StoredTransferJob>
+#include <KIO/TransferJob>
+
+#include <memory>
+
+const int WebEnginePartKIOHandler::s_maxRunningJobs = 6;
 
 void WebEnginePartKIOHandler::requestStarted(QWebEngineUrlRequestJob *req)
 {
     m_queuedRequests << RequestJobPointer(req);
-    processNextRequest();
+    processNextRequests();
 }
 
 WebEnginePartKIOHandler::WebEnginePartKIOHandler(QObject* parent):
     QWebEngineUrlSchemeHandler(parent)
-#ifndef USE_QWEBENGINE_URL_SCHEME
-    , m_embedder(nullptr)
-#endif
 {
-    connect(this, &WebEnginePartKIOHandler::ready, this, &WebEnginePartKIOHandler::sendReply);
 }
 
-void WebEnginePartKIOHandler::sendReply()
+void WebEnginePartKIOHandler::processNextRequests()
 {
-    if (m_currentRequest) {
-        if (isSuccessful()) {
-            QBuffer *buf = new QBuffer;
-            buf->open(QBuffer::ReadWrite);
-            buf->write(m_data);
-            buf->seek(0);
-            connect(buf, &QIODevice::aboutToClose, buf, &QObject::deleteLater); 
-            m_currentRequest->reply(m_mimeType.name().toUtf8(), buf);
-        } else {
-            m_currentRequest->fail(QWebEngineUrlRequestJob::UrlInvalid);
+    while (m_runningRequests.count() < s_maxRunningJobs && !m_queuedRequests.isEmpty()) {
+        RequestJobPointer req = m_queuedRequests.takeFirst();
+        if (!req) {
+            continue;
         }
-        m_currentRequest.clear();
-    }
-    processNextRequest();
-}
-
-void WebEnginePartKIOHandler::processNextRequest()
-{
-    if (m_currentRequest) {
-        return;
-    }
-    
-    while (!m_currentRequest && !m_queuedRequests.isEmpty()) {
-        m_currentRequest = m_queuedRequests.takeFirst();
-    }
-    
-    if (!m_currentRequest) {
-        return;
+        KIO::TransferJob *job = KIO::get(req->requestUrl(), KIO::NoReload, KIO::HideProgressInfo);
+        WebEnginePartKIODevice *dev = new WebEnginePartKIODevice(job, this);
+        //The device must live as long as the request. Deleting it kills the job, if it's still running
+        connect(req.data(), &QObject::destroyed, dev, &QObject::deleteLater);
+        connect(dev, &QObject::destroyed, this, [this, job](){
+            if (m_runningRequests.remove(job) > 0) {
+                processNextRequests();
+            }
+        });
+        m_runningRequests.insert(job, {req, dev, false, QMimeType()});
+        connect(job, &KIO::TransferJob::mimetype, this, &WebEnginePartKIOHandler::kioJobMimeType);
+        connect(job, &KJob::result, this, &WebEnginePartKIOHandler::kioJobFinished);
     }
-    KIO::StoredTransferJob *job =  KIO::storedGet(m_currentRequest ->requestUrl(), KIO::NoReload, KIO::HideProgressInfo);
-    connect(job, &KIO::StoredTransferJob::result, this, [this, job](){kioJobFinished(job);});
 }
 
-void WebEnginePartKIOHandler::embedderFinished(const QString& html)
+void WebEnginePartKIOHandler::reply(RunningRequest& req)
 {
-    m_data = html.toUtf8();
-    emit ready();
+    req.replied = true;
+    req.request->reply(req.mimeType.name().toUtf8(), req.device);
 }
 
-void WebEnginePartKIOHandler::processSlaveOutput()
+void WebEnginePartKIOHandler::kioJobMimeType(KIO::Job* job, const QString& mimeType)
 {
-#ifdef USE_QWEBENGINE_URL_SCHEME
-    emit ready();
-#else
-    if (m_mimeType.inherits("text/html") || m_mimeType.inherits("application/xhtml+xml")) {
-        htmlEmbedder()->startEmbedding(m_data, m_mimeType.name());
-    } else {
-        emit ready();
+    QHash<KJob*, RunningRequest>::iterator it = m_runningRequests.find(job);
+    if (it == m_runningRequests.end() || it->replied || !it->request) {
+        return;
+    }
+    QMimeDatabase db;
+    it->mimeType = db.mimeTypeForName(mimeType);
+    //Waiting for the job to finish to determine an unknown mimetype from the data would keep the whole content in memory
+    if (!it->mimeType.isValid()) {
+        it->mimeType = db.mimeTypeForName(QStringLiteral("application/octet-stream"));
+    }
+#ifndef USE_QWEBENGINE_URL_SCHEME
+    if (it->mimeType.inherits("text/html") || it->mimeType.inherits("application/xhtml+xml")) {
+        std::shared_ptr<WebEnginePartHtmlEmbedder> embedder = std::make_shared<WebEnginePartHtmlEmbedder>();
+        it->device->setFilter([embedder](const QByteArray &data, bool last){
+            return last ? embedder->finish() : embedder->process(data);
+        });
     }
 #endif
+    reply(*it);
 }
 
-void WebEnginePartKIOHandler::kioJobFinished(KIO::StoredTransferJob* job)
+void WebEnginePartKIOHandler::kioJobFinished(KJob* job)
 {
-    m_error = job->error() == 0 ? QWebEngineUrlRequestJob::NoError : QWebEngineUrlRequestJob::RequestFailed;
-    m_errorMessage = isSuccessful() ? job->errorString() : QString();
-    m_data = job->data();
-    m_mimeType = QMimeDatabase().mimeTypeForData(m_data);
-    processSlaveOutput();
-}
-
-#ifndef USE_QWEBENGINE_URL_SCHEME
-WebEnginePartHtmlEmbedder * WebEnginePartKIOHandler::htmlEmbedder()
-{
-    if (!m_embedder) {
-        m_embedder = new WebEnginePartHtmlEmbedder(this);
-        connect(htmlEmbedder(), &WebEnginePartHtmlEmbedder::finished, this, &WebEnginePartKIOHandler::embedderFinished);
+    QHash<KJob*, RunningRequest>::iterator it = m_runningRequests.find(job);
+    if (it == m_runningRequests.end()) {
+        return;
+    }
+    RunningRequest req = *it;
+    m_runningRequests.erase(it);
+    if (req.request && !req.replied) {
+        if (job->error() != 0) {
+            req.request->fail(QWebEngineUrlRequestJob::RequestFailed);
+            req.device->deleteLater();
+        } else {
+            if (!req.mimeType.isValid()) {
+                req.mimeType = QMimeDatabase().mimeTypeForData(req.device);
+            }
+            reply(req);
+        }
+    } else if (req.request && job->error() != 0) {
+        //The data already made available is only part of the content
+        qCWarning(WEBENGINEPART_LOG) << "Error while reading" << req.request->requestUrl() << ":" << job->errorString();
+        req.request->fail(QWebEngineUrlRequestJob::RequestFailed);
     }
-    return m_embedder;
+    processNextRequests();
 }
-#endif
@@ -25,30 +25,31 @@
 #include <QWebEngineUrlRequestJob>
 #include <QPointer>
 #include <QMimeType>
+#include <QHash>
+
+class KJob;
 
 namespace KIO {
-  class StoredTransferJob;  
+    class Job;
+    class TransferJob;
 };
 
-class WebEnginePartHtmlEmbedder;
+class WebEnginePartKIODevice;
 
 /**
  * @brief Class which allows QWebEngine to access URLs provided by KIO
  * 
- * The class assumes that the data can be obtained from KIO using `KIO::storedGet` and
- * passes it to `QWebEngineUrlRequestJob::reply`. The mime type is determined using 
- * `QMimeDatabase::mimeTypeForData`. If the data is HTML or XHTML, on Qt versions before 5.12
- * WebEnginePartHtmlEmbedder is used to embed the contents of local URLs inside the code,
- * so that it can be displayed by QWebEngine without breaking cross-origin rules.
- * 
- * This class provides a virtual function, processSlaveOutput() which allows to further process KIO output before
- * using it as reply. Derived classes can use it to change the data, its mimetype and to set 
- * an error code and error message.
+ * The data is obtained from KIO using `KIO::get` and passed to `QWebEngineUrlRequestJob::reply`
+ * as it arrives, using a WebEnginePartKIODevice. The mime type is the one given by the ioslave, or
+ * `application/octet-stream` if it's unknown; only if the ioslave doesn't give one, it's determined using
+ * `QMimeDatabase::mimeTypeForData` when the job finishes.
  * 
- * @internal
+ * Up to #s_maxRunningJobs requests are processed in parallel, so that, for example, the images in a page
+ * are loaded together; the others are queued.
  * 
- * Since requestStarted() can be called multiple times, requests are stored in a list and 
- * processed one by one. This is hidden to derived classes, which only work with the current request.
+ * If the data is HTML or XHTML, on Qt versions before 5.12 a WebEnginePartHtmlEmbedder is used to embed
+ * the contents of local URLs inside the code while it's streamed, so that it can be displayed by QWebEngine
+ * without breaking cross-origin rules.
  */
 class WebEnginePartKIOHandler : public QWebEngineUrlSchemeHandler
 {
@@ -65,203 +66,84 @@ public:
     /**
      * @brief Override of `QWebEngineUrlSchemeHandler::requestStarted`
      * 
-     * It adds the new request to the list and start processing it if there aren't
-     * other queued requests
+     * It adds the new request to the queue and starts processing it if less than
+     * #s_maxRunningJobs requests are being processed
      *
      * @param  req: the request job
      */
     void requestStarted(QWebEngineUrlRequestJob* req) override;
     
-protected slots:
-    
-    /**
-    * @brief Slot called in response to the WebEnginePartHtmlEmbedder::finished() signal
-    * 
-    * The base class implementation calls setData() with the resulting HTML code, then
-    * emits the ready() signal. You can override this function to do something else with
-    * the HTML code. In this case, most likely you won't want to call the base class version
-    * but just call setData() and emit the ready() when you're done processing the HTML code
-    * 
-    * @param html: the HTML code produced by the embedder 
-    */
-    virtual void embedderFinished(const QString &html);
-    
-protected:
-    
-    /**
-    * @brief Creates and returns the html embedder object
-    * 
-    * This is the object used to replace local URLs with their content as `data` URLs. 
-    *
-    * The embedder is only created on the first use of this function. When this happens, its
-    * WebEnginePartHtmlEmbedder::finished() signal is connected to the embedderFinished(). If you
-    * don't want this, either disconnect the signal or reimplement embedderFinished() so that it
-    * does nothing, then connect WebEnginePartHtmlEmbedder::finished() with the appropriate slot
-    * yourself
-    * 
-    * @return the html embedder
-    */
-#ifndef USE_QWEBENGINE_URL_SCHEME
-    WebEnginePartHtmlEmbedder* htmlEmbedder();
-#endif
-    /**
-     * @brief The request object
-     * 
-     * @return The request object
-     */
-    inline QPointer<QWebEngineUrlRequestJob> request() const {return m_currentRequest;}
-    
-    /**
-     * @brief The error code to pass to `QWebEngineUrlRequestJob::fail`
-     * 
-     * In the base class implementation, this can be either `QWebEngineUrlRequestJob::NoError` or
-     * `QWebEngineUrlRequestJob::RequestFailed`.
-     * 
-     * @return the error code to pass to `QWebEngineUrlRequestJob::fail`
-     */
-    inline QWebEngineUrlRequestJob::Error error() const {return m_error;}
-    
-    /**
-     * @brief Sets the error code passed to `QWebEngineUrlRequestJob::fail`
-     * 
-     * Changes the error code. This function can be called by derived class in their
-     * implementation of processSlaveOutput(). It should always be set to `QWebEngineUrlRequestJob::NoError`
-     * if `QWebEngineUrlRequestJob::reply` should be called.
-     * 
-     * @see isSuccessful()
-     * 
-     * @param error: the new error code
-     */
-    inline void setError(QWebEngineUrlRequestJob::Error error) {m_error = error;}
-    
-    /**
-     * @brief Whether an error has occurred or not
-     * 
-     * @return `true` if error() is `QWebEngineUrlRequestJob::NoError` and false otherwise
-     */
-    inline bool isSuccessful() const {return m_error == QWebEngineUrlRequestJob::NoError;}
-    
-    /**
-     * @brief The error message
-     * 
-     * Currently, this is only used for debugging purpose
-     * 
-     * @return The error message given by `KJob::errorString` (or set by derived classes using setErrorMessage())
-     *  or an empty string if KIO produced no error.
-     */
-    inline QString errorMessage() const {return m_errorMessage;}
-    
-    /**
-     * @brief Changes the error message
-     * 
-     * This function can be called by derived classes from their implementation of
-     * processSlaveOutput().
-     * 
-     * @param message the new error message. If error() is not `QWebEngineUrlRequestJob::NoError`, this
-     *  should not be empty
-     */
-    inline void setErrorMessage(const QString &message) {m_errorMessage = message;}
-    
-    /**
-     * @brief The data to pass to `QWebEngineUrlRequestJob::reply`
-     * 
-     * This is the data returned by the ioslave, but can be changed in processSlaveOutput() using setData()
-     * 
-     * @return The data to pass to QWebEngineUrlRequestJob::reply
-     */
-    inline QByteArray data() const {return m_data;}
-    
-    /**
-     * @brief Changes the data to pass to `QWebEngineUrlRequestJob::reply`
-     * 
-     * This function can be used by derived classes in their implementation of processSlaveOutput(). The base 
-     * class implementation calls it for (X)HTML code to embed the content of local files in the code itself.
-     * 
-     * @param data: the new data
-     */
-    inline void setData(const QByteArray& data) {m_data = data;}
+private slots:
     
     /**
-     * @brief The mime type of the data
+     * @brief Slot called when the ioslave tells the mime type of the data
      * 
-     * This value (actually, it's `name`) will be passed to QWebEngineUrlRequestJob::reply
-     * @return The mime type of the data
-     */
-    inline QMimeType mimeType() const {return m_mimeType;}
-    
-    /**
-     * @brief Changes the mime type of the data
+     * The request is replied to with a device which streams the data. On Qt versions before 5.12,
+     * (X)HTML code is passed through a WebEnginePartHtmlEmbedder
      * 
-     * This function can be used by derived classes in their implementation of processSlaveOutput()
-     * if the mime type according to `QMimeDatabase::mimeTypeForData` is not correct or if they change
-     * the data so that its mimetype changes from what the ioslave returned.
+     * @param job the ioslave job
+     * @param mimeType the mime type of the data
      */
-    inline void setMimeType(const QMimeType &mime) {m_mimeType = mime;}
+    void kioJobMimeType(KIO::Job *job, const QString &mimeType);
     
     /**
-     * @brief Processes the output from the ioslave and replies to the request
+     * @brief Slot called when the ioslave finishes
      * 
-     * In the base class implementation, if the data is (X)HTML code (according to mimetype()), the
-     * htmlEmbedder() is used to embed the content of local files in the code. In response to 
-     * WebEnginePartHtmlEmbedder::finished(), the ready() signal is emitted. For other mimetypes, the
-     * ready() signal is emitted directly from here.
+     * If the request hasn't been replied to yet, either because of an error or because the ioslave didn't
+     * give a mime type, it's done now. Then the next queued request is processed.
      * 
-     * Derived classes can reimplement this function to do their own processing, of the data produced
-     * by the ioslave. At the beginning of this function, data(), mimetype(), and errorMessage() are 
-     * those produced by the ioslave, while error is `QWebEngineUrlRequestJob::NoError` if the ioslave 
-     * was successful andd `QWebEngineUrlRequestJob::RequestFailed` if there were errors. Derived classes can
-     * change these values using setData(), setMimeType(), setError() and setErrorMessage().
-     * 
-     * It is important that, after having changed the values as desired, the ready() signal is emitted.
+     * @param job the finished ioslave job
      */
-    virtual void processSlaveOutput();
-    
-signals:
+    void kioJobFinished(KJob *job);
     
-    /**
-    * @brief Signal emitted when processing of data produced by the ioslave has finished
-    * 
-    * In response to this signal, sendReply() is called, sending the response to the original request
-    */
-    void ready();
+private:
     
-private slots:
+    using RequestJobPointer = QPointer<QWebEngineUrlRequestJob>;
     
     /**
-     * Slot called when the ioslave finishes
-     * 
-     * It reads the data, mimetype and error state from the job and stores it.
+     * @brief A request being processed
+     */
+    struct RunningRequest {
+        /**
+         * @brief The request to reply to
+         */
+        RequestJobPointer request;
+        
+        /**
+         * @brief The device the ioslave writes the data to
+         */
+        WebEnginePartKIODevice *device;
+        
+        /**
+         * @brief Whether the request has already been replied to
+         */
+        bool replied;
+        
+        /**
+         * @brief The mime type of the data
+         */
+        QMimeType mimeType;
+    };
+    
+    /**
+     * @brief Starts processing the queued requests, until there are #s_maxRunningJobs running
      * 
-     * @param job: the finished ioslave job
+     * @internal
+     * This function removes the first (valid) requests from #m_queuedRequests and starts a `KIO::get` for their URLs
      */
-    
-    void kioJobFinished(KIO::StoredTransferJob *job);
+    void processNextRequests();
     
     /**
-     * @brief Sends a reply to the `QWebEngineUrlRequestJob`
-     * 
-     * The reply is sent using the values returned by data(), mimeType(), error() and errorMessage().
+     * @brief Replies to a request with its device and mime type
      * 
-     * If error() is something else from `QWebEngineUrlRequestJob::NoError`, this function calls
-     * `QWebEngineUrlRequestJob::fail` with the corresponding error code, otherwise it calls 
-     * `QWebEngineUrlRequestJob::reply()` passing data() and mimetype() as arguments.
-     * 
-     * This slot is called in response to the ready() signal
+     * @param req the request
      */
-    void sendReply();
-    
-private:
+    void reply(RunningRequest &req);
     
     /**
-     * @brief Starts processing the next `QWebEngineUrlRequestJob` in queue
-     * 
-     * @internal
-     * This function removes the first (valid) request from #m_queuedRequests,
-     * stores it in #m_currentRequest and starts a `KIO::storedGet` for its URL
+     * @brief The maximum number of requests processed in parallel
      */
-    void processNextRequest();
-    
-    using RequestJobPointer = QPointer<QWebEngineUrlRequestJob>;
+    static const int s_maxRunningJobs;
     
     /**
      * @brief A list of requests to be processed
@@ -269,48 +151,9 @@ private:
     QList<RequestJobPointer> m_queuedRequests;
     
     /**
-     * @brief The request currently being processed
-     */
-    RequestJobPointer m_currentRequest;
-    
-    /**
-     * @brief The error code to use for `QWebEngineUrlRequestJob::fail` for the current request
-     * 
-     * This is valid only after the call to kioJobFinished()
-     */
-    QWebEngineUrlRequestJob::Error m_error;
-    
-    /**
-     * @brief The error message produced by KIO for the current request
-     * 
-     * Currently, this is only used for debugging purposes
-     * 
-     * This is valid only after the call to kioJobFinished()
-     */
-    QString m_errorMessage;
-    
-    /**
-     * @brief The data produced by KIO for the current request
-     * 
-     * This is valid only after the call to kioJobFinished()
-     */ 
-    QByteArray m_data;
-    
-    /**
-     * @brief The mime type of the data produced by KIO for the current request
-     * 
-     * This is valid only after the call to kioJobFinished()
-     */ 
-    QMimeType m_mimeType;
-    
-#ifndef USE_QWEBENGINE_URL_SCHEME
-    /**
-     * @brief The object to use for embedding `file` URLs in (X)HTML code
-     * 
-     * This empty until the first time htmlEmbedder() is called
+     * @brief The requests being processed, by ioslave job
      */
-    WebEnginePartHtmlEmbedder *m_embedder;
-#endif
+    QHash<KJob*, RunningRequest> m_runningRequests;
 };
 
 #endif // WEBENGINEPARTKIOHANDLER_H
@@ -0,0 +1,141 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "webengineparturlinterceptor.h"
+
+#include "settings/webenginesettings.h"
+#include "settings/webengine_filter.h"
+
+#include <webenginepart_debug.h>
+
+#include <QWebEngineProfile>
+#include <QWebEngineUrlRequestInfo>
+
+// Number of verdicts remembered by each thread
+#define VERDICT_CACHE_SIZE 512
+
+WebEnginePartUrlInterceptor::VerdictCache::VerdictCache()
+    : verdicts(VERDICT_CACHE_SIZE), generation(-1)
+{
+}
+
+WebEnginePartUrlInterceptor::WebEnginePartUrlInterceptor(QObject *parent)
+    : QWebEngineUrlRequestInterceptor(parent)
+{
+}
+
+WebEnginePartUrlInterceptor::~WebEnginePartUrlInterceptor()
+{
+}
+
+void WebEnginePartUrlInterceptor::installOn(QWebEngineProfile *profile)
+{
+    if (profile->findChild<WebEnginePartUrlInterceptor*>(QString(), Qt::FindDirectChildrenOnly)) {
+        return;
+    }
+    WebEnginePartUrlInterceptor *interceptor = new WebEnginePartUrlInterceptor(profile);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    profile->setUrlRequestInterceptor(interceptor);
+#else
+    profile->setRequestInterceptor(interceptor);
+#endif
+}
+
+void WebEnginePartUrlInterceptor::interceptRequest(QWebEngineUrlRequestInfo &info)
+{
+    // Never block what the user explicitly asked for
+    if (info.resourceType() == QWebEngineUrlRequestInfo::ResourceTypeMainFrame) {
+        return;
+    }
+
+    if (!WebEngineSettings::self()->isAdFilterEnabled()) {
+        return;
+    }
+
+    const QUrl url = info.requestUrl();
+    const QString scheme = url.scheme();
+    if (scheme != QLatin1String("http") && scheme != QLatin1String("https")) {
+        return;
+    }
+
+    const KDEPrivate::FilterRequest request(url.toString(), requestType(info.resourceType()), info.firstPartyUrl().host());
+    if (isBlocked(request)) {
+        qCDebug(WEBENGINEPART_LOG) << "Blocking" << url;
+        info.block(true);
+    }
+}
+
+KDEPrivate::FilterRequestType WebEnginePartUrlInterceptor::requestType(QWebEngineUrlRequestInfo::ResourceType type)
+{
+    switch (type) {
+    case QWebEngineUrlRequestInfo::ResourceTypeScript:
+        return KDEPrivate::ScriptRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeImage:
+    case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
+        return KDEPrivate::ImageRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+        return KDEPrivate::StylesheetRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeXhr:
+        return KDEPrivate::XmlHttpRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+        return KDEPrivate::SubdocumentRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeObject:
+    case QWebEngineUrlRequestInfo::ResourceTypePluginResource:
+        return KDEPrivate::ObjectRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+        return KDEPrivate::MediaRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+        return KDEPrivate::FontRequest;
+    case QWebEngineUrlRequestInfo::ResourceTypePing:
+    case QWebEngineUrlRequestInfo::ResourceTypeCspReport:
+        return KDEPrivate::PingRequest;
+    default:
+        return KDEPrivate::OtherRequest;
+    }
+}
+
+bool WebEnginePartUrlInterceptor::isBlocked(const KDEPrivate::FilterRequest &request)
+{
+    if (!m_caches.hasLocalData()) {
+        m_caches.setLocalData(new VerdictCache);
+    }
+    VerdictCache *cache = m_caches.localData();
+
+    // The filters changed since the verdicts were computed
+    const int generation = WebEngineSettings::self()->adFilterGeneration();
+    if (cache->generation != generation) {
+        cache->verdicts.clear();
+        cache->generation = generation;
+    }
+
+    // The same URL can be blocked for one type of resource or page and not for another
+    const QString key = QString::number(request.type) + QLatin1Char(' ') + request.firstPartyHost
+        + QLatin1Char(' ') + request.url;
+
+    // QCache::object() also marks the entry as the most recently used one
+    const bool *cached = cache->verdicts.object(key);
+    if (cached) {
+        return *cached;
+    }
+
+    const bool blocked = WebEngineSettings::self()->isAdFiltered(request);
+    cache->verdicts.insert(key, new bool(blocked));
+    return blocked;
+}
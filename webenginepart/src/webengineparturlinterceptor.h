@@ -0,0 +1,114 @@
+/*
+ * This file is part of the KDE project.
+ *
+ * Copyright (C) 2020 The Konqueror developers
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WEBENGINEPARTURLINTERCEPTOR_H
+#define WEBENGINEPARTURLINTERCEPTOR_H
+
+#include <QWebEngineUrlRequestInterceptor>
+#include <QWebEngineUrlRequestInfo>
+#include <QThreadStorage>
+#include <QCache>
+
+#include "kwebenginepartlib_export.h"
+#include "settings/webengine_filter.h"
+
+class QWebEngineProfile;
+
+/**
+ * @brief Request interceptor which blocks the URLs matched by the AdBlock filters
+ *
+ * Every subresource request made by a page is checked against the black and white
+ * lists kept by WebEngineSettings, together with the type of the resource and the
+ * page requesting it, so that filter options like `$script` or `$third-party` work.
+ * Requests for the main frame are never blocked, so that the user can still
+ * explicitly navigate to a filtered URL.
+ *
+ * Depending on the Qt version, interceptRequest() is called either on the GUI thread
+ * or on WebEngine's IO thread, and it is called for every single request. To avoid
+ * matching the same URL over and over again, each thread keeps a small LRU cache of
+ * the most recent verdicts. The cache is discarded whenever the filters change.
+ */
+class KWEBENGINEPARTLIB_EXPORT WebEnginePartUrlInterceptor : public QWebEngineUrlRequestInterceptor
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param parent the parent object
+     */
+    explicit WebEnginePartUrlInterceptor(QObject *parent = nullptr);
+
+    ~WebEnginePartUrlInterceptor() override;
+
+    /**
+     * @brief Installs an interceptor on the given profile, unless one is already installed
+     *
+     * @param profile the profile to install the interceptor on
+     */
+    static void installOn(QWebEngineProfile *profile);
+
+    /**
+     * @brief Override of `QWebEngineUrlRequestInterceptor::interceptRequest`
+     *
+     * Blocks the request if its URL is matched by the AdBlock filters
+     *
+     * @param info the request
+     */
+    void interceptRequest(QWebEngineUrlRequestInfo &info) override;
+
+private:
+    /**
+     * @brief The filter request type corresponding to a WebEngine resource type
+     *
+     * @param type the type of the resource being requested
+     * @return the corresponding request type, or KDEPrivate::OtherRequest if filters can't refer to it
+     */
+    static KDEPrivate::FilterRequestType requestType(QWebEngineUrlRequestInfo::ResourceType type);
+
+    /**
+     * @brief Whether the given request should be blocked
+     *
+     * The verdict is taken from the cache for the current thread, if possible.
+     * Otherwise, it is computed using WebEngineSettings::isAdFiltered() and stored
+     * in the cache
+     *
+     * @param request the request
+     * @return `true` if the request should be blocked and `false` otherwise
+     */
+    bool isBlocked(const KDEPrivate::FilterRequest &request);
+
+    /**
+     * @brief The verdicts computed on one thread
+     */
+    struct VerdictCache {
+        VerdictCache();
+        QCache<QString, bool> verdicts;
+        int generation;
+    };
+
+    /**
+     * @brief The verdict cache for each thread calling interceptRequest()
+     */
+    QThreadStorage<VerdictCache*> m_caches;
+};
+
+#endif // WEBENGINEPARTURLINTERCEPTOR_H
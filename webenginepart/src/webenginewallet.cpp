@@ -119,6 +119,31 @@ static QString walletKey(const WebEngineWallet::WebForm &form)
     return key;
 }
 
+/**
+ * The keys of the form data in the wallet, shared by all the pages, so that
+ * finding out which forms have stored data doesn't take a call to kwalletd
+ * for each of them. The keys are only known while a wallet is open: they're
+ * read when it's opened, and again each time the form data folder changes.
+ */
+struct WalletKeyIndex {
+    WalletKeyIndex() : openWallets(0) {}
+
+    QSet<QString> keys;
+    // The number of open wallets keeping the keys up to date
+    int openWallets;
+};
+
+Q_GLOBAL_STATIC(WalletKeyIndex, s_walletKeyIndex)
+
+static QSet<QString> toKeySet(const QStringList &keys)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    return QSet<QString>(keys.constBegin(), keys.constEnd());
+#else
+    return keys.toSet();
+#endif
+}
+
 static QUrl urlForFrame(const QUrl &frameUrl, const QUrl &pageUrl)
 {
     return (frameUrl.isEmpty() || frameUrl.isRelative() ? pageUrl.resolved(frameUrl) : frameUrl);
@@ -135,6 +160,7 @@ public:
     typedef std::function<void(const WebEngineWallet::WebFormList &)> WebWalletCallback;
 
     WebEngineWalletPrivate(WebEngineWallet *parent);
+    ~WebEngineWalletPrivate();
 
     void withFormData(WebEnginePage *page, const WebWalletCallback &callback, bool fillform = true, bool ignorepasswd = false);
     WebFormList parseFormData(const QVariant &result, const QUrl &url, bool fillform = true, bool ignorepasswd = false);
@@ -143,13 +169,17 @@ public:
     void saveDataToCache(const QString &key);
     void removeDataFromCache(const WebFormList &formList);
     void openWallet();
+    void trackWalletKeys();
+    void untrackWalletKeys();
 
     // Private slots...
     void _k_openWalletDone(bool);
     void _k_walletClosed();
+    void _k_walletFolderUpdated(const QString &folder);
 
     WId wid;
     WebEngineWallet *q;
+    bool walletKeysTracked;
     QScopedPointer<KWallet::Wallet> wallet;
     WebEngineWallet::WebFormList pendingRemoveRequests;
     QHash<QUrl, FormsData> pendingFillRequests;
@@ -158,8 +188,34 @@ public:
 };
 
 WebEngineWallet::WebEngineWalletPrivate::WebEngineWalletPrivate(WebEngineWallet *parent)
-    : wid(0), q(parent)
+    : wid(0), q(parent), walletKeysTracked(false)
+{
+}
+
+WebEngineWallet::WebEngineWalletPrivate::~WebEngineWalletPrivate()
+{
+    untrackWalletKeys();
+}
+
+void WebEngineWallet::WebEngineWalletPrivate::trackWalletKeys()
 {
+    Q_ASSERT(wallet);
+    if (!walletKeysTracked) {
+        walletKeysTracked = true;
+        s_walletKeyIndex->openWallets++;
+    }
+    s_walletKeyIndex->keys = toKeySet(wallet->entryList());
+}
+
+void WebEngineWallet::WebEngineWalletPrivate::untrackWalletKeys()
+{
+    if (walletKeysTracked) {
+        walletKeysTracked = false;
+        // Nobody keeps them up to date anymore
+        if (--s_walletKeyIndex->openWallets == 0) {
+            s_walletKeyIndex->keys.clear();
+        }
+    }
 }
 
 WebEngineWallet::WebFormList WebEngineWallet::WebEngineWalletPrivate::parseFormData(const QVariant &result, const QUrl &url, bool fillform, bool ignorepasswd)
@@ -226,22 +282,52 @@ void WebEngineWallet::WebEngineWalletPrivate::fillDataFromCache(WebEngineWallet:
         return;
     }
 
-    QString lastKey;
-    QMap<QString, QString> cachedValues;
-    QMutableVectorIterator <WebForm> formIt(formList);
+    QStringList keys;
+    for (const WebForm &form : formList) {
+        const QString key(walletKey(form));
+        if (!keys.contains(key)) {
+            keys.append(key);
+        }
+    }
+
+    // The forms of a page usually only differ by their name: read the ones with
+    // the same URL at once, unless the URL contains wildcard characters. Forms in
+    // frames from other origins have other URLs, so they're read separately
+    QHash<QString, int> formsByUrl;
+    for (const QString &key : qAsConst(keys)) {
+        ++formsByUrl[key.left(key.indexOf(QL1C('#')) + 1)];
+    }
+    QMap<QString, QMap<QString, QString> > cachedData;
+    for (QHash<QString, int>::const_iterator it = formsByUrl.constBegin(); it != formsByUrl.constEnd(); ++it) {
+        const QString &prefix = it.key();
+        if (it.value() < 2 || !prefix.endsWith(QL1C('#')) || prefix.contains(QL1C('*')) || prefix.contains(QL1C('?')) || prefix.contains(QL1C('['))) {
+            continue;
+        }
+        QMap<QString, QMap<QString, QString> > data;
+        if (wallet->readMapList(prefix + QL1C('*'), data) == 0) {
+            for (QMap<QString, QMap<QString, QString> >::const_iterator dataIt = data.constBegin(); dataIt != data.constEnd(); ++dataIt) {
+                cachedData.insert(dataIt.key(), dataIt.value());
+            }
+        }
+    }
 
+    QMutableVectorIterator <WebForm> formIt(formList);
     while (formIt.hasNext()) {
         WebEngineWallet::WebForm &form = formIt.next();
         const QString key(walletKey(form));
-        if (key != lastKey && wallet->readMap(key, cachedValues) != 0) {
-            qCWarning(WEBENGINEPART_LOG) << "Unable to read form data for key:" << key;
-            continue;
+        QMap<QString, QMap<QString, QString> >::const_iterator it = cachedData.constFind(key);
+        if (it == cachedData.constEnd()) {
+            QMap<QString, QString> cachedValues;
+            if (wallet->readMap(key, cachedValues) != 0) {
+                qCWarning(WEBENGINEPART_LOG) << "Unable to read form data for key:" << key;
+                continue;
+            }
+            it = cachedData.insert(key, cachedValues);
         }
 
         for (int i = 0, count = form.fields.count(); i < count; ++i) {
-            form.fields[i].second = cachedValues.value(form.fields[i].first);
+            form.fields[i].second = it.value().value(form.fields[i].first);
         }
-        lastKey = key;
     }
 }
 
@@ -291,6 +377,7 @@ void WebEngineWallet::WebEngineWalletPrivate::saveDataToCache(const QString &key
             }
 
             if (wallet->writeMap(accessKey, values) == 0) {
+                s_walletKeyIndex->keys.insert(accessKey);
                 count++;
             } else {
                 qCWarning(WEBENGINEPART_LOG) << "Unable to write form data to wallet";
@@ -324,6 +411,7 @@ void WebEngineWallet::WebEngineWalletPrivate::openWallet()
 
     connect(wallet.data(), SIGNAL(walletOpened(bool)), q, SLOT(_k_openWalletDone(bool)));
     connect(wallet.data(), SIGNAL(walletClosed()), q, SLOT(_k_walletClosed()));
+    connect(wallet.data(), SIGNAL(folderUpdated(QString)), q, SLOT(_k_walletFolderUpdated(QString)));
 }
 
 void WebEngineWallet::WebEngineWalletPrivate::removeDataFromCache(const WebFormList &formList)
@@ -335,7 +423,10 @@ void WebEngineWallet::WebEngineWalletPrivate::removeDataFromCache(const WebFormL
 
     QVectorIterator<WebForm> formIt(formList);
     while (formIt.hasNext()) {
-        wallet->removeEntry(walletKey(formIt.next()));
+        const QString key = walletKey(formIt.next());
+        if (wallet->removeEntry(key) == 0) {
+            s_walletKeyIndex->keys.remove(key);
+        }
     }
 }
 
@@ -348,6 +439,8 @@ void WebEngineWallet::WebEngineWalletPrivate::_k_openWalletDone(bool ok)
              wallet->createFolder(KWallet::Wallet::FormDataFolder())) &&
             wallet->setFolder(KWallet::Wallet::FormDataFolder())) {
 
+        trackWalletKeys();
+
         // Do pending fill requests...
         if (!pendingFillRequests.isEmpty()) {
             QMutableHashIterator<QUrl, FormsData> requestIt(pendingFillRequests);
@@ -383,6 +476,7 @@ void WebEngineWallet::WebEngineWalletPrivate::_k_openWalletDone(bool ok)
 
 void WebEngineWallet::WebEngineWalletPrivate::_k_walletClosed()
 {
+    untrackWalletKeys();
     if (wallet) {
         wallet.take()->deleteLater();
     }
@@ -390,6 +484,14 @@ void WebEngineWallet::WebEngineWalletPrivate::_k_walletClosed()
     emit q->walletClosed();
 }
 
+void WebEngineWallet::WebEngineWalletPrivate::_k_walletFolderUpdated(const QString &folder)
+{
+    // Also changed by other applications
+    if (wallet && walletKeysTracked && folder == KWallet::Wallet::FormDataFolder()) {
+        s_walletKeyIndex->keys = toKeySet(wallet->entryList());
+    }
+}
+
 WebEngineWallet::WebEngineWallet(QObject *parent, WId wid)
     : QObject(parent), d(new WebEngineWalletPrivate(this))
 {
@@ -556,9 +658,13 @@ WebEngineWallet::WebFormList WebEngineWallet::formsToSave(const QString &key) co
 
 bool WebEngineWallet::hasCachedFormData(const WebForm &form) const
 {
+    const QString key = walletKey(form);
+    if (s_walletKeyIndex->openWallets > 0) {
+        return s_walletKeyIndex->keys.contains(key);
+    }
     return !KWallet::Wallet::keyDoesNotExist(KWallet::Wallet::NetworkWallet(),
             KWallet::Wallet::FormDataFolder(),
-            walletKey(form));
+            key);
 }
 
 void WebEngineWallet::fillFormDataFromCache(const QList<QUrl> &urlList)
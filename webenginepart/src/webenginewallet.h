@@ -299,6 +299,7 @@ private:
 
     Q_PRIVATE_SLOT(d, void _k_openWalletDone(bool))
     Q_PRIVATE_SLOT(d, void _k_walletClosed())
+    Q_PRIVATE_SLOT(d, void _k_walletFolderUpdated(const QString &))
 };
 
 